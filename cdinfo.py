@@ -16,6 +16,7 @@ import string
 import struct
 import sys
 import time
+import wave
 from time import sleep
 
 APPNAME = 'cdinfo'
@@ -63,9 +64,17 @@ Usage:  template [options] arguments
         -p port                 specify port (80)
         -u username             specify username
         -l                      long form, show data for all matches
+        -c sheet.cue            take the disc from a CUE sheet and its .wav
+                                image, and save the record as sheet.cddb
+        -m N                    with -c, the match to save (0)
+        -f                      with -c, fetch again even if saved
         -v                      verbose
         -T                      test mode
 
+With -c, a record that was saved before is used as it is, so a batch
+of images only goes to the server once each. wavcue reads the saved
+record to tag the tracks it splits from the image.
+
 Exit codes:
 
         0 - command accepted, successful return
@@ -126,6 +135,37 @@ class CdInfo(object):
       return cdinfo
     return None
 
+  @staticmethod
+  def FromCueSheet(path):
+    """Create CdInfo object from a CUE sheet for a single .wav image
+    of the disc. The track offsets are the INDEX 01 times, and the
+    length of the image gives the leadout."""
+    image = None
+    offsets = []
+    with open(path) as f:
+      for line in f:
+        words = line.split()
+        if len(words) >= 2 and words[0].upper() == 'FILE':
+          mo = re.match(r'\s*FILE\s+"(.*)"', line, re.I)
+          image = mo.group(1) if mo else words[1]
+        elif len(words) >= 3 and words[0].upper() == 'INDEX' and \
+            int(words[1]) == 1:
+          mm, ss, ff = map(int, words[2].split(':'))
+          offsets.append((mm*60 + ss)*75 + ff)
+    if image is None or not offsets:
+      print("%s: no FILE or INDEX 01 lines" % path, file=sys.stderr)
+      return None
+    image = os.path.join(os.path.dirname(path), image)
+    try:
+      w = wave.open(image, 'rb')
+      leadout = w.getnframes() * 75 // w.getframerate()
+      w.close()
+    except Exception as e:
+      print("Failed to read %s, %s" % (image, e), file=sys.stderr)
+      return None
+    # The first track starts 2 seconds into the disc
+    return CdInfo.FromOffsets([off + 150 for off in offsets], leadout + 150)
+
   @staticmethod
   def FromOffsets(offsets, leadout):
     """Create CdInfo object from list of offsets and leadout value"""
@@ -403,16 +443,35 @@ class CDDB(object):
       return None
 
 
+def save_record(path, discid, disc):
+  """Save a disc record, as returned by CDDB.fetch(), in xmcd format."""
+  try:
+    with open(path, 'w') as f:
+      f.write("# xmcd\n#\n# Saved by %s %s, disc id %08x\n" % \
+        (APPNAME, VERSION, discid))
+      for kv in disc:
+        f.write("%s=%s\n" % kv)
+  except (IOError, OSError) as e:
+    print("Failed to write %s, %s" % (path, e), file=sys.stderr)
+    return 3
+  if verbose:
+    print("saved", path)
+  return 0
+
+
 def main():
   global device, freedb_server, freedb_port, verbose, user
 
   test_mode = False
   long_form = False
+  cue_sheet = None
+  match_no = 0
+  force = False
 
   # Get arguments with getopt
   long_opts = ['help', 'device=', 'server=', 'port=']
   try:
-    (optlist, args) = getopt.getopt(sys.argv[1:], 'hd:s:p:u:Tvlg:', long_opts)
+    (optlist, args) = getopt.getopt(sys.argv[1:], 'hd:s:p:u:Tvlg:c:m:f', long_opts)
     for flag, value in optlist:
       if flag in ('-h', "--help"):
         print(usage)
@@ -431,17 +490,35 @@ def main():
         long_form = True
       elif flag == '-T':
         test_mode = True
-  except getopt.GetoptError as e:
+      elif flag == '-c':
+        cue_sheet = value
+      elif flag == '-m':
+        match_no = int(value)
+      elif flag == '-f':
+        force = True
+  except (getopt.GetoptError, ValueError) as e:
     print(e, file=sys.stderr)
     sys.exit(2)
 
+  if cue_sheet:
+    record = os.path.splitext(cue_sheet)[0] + '.cddb'
+    if os.path.exists(record) and not force:
+      if verbose:
+        print("%s: already saved" % record)
+      return 0
+    cd_info = CdInfo.FromCueSheet(cue_sheet)
+    if not cd_info:
+      return 3
+
 #  test_track = CdInfo.CdTrack.FromOffset(1, 86037)
 #  print(test_track)
 #  print(test_track.getSeconds())
 #  print(test_track.getFrames())
 #  return 0
 
-  if test_mode:
+  if cue_sheet:
+    pass
+  elif test_mode:
     # Max Sharam, A million year girl
     cd_info = CdInfo.FromOffsets((150, 17395, 34292, 53067,
         71137, 84725, 85962, 104055, 124290, 141842, 162472,
@@ -483,6 +560,16 @@ def main():
   for i, match in enumerate(matches):
     print("%2d: %8s %8s %s" % ((i,) + match))
 
+  if cue_sheet:
+    if match_no >= len(matches):
+      print("%s: no match %d" % (cue_sheet, match_no), file=sys.stderr)
+      return 4
+    disc = cddb.fetch(matches[match_no][0], matches[match_no][1])
+    if not disc:
+      print("Failed to read %s/%s" % matches[match_no][:2], file=sys.stderr)
+      return 4
+    return save_record(record, id, disc)
+
   if long_form:
     for match in matches:
       print()
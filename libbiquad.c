@@ -0,0 +1,275 @@
+/**
+ * @file
+ * Cascaded biquad filters.
+ *
+ * Each stage is in transposed direct form II, which needs two state
+ * values per channel and behaves well in floating point:
+ *
+ *	y  = b0 x + s1
+ *	s1 = b1 x - a1 y + s2
+ *	s2 = b2 x - a2 y
+ *
+ * With SSE2, a pair of channels shares one __m128d per value, and the
+ * coefficients and state are loaded once per call, not per sample. Samples
+ * are converted to double on the way in and back to float once, after
+ * the last stage.
+ *
+ * A decaying filter fed silence ends up with denormal state, which is
+ * very slow on most CPUs, so after every call state that is too small
+ * to matter is set to zero.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#ifdef	__SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "libbiquad.h"
+
+#define	TINY_STATE	1e-30	/* Below this, state is flushed to 0 */
+
+struct filter_bank {
+  int channels;
+  int nstages;
+  BiquadCoefs *coefs;
+  double *state;	/* nstages * channels * {s1, s2} */
+};
+
+static struct {
+  const char *name;
+  int value;
+} typeNames[] = {
+  {"dc", BIQUAD_DC},
+  {"hp", BIQUAD_HIGHPASS},
+  {"highpass", BIQUAD_HIGHPASS},
+  {"lp", BIQUAD_LOWPASS},
+  {"lowpass", BIQUAD_LOWPASS},
+  {"lowshelf", BIQUAD_LOWSHELF},
+  {"highshelf", BIQUAD_HIGHSHELF},
+  {"peak", BIQUAD_PEAK},
+  {"notch", BIQUAD_NOTCH},
+};
+
+#define	NA(a)	(sizeof(a)/sizeof(a[0]))
+
+const char *BiquadError = NULL;
+
+int
+BiquadDesign(BiquadCoefs *c, BiquadType type, double rate,
+	double freq, double q, double gain_db)
+{
+    double w0, cw, alpha, A, sa, a0;
+    double b0, b1, b2, a1, a2;
+
+    if (rate <= 0 || freq <= 0 || freq >= rate / 2) {
+	BiquadError = "Frequency must be between 0 and half the sample rate";
+	return -1;
+    }
+    if (type == BIQUAD_DC) {
+	c->b0 = 1;
+	c->b1 = -1;
+	c->b2 = 0;
+	c->a1 = -exp(-2 * M_PI * freq / rate);
+	c->a2 = 0;
+	return 0;
+    }
+    if (q <= 0) {
+	BiquadError = "Q must be positive";
+	return -1;
+    }
+
+    w0 = 2 * M_PI * freq / rate;
+    cw = cos(w0);
+    alpha = sin(w0) / (2 * q);
+    A = pow(10, gain_db / 40);
+    sa = 2 * sqrt(A) * alpha;
+
+    switch (type) {
+      case BIQUAD_HIGHPASS:
+	b0 = b2 = (1 + cw) / 2;
+	b1 = -(1 + cw);
+	a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+	break;
+      case BIQUAD_LOWPASS:
+	b0 = b2 = (1 - cw) / 2;
+	b1 = 1 - cw;
+	a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+	break;
+      case BIQUAD_LOWSHELF:
+	b0 = A * ((A+1) - (A-1) * cw + sa);
+	b1 = 2 * A * ((A-1) - (A+1) * cw);
+	b2 = A * ((A+1) - (A-1) * cw - sa);
+	a0 = (A+1) + (A-1) * cw + sa;
+	a1 = -2 * ((A-1) + (A+1) * cw);
+	a2 = (A+1) + (A-1) * cw - sa;
+	break;
+      case BIQUAD_HIGHSHELF:
+	b0 = A * ((A+1) + (A-1) * cw + sa);
+	b1 = -2 * A * ((A-1) + (A+1) * cw);
+	b2 = A * ((A+1) + (A-1) * cw - sa);
+	a0 = (A+1) - (A-1) * cw + sa;
+	a1 = 2 * ((A-1) - (A+1) * cw);
+	a2 = (A+1) - (A-1) * cw - sa;
+	break;
+      case BIQUAD_PEAK:
+	b0 = 1 + alpha * A;
+	b1 = -2 * cw;
+	b2 = 1 - alpha * A;
+	a0 = 1 + alpha / A; a1 = -2 * cw; a2 = 1 - alpha / A;
+	break;
+      case BIQUAD_NOTCH:
+	b0 = b2 = 1;
+	b1 = -2 * cw;
+	a0 = 1 + alpha; a1 = -2 * cw; a2 = 1 - alpha;
+	break;
+      default:
+	BiquadError = "Unknown filter type";
+	return -1;
+    }
+    c->b0 = b0 / a0;
+    c->b1 = b1 / a0;
+    c->b2 = b2 / a0;
+    c->a1 = a1 / a0;
+    c->a2 = a2 / a0;
+    return 0;
+}
+
+FilterBank *
+NewFilterBank(int channels, const BiquadCoefs *stages, int nstages)
+{
+    FilterBank *fb;
+
+    if ((fb = calloc(1, sizeof(*fb))) == NULL) {
+	return NULL;
+    }
+    fb->channels = channels;
+    fb->nstages = nstages;
+    fb->coefs = malloc((nstages > 0 ? nstages : 1) * sizeof(BiquadCoefs));
+    fb->state = calloc((size_t)(nstages > 0 ? nstages : 1) * channels * 2,
+	    sizeof(double));
+    if (fb->coefs == NULL || fb->state == NULL) {
+	FreeFilterBank(fb);
+	return NULL;
+    }
+    memcpy(fb->coefs, stages, nstages * sizeof(BiquadCoefs));
+    return fb;
+}
+
+/**
+ * Run all stages over one channel
+ */
+static void
+filterChannel(FilterBank *fb, float *x, size_t frames, int c)
+{
+    const int nc = fb->channels;
+    size_t i;
+    int k;
+
+    for (i=0; i < frames; ++i) {
+	double v = x[i * nc + c];
+	for (k=0; k < fb->nstages; ++k) {
+	    const BiquadCoefs *bc = &fb->coefs[k];
+	    double *s = fb->state + 2 * ((size_t)k * nc + c);
+	    double y = bc->b0 * v + s[0];
+	    s[0] = bc->b1 * v - bc->a1 * y + s[1];
+	    s[1] = bc->b2 * v - bc->a2 * y;
+	    v = y;
+	}
+	x[i * nc + c] = (float)v;
+    }
+}
+
+#ifdef	__SSE2__
+/**
+ * Run all stages over channels c and c+1
+ */
+static void
+filterPair(FilterBank *fb, float *x, size_t frames, int c)
+{
+    const int nc = fb->channels, ns = fb->nstages;
+    __m128d b0[ns], b1[ns], b2[ns], a1[ns], a2[ns], s1[ns], s2[ns];
+    size_t i;
+    int k;
+
+    for (k=0; k < ns; ++k) {
+	const BiquadCoefs *bc = &fb->coefs[k];
+	double *s = fb->state + 2 * ((size_t)k * nc + c);
+	b0[k] = _mm_set1_pd(bc->b0);
+	b1[k] = _mm_set1_pd(bc->b1);
+	b2[k] = _mm_set1_pd(bc->b2);
+	a1[k] = _mm_set1_pd(bc->a1);
+	a2[k] = _mm_set1_pd(bc->a2);
+	s1[k] = _mm_set_pd(s[2], s[0]);
+	s2[k] = _mm_set_pd(s[3], s[1]);
+    }
+    for (i=0; i < frames; ++i) {
+	float *p = x + i * nc + c;
+	__m128d v = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double *)p)));
+	for (k=0; k < ns; ++k) {
+	    __m128d y = _mm_add_pd(_mm_mul_pd(b0[k], v), s1[k]);
+	    s1[k] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1[k], v),
+				_mm_mul_pd(a1[k], y)), s2[k]);
+	    s2[k] = _mm_sub_pd(_mm_mul_pd(b2[k], v), _mm_mul_pd(a2[k], y));
+	    v = y;
+	}
+	_mm_store_sd((double *)p, _mm_castps_pd(_mm_cvtpd_ps(v)));
+    }
+    for (k=0; k < ns; ++k) {
+	double *s = fb->state + 2 * ((size_t)k * nc + c);
+	_mm_storel_pd(&s[0], s1[k]);
+	_mm_storeh_pd(&s[2], s1[k]);
+	_mm_storel_pd(&s[1], s2[k]);
+	_mm_storeh_pd(&s[3], s2[k]);
+    }
+}
+#endif
+
+void
+FilterFrames(FilterBank *fb, float *samples, size_t frames)
+{
+    size_t i, n = (size_t)fb->nstages * fb->channels * 2;
+    int c = 0;
+
+    if (fb->nstages == 0) {
+	return;
+    }
+#ifdef	__SSE2__
+    for (; c + 2 <= fb->channels; c += 2) {
+	filterPair(fb, samples, frames, c);
+    }
+#endif
+    for (; c < fb->channels; ++c) {
+	filterChannel(fb, samples, frames, c);
+    }
+
+    for (i=0; i < n; ++i) {
+	if (fabs(fb->state[i]) < TINY_STATE) {
+	    fb->state[i] = 0;
+	}
+    }
+}
+
+void
+FreeFilterBank(FilterBank *fb)
+{
+    if (fb != NULL) {
+	free(fb->coefs);
+	free(fb->state);
+	free(fb);
+    }
+}
+
+int
+BiquadTypeFromName(const char *name)
+{
+    int i;
+    for (i=0; i < NA(typeNames); ++i) {
+	if (strcasecmp(name, typeNames[i].name) == 0) {
+	    return typeNames[i].value;
+	}
+    }
+    return -1;
+}
@@ -0,0 +1,79 @@
+#ifndef	LIBBIQUAD_H
+#define	LIBBIQUAD_H
+
+#include <stddef.h>
+
+/**
+ * Cascaded biquad (second order IIR) filters.
+ *
+ * Coefficients come from the Audio EQ Cookbook (R. Bristow-Johnson),
+ * plus a one-pole DC blocker. A filter bank runs a cascade of stages
+ * over every channel of interleaved float samples, in place. State is
+ * kept in double precision, which low cutoffs at high sample rates
+ * need, and channels are filtered two at a time with SSE2.
+ */
+
+typedef enum {
+  BIQUAD_DC,		/* DC blocker, freq = -3 dB point */
+  BIQUAD_HIGHPASS,	/* 12 dB/octave */
+  BIQUAD_LOWPASS,
+  BIQUAD_LOWSHELF,	/* freq = midpoint of the shelf */
+  BIQUAD_HIGHSHELF,
+  BIQUAD_PEAK,		/* Peaking EQ */
+  BIQUAD_NOTCH,
+} BiquadType;
+
+/**
+ * Normalized coefficients:
+ * y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+ */
+typedef struct biquad_coefs {
+  double b0, b1, b2, a1, a2;
+} BiquadCoefs;
+
+typedef struct filter_bank FilterBank;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern const char *BiquadError;	/* Error text from last failure */
+
+/**
+ * Design one stage.
+ * @param rate     sample rate
+ * @param freq     cutoff or center frequency, below rate/2
+ * @param q        quality factor; ignored for BIQUAD_DC
+ * @param gain_db  gain for shelves and peaks, ignored for the rest
+ * @return 0 on success, -1 if a parameter is out of range
+ */
+extern	int	BiquadDesign(BiquadCoefs *, BiquadType, double rate,
+			double freq, double q, double gain_db);
+
+/**
+ * Create a filter bank. The stages are copied.
+ * @return new bank or NULL if out of memory
+ */
+extern	FilterBank *NewFilterBank(int channels, const BiquadCoefs *stages,
+			int nstages);
+
+/**
+ * Filter interleaved samples in place. State carries over from one
+ * call to the next, so a file must be fed through in order.
+ */
+extern	void	FilterFrames(FilterBank *, float *samples, size_t frames);
+
+extern	void	FreeFilterBank(FilterBank *);
+
+/**
+ * Parse a filter type name, e.g. "hp" or "highpass".
+ * @return the value, or -1 if the name is not recognized
+ */
+extern	int	BiquadTypeFromName(const char *name);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBBIQUAD_H */
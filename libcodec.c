@@ -0,0 +1,622 @@
+/**
+ * @file
+ * Decoders for G.711 and ADPCM .wav files, and an IMA ADPCM encoder.
+ *
+ * G.711 is a straight table lookup; the two 256-entry tables are
+ * built once, on first use.
+ *
+ * ADPCM state (predictor and step size) is reset by the header at
+ * the start of every block, so blocks are independent. A run of
+ * blocks is cut into one contiguous range per thread, and each
+ * thread writes its frames straight into place in the output.
+ *
+ * The encoder keeps blocks independent too: instead of carrying the
+ * step index over from the previous block, each block picks its
+ * starting step from its own first few samples.
+ *
+ * Block layouts, per channel c of nc:
+ *
+ * IMA:  4 byte header (int16 sample, step index, 0), then groups of
+ *	 4 bytes per channel, 8 samples each, low nibble first.
+ * MS:   predictor index[nc], delta[nc], sample1[nc], sample2[nc],
+ *	 then one nibble per sample, high nibble first, channels
+ *	 interleaved. sample2 is the first sample of the block.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "libcodec.h"
+
+#define	MIN_BLOCKS	16	/* Don't start a thread for fewer blocks */
+#define	MAX_COEFS	256
+
+/* Internal type definitions */
+
+typedef struct codec {
+  uint16_t type;
+  int channels;
+  uint32_t align;	/* Bytes per block */
+  uint32_t frames;	/* Frames per whole block */
+  int ncoefs;		/* MS ADPCM predictors */
+  int16_t coefs[MAX_COEFS][2];
+} Codec;
+
+typedef struct job {
+  const Codec *codec;
+  const uint8_t *in;
+  size_t len;		/* Total bytes of input */
+  size_t first;		/* First block */
+  size_t count;		/* # of blocks */
+  int16_t *out16;	/* Decoding: exactly one of these is set */
+  float *outf;
+  const int16_t *pcm;	/* Encoding: whole blocks of input */
+  uint8_t *coded;	/* Encoding: output */
+} Job;
+
+const char *CodecError;
+
+static const int16_t imaSteps[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37,
+  41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173,
+  190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+  724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+  2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894,
+  6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289,
+  16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static const int8_t imaIndex[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+static const int16_t msAdapt[16] = {
+  230, 230, 230, 230, 307, 409, 512, 614,
+  768, 614, 512, 409, 307, 230, 230, 230,
+};
+
+static const int16_t msCoefs[7][2] = {
+  {256, 0}, {512, -256}, {0, 0}, {192, 64}, {240, 0}, {460, -208}, {392, -232},
+};
+
+static int16_t alawTable[256];
+static int16_t mulawTable[256];
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+
+static inline uint16_t
+get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline int16_t
+clamp16(int v)
+{
+    return v < -32768 ? -32768 : v > 32767 ? 32767 : v;
+}
+
+
+	/*** G.711 */
+
+static void
+makeTables(void)
+{
+    int i, t, seg;
+    uint8_t u;
+
+    for (i=0; i < 256; ++i) {
+	/* mu-law: complemented sign/exponent/mantissa, bias 0x84 */
+	u = ~i;
+	t = ((u & 0x0f) << 3) + 0x84;
+	t <<= (u & 0x70) >> 4;
+	mulawTable[i] = (u & 0x80) ? 0x84 - t : t - 0x84;
+
+	/* A-law: even bits inverted, no bias */
+	u = i ^ 0x55;
+	t = (u & 0x0f) << 4;
+	seg = (u & 0x70) >> 4;
+	if (seg == 0) {
+	    t += 8;
+	} else {
+	    t = (t + 0x108) << (seg - 1);
+	}
+	alawTable[i] = (u & 0x80) ? t : -t;
+    }
+}
+
+static const int16_t *
+g711Table(const FmtChunk *fmt)
+{
+    pthread_once(&tablesOnce, makeTables);
+    switch (FmtType(fmt)) {
+      case RIFF_ALAW: case IBM_FORMAT_ALAW: return alawTable;
+      case RIFF_MULAW: case IBM_FORMAT_MULAW: return mulawTable;
+    }
+    return NULL;
+}
+
+void
+DecodeG711(const FmtChunk *fmt, const uint8_t *in, int16_t *out, size_t samples)
+{
+    const int16_t *table = g711Table(fmt);
+    size_t i;
+
+    for (i=0; i < samples; ++i) {
+	out[i] = table[in[i]];
+    }
+}
+
+void
+DecodeG711Float(const FmtChunk *fmt, const uint8_t *in, float *out, size_t samples)
+{
+    const int16_t *table = g711Table(fmt);
+    size_t i;
+
+    for (i=0; i < samples; ++i) {
+	out[i] = table[in[i]] * (1.0f/32768);
+    }
+}
+
+
+	/*** ADPCM */
+
+/**
+ * Fill in a Codec from the format chunk.
+ * @return 0 on success, -1 if the format can't be decoded
+ */
+static int
+prepare(const FmtChunk *fmt, Codec *c)
+{
+    uint32_t max;
+    int nc = fmt->channels, i;
+
+    c->type = FmtType(fmt);
+    c->channels = nc;
+    c->align = fmt->block_align;
+    CodecError = "Unsupported compression format";
+    if (nc == 0 || fmt->bits_samp != 4) {
+	return -1;
+    }
+
+    switch (c->type) {
+      case RIFF_IMA_ADPCM:
+	if (c->align < 4 * nc + 4 * nc || (c->align - 4 * nc) % (4 * nc) != 0) {
+	    CodecError = "Invalid IMA ADPCM block size";
+	    return -1;
+	}
+	max = (c->align - 4 * nc) * 2 / nc + 1;
+	break;
+      case RIFF_MS_ADPCM:
+	if (c->align < 7 * nc + 1) {
+	    CodecError = "Invalid MS ADPCM block size";
+	    return -1;
+	}
+	max = (c->align - 7 * nc) * 2 / nc + 2;
+	memcpy(c->coefs, msCoefs, sizeof(msCoefs));
+	c->ncoefs = 7;
+	/* cbSize, samples per block, # of coefs, coef pairs */
+	if (fmt->ext != NULL && fmt->ext_len >= 6) {
+	    int n = get16(fmt->ext + 4);
+	    if (n > MAX_COEFS || fmt->ext_len < 6 + 4 * n) {
+		CodecError = "Invalid MS ADPCM coefficient table";
+		return -1;
+	    }
+	    for (i=0; i < n; ++i) {
+		c->coefs[i][0] = (int16_t)get16(fmt->ext + 6 + 4*i);
+		c->coefs[i][1] = (int16_t)get16(fmt->ext + 8 + 4*i);
+	    }
+	    c->ncoefs = n;
+	}
+	break;
+      default:
+	return -1;
+    }
+
+    /* wSamplesPerBlock may be less than the block can hold */
+    c->frames = max;
+    if (fmt->ext != NULL && fmt->ext_len >= 4) {
+	uint32_t spb = get16(fmt->ext + 2);
+	if (spb > 0 && spb < max) {
+	    c->frames = spb;
+	}
+    }
+    return 0;
+}
+
+/**
+ * # of frames in a block of len bytes
+ */
+static uint32_t
+blockFrames(const Codec *c, size_t len)
+{
+    const size_t nc = c->channels;
+    uint32_t n;
+
+    if (len >= c->align) {
+	return c->frames;
+    }
+    if (c->type == RIFF_IMA_ADPCM) {
+	n = len < 4 * nc ? 0 : 1 + (len - 4 * nc) / (4 * nc) * 8;
+    } else {
+	n = len < 7 * nc ? 0 : 2 + (len - 7 * nc) * 2 / nc;
+    }
+    return n < c->frames ? n : c->frames;
+}
+
+static void
+decodeIma(const Codec *c, const uint8_t *in, uint32_t frames, int16_t *out)
+{
+    const int nc = c->channels;
+    const uint8_t *data = in + 4 * nc;
+    uint32_t f, g;
+    int ch, k;
+
+    for (ch=0; ch < nc; ++ch) {
+	int pred = (int16_t)get16(in + 4 * ch);
+	int index = in[4 * ch + 2];
+	int16_t *y = out + ch;
+	index = index > 88 ? 88 : index;
+	if (frames > 0) {
+	    y[0] = pred;
+	}
+	for (f=1, g=0; f < frames; ++g) {
+	    const uint8_t *b = data + (g * nc + ch) * 4;
+	    for (k=0; k < 8 && f < frames; ++k, ++f) {
+		int nib = (b[k >> 1] >> ((k & 1) * 4)) & 0xf;
+		int step = imaSteps[index];
+		int diff = step >> 3;
+		if (nib & 4) diff += step;
+		if (nib & 2) diff += step >> 1;
+		if (nib & 1) diff += step >> 2;
+		pred = clamp16(nib & 8 ? pred - diff : pred + diff);
+		index += imaIndex[nib];
+		index = index < 0 ? 0 : index > 88 ? 88 : index;
+		y[f * nc] = pred;
+	    }
+	}
+    }
+}
+
+static void
+decodeMs(const Codec *c, const uint8_t *in, uint32_t frames, int16_t *out)
+{
+    const int nc = c->channels;
+    int c1[nc], c2[nc], delta[nc], s1[nc], s2[nc];
+    const uint8_t *data = in + 7 * nc;
+    uint32_t k, n;
+    int ch;
+
+    for (ch=0; ch < nc; ++ch) {
+	int p = in[ch] < c->ncoefs ? in[ch] : 0;
+	c1[ch] = c->coefs[p][0];
+	c2[ch] = c->coefs[p][1];
+	delta[ch] = (int16_t)get16(in + nc + 2 * ch);
+	s1[ch] = (int16_t)get16(in + 3 * nc + 2 * ch);
+	s2[ch] = (int16_t)get16(in + 5 * nc + 2 * ch);
+	if (frames > 0) out[ch] = s2[ch];
+	if (frames > 1) out[nc + ch] = s1[ch];
+    }
+
+    n = frames > 2 ? (frames - 2) * nc : 0;
+    for (k=0; k < n; ++k) {
+	int nib = (data[k >> 1] >> ((k & 1) ? 0 : 4)) & 0xf;
+	int sn = nib >= 8 ? nib - 16 : nib;
+	int p;
+	ch = k % nc;
+	p = (s1[ch] * c1[ch] + s2[ch] * c2[ch]) >> 8;
+	p = clamp16(p + sn * delta[ch]);
+	s2[ch] = s1[ch];
+	s1[ch] = p;
+	delta[ch] = (msAdapt[nib] * delta[ch]) >> 8;
+	if (delta[ch] < 16) {
+	    delta[ch] = 16;
+	}
+	out[2 * nc + k] = p;
+    }
+}
+
+/**
+ * Encode one IMA ADPCM block. Every block is a full c->frames
+ * frames; the caller pads the last one.
+ */
+static void
+encodeIma(const Codec *c, const int16_t *in, uint8_t *out)
+{
+    const int nc = c->channels;
+    const uint32_t frames = c->frames;
+    uint8_t *data = out + 4 * nc;
+    uint32_t f, g, n;
+    int ch, k, index;
+    long sum;
+
+    memset(data, 0, c->align - 4 * nc);
+    for (ch=0; ch < nc; ++ch) {
+	const int16_t *x = in + ch;
+	int pred = x[0];
+
+	/* Start with a step near the typical sample difference */
+	n = frames < 17 ? frames : 17;
+	for (f=1, sum=0; f < n; ++f) {
+	    sum += abs(x[f * nc] - x[(f-1) * nc]);
+	}
+	sum = n > 1 ? sum / (n - 1) : 0;
+	for (index=0; index < 88 && imaSteps[index] < sum; ++index)
+	    ;
+
+	out[4 * ch] = pred & 0xff;
+	out[4 * ch + 1] = (pred >> 8) & 0xff;
+	out[4 * ch + 2] = index;
+	out[4 * ch + 3] = 0;
+
+	for (f=1, g=0; f < frames; ++g) {
+	    uint8_t *b = data + (g * nc + ch) * 4;
+	    for (k=0; k < 8 && f < frames; ++k, ++f) {
+		int step = imaSteps[index];
+		int d = x[f * nc] - pred;
+		int nib = 0, diff = step >> 3;
+		if (d < 0) {
+		    nib = 8;
+		    d = -d;
+		}
+		/* Mirror the decoder exactly so the two stay in step */
+		if (d >= step) { nib |= 4; d -= step; diff += step; }
+		if (d >= step >> 1) { nib |= 2; d -= step >> 1; diff += step >> 1; }
+		if (d >= step >> 2) { nib |= 1; diff += step >> 2; }
+		pred = clamp16(nib & 8 ? pred - diff : pred + diff);
+		index += imaIndex[nib];
+		index = index < 0 ? 0 : index > 88 ? 88 : index;
+		b[k >> 1] |= nib << ((k & 1) * 4);
+	    }
+	}
+    }
+}
+
+static void *
+encodeJob(void *arg)
+{
+    Job *job = arg;
+    const Codec *c = job->codec;
+    size_t b;
+
+    for (b = job->first; b < job->first + job->count; ++b) {
+	encodeIma(c, job->pcm + b * c->frames * c->channels,
+	    job->coded + b * c->align);
+    }
+    return NULL;
+}
+
+static void *
+decodeJob(void *arg)
+{
+    Job *job = arg;
+    const Codec *c = job->codec;
+    const size_t fsize = (size_t)c->frames * c->channels;
+    int16_t *scratch = NULL;
+    size_t b, i, n;
+
+    if (job->outf != NULL && (scratch = malloc(fsize * sizeof(int16_t))) == NULL) {
+	return (void *)-1;
+    }
+    for (b = job->first; b < job->first + job->count; ++b) {
+	size_t off = b * c->align;
+	uint32_t frames = blockFrames(c, job->len - off);
+	int16_t *out = scratch != NULL ? scratch : job->out16 + b * fsize;
+	if (c->type == RIFF_IMA_ADPCM) {
+	    decodeIma(c, job->in + off, frames, out);
+	} else {
+	    decodeMs(c, job->in + off, frames, out);
+	}
+	if (scratch != NULL) {
+	    float *y = job->outf + b * fsize;
+	    n = (size_t)frames * c->channels;
+	    for (i=0; i < n; ++i) {
+		y[i] = scratch[i] * (1.0f/32768);
+	    }
+	}
+    }
+    free(scratch);
+    return NULL;
+}
+
+/**
+ * Split nblocks blocks into one range per thread and run fn on
+ * each. jobs[0] has everything but the range filled in.
+ * @return 0 on success, -1 if any job failed
+ */
+static int
+runParallel(void *(*fn)(void *), Job *proto, size_t nblocks, int threads)
+{
+    size_t per, b;
+    int t, nt, started;
+    int rval = 0;
+    void *r;
+
+    nt = threads < 1 ? 1 : threads;
+    if ((size_t)nt > nblocks / MIN_BLOCKS) {
+	nt = nblocks / MIN_BLOCKS > 0 ? nblocks / MIN_BLOCKS : 1;
+    }
+
+    Job jobs[nt];
+    pthread_t tids[nt];
+
+    per = (nblocks + nt - 1) / nt;
+    for (t=0, b=0; t < nt; ++t, b += per) {
+	jobs[t] = *proto;
+	jobs[t].first = b;
+	jobs[t].count = b >= nblocks ? 0 : nblocks - b < per ? nblocks - b : per;
+    }
+    for (started=1; started < nt; ++started) {
+	if (pthread_create(&tids[started], NULL, fn, &jobs[started]) != 0) {
+	    break;
+	}
+    }
+    /* Do the share of any threads that could not be started */
+    for (t=started; t < nt; ++t) {
+	if (fn(&jobs[t]) != NULL) rval = -1;
+    }
+    if (fn(&jobs[0]) != NULL) rval = -1;
+    for (t=1; t < started; ++t) {
+	pthread_join(tids[t], &r);
+	if (r != NULL) rval = -1;
+    }
+    return rval;
+}
+
+static long
+decodeBlocks(const FmtChunk *fmt, const uint8_t *in, size_t len,
+	int16_t *out16, float *outf, int threads)
+{
+    Codec c;
+    Job job;
+    size_t nblocks;
+    uint32_t last;
+
+    if (prepare(fmt, &c) != 0) {
+	return -1;
+    }
+    nblocks = (len + c.align - 1) / c.align;
+    if (nblocks == 0) {
+	return 0;
+    }
+    last = blockFrames(&c, len - (nblocks - 1) * c.align);
+
+    memset(&job, 0, sizeof(job));
+    job.codec = &c;
+    job.in = in;
+    job.len = len;
+    job.out16 = out16;
+    job.outf = outf;
+    if (runParallel(decodeJob, &job, nblocks, threads) != 0) {
+	CodecError = "Out of memory";
+	return -1;
+    }
+    return (long)((nblocks - 1) * c.frames + last);
+}
+
+long
+EncodeImaBlocks(const FmtChunk *fmt, const int16_t *in, size_t frames,
+	uint8_t *out, int threads)
+{
+    Codec c;
+    Job job;
+
+    if (prepare(fmt, &c) != 0 || c.type != RIFF_IMA_ADPCM) {
+	CodecError = "Not an IMA ADPCM format";
+	return -1;
+    }
+    if (frames % c.frames != 0) {
+	CodecError = "Input must be whole blocks";
+	return -1;
+    }
+    memset(&job, 0, sizeof(job));
+    job.codec = &c;
+    job.pcm = in;
+    job.coded = out;
+    runParallel(encodeJob, &job, frames / c.frames, threads);
+    return (long)(frames / c.frames * c.align);
+}
+
+int
+SetImaFmt(FmtChunk *fmt, int channels, uint32_t sample_rate, uint16_t block_align)
+{
+    uint32_t frames;
+    uint8_t *ext = fmt->ext;
+
+    if (block_align == 0) {
+	/* The sizes Windows uses */
+	block_align = (sample_rate <= 11025 ? 256 : sample_rate <= 22050 ? 512 : 1024)
+	    * channels;
+    }
+    if (channels <= 0 || block_align < 8 * channels ||
+	(block_align - 4 * channels) % (4 * channels) != 0)
+    {
+	CodecError = "Invalid IMA ADPCM block size";
+	return -1;
+    }
+    if (ext == NULL || fmt->ext_len < 4) {
+	if ((ext = realloc(ext, 4)) == NULL) {
+	    CodecError = "Out of memory";
+	    return -1;
+	}
+	fmt->ext = ext;
+    }
+    frames = (block_align - 4 * channels) * 2 / channels + 1;
+    fmt->header.length = 20;
+    fmt->type = RIFF_IMA_ADPCM;
+    fmt->channels = channels;
+    fmt->sample_rate = sample_rate;
+    fmt->block_align = block_align;
+    fmt->bits_samp = 4;
+    fmt->bytes_sec = (uint32_t)((uint64_t)sample_rate * block_align / frames);
+    fmt->ext_len = 4;
+    fmt->ext[0] = 2;		/* cbSize */
+    fmt->ext[1] = 0;
+    fmt->ext[2] = frames & 0xff;	/* wSamplesPerBlock */
+    fmt->ext[3] = (frames >> 8) & 0xff;
+    return 0;
+}
+
+long
+DecodeBlocks(const FmtChunk *fmt, const uint8_t *in, size_t len,
+	int16_t *out, int threads)
+{
+    return decodeBlocks(fmt, in, len, out, NULL, threads);
+}
+
+long
+DecodeBlocksFloat(const FmtChunk *fmt, const uint8_t *in, size_t len,
+	float *out, int threads)
+{
+    return decodeBlocks(fmt, in, len, NULL, out, threads);
+}
+
+
+	/*** INFO */
+
+bool
+CodecSupported(const FmtChunk *fmt)
+{
+    Codec c;
+
+    switch (FmtType(fmt)) {
+      case RIFF_ALAW: case RIFF_MULAW:
+      case IBM_FORMAT_ALAW: case IBM_FORMAT_MULAW:
+	return fmt->bits_samp == 8 && fmt->channels > 0 &&
+	    fmt->block_align == fmt->channels;
+      case RIFF_IMA_ADPCM: case RIFF_MS_ADPCM:
+	return prepare(fmt, &c) == 0;
+    }
+    return false;
+}
+
+uint32_t
+CodecBlockFrames(const FmtChunk *fmt)
+{
+    Codec c;
+
+    switch (FmtType(fmt)) {
+      case RIFF_IMA_ADPCM: case RIFF_MS_ADPCM:
+	return prepare(fmt, &c) == 0 ? c.frames : 0;
+    }
+    return 1;
+}
+
+uint32_t
+CodecFrames(const FmtChunk *fmt, uint32_t len)
+{
+    Codec c;
+    uint32_t full;
+
+    switch (FmtType(fmt)) {
+      case RIFF_IMA_ADPCM: case RIFF_MS_ADPCM:
+	if (prepare(fmt, &c) != 0) {
+	    return 0;
+	}
+	full = len / c.align;
+	return full * c.frames + blockFrames(&c, len - full * c.align);
+    }
+    return fmt->block_align == 0 ? 0 : len / fmt->block_align;
+}
@@ -0,0 +1,91 @@
+#ifndef	LIBCODEC_H
+#define	LIBCODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "libwav.h"
+
+/**
+ * Decoders for the compressed .wav sample formats: G.711 A-law and
+ * mu-law (including the IBM format codes), IMA ADPCM and Microsoft
+ * ADPCM. IMA ADPCM can also be encoded.
+ *
+ * G.711 is one byte per sample, so it decodes like PCM. ADPCM is
+ * coded in independent blocks of block_align bytes, each holding
+ * CodecBlockFrames() sample frames; any number of blocks can be
+ * decoded at once, and are spread across threads.
+ */
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern const char *CodecError;	/* Error text from last failure */
+
+/**
+ * @return true if this format can be decoded here
+ */
+extern	bool	CodecSupported(const FmtChunk *fmt);
+
+/**
+ * @return # of sample frames in one block of block_align bytes; 1
+ * for G.711
+ */
+extern	uint32_t CodecBlockFrames(const FmtChunk *fmt);
+
+/**
+ * @return # of sample frames in len bytes of data, counting a
+ * partial block at the end
+ */
+extern	uint32_t CodecFrames(const FmtChunk *fmt, uint32_t len);
+
+/**
+ * Decode G.711 samples.
+ * @param samples  # of samples (not frames)
+ */
+extern	void	DecodeG711(const FmtChunk *fmt, const uint8_t *in, int16_t *out,
+			size_t samples);
+extern	void	DecodeG711Float(const FmtChunk *fmt, const uint8_t *in, float *out,
+			size_t samples);
+
+/**
+ * Decode len bytes of whole blocks, plus a partial block at the end
+ * if the data ends with one, into interleaved samples.
+ * @param threads  max # of threads to use
+ * @return # of sample frames decoded, or -1 on error
+ */
+extern	long	DecodeBlocks(const FmtChunk *fmt, const uint8_t *in, size_t len,
+			int16_t *out, int threads);
+extern	long	DecodeBlocksFloat(const FmtChunk *fmt, const uint8_t *in, size_t len,
+			float *out, int threads);
+
+/**
+ * Fill in a fmt chunk for IMA ADPCM. fmt->ext, which must be NULL or
+ * belong to fmt, is reused if it is big enough, else reallocated.
+ * @param block_align  bytes per block, or 0 for the usual size for
+ *                     the sample rate
+ * @return 0 on success, -1 on error
+ */
+extern	int	SetImaFmt(FmtChunk *fmt, int channels, uint32_t sample_rate,
+			uint16_t block_align);
+
+/**
+ * Encode interleaved 16-bit samples as IMA ADPCM. Blocks are
+ * encoded independently, on up to threads threads, and stored in
+ * order.
+ * @param frames  # of input frames, a multiple of CodecBlockFrames();
+ *                pad the last block
+ * @param out     receives frames / CodecBlockFrames() blocks
+ * @return # of bytes stored, or -1 on error
+ */
+extern	long	EncodeImaBlocks(const FmtChunk *fmt, const int16_t *in, size_t frames,
+			uint8_t *out, int threads);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBCODEC_H */
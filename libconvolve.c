@@ -0,0 +1,331 @@
+/**
+ * @file
+ * Uniformly partitioned convolution (overlap-save).
+ *
+ * With partition size B, every transform is 2B points. Partition p of
+ * the impulse response is zero-padded to 2B and transformed once. For
+ * each block of input, the last 2B input samples are transformed and
+ * the spectrum goes into a ring of the last P input spectra, the
+ * frequency-domain delay line. The output spectrum is
+ *
+ *	Y = sum over p of X[t-p] H[p]
+ *
+ * and the second half of its inverse transform is the next B output
+ * samples. The 1/2B scale of the inverse transform and the output
+ * gain are folded into H.
+ *
+ * The multiply-add runs over split real and imaginary arrays, four
+ * bins at a time with SSE. Channels are independent, so each thread
+ * takes a share of the channels for a whole call.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef	__SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "libconvolve.h"
+#include "libfft.h"
+
+/* Internal type definitions */
+
+struct ir_spectra {
+  int block;		/* B */
+  int bins;		/* B + 1 */
+  int parts;		/* P */
+  int channels;
+  size_t frames;
+  float *re, *im;	/* channels * parts * bins */
+};
+
+typedef struct channel {
+  const float *hre, *him;	/* This channel's partitions */
+  float *xre, *xim;	/* Delay line, parts * bins */
+  int head;		/* Slot of the newest input spectrum */
+  float *prev;		/* The last B input samples */
+  float *x;		/* Scratch, 2B samples */
+  float *yre, *yim;	/* Scratch, bins */
+} Channel;
+
+struct convolver {
+  const IrSpectra *ir;
+  Fft *fft;
+  int channels;
+  int nthreads;
+  Channel *chans;
+};
+
+typedef struct job {
+  Convolver *cv;
+  int first, step;	/* Channels first, first+step, ... */
+  const float *in;
+  float *out;
+  size_t blocks;
+} Job;
+
+const char *ConvolveError = NULL;
+
+IrSpectra *
+NewIrSpectra(const float *ir, size_t frames, int channels, int block, float gain)
+{
+    IrSpectra *s;
+    Fft *fft = NULL;
+    float *x = NULL;
+    size_t i, start;
+    int c, p, n;
+
+    if (frames == 0 || channels < 1) {
+	ConvolveError = "Impulse response is empty";
+	return NULL;
+    }
+    if (block == 0) {
+	/* Keep the # of partitions near 16 */
+	for (block = 256; block < 8192 && (size_t)block * 16 < frames; block *= 2)
+	  ;
+    }
+    if (block < 64 || block > 65536 || (block & (block-1)) != 0) {
+	ConvolveError = "Block size must be a power of 2 from 64 to 65536";
+	return NULL;
+    }
+    if ((s = calloc(1, sizeof(*s))) == NULL) {
+	ConvolveError = "Out of memory";
+	return NULL;
+    }
+    n = 2 * block;
+    s->block = block;
+    s->bins = block + 1;
+    s->parts = (int)((frames + block - 1) / block);
+    s->channels = channels;
+    s->frames = frames;
+    s->re = malloc((size_t)channels * s->parts * s->bins * sizeof(float));
+    s->im = malloc((size_t)channels * s->parts * s->bins * sizeof(float));
+    fft = NewFft(n);
+    x = malloc(n * sizeof(float));
+    if (s->re == NULL || s->im == NULL || fft == NULL || x == NULL) {
+	ConvolveError = "Out of memory";
+	FreeIrSpectra(s);
+	s = NULL;
+	goto exit;
+    }
+
+    gain /= n;
+    for (c=0; c < channels; ++c) {
+	for (p=0; p < s->parts; ++p) {
+	    size_t off = ((size_t)c * s->parts + p) * s->bins;
+	    start = (size_t)p * block;
+	    memset(x, 0, n * sizeof(float));
+	    for (i=0; i < (size_t)block && start + i < frames; ++i) {
+		x[i] = ir[(start + i) * channels + c] * gain;
+	    }
+	    RealFft(fft, x, s->re + off, s->im + off);
+	}
+    }
+
+exit:
+    free(x);
+    FreeFft(fft);
+    return s;
+}
+
+int
+IrBlock(const IrSpectra *s)
+{
+    return s->block;
+}
+
+size_t
+IrLength(const IrSpectra *s)
+{
+    return s->frames;
+}
+
+void
+FreeIrSpectra(IrSpectra *s)
+{
+    if (s != NULL) {
+	free(s->re);
+	free(s->im);
+	free(s);
+    }
+}
+
+Convolver *
+NewConvolver(const IrSpectra *ir, int channels, int threads)
+{
+    Convolver *cv;
+    const int B = ir->block, bins = ir->bins;
+    int c;
+
+    if (ir->channels != 1 && ir->channels != channels) {
+	ConvolveError = "Impulse response must have 1 channel or one per input channel";
+	return NULL;
+    }
+    if ((cv = calloc(1, sizeof(*cv))) == NULL ||
+	(cv->chans = calloc(channels, sizeof(Channel))) == NULL)
+    {
+	free(cv);
+	ConvolveError = "Out of memory";
+	return NULL;
+    }
+    cv->ir = ir;
+    cv->channels = channels;
+    cv->nthreads = threads < 1 ? 1 : threads > channels ? channels : threads;
+    cv->fft = NewFft(2 * B);
+    for (c=0; c < channels; ++c) {
+	Channel *ch = &cv->chans[c];
+	size_t off = ir->channels == 1 ? 0 : (size_t)c * ir->parts * bins;
+	ch->hre = ir->re + off;
+	ch->him = ir->im + off;
+	ch->xre = calloc((size_t)ir->parts * bins, sizeof(float));
+	ch->xim = calloc((size_t)ir->parts * bins, sizeof(float));
+	ch->prev = calloc(B, sizeof(float));
+	ch->x = malloc(2 * B * sizeof(float));
+	ch->yre = malloc(bins * sizeof(float));
+	ch->yim = malloc(bins * sizeof(float));
+	if (ch->xre == NULL || ch->xim == NULL || ch->prev == NULL ||
+	    ch->x == NULL || ch->yre == NULL || ch->yim == NULL)
+	{
+	    break;
+	}
+    }
+    if (c < channels || cv->fft == NULL) {
+	ConvolveError = "Out of memory";
+	FreeConvolver(cv);
+	return NULL;
+    }
+    return cv;
+}
+
+/**
+ * y += x * h, complex, over n bins
+ */
+static void
+multiplyAdd(float *yre, float *yim, const float *xre, const float *xim,
+	const float *hre, const float *him, int n)
+{
+    int k = 0;
+
+#ifdef	__SSE__
+    for (; k + 4 <= n; k += 4) {
+	__m128 ar = _mm_loadu_ps(xre + k), ai = _mm_loadu_ps(xim + k);
+	__m128 br = _mm_loadu_ps(hre + k), bi = _mm_loadu_ps(him + k);
+	__m128 cr = _mm_loadu_ps(yre + k), ci = _mm_loadu_ps(yim + k);
+	cr = _mm_add_ps(cr, _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi)));
+	ci = _mm_add_ps(ci, _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br)));
+	_mm_storeu_ps(yre + k, cr);
+	_mm_storeu_ps(yim + k, ci);
+    }
+#endif
+    for (; k < n; ++k) {
+	yre[k] += xre[k] * hre[k] - xim[k] * him[k];
+	yim[k] += xre[k] * him[k] + xim[k] * hre[k];
+    }
+}
+
+/**
+ * Run one block of one channel.
+ * @param in   first input sample, every nc'th sample is this channel's
+ * @param out  first output sample, likewise
+ */
+static void
+convolveBlock(Convolver *cv, Channel *ch, const float *in, float *out)
+{
+    const IrSpectra *ir = cv->ir;
+    const int B = ir->block, bins = ir->bins, P = ir->parts;
+    const int nc = cv->channels;
+    int i, p, slot;
+
+    memcpy(ch->x, ch->prev, B * sizeof(float));
+    for (i=0; i < B; ++i) {
+	ch->x[B + i] = ch->prev[i] = in[(size_t)i * nc];
+    }
+    ch->head = ch->head == 0 ? P - 1 : ch->head - 1;
+    RealFft(cv->fft, ch->x, ch->xre + (size_t)ch->head * bins,
+	    ch->xim + (size_t)ch->head * bins);
+
+    memset(ch->yre, 0, bins * sizeof(float));
+    memset(ch->yim, 0, bins * sizeof(float));
+    for (p=0, slot=ch->head; p < P; ++p, slot = slot + 1 == P ? 0 : slot + 1) {
+	multiplyAdd(ch->yre, ch->yim,
+	    ch->xre + (size_t)slot * bins, ch->xim + (size_t)slot * bins,
+	    ch->hre + (size_t)p * bins, ch->him + (size_t)p * bins, bins);
+    }
+    InverseRealFft(cv->fft, ch->yre, ch->yim, ch->x);
+    for (i=0; i < B; ++i) {
+	out[(size_t)i * nc] = ch->x[B + i];
+    }
+}
+
+static void *
+runJob(void *arg)
+{
+    Job *job = arg;
+    Convolver *cv = job->cv;
+    const size_t step = (size_t)cv->ir->block * cv->channels;
+    size_t b;
+    int c;
+
+    for (c = job->first; c < cv->channels; c += job->step) {
+	for (b=0; b < job->blocks; ++b) {
+	    convolveBlock(cv, &cv->chans[c], job->in + b * step + c,
+		job->out + b * step + c);
+	}
+    }
+    return NULL;
+}
+
+void
+ConvolveBlocks(Convolver *cv, const float *in, size_t blocks, float *out)
+{
+    Job jobs[cv->nthreads];
+    pthread_t tids[cv->nthreads];
+    int t, started = 1;
+
+    for (t=0; t < cv->nthreads; ++t) {
+	jobs[t].cv = cv;
+	jobs[t].first = t;
+	jobs[t].step = cv->nthreads;
+	jobs[t].in = in;
+	jobs[t].out = out;
+	jobs[t].blocks = blocks;
+    }
+    for (t=1; t < cv->nthreads; ++t) {
+	if (pthread_create(&tids[t], NULL, runJob, &jobs[t]) != 0) {
+	    break;
+	}
+	++started;
+    }
+    /* Do the share of any threads that could not be started */
+    for (t=started; t < cv->nthreads; ++t) {
+	runJob(&jobs[t]);
+    }
+    runJob(&jobs[0]);
+    for (t=1; t < started; ++t) {
+	pthread_join(tids[t], NULL);
+    }
+}
+
+void
+FreeConvolver(Convolver *cv)
+{
+    int c;
+
+    if (cv != NULL) {
+	if (cv->chans != NULL) {
+	    for (c=0; c < cv->channels; ++c) {
+		Channel *ch = &cv->chans[c];
+		free(ch->xre);
+		free(ch->xim);
+		free(ch->prev);
+		free(ch->x);
+		free(ch->yre);
+		free(ch->yim);
+	    }
+	    free(cv->chans);
+	}
+	FreeFft(cv->fft);
+	free(cv);
+    }
+}
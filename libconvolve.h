@@ -0,0 +1,76 @@
+#ifndef	LIBCONVOLVE_H
+#define	LIBCONVOLVE_H
+
+#include <stddef.h>
+
+/**
+ * Uniformly partitioned FFT convolution, for impulse responses of
+ * any length.
+ *
+ * The impulse response is cut into partitions of "block" samples and
+ * the spectrum of each is computed once, in an IrSpectra. That is
+ * read-only afterwards, so it can be shared by any number of
+ * convolvers, e.g. one per file of a batch. A convolver transforms
+ * each block of input once, keeps the spectra of the last few blocks,
+ * and multiplies and adds them with the partitions (overlap-save).
+ * The cost per sample grows with the number of partitions, not with
+ * the number of taps.
+ */
+
+typedef struct ir_spectra IrSpectra;
+typedef struct convolver Convolver;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern const char *ConvolveError;	/* Error text from last failure */
+
+/**
+ * Compute the partition spectra of an impulse response.
+ * @param ir        interleaved samples
+ * @param frames    length of the impulse response
+ * @param channels  # of channels in ir; 1 applies to every channel
+ * @param block     partition size, a power of 2 from 64 to 65536, or 0
+ *                  to pick one from the length
+ * @param gain      linear gain applied to the output
+ * @return new spectra, or NULL on error
+ */
+extern	IrSpectra *NewIrSpectra(const float *ir, size_t frames, int channels,
+			int block, float gain);
+
+/** Partition size, in frames */
+extern	int	IrBlock(const IrSpectra *);
+
+/** Length of the impulse response, in frames */
+extern	size_t	IrLength(const IrSpectra *);
+
+extern	void	FreeIrSpectra(IrSpectra *);
+
+/**
+ * Create a convolver. The spectra must stay until it is freed.
+ * @param channels  # of interleaved channels; the spectra must have
+ *                  1 or this many
+ * @param threads   max # of threads; channels are divided among them
+ * @return new convolver, or NULL on error
+ */
+extern	Convolver *NewConvolver(const IrSpectra *, int channels, int threads);
+
+/**
+ * Convolve whole blocks of interleaved input. Output is not delayed:
+ * block i of output holds output frames i*block to (i+1)*block-1. At
+ * the end of the input, pad the last block with zeros and feed zero
+ * blocks to get the tail.
+ * @param in      blocks * IrBlock() frames
+ * @param out     receives the same number of frames
+ */
+extern	void	ConvolveBlocks(Convolver *, const float *in, size_t blocks, float *out);
+
+extern	void	FreeConvolver(Convolver *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBCONVOLVE_H */
@@ -0,0 +1,294 @@
+/**
+ * @file
+ * Requantization with dither and noise shaping.
+ *
+ * Noise shaping uses the usual error feedback structure:
+ *
+ *	s[n] = x[n] - sum(h[k] * e[n-1-k])
+ *	q[n] = round(s[n] + dither)
+ *	e[n] = q[n] - s[n]
+ *
+ * which gives the requantization noise a spectrum of |1 - H(z)|^2.
+ * The filter state is kept per channel, with the channels side by
+ * side, so the inner loop runs across channels with no dependencies
+ * and the compiler can put the channels in SIMD lanes. Without noise
+ * shaping there is no feedback at all and the whole block is one
+ * vectorizable loop.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "libdither.h"
+
+#define	BLOCK_SAMPLES	4096	/* Samples processed at a time */
+#define	MAX_TAPS	5
+
+/* Internal type definitions */
+
+struct ditherer {
+  int channels;
+  int bits;
+  DitherType type;
+  float scale;		/* Full scale, e.g. 32768 for 16 bits */
+  int32_t lo, hi;	/* Output range */
+  const float *coefs;	/* Noise shaping filter */
+  int ntaps;
+  float *err;		/* ntaps * channels, circular by frame */
+  int head;		/* Index of the most recent error in err */
+  uint32_t rng;
+  float *noise;		/* Scratch space: dither for one block */
+  float *shaped;	/* Scratch space: values to be rounded */
+  int32_t *q;		/* Scratch space: quantized samples */
+};
+
+static const float simpleCoefs[] = {1.0f};
+static const float eWeightedCoefs[] = {2.033f, -2.165f, 1.959f, -1.590f, 0.6149f};
+
+static struct {
+  const char *name;
+  int value;
+} ditherNames[] = {
+  {"none", DITHER_NONE},
+  {"rect", DITHER_RECT},
+  {"tpdf", DITHER_TPDF},
+}, shapeNames[] = {
+  {"none", SHAPE_NONE},
+  {"simple", SHAPE_SIMPLE},
+  {"ew", SHAPE_EWEIGHTED},
+};
+
+#define	NA(a)	(sizeof(a)/sizeof(a[0]))
+
+/**
+ * xorshift32; quality is more than adequate for dither.
+ * @return uniform random value in [-0.5, 0.5)
+ */
+static inline float
+uniform(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (x >> 8) * (1.0f/16777216) - 0.5f;
+}
+
+Ditherer *
+NewDitherer(int channels, int bits, DitherType type, NoiseShape shape,
+	uint32_t seed)
+{
+    Ditherer *d;
+
+    if ((d = calloc(1, sizeof(*d))) == NULL) {
+	return NULL;
+    }
+    d->channels = channels;
+    d->bits = bits;
+    d->type = type;
+    d->scale = (float)(1 << (bits-1));
+    d->lo = -(1 << (bits-1));
+    d->hi = (1 << (bits-1)) - 1;
+    d->rng = seed ? seed : 0x12345678;
+    switch (shape) {
+      case SHAPE_NONE: d->ntaps = 0; break;
+      case SHAPE_SIMPLE: d->coefs = simpleCoefs; d->ntaps = NA(simpleCoefs); break;
+      case SHAPE_EWEIGHTED: d->coefs = eWeightedCoefs; d->ntaps = NA(eWeightedCoefs); break;
+    }
+    d->err = calloc(MAX_TAPS * channels, sizeof(float));
+    d->noise = malloc(BLOCK_SAMPLES * sizeof(float));
+    d->shaped = malloc(channels * sizeof(float));
+    d->q = malloc(BLOCK_SAMPLES * sizeof(int32_t));
+    if (d->err == NULL || d->noise == NULL || d->shaped == NULL || d->q == NULL) {
+	FreeDitherer(d);
+	return NULL;
+    }
+    return d;
+}
+
+/**
+ * Generate one block of dither
+ */
+static void
+makeNoise(Ditherer *d, size_t n)
+{
+    size_t i;
+
+    switch (d->type) {
+      case DITHER_NONE:
+	memset(d->noise, 0, n * sizeof(float));
+	break;
+      case DITHER_RECT:
+	for (i=0; i < n; ++i) {
+	    d->noise[i] = uniform(&d->rng);
+	}
+	break;
+      case DITHER_TPDF:
+	for (i=0; i < n; ++i) {
+	    d->noise[i] = uniform(&d->rng) + uniform(&d->rng);
+	}
+	break;
+    }
+}
+
+/**
+ * Requantize without noise shaping. No feedback, so this
+ * vectorizes.
+ */
+static void
+quantFlat(Ditherer *d, const float *in, size_t n)
+{
+    const float scale = d->scale, lo = (float)d->lo, hi = (float)d->hi;
+    const float *noise = d->noise;
+    int32_t *q = d->q;
+    size_t i;
+    float v;
+
+    for (i=0; i < n; ++i) {
+	v = floorf(in[i] * scale + noise[i] + 0.5f);
+	v = v < lo ? lo : v;
+	v = v > hi ? hi : v;
+	q[i] = (int32_t)v;
+    }
+}
+
+/**
+ * Requantize with error feedback. Serial in time, parallel
+ * across channels.
+ */
+static void
+quantShaped(Ditherer *d, const float *in, size_t frames)
+{
+    const int nc = d->channels, ntaps = d->ntaps;
+    const float scale = d->scale, lo = (float)d->lo, hi = (float)d->hi;
+    float *s = d->shaped;
+    size_t f;
+    int c, k, slot;
+    float v, e;
+
+    for (f=0; f < frames; ++f) {
+	const float *x = in + f * nc;
+	const float *noise = d->noise + f * nc;
+	int32_t *q = d->q + f * nc;
+
+	for (c=0; c < nc; ++c) {
+	    s[c] = x[c] * scale;
+	}
+	for (k=0; k < ntaps; ++k) {
+	    const float h = d->coefs[k];
+	    const float *err;
+	    slot = d->head - k;
+	    if (slot < 0) {
+		slot += ntaps;
+	    }
+	    err = d->err + slot * nc;
+	    for (c=0; c < nc; ++c) {
+		s[c] -= h * err[c];
+	    }
+	}
+
+	if (++d->head >= ntaps) {
+	    d->head = 0;
+	}
+	for (c=0; c < nc; ++c) {
+	    float *err = d->err + d->head * nc;
+	    v = floorf(s[c] + noise[c] + 0.5f);
+	    v = v < lo ? lo : v;
+	    v = v > hi ? hi : v;
+	    q[c] = (int32_t)v;
+	    /* Keep the loop stable when the output clips */
+	    e = v - s[c];
+	    e = e < -1.0f ? -1.0f : e;
+	    err[c] = e > 1.0f ? 1.0f : e;
+	}
+    }
+}
+
+void
+DitherFrames(Ditherer *d, const float *in, void *out, size_t frames)
+{
+    const int nc = d->channels;
+    size_t block = BLOCK_SAMPLES / nc;
+    size_t n, i;
+    uint8_t *bytes = out;
+
+    if (block == 0) {
+	block = 1;	/* More channels than BLOCK_SAMPLES; not likely */
+    }
+
+    while (frames > 0) {
+	size_t fr = frames < block ? frames : block;
+	n = fr * nc;
+	makeNoise(d, n);
+	if (d->ntaps == 0) {
+	    quantFlat(d, in, n);
+	} else {
+	    quantShaped(d, in, fr);
+	}
+
+	switch (d->bits) {
+	  case 8:
+	    for (i=0; i < n; ++i) {
+		bytes[i] = (uint8_t)(d->q[i] + 128);
+	    }
+	    break;
+	  case 16:
+	    for (i=0; i < n; ++i) {
+		bytes[2*i] = d->q[i] & 0xff;
+		bytes[2*i+1] = (d->q[i] >> 8) & 0xff;
+	    }
+	    break;
+	  case 24:
+	    for (i=0; i < n; ++i) {
+		bytes[3*i] = d->q[i] & 0xff;
+		bytes[3*i+1] = (d->q[i] >> 8) & 0xff;
+		bytes[3*i+2] = (d->q[i] >> 16) & 0xff;
+	    }
+	    break;
+	}
+	bytes += n * (d->bits / 8);
+	in += n;
+	frames -= fr;
+    }
+}
+
+void
+FreeDitherer(Ditherer *d)
+{
+    if (d != NULL) {
+	free(d->err);
+	free(d->noise);
+	free(d->shaped);
+	free(d->q);
+	free(d);
+    }
+}
+
+int
+DitherTypeFromName(const char *name)
+{
+    int i;
+    for (i=0; i < NA(ditherNames); ++i) {
+	if (strcasecmp(name, ditherNames[i].name) == 0) {
+	    return ditherNames[i].value;
+	}
+    }
+    return -1;
+}
+
+int
+NoiseShapeFromName(const char *name)
+{
+    int i;
+    for (i=0; i < NA(shapeNames); ++i) {
+	if (strcasecmp(name, shapeNames[i].name) == 0) {
+	    return shapeNames[i].value;
+	}
+    }
+    return -1;
+}
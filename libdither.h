@@ -0,0 +1,63 @@
+#ifndef	LIBDITHER_H
+#define	LIBDITHER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Requantize float samples to a shorter integer word length, with
+ * optional dither and noise shaping.
+ */
+
+typedef enum {
+  DITHER_NONE,		/* Plain rounding */
+  DITHER_RECT,		/* Rectangular, 1 LSB peak to peak */
+  DITHER_TPDF,		/* Triangular, 2 LSB peak to peak */
+} DitherType;
+
+typedef enum {
+  SHAPE_NONE,		/* Flat noise spectrum */
+  SHAPE_SIMPLE,		/* First order high-pass, 1 - z^-1 */
+  SHAPE_EWEIGHTED,	/* 5-tap E-weighted curve (Lipshitz et al.) */
+} NoiseShape;
+
+typedef struct ditherer Ditherer;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+/**
+ * Create a ditherer.
+ * @param channels  # of interleaved channels
+ * @param bits      output word length, 8, 16 or 24
+ * @param type      dither type
+ * @param shape     noise shaping filter
+ * @param seed      random seed; the same seed gives the same output
+ * @return new ditherer or NULL if out of memory
+ */
+extern	Ditherer *NewDitherer(int channels, int bits, DitherType type,
+			NoiseShape shape, uint32_t seed);
+
+/**
+ * Requantize interleaved float samples and store them as little-endian
+ * PCM of the ditherer's word length. Noise shaping state carries over
+ * from one call to the next, so a file must be fed through in order.
+ */
+extern	void	DitherFrames(Ditherer *, const float *in, void *out, size_t frames);
+
+extern	void	FreeDitherer(Ditherer *);
+
+/**
+ * Parse a dither or noise shape name, e.g. "tpdf".
+ * @return the value, or -1 if the name is not recognized
+ */
+extern	int	DitherTypeFromName(const char *name);
+extern	int	NoiseShapeFromName(const char *name);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBDITHER_H */
@@ -0,0 +1,213 @@
+/**
+ * @file
+ * Real FFT.
+ *
+ * A real transform of n samples is done as a complex transform of
+ * n/2 points, taking the even samples as the real parts and the odd
+ * samples as the imaginary parts, followed by a split pass that
+ * separates the two halves into the n/2+1 bins. The inverse runs the
+ * same steps backwards, using the forward complex transform on the
+ * complex conjugate.
+ *
+ * The complex transform is iterative radix-2, decimation in time, on
+ * separate real and imaginary arrays. Each stage's twiddles are
+ * stored together, so the butterflies of a stage run over contiguous
+ * memory and can be done four at a time with SSE.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#ifdef	__SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "libfft.h"
+
+struct fft {
+  int n;		/* Real transform size */
+  int m;		/* Complex transform size, n/2 */
+  int *rev;		/* Bit reversal of 0..m-1 */
+  float *twr, *twi;	/* Stage of span h uses [h, 2h) */
+  float *spr, *spi;	/* Split pass, e^(-2 pi i k/n) for k <= m/2 */
+};
+
+Fft *
+NewFft(int n)
+{
+    Fft *f;
+    int m, bits, h, j, k, r;
+
+    if (n < 4 || (n & (n-1)) != 0) {
+	return NULL;
+    }
+    if ((f = calloc(1, sizeof(*f))) == NULL) {
+	return NULL;
+    }
+    f->n = n;
+    f->m = m = n / 2;
+    f->rev = malloc(m * sizeof(int));
+    f->twr = malloc(m * sizeof(float));
+    f->twi = malloc(m * sizeof(float));
+    f->spr = malloc((m/2 + 1) * sizeof(float));
+    f->spi = malloc((m/2 + 1) * sizeof(float));
+    if (f->rev == NULL || f->twr == NULL || f->twi == NULL ||
+	f->spr == NULL || f->spi == NULL)
+    {
+	FreeFft(f);
+	return NULL;
+    }
+
+    for (bits=0; (1 << bits) < m; ++bits)
+      ;
+    for (k=0; k < m; ++k) {
+	for (r=0, j=0; j < bits; ++j) {
+	    r |= ((k >> j) & 1) << (bits - 1 - j);
+	}
+	f->rev[k] = r;
+    }
+    for (h=1; h < m; h *= 2) {
+	for (j=0; j < h; ++j) {
+	    f->twr[h + j] = cos(M_PI * j / h);
+	    f->twi[h + j] = -sin(M_PI * j / h);
+	}
+    }
+    for (k=0; k <= m/2; ++k) {
+	f->spr[k] = cos(2 * M_PI * k / n);
+	f->spi[k] = -sin(2 * M_PI * k / n);
+    }
+    return f;
+}
+
+static void
+complexFft(const Fft *f, float *re, float *im)
+{
+    const int m = f->m;
+    int h, g, j;
+
+    for (h=1; h < m; h *= 2) {
+	const float *wr = f->twr + h, *wi = f->twi + h;
+	for (g=0; g < m; g += 2*h) {
+	    float *ar = re + g, *ai = im + g;
+	    float *br = ar + h, *bi = ai + h;
+	    j = 0;
+#ifdef	__SSE2__
+	    for (; j + 4 <= h; j += 4) {
+		__m128 xr = _mm_loadu_ps(br + j), xi = _mm_loadu_ps(bi + j);
+		__m128 cr = _mm_loadu_ps(wr + j), ci = _mm_loadu_ps(wi + j);
+		__m128 yr = _mm_loadu_ps(ar + j), yi = _mm_loadu_ps(ai + j);
+		__m128 tr = _mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci));
+		__m128 ti = _mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr));
+		_mm_storeu_ps(ar + j, _mm_add_ps(yr, tr));
+		_mm_storeu_ps(ai + j, _mm_add_ps(yi, ti));
+		_mm_storeu_ps(br + j, _mm_sub_ps(yr, tr));
+		_mm_storeu_ps(bi + j, _mm_sub_ps(yi, ti));
+	    }
+#endif
+	    for (; j < h; ++j) {
+		float tr = br[j] * wr[j] - bi[j] * wi[j];
+		float ti = br[j] * wi[j] + bi[j] * wr[j];
+		br[j] = ar[j] - tr;
+		bi[j] = ai[j] - ti;
+		ar[j] += tr;
+		ai[j] += ti;
+	    }
+	}
+    }
+}
+
+void
+RealFft(const Fft *f, const float *in, float *re, float *im)
+{
+    const int m = f->m;
+    float zr, zi, er, ei, orr, oi, tr, ti;
+    int k, j;
+
+    for (k=0; k < m; ++k) {
+	re[f->rev[k]] = in[2*k];
+	im[f->rev[k]] = in[2*k + 1];
+    }
+    complexFft(f, re, im);
+
+    /* Split Z into the transforms of the even and odd samples, E and
+     * O, and combine them: X[k] = E[k] + W^k O[k] and
+     * X[m-k] = conj(E[k] - W^k O[k]).
+     */
+    zr = re[0];
+    zi = im[0];
+    re[0] = zr + zi;
+    im[0] = 0;
+    re[m] = zr - zi;
+    im[m] = 0;
+    for (k=1; k < m/2; ++k) {
+	j = m - k;
+	er = 0.5f * (re[k] + re[j]);
+	ei = 0.5f * (im[k] - im[j]);
+	orr = 0.5f * (im[k] + im[j]);
+	oi = -0.5f * (re[k] - re[j]);
+	tr = f->spr[k] * orr - f->spi[k] * oi;
+	ti = f->spr[k] * oi + f->spi[k] * orr;
+	re[k] = er + tr;
+	im[k] = ei + ti;
+	re[j] = er - tr;
+	im[j] = ti - ei;
+    }
+    im[m/2] = -im[m/2];
+}
+
+void
+InverseRealFft(const Fft *f, float *re, float *im, float *out)
+{
+    const int m = f->m;
+    float er, ei, dr, di, orr, oi, t;
+    int k, j, r;
+
+    /* Recombine E and O, twice over, from X and form
+     * conj(Z) = conj(E + iO), ready for the bit reversal.
+     */
+    er = re[0] + re[m];
+    ei = re[0] - re[m];
+    re[0] = er;
+    im[0] = -ei;
+    for (k=1; k < m/2; ++k) {
+	j = m - k;
+	er = re[k] + re[j];
+	ei = im[k] - im[j];
+	dr = re[k] - re[j];
+	di = im[k] + im[j];
+	/* O[k] = D conj(W^k); O[m-k] = conj(O[k]) */
+	orr = dr * f->spr[k] + di * f->spi[k];
+	oi = di * f->spr[k] - dr * f->spi[k];
+	re[k] = er - oi;
+	im[k] = -(ei + orr);
+	re[j] = er + oi;
+	im[j] = -(orr - ei);
+    }
+    re[m/2] = 2 * re[m/2];
+    im[m/2] = 2 * im[m/2];
+
+    for (k=0; k < m; ++k) {
+	r = f->rev[k];
+	if (r > k) {
+	    t = re[k]; re[k] = re[r]; re[r] = t;
+	    t = im[k]; im[k] = im[r]; im[r] = t;
+	}
+    }
+    complexFft(f, re, im);
+    for (k=0; k < m; ++k) {
+	out[2*k] = re[k];
+	out[2*k + 1] = -im[k];
+    }
+}
+
+void
+FreeFft(Fft *f)
+{
+    if (f != NULL) {
+	free(f->rev);
+	free(f->twr);
+	free(f->twi);
+	free(f->spr);
+	free(f->spi);
+	free(f);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef	LIBFFT_H
+#define	LIBFFT_H
+
+/**
+ * Fast Fourier transform of real samples, for power-of-2 sizes.
+ *
+ * A plan holds the tables for one size. It is not changed by the
+ * transforms, so one plan can be shared by any number of threads.
+ */
+
+typedef struct fft Fft;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+/**
+ * Make a plan for transforms of n real samples.
+ * @return new plan, or NULL if n is not a power of 2 of at least 4
+ *         or out of memory
+ */
+extern	Fft	*NewFft(int n);
+
+/**
+ * Forward transform. No scaling is applied.
+ * @param in  n samples
+ * @param re  receives the real parts of bins 0 to n/2
+ * @param im  receives the imaginary parts of bins 0 to n/2
+ */
+extern	void	RealFft(const Fft *, const float *in, float *re, float *im);
+
+/**
+ * Inverse transform. The result is scaled by n, so a forward and an
+ * inverse transform multiply the samples by n.
+ * @param re   real parts of bins 0 to n/2; destroyed
+ * @param im   imaginary parts of bins 0 to n/2; destroyed
+ * @param out  receives n samples
+ */
+extern	void	InverseRealFft(const Fft *, float *re, float *im, float *out);
+
+extern	void	FreeFft(Fft *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBFFT_H */
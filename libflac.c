@@ -0,0 +1,1957 @@
+/**
+ * @file
+ * FLAC encoder and decoder.
+ *
+ * Encoding: every block of BLOCK_SIZE frames is coded on its own.
+ * Each channel is tried as a constant, a fixed polynomial predictor
+ * (the order with the smallest sum of absolute residuals) and an LPC
+ * predictor (Levinson-Durbin on a Tukey-windowed autocorrelation, with
+ * the order picked from the prediction error), and the smallest
+ * wins, falling back to verbatim samples. Stereo blocks also try
+ * left/side, right/side and mid/side. Residuals are Rice coded, with
+ * the partition order and parameters picked from partition sums.
+ *
+ * The input is held until there is a batch of blocks for every
+ * thread. Each thread codes its share of the batch into its own
+ * buffers, and the frames are then written out in order.
+ *
+ * Decoding reads one frame at a time from a buffer that is kept at
+ * least half full, so a frame is always in memory in one piece for
+ * the CRC checks.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "libflac.h"
+
+#define	BLOCK_SIZE	4096	/* Frames per encoded block */
+#define	MAX_FIXED_ORDER	4
+#define	MAX_LPC_ORDER	12
+#define	MAX_PARTITION_ORDER	8
+#define	BATCH_BLOCKS	8	/* Blocks per thread in a batch */
+#define	MAX_META	0xFFFFFF	/* Largest metadata block */
+#define	MIN_BUFSIZE	(64*1024)	/* Smallest decoder buffer */
+
+#define	SUB_CONSTANT	0
+#define	SUB_VERBATIM	1
+#define	SUB_FIXED	8	/* + order */
+#define	SUB_LPC		32	/* + order - 1 */
+
+#define	META_STREAMINFO	0
+#define	META_APPLICATION 2
+#define	META_VORBIS	4
+
+#define	CH_LEFT_SIDE	8
+#define	CH_RIGHT_SIDE	9
+#define	CH_MID_SIDE	10
+
+static const char vendor[] = "AudioTools libflac";
+
+/* Internal type definitions */
+
+/**
+ * Bits being written. Bits are collected in acc and moved to buf a
+ * byte at a time.
+ */
+typedef struct bits {
+  uint8_t *buf;
+  size_t cap;
+  size_t len;		/* # of whole bytes in buf */
+  uint64_t acc;		/* Pending bits, right-justified */
+  int nacc;		/* # of pending bits, < 8 between calls */
+  int failed;		/* Out of memory */
+} Bits;
+
+/**
+ * Partitioned Rice coding of one residual
+ */
+typedef struct rice {
+  int order;		/* Partition order */
+  int method;		/* 0: 4-bit parameters, 1: 5-bit */
+  uint8_t k[1 << MAX_PARTITION_ORDER];
+} Rice;
+
+typedef struct md5 {
+  uint32_t h[4];
+  uint64_t len;		/* # of bytes hashed */
+  uint8_t buf[64];
+} Md5;
+
+/**
+ * One encoding thread, with its own scratch space
+ */
+typedef struct worker {
+  FlacEncoder *enc;
+  size_t first, count;	/* Blocks of the batch to encode */
+  size_t frames;	/* # of frames in the batch */
+  int32_t *chan;	/* One block per channel, then mid and side */
+  int32_t *shifted;	/* Samples with wasted bits removed */
+  int32_t *res[2];	/* Best residual and candidate residual */
+  double *data;		/* Windowed samples */
+  double *window;
+  uint32_t window_n;	/* Block size of window */
+  Bits *sub;		/* Coded subframes of one block */
+  int nsub;
+  int rval;
+} Worker;
+
+struct flac_encoder {
+  FILE *file;
+  int channels;
+  int bits;
+  uint32_t sample_rate;
+  uint64_t frames;	/* Total promised in STREAMINFO */
+  uint64_t encoded;	/* # of frames taken so far */
+  int ncomments;
+  char **comments;
+  FlacApp *apps;
+  FlacApp **app_tail;
+  int started;		/* Metadata has been written */
+  long start;		/* File offset of "fLaC", -1 if not seekable */
+  int32_t *pending;	/* Interleaved frames waiting for a batch */
+  size_t npending;
+  size_t nblocks;	/* Blocks per batch */
+  Bits *coded;		/* Coded frames of one batch */
+  Worker *workers;
+  int nworkers;
+  uint32_t frame_no;	/* Number of the next frame */
+  uint32_t min_frame, max_frame;	/* Frame sizes in bytes */
+  Md5 md5;
+};
+
+const char *FlacError;
+
+static uint8_t crc8Table[256];
+static uint16_t crc16Table[256];
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+
+	/* CRC AND MD5 */
+
+static void
+initCrc(void)
+{
+    int i, j;
+    unsigned c;
+
+    for (i=0; i < 256; ++i) {
+	for (c=i, j=0; j < 8; ++j) {
+	    c = (c & 0x80) ? (c << 1) ^ 0x07 : c << 1;
+	}
+	crc8Table[i] = c;
+	for (c=i << 8, j=0; j < 8; ++j) {
+	    c = (c & 0x8000) ? (c << 1) ^ 0x8005 : c << 1;
+	}
+	crc16Table[i] = c;
+    }
+}
+
+static unsigned
+crc8(const uint8_t *p, size_t len)
+{
+    unsigned crc = 0;
+    while (len-- > 0) {
+	crc = crc8Table[crc ^ *p++];
+    }
+    return crc;
+}
+
+static unsigned
+crc16(const uint8_t *p, size_t len)
+{
+    unsigned crc = 0;
+    while (len-- > 0) {
+	crc = ((crc << 8) ^ crc16Table[(crc >> 8) ^ *p++]) & 0xffff;
+    }
+    return crc;
+}
+
+static const uint32_t md5K[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+  0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+  0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+  0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+  0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+  0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint8_t md5R[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static void
+md5Init(Md5 *m)
+{
+    m->h[0] = 0x67452301;
+    m->h[1] = 0xefcdab89;
+    m->h[2] = 0x98badcfe;
+    m->h[3] = 0x10325476;
+    m->len = 0;
+}
+
+static void
+md5Block(Md5 *m, const uint8_t *p)
+{
+    uint32_t w[16], a, b, c, d, f, t;
+    int i, g;
+
+    for (i=0; i < 16; ++i) {
+	w[i] = p[4*i] | p[4*i+1] << 8 | p[4*i+2] << 16 | (uint32_t)p[4*i+3] << 24;
+    }
+    a = m->h[0]; b = m->h[1]; c = m->h[2]; d = m->h[3];
+    for (i=0; i < 64; ++i) {
+	if (i < 16) {
+	    f = (b & c) | (~b & d); g = i;
+	} else if (i < 32) {
+	    f = (d & b) | (~d & c); g = (5*i + 1) % 16;
+	} else if (i < 48) {
+	    f = b ^ c ^ d; g = (3*i + 5) % 16;
+	} else {
+	    f = c ^ (b | ~d); g = (7*i) % 16;
+	}
+	t = a + f + md5K[i] + w[g];
+	a = d; d = c; c = b;
+	b += (t << md5R[i]) | (t >> (32 - md5R[i]));
+    }
+    m->h[0] += a; m->h[1] += b; m->h[2] += c; m->h[3] += d;
+}
+
+static void
+md5Update(Md5 *m, const uint8_t *p, size_t len)
+{
+    size_t used = m->len % 64, n;
+
+    m->len += len;
+    if (used > 0) {
+	n = 64 - used < len ? 64 - used : len;
+	memcpy(m->buf + used, p, n);
+	p += n; len -= n;
+	if (used + n < 64) {
+	    return;
+	}
+	md5Block(m, m->buf);
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+	md5Block(m, p);
+    }
+    memcpy(m->buf, p, len);
+}
+
+static void
+md5Final(Md5 *m, uint8_t digest[16])
+{
+    uint8_t pad[72];
+    uint64_t bits = m->len * 8;
+    size_t n = 64 - (m->len + 8) % 64;
+    int i;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i=0; i < 8; ++i) {
+	pad[n + i] = bits >> (8*i);
+    }
+    md5Update(m, pad, n + 8);
+    for (i=0; i < 16; ++i) {
+	digest[i] = m->h[i/4] >> (8*(i%4));
+    }
+}
+
+/**
+ * Hash interleaved samples the way FLAC does: little-endian, in as
+ * few bytes as hold the sample size.
+ */
+static void
+md5Samples(Md5 *m, const int32_t *x, size_t n, int bits)
+{
+    uint8_t buf[4096];
+    const int size = bits < 1 ? 1 : bits > 32 ? 4 : (bits + 7) / 8;
+    size_t i, j = 0;
+    int b;
+
+    for (i=0; i < n; ++i) {
+	if (j + size > sizeof(buf)) {
+	    md5Update(m, buf, j);
+	    j = 0;
+	}
+	for (b=0; b < size; ++b) {
+	    buf[j++] = (uint32_t)x[i] >> (8*b);
+	}
+    }
+    md5Update(m, buf, j);
+}
+
+
+	/* BIT WRITER */
+
+static void
+resetBits(Bits *b)
+{
+    b->len = 0;
+    b->acc = 0;
+    b->nacc = 0;
+}
+
+static void
+putBits(Bits *b, uint32_t v, int n)
+{
+    if (b->len + 8 > b->cap) {
+	size_t cap = b->cap < 4096 ? 4096 : 2 * b->cap;
+	uint8_t *buf = realloc(b->buf, cap);
+	if (buf == NULL) {
+	    b->failed = 1;
+	    return;
+	}
+	b->buf = buf;
+	b->cap = cap;
+    }
+    b->acc = (b->acc << n) | (v & ((UINT64_C(1) << n) - 1));
+    b->nacc += n;
+    while (b->nacc >= 8) {
+	b->nacc -= 8;
+	b->buf[b->len++] = b->acc >> b->nacc;
+    }
+    b->acc &= (1u << b->nacc) - 1;
+}
+
+static void
+alignBits(Bits *b)
+{
+    if (b->nacc > 0) {
+	putBits(b, 0, 8 - b->nacc);
+    }
+}
+
+/**
+ * Append the contents of one bit writer to another
+ */
+static void
+appendBits(Bits *dst, const Bits *src)
+{
+    size_t i;
+
+    for (i=0; i + 4 <= src->len; i += 4) {
+	putBits(dst, (uint32_t)src->buf[i] << 24 | src->buf[i+1] << 16 |
+	    src->buf[i+2] << 8 | src->buf[i+3], 32);
+    }
+    for (; i < src->len; ++i) {
+	putBits(dst, src->buf[i], 8);
+    }
+    putBits(dst, src->acc, src->nacc);
+}
+
+static uint64_t
+bitLength(const Bits *b)
+{
+    return (uint64_t)b->len * 8 + b->nacc;
+}
+
+/**
+ * Frame and sample numbers are coded like UTF-8, extended to 36 bits
+ */
+static void
+putUtf8(Bits *b, uint64_t v)
+{
+    int n, i;
+
+    if (v < 0x80) {
+	putBits(b, v, 8);
+	return;
+    }
+    n = v < 0x800 ? 2 : v < 0x10000 ? 3 : v < 0x200000 ? 4 :
+	v < 0x4000000 ? 5 : v < 0x80000000 ? 6 : 7;
+    putBits(b, ((0xFF00 >> n) & 0xFF) | (v >> (6*(n-1))), 8);
+    for (i=n-2; i >= 0; --i) {
+	putBits(b, 0x80 | ((v >> (6*i)) & 0x3F), 8);
+    }
+}
+
+
+	/* ENCODER ANALYSIS */
+
+static inline uint32_t
+zigzag(int32_t r)
+{
+    return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+/**
+ * Rice parameter and size for a partition with this sum of zigzag
+ * values. sum >> k stands in for the sum of the quotients.
+ */
+static uint64_t
+riceBits(uint64_t sum, uint32_t count, int *kp)
+{
+    uint64_t bits, alt;
+    int k;
+
+    if (count == 0) {
+	*kp = 0;
+	return 0;
+    }
+    for (k=0; k < 30 && ((uint64_t)count << (k+1)) < sum; ++k)
+      ;
+    bits = (uint64_t)count * (k+1) + (sum >> k);
+    if (k > 0) {
+	alt = (uint64_t)count * k + (sum >> (k-1));
+	if (alt < bits) {
+	    --k;
+	    bits = alt;
+	}
+    }
+    *kp = k;
+    return bits;
+}
+
+/**
+ * Pick the partition order and Rice parameters for a residual.
+ * The sums for the finest partitions are added in pairs to get
+ * each coarser order.
+ * @param res    residual, valid from res[order]
+ * @return size of the coded residual in bits
+ */
+static uint64_t
+riceCost(const int32_t *res, uint32_t n, int order, Rice *rice)
+{
+    uint64_t sums[1 << MAX_PARTITION_ORDER];
+    uint8_t ks[1 << MAX_PARTITION_ORDER];
+    uint64_t best = UINT64_MAX, bits;
+    uint32_t np, psize, p, i, count;
+    int po, maxpo = 0, k, maxk;
+
+    while (maxpo < MAX_PARTITION_ORDER && n % (2u << maxpo) == 0 &&
+	   (n >> (maxpo+1)) > (uint32_t)order)
+    {
+	++maxpo;
+    }
+    np = 1u << maxpo;
+    psize = n >> maxpo;
+    for (p=0; p < np; ++p) {
+	sums[p] = 0;
+	for (i = p == 0 ? order : p * psize; i < (p+1) * psize; ++i) {
+	    sums[p] += zigzag(res[i]);
+	}
+    }
+
+    for (po=maxpo; po >= 0; --po) {
+	np = 1u << po;
+	psize = n >> po;
+	bits = 6;
+	maxk = 0;
+	for (p=0; p < np; ++p) {
+	    count = psize - (p == 0 ? order : 0);
+	    bits += riceBits(sums[p], count, &k);
+	    ks[p] = k;
+	    if (k > maxk) maxk = k;
+	}
+	bits += np * (maxk > 14 ? 5 : 4);
+	if (bits < best) {
+	    best = bits;
+	    rice->order = po;
+	    rice->method = maxk > 14;
+	    memcpy(rice->k, ks, np);
+	}
+	for (p=0; p < np/2; ++p) {
+	    sums[p] = sums[2*p] + sums[2*p+1];
+	}
+    }
+    return best;
+}
+
+static void
+writeResidual(Bits *b, const int32_t *res, uint32_t n, int order,
+	const Rice *rice)
+{
+    const uint32_t np = 1u << rice->order, psize = n >> rice->order;
+    uint32_t p, i, u, q, end;
+    int k;
+
+    putBits(b, rice->method, 2);
+    putBits(b, rice->order, 4);
+    for (p=0, i=order; p < np; ++p) {
+	k = rice->k[p];
+	putBits(b, k, rice->method ? 5 : 4);
+	for (end = (p+1) * psize; i < end; ++i) {
+	    u = zigzag(res[i]);
+	    q = u >> k;
+	    if (q + 1 + k <= 32) {
+		putBits(b, (1u << k) | (u & ((1u << k) - 1)), q + 1 + k);
+	    } else {
+		for (; q >= 32; q -= 32) {
+		    putBits(b, 0, 32);
+		}
+		putBits(b, 1, q + 1);
+		putBits(b, u, k);
+	    }
+	}
+    }
+}
+
+/**
+ * @return the fixed predictor order with the smallest sum of
+ * absolute residuals
+ */
+static int
+bestFixedOrder(const int32_t *x, uint32_t n)
+{
+    uint64_t e[MAX_FIXED_ORDER+1] = {0};
+    int64_t r1, r2, r3, r4;
+    uint32_t i;
+    int o, best = 0;
+
+    if (n <= MAX_FIXED_ORDER) {
+	return 0;
+    }
+    for (i=MAX_FIXED_ORDER; i < n; ++i) {
+	r1 = (int64_t)x[i] - x[i-1];
+	r2 = r1 - ((int64_t)x[i-1] - x[i-2]);
+	r3 = r2 - ((int64_t)x[i-1] - 2*(int64_t)x[i-2] + x[i-3]);
+	r4 = r3 - ((int64_t)x[i-1] - 3*(int64_t)x[i-2] + 3*(int64_t)x[i-3] - x[i-4]);
+	e[0] += llabs(x[i]);
+	e[1] += llabs(r1);
+	e[2] += llabs(r2);
+	e[3] += llabs(r3);
+	e[4] += llabs(r4);
+    }
+    for (o=1; o <= MAX_FIXED_ORDER; ++o) {
+	if (e[o] < e[best]) best = o;
+    }
+    return best;
+}
+
+static void
+fixedResidual(const int32_t *x, uint32_t n, int order, int32_t *res)
+{
+    uint32_t i;
+
+    for (i=order; i < n; ++i) {
+	switch (order) {
+	  case 0: res[i] = x[i]; break;
+	  case 1: res[i] = x[i] - x[i-1]; break;
+	  case 2: res[i] = x[i] - 2*x[i-1] + x[i-2]; break;
+	  case 3: res[i] = x[i] - 3*x[i-1] + 3*x[i-2] - x[i-3]; break;
+	  case 4: res[i] = x[i] - 4*x[i-1] + 6*x[i-2] - 4*x[i-3] + x[i-4]; break;
+	}
+    }
+}
+
+/**
+ * Find and quantize LPC coefficients.
+ * @return the order, or 0 if no usable predictor was found
+ */
+static int
+lpcAnalyze(Worker *w, const int32_t *x, uint32_t n, int bps,
+	int32_t *q, int *precisionp, int *shiftp)
+{
+    double autoc[MAX_LPC_ORDER+1], lpc[MAX_LPC_ORDER], err[MAX_LPC_ORDER];
+    double lp[MAX_LPC_ORDER][MAX_LPC_ORDER];
+    double r, tmp, sum, cmax, bits, best, scale, error;
+    uint32_t i, np;
+    int j, o, maxorder = MAX_LPC_ORDER, order, precision, shift, log2cmax;
+    long qi, qmax;
+
+    if (w->window_n != n) {
+	/* Tukey window, p = 0.5 */
+	np = n / 4 - 1;
+	for (i=0; i < n; ++i) {
+	    if (i <= np) {
+		w->window[i] = 0.5 - 0.5 * cos(M_PI * i / np);
+	    } else if (i >= n - np - 1) {
+		w->window[i] = 0.5 - 0.5 * cos(M_PI * (n - i - 1) / np);
+	    } else {
+		w->window[i] = 1;
+	    }
+	}
+	w->window_n = n;
+    }
+    for (i=0; i < n; ++i) {
+	w->data[i] = x[i] * w->window[i];
+    }
+    for (o=0; o <= maxorder; ++o) {
+	for (sum=0, i=o; i < n; ++i) {
+	    sum += w->data[i] * w->data[i-o];
+	}
+	autoc[o] = sum;
+    }
+    if (autoc[0] == 0) {
+	return 0;
+    }
+
+    /* Levinson-Durbin recursion, keeping every order */
+    error = autoc[0];
+    for (o=0; o < maxorder; ++o) {
+	r = -autoc[o+1];
+	for (j=0; j < o; ++j) {
+	    r -= lpc[j] * autoc[o-j];
+	}
+	r /= error;
+	lpc[o] = r;
+	for (j=0; j < o/2; ++j) {
+	    tmp = lpc[j];
+	    lpc[j] += r * lpc[o-1-j];
+	    lpc[o-1-j] += r * tmp;
+	}
+	if (o & 1) {
+	    lpc[j] += lpc[j] * r;
+	}
+	error *= 1 - r * r;
+	for (j=0; j <= o; ++j) {
+	    lp[o][j] = -lpc[j];
+	}
+	err[o] = error;
+	if (error <= 0) {
+	    maxorder = o + 1;
+	    break;
+	}
+    }
+
+    precision = n >= 2304 ? 12 : n >= 1152 ? 11 : n >= 576 ? 10 : 9;
+    if (bps > 16) {
+	precision += 2;
+    }
+
+    /* Order with the smallest estimated size */
+    scale = 0.5 / n;
+    best = HUGE_VAL;
+    order = 1;
+    for (o=1; o <= maxorder; ++o) {
+	bits = err[o-1] > 0 ? 0.5 * log2(scale * err[o-1]) : 0;
+	if (bits < 0) bits = 0;
+	bits = bits * (n - o) + o * (bps + precision);
+	if (bits < best) {
+	    best = bits;
+	    order = o;
+	}
+    }
+
+    /* Quantize, carrying the rounding error along */
+    for (cmax=0, j=0; j < order; ++j) {
+	if (fabs(lp[order-1][j]) > cmax) cmax = fabs(lp[order-1][j]);
+    }
+    if (cmax <= 0) {
+	return 0;
+    }
+    frexp(cmax, &log2cmax);
+    shift = precision - 1 - log2cmax;
+    if (shift > 15) {
+	shift = 15;
+    } else if (shift < 0) {
+	return 0;
+    }
+    qmax = (1L << (precision - 1)) - 1;
+    for (error=0, j=0; j < order; ++j) {
+	error += lp[order-1][j] * (1 << shift);
+	qi = lround(error);
+	if (qi > qmax) qi = qmax;
+	else if (qi < -qmax-1) qi = -qmax-1;
+	error -= qi;
+	q[j] = qi;
+    }
+    *precisionp = precision;
+    *shiftp = shift;
+    return order;
+}
+
+/**
+ * @return 0 on success, -1 if a residual does not fit in 32 bits
+ */
+static int
+lpcResidual(const int32_t *x, uint32_t n, int order, const int32_t *q,
+	int shift, int32_t *res)
+{
+    uint32_t i;
+    int64_t sum, r;
+    int j;
+
+    for (i=order; i < n; ++i) {
+	for (sum=0, j=0; j < order; ++j) {
+	    sum += (int64_t)q[j] * x[i-1-j];
+	}
+	r = x[i] - (sum >> shift);
+	if (r > INT32_MAX || r < -INT32_MAX) {
+	    return -1;
+	}
+	res[i] = r;
+    }
+    return 0;
+}
+
+/**
+ * Code one channel of a block, picking the smallest representation.
+ */
+static void
+encodeSubframe(Worker *w, const int32_t *x, uint32_t n, int bps, Bits *out)
+{
+    Rice rice[2];
+    int32_t q[MAX_LPC_ORDER], *tmp;
+    uint64_t cost, lcost;
+    uint32_t i, all = 0;
+    int wasted = 0, order, lorder, precision = 0, shift = 0, type, j;
+
+    resetBits(out);
+
+    for (i=1; i < n && x[i] == x[0]; ++i)
+      ;
+    if (i == n) {
+	putBits(out, SUB_CONSTANT << 1, 8);
+	putBits(out, x[0], bps);
+	return;
+    }
+
+    /* Low bits that are zero in every sample are dropped */
+    for (i=0; i < n; ++i) {
+	all |= x[i];
+    }
+    while ((all & (1u << wasted)) == 0) {
+	++wasted;
+    }
+    if (wasted > 0) {
+	for (i=0; i < n; ++i) {
+	    w->shifted[i] = x[i] >> wasted;
+	}
+	x = w->shifted;
+	bps -= wasted;
+    }
+
+    order = bestFixedOrder(x, n);
+    fixedResidual(x, n, order, w->res[0]);
+    cost = riceCost(w->res[0], n, order, &rice[0]) + order * bps;
+    type = SUB_FIXED + order;
+
+    if (n > 2 * MAX_LPC_ORDER &&
+	(lorder = lpcAnalyze(w, x, n, bps, q, &precision, &shift)) > 0 &&
+	lpcResidual(x, n, lorder, q, shift, w->res[1]) == 0)
+    {
+	lcost = riceCost(w->res[1], n, lorder, &rice[1]) +
+	    lorder * (bps + precision) + 9;
+	if (lcost < cost) {
+	    tmp = w->res[0]; w->res[0] = w->res[1]; w->res[1] = tmp;
+	    rice[0] = rice[1];
+	    cost = lcost;
+	    order = lorder;
+	    type = SUB_LPC + order - 1;
+	}
+    }
+    if (cost >= (uint64_t)n * bps) {
+	type = SUB_VERBATIM;
+    }
+
+    putBits(out, type << 1 | (wasted > 0), 8);
+    if (wasted > 0) {
+	putBits(out, 1, wasted);
+    }
+    if (type == SUB_VERBATIM) {
+	for (i=0; i < n; ++i) {
+	    putBits(out, x[i], bps);
+	}
+	return;
+    }
+    for (i=0; i < (uint32_t)order; ++i) {
+	putBits(out, x[i], bps);
+    }
+    if (type >= SUB_LPC) {
+	putBits(out, precision - 1, 4);
+	putBits(out, shift, 5);
+	for (j=0; j < order; ++j) {
+	    putBits(out, q[j], precision);
+	}
+    }
+    writeResidual(out, w->res[0], n, order, &rice[0]);
+}
+
+static int
+blockSizeCode(uint32_t n)
+{
+    int i;
+
+    if (n == 192) return 1;
+    for (i=0; i < 4; ++i) {
+	if (n == 576u << i) return 2 + i;
+    }
+    for (i=0; i < 8; ++i) {
+	if (n == 256u << i) return 8 + i;
+    }
+    return n <= 256 ? 6 : 7;
+}
+
+static int
+sampleRateCode(uint32_t rate)
+{
+    static const uint32_t rates[] = {
+      0, 88200, 176400, 192000, 8000, 16000, 22050, 24000,
+      32000, 44100, 48000, 96000,
+    };
+    int i;
+
+    for (i=1; i < (int)(sizeof(rates)/sizeof(rates[0])); ++i) {
+	if (rate == rates[i]) return i;
+    }
+    if (rate % 1000 == 0 && rate / 1000 <= 255) return 12;
+    if (rate <= 65535) return 13;
+    if (rate % 10 == 0 && rate / 10 <= 65535) return 14;
+    return 0;
+}
+
+static int
+sampleSizeCode(int bits)
+{
+    switch (bits) {
+      case 8: return 1;
+      case 12: return 2;
+      case 16: return 4;
+      case 20: return 5;
+      case 24: return 6;
+    }
+    return 0;
+}
+
+/**
+ * Code one block of interleaved samples as a complete frame.
+ */
+static void
+encodeFrame(Worker *w, const int32_t *in, uint32_t n, uint32_t frameNo,
+	Bits *out)
+{
+    FlacEncoder *enc = w->enc;
+    const int nc = enc->channels;
+    int32_t *chan = w->chan;
+    uint64_t size, best;
+    uint32_t i;
+    int c, bc, rc, assign, a, b;
+
+    for (c=0; c < nc; ++c) {
+	for (i=0; i < n; ++i) {
+	    chan[c * BLOCK_SIZE + i] = in[i * nc + c];
+	}
+	encodeSubframe(w, chan + c * BLOCK_SIZE, n, enc->bits, &w->sub[c]);
+    }
+
+    assign = nc - 1;
+    a = 0; b = 1;
+    if (nc == 2) {
+	int32_t *l = chan, *r = chan + BLOCK_SIZE;
+	int32_t *mid = chan + 2 * BLOCK_SIZE, *side = chan + 3 * BLOCK_SIZE;
+	uint64_t sz[4];
+	for (i=0; i < n; ++i) {
+	    side[i] = l[i] - r[i];
+	    mid[i] = (l[i] + r[i]) >> 1;
+	}
+	encodeSubframe(w, mid, n, enc->bits, &w->sub[2]);
+	encodeSubframe(w, side, n, enc->bits + 1, &w->sub[3]);
+	for (c=0; c < 4; ++c) {
+	    sz[c] = bitLength(&w->sub[c]);
+	}
+	best = sz[0] + sz[1];
+	if ((size = sz[0] + sz[3]) < best) {
+	    best = size; assign = CH_LEFT_SIDE; a = 0; b = 3;
+	}
+	if ((size = sz[3] + sz[1]) < best) {
+	    best = size; assign = CH_RIGHT_SIDE; a = 3; b = 1;
+	}
+	if ((size = sz[2] + sz[3]) < best) {
+	    best = size; assign = CH_MID_SIDE; a = 2; b = 3;
+	}
+    }
+
+    resetBits(out);
+    putBits(out, 0xFFF8, 16);	/* Sync code, fixed block size */
+    bc = blockSizeCode(n);
+    rc = sampleRateCode(enc->sample_rate);
+    putBits(out, bc, 4);
+    putBits(out, rc, 4);
+    putBits(out, assign, 4);
+    putBits(out, sampleSizeCode(enc->bits), 3);
+    putBits(out, 0, 1);
+    putUtf8(out, frameNo);
+    if (bc == 6) {
+	putBits(out, n - 1, 8);
+    } else if (bc == 7) {
+	putBits(out, n - 1, 16);
+    }
+    if (rc == 12) {
+	putBits(out, enc->sample_rate / 1000, 8);
+    } else if (rc == 13) {
+	putBits(out, enc->sample_rate, 16);
+    } else if (rc == 14) {
+	putBits(out, enc->sample_rate / 10, 16);
+    }
+    if (out->failed) {
+	return;
+    }
+    putBits(out, crc8(out->buf, out->len), 8);
+
+    if (nc == 2) {
+	appendBits(out, &w->sub[a]);
+	appendBits(out, &w->sub[b]);
+    } else {
+	for (c=0; c < nc; ++c) {
+	    appendBits(out, &w->sub[c]);
+	}
+    }
+    alignBits(out);
+    if (out->failed) {
+	return;
+    }
+    putBits(out, crc16(out->buf, out->len), 16);
+}
+
+static void *
+encodeJob(void *arg)
+{
+    Worker *w = arg;
+    FlacEncoder *enc = w->enc;
+    size_t b, f;
+    int c;
+
+    for (b=w->first; b < w->first + w->count; ++b) {
+	f = b * BLOCK_SIZE;
+	encodeFrame(w, enc->pending + f * enc->channels,
+	    w->frames - f < BLOCK_SIZE ? w->frames - f : BLOCK_SIZE,
+	    enc->frame_no + b, &enc->coded[b]);
+	if (enc->coded[b].failed) {
+	    w->rval = -1;
+	}
+    }
+    for (c=0; c < w->nsub; ++c) {
+	if (w->sub[c].failed) w->rval = -1;
+    }
+    return NULL;
+}
+
+
+	/* ENCODER */
+
+static void
+putMetaHeader(uint8_t *p, int last, int type, uint32_t len)
+{
+    p[0] = (last ? 0x80 : 0) | type;
+    p[1] = len >> 16;
+    p[2] = len >> 8;
+    p[3] = len;
+}
+
+static void
+putLE32(uint8_t *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void
+streamInfo(FlacEncoder *enc, uint8_t info[34])
+{
+    uint8_t buf[64];
+    uint8_t md5[16];
+    Bits b = {buf, sizeof(buf), 0, 0, 0, 0};
+    Md5 m = enc->md5;
+    uint64_t frames = enc->started && enc->npending == 0 ? enc->encoded :
+	enc->frames;
+    uint32_t bs = frames == 0 || frames >= BLOCK_SIZE ? BLOCK_SIZE :
+	frames < 16 ? 16 : frames;
+    int i;
+
+    if (enc->encoded > 0) {
+	md5Final(&m, md5);
+    } else {
+	memset(md5, 0, sizeof(md5));
+    }
+    putBits(&b, bs, 16);
+    putBits(&b, bs, 16);
+    putBits(&b, enc->min_frame, 24);
+    putBits(&b, enc->max_frame, 24);
+    putBits(&b, enc->sample_rate, 20);
+    putBits(&b, enc->channels - 1, 3);
+    putBits(&b, enc->bits - 1, 5);
+    putBits(&b, frames >> 32, 4);
+    putBits(&b, frames, 32);
+    for (i=0; i < 16; ++i) {
+	putBits(&b, md5[i], 8);
+    }
+    memcpy(info, buf, 34);
+}
+
+/**
+ * Write the stream marker and all of the metadata blocks
+ */
+static int
+writeMetadata(FlacEncoder *enc)
+{
+    uint8_t hdr[4], info[34], *vc, *p;
+    size_t vlen;
+    FlacApp *app;
+    int i;
+
+    enc->start = ftell(enc->file);
+    enc->min_frame = 0;
+    enc->max_frame = 0;
+
+    vlen = 4 + strlen(vendor) + 4;
+    for (i=0; i < enc->ncomments; ++i) {
+	vlen += 4 + strlen(enc->comments[i]);
+    }
+    if (vlen > MAX_META) {
+	FlacError = "Too many comments";
+	return -1;
+    }
+    if ((vc = malloc(vlen)) == NULL) {
+	FlacError = "Out of memory";
+	return -1;
+    }
+    p = vc;
+    putLE32(p, strlen(vendor));
+    memcpy(p + 4, vendor, strlen(vendor));
+    p += 4 + strlen(vendor);
+    putLE32(p, enc->ncomments);
+    p += 4;
+    for (i=0; i < enc->ncomments; ++i) {
+	putLE32(p, strlen(enc->comments[i]));
+	memcpy(p + 4, enc->comments[i], strlen(enc->comments[i]));
+	p += 4 + strlen(enc->comments[i]);
+    }
+
+    fwrite("fLaC", 1, 4, enc->file);
+    putMetaHeader(hdr, 0, META_STREAMINFO, sizeof(info));
+    streamInfo(enc, info);
+    fwrite(hdr, 1, sizeof(hdr), enc->file);
+    fwrite(info, 1, sizeof(info), enc->file);
+    putMetaHeader(hdr, enc->apps == NULL, META_VORBIS, vlen);
+    fwrite(hdr, 1, sizeof(hdr), enc->file);
+    fwrite(vc, 1, vlen, enc->file);
+    free(vc);
+    for (app=enc->apps; app != NULL; app=app->next) {
+	putMetaHeader(hdr, app->next == NULL, META_APPLICATION, 4 + app->length);
+	fwrite(hdr, 1, sizeof(hdr), enc->file);
+	fwrite(app->id, 1, 4, enc->file);
+	fwrite(app->data, 1, app->length, enc->file);
+    }
+    enc->started = 1;
+    if (ferror(enc->file)) {
+	FlacError = "Write failed";
+	return -1;
+    }
+    return 0;
+}
+
+/**
+ * Encode the pending frames on all threads and write them out
+ */
+static int
+encodeBatch(FlacEncoder *enc)
+{
+    const size_t nb = (enc->npending + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    pthread_t tids[enc->nworkers];
+    size_t per, b;
+    int t, nt, started;
+    int rval = 0;
+
+    nt = (size_t)enc->nworkers < nb ? enc->nworkers : (int)nb;
+    per = (nb + nt - 1) / nt;
+    for (t=0, b=0; t < nt; ++t, b += per) {
+	Worker *w = &enc->workers[t];
+	w->first = b;
+	w->count = b >= nb ? 0 : nb - b < per ? nb - b : per;
+	w->frames = enc->npending;
+	w->rval = 0;
+    }
+    for (started=1; started < nt; ++started) {
+	if (pthread_create(&tids[started], NULL, encodeJob,
+		&enc->workers[started]) != 0)
+	{
+	    break;
+	}
+    }
+    /* Do the share of any threads that could not be started */
+    for (t=started; t < nt; ++t) {
+	encodeJob(&enc->workers[t]);
+    }
+    encodeJob(&enc->workers[0]);
+    for (t=1; t < started; ++t) {
+	pthread_join(tids[t], NULL);
+    }
+    for (t=0; t < nt; ++t) {
+	if (enc->workers[t].rval != 0) rval = -1;
+    }
+    if (rval != 0) {
+	FlacError = "Out of memory";
+	return -1;
+    }
+
+    for (b=0; b < nb; ++b) {
+	const Bits *f = &enc->coded[b];
+	if (enc->min_frame == 0 || f->len < enc->min_frame) {
+	    enc->min_frame = f->len;
+	}
+	if (f->len > enc->max_frame) {
+	    enc->max_frame = f->len;
+	}
+	if (fwrite(f->buf, 1, f->len, enc->file) != f->len) {
+	    FlacError = "Write failed";
+	    return -1;
+	}
+    }
+    enc->frame_no += nb;
+    enc->npending = 0;
+    return 0;
+}
+
+FlacEncoder *
+NewFlacEncoder(FILE *out, int channels, uint32_t sample_rate, int bits,
+	uint64_t frames, int threads)
+{
+    FlacEncoder *enc;
+    int t, nsub;
+
+    if (channels < 1 || channels > 8) {
+	FlacError = "FLAC supports 1 to 8 channels";
+	return NULL;
+    }
+    if (bits < 4 || bits > 24) {
+	FlacError = "Only 4 to 24 bit samples are supported";
+	return NULL;
+    }
+    if (sample_rate == 0 || sample_rate > 655350) {
+	FlacError = "Unsupported sample rate";
+	return NULL;
+    }
+    pthread_once(&crcOnce, initCrc);
+
+    if ((enc = calloc(1, sizeof(*enc))) == NULL) {
+	goto fail;
+    }
+    enc->file = out;
+    enc->channels = channels;
+    enc->bits = bits;
+    enc->sample_rate = sample_rate;
+    enc->frames = frames;
+    enc->app_tail = &enc->apps;
+    enc->nworkers = threads < 1 ? 1 : threads;
+    enc->nblocks = enc->nworkers * BATCH_BLOCKS;
+    md5Init(&enc->md5);
+
+    enc->pending = malloc(enc->nblocks * BLOCK_SIZE * channels * sizeof(int32_t));
+    enc->coded = calloc(enc->nblocks, sizeof(Bits));
+    enc->workers = calloc(enc->nworkers, sizeof(Worker));
+    if (enc->pending == NULL || enc->coded == NULL || enc->workers == NULL) {
+	goto fail;
+    }
+    nsub = channels < 4 ? 4 : channels;
+    for (t=0; t < enc->nworkers; ++t) {
+	Worker *w = &enc->workers[t];
+	w->enc = enc;
+	w->chan = malloc((size_t)(channels + 2) * BLOCK_SIZE * sizeof(int32_t));
+	w->shifted = malloc(BLOCK_SIZE * sizeof(int32_t));
+	w->res[0] = malloc(BLOCK_SIZE * sizeof(int32_t));
+	w->res[1] = malloc(BLOCK_SIZE * sizeof(int32_t));
+	w->data = malloc(BLOCK_SIZE * sizeof(double));
+	w->window = malloc(BLOCK_SIZE * sizeof(double));
+	w->sub = calloc(nsub, sizeof(Bits));
+	w->nsub = nsub;
+	if (w->chan == NULL || w->shifted == NULL || w->res[0] == NULL ||
+	    w->res[1] == NULL || w->data == NULL || w->window == NULL ||
+	    w->sub == NULL)
+	{
+	    goto fail;
+	}
+    }
+    return enc;
+
+fail:
+    FlacError = "Out of memory";
+    FreeFlacEncoder(enc);
+    return NULL;
+}
+
+int
+FlacAddComment(FlacEncoder *enc, const char *name, const char *value)
+{
+    char **comments, *c;
+
+    if (enc->started) {
+	FlacError = "Metadata already written";
+	return -1;
+    }
+    comments = realloc(enc->comments, (enc->ncomments + 1) * sizeof(char *));
+    if (comments == NULL) {
+	FlacError = "Out of memory";
+	return -1;
+    }
+    enc->comments = comments;
+    if ((c = malloc(strlen(name) + strlen(value) + 2)) == NULL) {
+	FlacError = "Out of memory";
+	return -1;
+    }
+    sprintf(c, "%s=%s", name, value);
+    enc->comments[enc->ncomments++] = c;
+    return 0;
+}
+
+int
+FlacAddApplication(FlacEncoder *enc, const char *id, const void *data,
+	uint32_t len)
+{
+    FlacApp *app;
+
+    if (enc->started) {
+	FlacError = "Metadata already written";
+	return -1;
+    }
+    if (len > MAX_META - 4) {
+	FlacError = "Application data too large for a metadata block";
+	return -1;
+    }
+    if ((app = malloc(sizeof(*app) + len)) == NULL) {
+	FlacError = "Out of memory";
+	return -1;
+    }
+    app->next = NULL;
+    memcpy(app->id, id, 4);
+    app->length = len;
+    memcpy(app->data, data, len);
+    *enc->app_tail = app;
+    enc->app_tail = &app->next;
+    return 0;
+}
+
+int
+FlacEncode(FlacEncoder *enc, const int32_t *samples, size_t frames)
+{
+    const size_t batch = enc->nblocks * BLOCK_SIZE;
+    const int nc = enc->channels;
+    size_t n;
+
+    if (!enc->started && writeMetadata(enc) != 0) {
+	return -1;
+    }
+    md5Samples(&enc->md5, samples, frames * nc, enc->bits);
+    enc->encoded += frames;
+    while (frames > 0) {
+	n = batch - enc->npending < frames ? batch - enc->npending : frames;
+	memcpy(enc->pending + enc->npending * nc, samples,
+	    n * nc * sizeof(int32_t));
+	enc->npending += n;
+	samples += n * nc;
+	frames -= n;
+	if (enc->npending == batch && encodeBatch(enc) != 0) {
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+int
+FlacFinish(FlacEncoder *enc)
+{
+    uint8_t info[34];
+    long end;
+
+    if (!enc->started && writeMetadata(enc) != 0) {
+	return -1;
+    }
+    if (enc->npending > 0 && encodeBatch(enc) != 0) {
+	return -1;
+    }
+    /* Go back and fill in the frame sizes, length and MD5 sum */
+    if (enc->start >= 0 && (end = ftell(enc->file)) >= 0 &&
+	fseek(enc->file, enc->start + 8, SEEK_SET) == 0)
+    {
+	streamInfo(enc, info);
+	fwrite(info, 1, sizeof(info), enc->file);
+	fseek(enc->file, end, SEEK_SET);
+    }
+    if (fflush(enc->file) != 0 || ferror(enc->file)) {
+	FlacError = "Write failed";
+	return -1;
+    }
+    return 0;
+}
+
+void
+FreeFlacEncoder(FlacEncoder *enc)
+{
+    FlacApp *app, *next;
+    size_t b;
+    int i, c;
+
+    if (enc == NULL) {
+	return;
+    }
+    for (i=0; i < enc->ncomments; ++i) {
+	free(enc->comments[i]);
+    }
+    free(enc->comments);
+    for (app=enc->apps; app != NULL; app=next) {
+	next = app->next;
+	free(app);
+    }
+    if (enc->coded != NULL) {
+	for (b=0; b < enc->nblocks; ++b) {
+	    free(enc->coded[b].buf);
+	}
+    }
+    if (enc->workers != NULL) {
+	for (i=0; i < enc->nworkers; ++i) {
+	    Worker *w = &enc->workers[i];
+	    free(w->chan);
+	    free(w->shifted);
+	    free(w->res[0]);
+	    free(w->res[1]);
+	    free(w->data);
+	    free(w->window);
+	    if (w->sub != NULL) {
+		for (c=0; c < w->nsub; ++c) {
+		    free(w->sub[c].buf);
+		}
+	    }
+	    free(w->sub);
+	}
+    }
+    free(enc->workers);
+    free(enc->coded);
+    free(enc->pending);
+    free(enc);
+}
+
+
+	/* DECODER */
+
+/**
+ * Keep the buffer at least half full
+ */
+static void
+refill(FlacDecoder *d)
+{
+    size_t n;
+
+    if (d->eof || d->len - d->pos >= d->bufsize / 2) {
+	return;
+    }
+    memmove(d->buffer, d->buffer + d->pos, d->len - d->pos);
+    d->len -= d->pos;
+    d->pos = 0;
+    n = fread(d->buffer + d->len, 1, d->bufsize - d->len, d->file);
+    d->len += n;
+    if (d->len < d->bufsize) {
+	d->eof = true;
+    }
+}
+
+static uint32_t
+getBits(FlacDecoder *d, int n)
+{
+    uint64_t v;
+    uint32_t r;
+    int i;
+
+    if (n == 0) {
+	return 0;
+    }
+    if (d->pos + 8 <= d->len) {
+	const uint8_t *p = d->buffer + d->pos;
+	for (v=0, i=0; i < 8; ++i) {
+	    v = v << 8 | p[i];
+	}
+	r = (v << d->bit) >> (64 - n);
+	d->bit += n;
+	d->pos += d->bit >> 3;
+	d->bit &= 7;
+	return r;
+    }
+    /* Near the end of the buffer: a bit at a time */
+    for (r=0, i=0; i < n; ++i) {
+	if (d->pos >= d->len) {
+	    d->overrun = true;
+	    return 0;
+	}
+	r = r << 1 | ((d->buffer[d->pos] >> (7 - d->bit)) & 1);
+	if (++d->bit == 8) {
+	    d->bit = 0;
+	    ++d->pos;
+	}
+    }
+    return r;
+}
+
+static int32_t
+getSigned(FlacDecoder *d, int n)
+{
+    uint32_t v = getBits(d, n);
+
+    if (n == 0 || n == 32) {
+	return (int32_t)v;
+    }
+    return (int32_t)(v << (32 - n)) >> (32 - n);
+}
+
+/**
+ * @return # of 0 bits before the next 1 bit, which is consumed
+ */
+static uint32_t
+getUnary(FlacDecoder *d)
+{
+    uint32_t q = 0;
+    unsigned byte;
+    int b;
+
+    while (d->pos < d->len) {
+	byte = d->buffer[d->pos] & (0xFF >> d->bit);
+	if (byte == 0) {
+	    q += 8 - d->bit;
+	    d->bit = 0;
+	    ++d->pos;
+	    continue;
+	}
+	for (b=7; (byte & (1u << b)) == 0; --b)
+	  ;
+	q += 7 - b - d->bit;
+	d->bit = 8 - b;
+	if (d->bit == 8) {
+	    d->bit = 0;
+	    ++d->pos;
+	}
+	return q;
+    }
+    d->overrun = true;
+    return 0;
+}
+
+static int
+decodeResidual(FlacDecoder *d, int32_t *x, uint32_t n, int order)
+{
+    uint32_t np, psize, p, i, count, u;
+    int method, po, k, nb, esc, pbits;
+
+    method = getBits(d, 2);
+    if (method > 1) {
+	FlacError = "Reserved residual coding method";
+	return -1;
+    }
+    pbits = method ? 5 : 4;
+    esc = method ? 31 : 15;
+    po = getBits(d, 4);
+    np = 1u << po;
+    psize = n >> po;
+    if (psize * np != n || psize < (uint32_t)order) {
+	FlacError = "Bad partition order";
+	return -1;
+    }
+    for (p=0, i=order; p < np && !d->overrun; ++p) {
+	count = psize - (p == 0 ? order : 0);
+	k = getBits(d, pbits);
+	if (k == esc) {
+	    nb = getBits(d, 5);
+	    for (; count > 0; --count, ++i) {
+		x[i] = getSigned(d, nb);
+	    }
+	    continue;
+	}
+	for (; count > 0; --count, ++i) {
+	    u = getUnary(d) << k;
+	    u |= getBits(d, k);
+	    x[i] = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+	}
+    }
+    return 0;
+}
+
+static int
+decodeSubframe(FlacDecoder *d, int32_t *x, uint32_t n, int bps)
+{
+    int32_t q[32];
+    int64_t sum;
+    uint32_t i;
+    int type, wasted = 0, order, precision, shift, j;
+
+    if (getBits(d, 1) != 0) {
+	FlacError = "Bad subframe header";
+	return -1;
+    }
+    type = getBits(d, 6);
+    if (getBits(d, 1)) {
+	for (wasted=1; getBits(d, 1) == 0 && !d->overrun; ++wasted)
+	  ;
+	if (wasted >= bps) {
+	    FlacError = "Bad wasted bits count";
+	    return -1;
+	}
+	bps -= wasted;
+    }
+
+    if (type == SUB_CONSTANT) {
+	int32_t v = getSigned(d, bps);
+	for (i=0; i < n; ++i) {
+	    x[i] = v;
+	}
+    } else if (type == SUB_VERBATIM) {
+	for (i=0; i < n; ++i) {
+	    x[i] = getSigned(d, bps);
+	}
+    } else if (type >= SUB_FIXED && type <= SUB_FIXED + MAX_FIXED_ORDER) {
+	order = type - SUB_FIXED;
+	if ((uint32_t)order > n) {
+	    FlacError = "Predictor order larger than block";
+	    return -1;
+	}
+	for (i=0; i < (uint32_t)order; ++i) {
+	    x[i] = getSigned(d, bps);
+	}
+	if (decodeResidual(d, x, n, order) != 0) {
+	    return -1;
+	}
+	for (i=order; i < n; ++i) {
+	    switch (order) {
+	      case 1: x[i] += x[i-1]; break;
+	      case 2: x[i] += 2*x[i-1] - x[i-2]; break;
+	      case 3: x[i] += 3*x[i-1] - 3*x[i-2] + x[i-3]; break;
+	      case 4: x[i] += 4*x[i-1] - 6*x[i-2] + 4*x[i-3] - x[i-4]; break;
+	    }
+	}
+    } else if (type >= SUB_LPC) {
+	order = type - SUB_LPC + 1;
+	if ((uint32_t)order > n) {
+	    FlacError = "Predictor order larger than block";
+	    return -1;
+	}
+	for (i=0; i < (uint32_t)order; ++i) {
+	    x[i] = getSigned(d, bps);
+	}
+	precision = getBits(d, 4) + 1;
+	shift = getSigned(d, 5);
+	if (precision == 16 || shift < 0) {
+	    FlacError = "Bad LPC parameters";
+	    return -1;
+	}
+	for (j=0; j < order; ++j) {
+	    q[j] = getSigned(d, precision);
+	}
+	if (decodeResidual(d, x, n, order) != 0) {
+	    return -1;
+	}
+	for (i=order; i < n; ++i) {
+	    for (sum=0, j=0; j < order; ++j) {
+		sum += (int64_t)q[j] * x[i-1-j];
+	    }
+	    x[i] += (int32_t)(sum >> shift);
+	}
+    } else {
+	FlacError = "Reserved subframe type";
+	return -1;
+    }
+
+    if (wasted > 0) {
+	for (i=0; i < n; ++i) {
+	    x[i] = (int32_t)((uint32_t)x[i] << wasted);
+	}
+    }
+    return 0;
+}
+
+/**
+ * Decode the next frame into d->block
+ * @return 1 on success, 0 at end of stream, -1 on error
+ */
+static int
+decodeFrame(FlacDecoder *d)
+{
+    static const int sizes[8] = {0, 8, 12, 0, 16, 20, 24, 0};
+    const size_t stride = d->max_block;
+    size_t start;
+    uint32_t sync, n, v, crc;
+    int bs, rc, assign, ss, bps, nc, c, extra;
+
+    refill(d);
+    if (d->pos >= d->len) {
+	return 0;
+    }
+    start = d->pos;
+    d->overrun = false;
+
+    sync = getBits(d, 16);
+    if ((sync & 0xFFFE) != 0xFFF8) {
+	FlacError = "Lost sync";
+	return -1;
+    }
+    bs = getBits(d, 4);
+    rc = getBits(d, 4);
+    assign = getBits(d, 4);
+    ss = getBits(d, 3);
+    getBits(d, 1);
+
+    /* Frame or sample number; only its length matters */
+    v = getBits(d, 8);
+    for (extra=0; v & (0x80 >> extra); ++extra)
+      ;
+    for (extra = extra > 0 ? extra - 1 : 0; extra > 0; --extra) {
+	if ((getBits(d, 8) & 0xC0) != 0x80) {
+	    FlacError = "Bad frame number";
+	    return -1;
+	}
+    }
+
+    if (bs == 0) {
+	FlacError = "Reserved block size";
+	return -1;
+    } else if (bs == 1) {
+	n = 192;
+    } else if (bs <= 5) {
+	n = 576u << (bs - 2);
+    } else if (bs == 6) {
+	n = getBits(d, 8) + 1;
+    } else if (bs == 7) {
+	n = getBits(d, 16) + 1;
+    } else {
+	n = 256u << (bs - 8);
+    }
+    if (rc == 12) {
+	getBits(d, 8);
+    } else if (rc == 13 || rc == 14) {
+	getBits(d, 16);
+    } else if (rc == 15) {
+	FlacError = "Bad sample rate";
+	return -1;
+    }
+    bps = ss == 0 ? d->bits : sizes[ss];
+    if (bps == 0 || bps > 24) {
+	FlacError = "Unsupported sample size";
+	return -1;
+    }
+    crc = crc8(d->buffer + start, d->pos - start);
+    if (d->overrun || crc != getBits(d, 8)) {
+	FlacError = "Frame header CRC error";
+	return -1;
+    }
+    if (n > d->max_block) {
+	FlacError = "Block larger than the stream's maximum";
+	return -1;
+    }
+
+    nc = assign < 8 ? assign + 1 : assign <= CH_MID_SIDE ? 2 : 0;
+    if (nc != d->channels) {
+	FlacError = "Bad channel assignment";
+	return -1;
+    }
+    for (c=0; c < nc; ++c) {
+	int side = (assign == CH_LEFT_SIDE && c == 1) ||
+	    (assign == CH_RIGHT_SIDE && c == 0) ||
+	    (assign == CH_MID_SIDE && c == 1);
+	if (decodeSubframe(d, d->block + c * stride, n, bps + side) != 0) {
+	    return -1;
+	}
+	if (d->overrun) {
+	    break;
+	}
+    }
+    if (d->bit > 0) {
+	d->bit = 0;
+	++d->pos;
+    }
+    if (d->overrun || d->pos + 2 > d->len) {
+	FlacError = "Truncated frame";
+	return -1;
+    }
+    crc = crc16(d->buffer + start, d->pos - start);
+    if (crc != getBits(d, 16)) {
+	FlacError = "Frame CRC error";
+	return -1;
+    }
+
+    if (assign >= CH_LEFT_SIDE) {
+	int32_t *a = d->block, *b = d->block + stride;
+	uint32_t i;
+	for (i=0; i < n; ++i) {
+	    switch (assign) {
+	      case CH_LEFT_SIDE: b[i] = a[i] - b[i]; break;
+	      case CH_RIGHT_SIDE: a[i] += b[i]; break;
+	      case CH_MID_SIDE:
+		{
+		    int32_t mid = (int32_t)((uint32_t)a[i] << 1) | (b[i] & 1);
+		    a[i] = (mid + b[i]) >> 1;
+		    b[i] = (mid - b[i]) >> 1;
+		}
+		break;
+	    }
+	}
+    }
+    d->block_frames = n;
+    d->block_used = 0;
+    return 1;
+}
+
+static uint32_t
+getLE32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int
+readComments(FlacDecoder *d, const uint8_t *p, uint32_t len)
+{
+    const uint8_t *end = p + len;
+    uint32_t l, n, i;
+
+    if (len < 8 || (l = getLE32(p)) > len - 8) {
+	goto bad;
+    }
+    p += 4 + l;
+    n = getLE32(p);
+    p += 4;
+    if (n > (uint32_t)(end - p) / 4) {
+	goto bad;
+    }
+    if ((d->comments = calloc(n > 0 ? n : 1, sizeof(char *))) == NULL) {
+	FlacError = "Out of memory";
+	return -1;
+    }
+    for (i=0; i < n; ++i) {
+	if (end - p < 4 || (l = getLE32(p)) > (uint32_t)(end - p) - 4) {
+	    goto bad;
+	}
+	if ((d->comments[i] = malloc(l + 1)) == NULL) {
+	    FlacError = "Out of memory";
+	    return -1;
+	}
+	memcpy(d->comments[i], p + 4, l);
+	d->comments[i][l] = '\0';
+	d->ncomments = i + 1;
+	p += 4 + l;
+    }
+    return 0;
+
+bad:
+    FlacError = "Bad Vorbis comment block";
+    return -1;
+}
+
+FlacDecoder *
+OpenFlacDecoder(FILE *in)
+{
+    FlacDecoder *d;
+    FlacApp *app, **tail;
+    uint8_t hdr[10], *data = NULL;
+    uint32_t len, size;
+    int last = 0, type, info = 0;
+
+    pthread_once(&crcOnce, initCrc);
+
+    if ((d = calloc(1, sizeof(*d))) == NULL) {
+	FlacError = "Out of memory";
+	return NULL;
+    }
+    d->file = in;
+    tail = &d->apps;
+
+    if (fread(hdr, 1, 4, in) != 4) {
+	goto notflac;
+    }
+    if (memcmp(hdr, "ID3", 3) == 0) {
+	/* Skip an ID3v2 tag */
+	if (fread(hdr + 4, 1, 6, in) != 6) {
+	    goto notflac;
+	}
+	size = (hdr[6] & 0x7f) << 21 | (hdr[7] & 0x7f) << 14 |
+	    (hdr[8] & 0x7f) << 7 | (hdr[9] & 0x7f);
+	if (fseek(in, size, SEEK_CUR) != 0 || fread(hdr, 1, 4, in) != 4) {
+	    goto notflac;
+	}
+    }
+    if (memcmp(hdr, "fLaC", 4) != 0) {
+	goto notflac;
+    }
+
+    while (!last) {
+	if (fread(hdr, 1, 4, in) != 4) {
+	    FlacError = "Short file";
+	    goto fail;
+	}
+	last = hdr[0] & 0x80;
+	type = hdr[0] & 0x7f;
+	len = hdr[1] << 16 | hdr[2] << 8 | hdr[3];
+	if (type != META_STREAMINFO && type != META_APPLICATION &&
+	    type != META_VORBIS)
+	{
+	    if (fseek(in, len, SEEK_CUR) != 0) {
+		FlacError = "Short file";
+		goto fail;
+	    }
+	    continue;
+	}
+	if ((data = malloc(len > 0 ? len : 1)) == NULL) {
+	    FlacError = "Out of memory";
+	    goto fail;
+	}
+	if (fread(data, 1, len, in) != len) {
+	    FlacError = "Short file";
+	    goto fail;
+	}
+	if (type == META_STREAMINFO) {
+	    if (len < 34) {
+		FlacError = "Bad STREAMINFO block";
+		goto fail;
+	    }
+	    d->max_block = data[2] << 8 | data[3];
+	    d->sample_rate = data[10] << 12 | data[11] << 4 | data[12] >> 4;
+	    d->channels = ((data[12] >> 1) & 7) + 1;
+	    d->bits = ((data[12] & 1) << 4 | data[13] >> 4) + 1;
+	    d->frames = (uint64_t)(data[13] & 0x0f) << 32 |
+		(uint32_t)data[14] << 24 | data[15] << 16 | data[16] << 8 | data[17];
+	    memcpy(d->md5, data + 18, 16);
+	    info = 1;
+	} else if (type == META_APPLICATION) {
+	    if (len < 4 || (app = malloc(sizeof(*app) + len - 4)) == NULL) {
+		FlacError = len < 4 ? "Bad APPLICATION block" : "Out of memory";
+		goto fail;
+	    }
+	    app->next = NULL;
+	    memcpy(app->id, data, 4);
+	    app->length = len - 4;
+	    memcpy(app->data, data + 4, len - 4);
+	    *tail = app;
+	    tail = &app->next;
+	} else if (d->comments == NULL) {
+	    if (readComments(d, data, len) != 0) {
+		goto fail;
+	    }
+	}
+	free(data);
+	data = NULL;
+    }
+
+    if (!info) {
+	FlacError = "No STREAMINFO block";
+	goto fail;
+    }
+    if (d->bits > 24) {
+	FlacError = "Only 4 to 24 bit samples are supported";
+	goto fail;
+    }
+    if (d->max_block < 16) {
+	d->max_block = 65535;
+    }
+    /* Room for two of the largest possible frames */
+    d->bufsize = 2 * ((size_t)d->max_block * d->channels * (d->bits + 1) / 8 +
+	64 * d->channels + 32);
+    if (d->bufsize < MIN_BUFSIZE) {
+	d->bufsize = MIN_BUFSIZE;
+    }
+    d->buffer = malloc(d->bufsize);
+    d->block = malloc((size_t)d->max_block * d->channels * sizeof(int32_t));
+    d->md5ctx = malloc(sizeof(Md5));
+    if (d->buffer == NULL || d->block == NULL || d->md5ctx == NULL) {
+	FlacError = "Out of memory";
+	goto fail;
+    }
+    md5Init(d->md5ctx);
+    return d;
+
+notflac:
+    FlacError = "Not a FLAC file";
+fail:
+    free(data);
+    CloseFlacDecoder(d);
+    return NULL;
+}
+
+long
+FlacDecode(FlacDecoder *d, int32_t *samples, size_t frames)
+{
+    static const uint8_t zero[16];
+    const int nc = d->channels;
+    uint8_t digest[16];
+    size_t copied = 0, n, i;
+    int c, r;
+
+    while (copied < frames) {
+	if (d->block_used == d->block_frames) {
+	    if ((r = decodeFrame(d)) < 0) {
+		return -1;
+	    }
+	    if (r == 0) {
+		break;
+	    }
+	}
+	n = d->block_frames - d->block_used;
+	if (n > frames - copied) {
+	    n = frames - copied;
+	}
+	for (c=0; c < nc; ++c) {
+	    const int32_t *x = d->block + c * d->max_block + d->block_used;
+	    int32_t *y = samples + copied * nc + c;
+	    for (i=0; i < n; ++i) {
+		y[i * nc] = x[i];
+	    }
+	}
+	md5Samples(d->md5ctx, samples + copied * nc, n * nc, d->bits);
+	d->block_used += n;
+	d->position += n;
+	copied += n;
+    }
+
+    if (copied == 0 && !d->done) {
+	d->done = true;
+	if (d->frames != 0 && d->position != d->frames) {
+	    FlacError = "Stream length does not match STREAMINFO";
+	    return -1;
+	}
+	md5Final(d->md5ctx, digest);
+	if (memcmp(d->md5, zero, 16) != 0 && memcmp(d->md5, digest, 16) != 0) {
+	    FlacError = "MD5 mismatch";
+	    return -1;
+	}
+    }
+    return copied;
+}
+
+const char *
+FlacComment(const FlacDecoder *d, const char *name)
+{
+    size_t len = strlen(name);
+    int i;
+
+    for (i=0; i < d->ncomments; ++i) {
+	if (strncasecmp(d->comments[i], name, len) == 0 &&
+	    d->comments[i][len] == '=')
+	{
+	    return d->comments[i] + len + 1;
+	}
+    }
+    return NULL;
+}
+
+void
+CloseFlacDecoder(FlacDecoder *d)
+{
+    FlacApp *app, *next;
+    int i;
+
+    if (d == NULL) {
+	return;
+    }
+    for (i=0; i < d->ncomments; ++i) {
+	free(d->comments[i]);
+    }
+    free(d->comments);
+    for (app=d->apps; app != NULL; app=next) {
+	next = app->next;
+	free(app);
+    }
+    free(d->buffer);
+    free(d->block);
+    free(d->md5ctx);
+    free(d);
+}
@@ -0,0 +1,138 @@
+#ifndef	LIBFLAC_H
+#define	LIBFLAC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * FLAC encoding and decoding of integer samples of 4 to 24 bits.
+ *
+ * Samples are passed as interleaved int32_t, signed, right-justified.
+ *
+ * The encoder writes fixed-size blocks with fixed or LPC predictors,
+ * partitioned Rice residuals and stereo decorrelation. Blocks do not
+ * depend on each other, so batches of them are encoded on several
+ * threads and then written in order. The decoder reads any stream
+ * within the sample size limits.
+ *
+ * The only metadata handled are Vorbis comments and APPLICATION
+ * blocks; anything else is skipped when reading.
+ */
+
+/**
+ * APPLICATION metadata block
+ */
+typedef struct flac_app {
+  struct flac_app *next;
+  char id[4];		/* Registered application id, e.g. "riff" */
+  uint32_t length;	/* Length of data */
+  uint8_t data[];
+} FlacApp;
+
+typedef struct flac_encoder FlacEncoder;
+
+typedef struct flac_decoder {
+  uint32_t sample_rate;
+  int channels;
+  int bits;		/* Bits per sample */
+  uint64_t frames;	/* Total # of sample frames, 0 if unknown */
+  uint32_t max_block;	/* Largest block, in frames */
+  uint8_t md5[16];	/* MD5 of the samples, all zero if unknown */
+  int ncomments;
+  char **comments;	/* Vorbis comments, "NAME=value" in UTF-8 */
+  FlacApp *apps;	/* APPLICATION blocks, in file order */
+  /* Private */
+  FILE *file;
+  uint8_t *buffer;	/* Bytes read from file */
+  size_t bufsize;
+  size_t len;		/* # of valid bytes in buffer */
+  size_t pos;		/* Next byte */
+  int bit;		/* Next bit in buffer[pos], from the top */
+  bool eof;		/* Nothing more to read from file */
+  bool overrun;		/* Ran past the end of buffer */
+  bool done;		/* End of stream has been checked */
+  int32_t *block;	/* Decoded block, channel after channel */
+  uint32_t block_frames;	/* # of frames in block */
+  uint32_t block_used;	/* # of them already returned */
+  uint64_t position;	/* # of frames returned */
+  void *md5ctx;
+} FlacDecoder;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern const char *FlacError;	/* Error text from last failure */
+
+/**
+ * Start a FLAC stream. Nothing is written until the first samples
+ * arrive, so comments and application blocks can be added first.
+ * If the file is seekable, the frame sizes and MD5 sum are filled
+ * in by FlacFinish().
+ * @param frames   total # of sample frames, or 0 if unknown
+ * @param threads  max # of threads to encode on
+ * @return new encoder, or NULL on error
+ */
+extern	FlacEncoder *NewFlacEncoder(FILE *out, int channels, uint32_t sample_rate,
+			int bits, uint64_t frames, int threads);
+
+/**
+ * Add a Vorbis comment. value must be UTF-8.
+ * @return 0 on success, -1 on error
+ */
+extern	int	FlacAddComment(FlacEncoder *, const char *name, const char *value);
+
+/**
+ * Add an APPLICATION block. The data is copied.
+ * @return 0 on success, -1 on error, e.g. if len is too big for a
+ *         metadata block
+ */
+extern	int	FlacAddApplication(FlacEncoder *, const char *id, const void *data,
+			uint32_t len);
+
+/**
+ * Encode interleaved samples. Samples are held until a batch of
+ * blocks is full.
+ * @return 0 on success, -1 on error
+ */
+extern	int	FlacEncode(FlacEncoder *, const int32_t *samples, size_t frames);
+
+/**
+ * Encode any held samples and complete the stream info. The file
+ * is not closed.
+ * @return 0 on success, -1 on error
+ */
+extern	int	FlacFinish(FlacEncoder *);
+
+extern	void	FreeFlacEncoder(FlacEncoder *);
+
+/**
+ * Read the metadata of a FLAC stream, leaving the file positioned
+ * at the first audio frame.
+ * @return new decoder, or NULL on error
+ */
+extern	FlacDecoder *OpenFlacDecoder(FILE *in);
+
+/**
+ * Decode up to frames sample frames into interleaved samples. At the
+ * end of the stream, the samples are checked against the MD5 sum.
+ * @return # of frames decoded, 0 at the end, -1 on error
+ */
+extern	long	FlacDecode(FlacDecoder *, int32_t *samples, size_t frames);
+
+/**
+ * Find the value of a Vorbis comment, ignoring case in the name.
+ * @return pointer into the comment, or NULL if not present
+ */
+extern	const char *FlacComment(const FlacDecoder *, const char *name);
+
+extern	void	CloseFlacDecoder(FlacDecoder *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBFLAC_H */
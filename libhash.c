@@ -0,0 +1,372 @@
+/**
+ * @file
+ * xxHash64 and SHA-256, and segmented hashing of file ranges.
+ *
+ * Xxh64() follows the reference xxHash specification: four lanes of
+ * 64-bit multiply-rotate over 32-byte stripes, merged and mixed with
+ * the tail bytes at the end.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libhash.h"
+#include "myendian.h"
+
+#define	P64_1	0x9E3779B185EBCA87ULL
+#define	P64_2	0xC2B2AE3D27D4EB4FULL
+#define	P64_3	0x165667B19E3779F9ULL
+#define	P64_4	0x85EBCA77C2B2AE63ULL
+#define	P64_5	0x27D4EB2F165667C5ULL
+
+typedef struct job {
+  int fd;
+  uint64_t start, length;
+  HashType type;
+  uint8_t *segments;	/* Digests, one per segment */
+  size_t first, step;	/* Segments first, first+step, ... */
+  int error;
+} Job;
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return swaple64(v);
+}
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swaple32(v);
+}
+
+static inline uint64_t
+xxhRound(uint64_t acc, uint64_t input)
+{
+    acc += input * P64_2;
+    acc = rotl64(acc, 31);
+    return acc * P64_1;
+}
+
+static inline uint64_t
+xxhMerge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxhRound(0, val);
+    return acc * P64_1 + P64_4;
+}
+
+uint64_t
+Xxh64(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *p = data, *end = p + len;
+    uint64_t h, v1, v2, v3, v4;
+
+    if (len >= 32) {
+	v1 = seed + P64_1 + P64_2;
+	v2 = seed + P64_2;
+	v3 = seed;
+	v4 = seed - P64_1;
+	for (; p + 32 <= end; p += 32) {
+	    v1 = xxhRound(v1, read64(p));
+	    v2 = xxhRound(v2, read64(p + 8));
+	    v3 = xxhRound(v3, read64(p + 16));
+	    v4 = xxhRound(v4, read64(p + 24));
+	}
+	h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+	h = xxhMerge(h, v1);
+	h = xxhMerge(h, v2);
+	h = xxhMerge(h, v3);
+	h = xxhMerge(h, v4);
+    } else {
+	h = seed + P64_5;
+    }
+    h += len;
+
+    for (; p + 8 <= end; p += 8) {
+	h ^= xxhRound(0, read64(p));
+	h = rotl64(h, 27) * P64_1 + P64_4;
+    }
+    if (p + 4 <= end) {
+	h ^= read32(p) * P64_1;
+	h = rotl64(h, 23) * P64_2 + P64_3;
+	p += 4;
+    }
+    for (; p < end; ++p) {
+	h ^= *p * P64_5;
+	h = rotl64(h, 11) * P64_1;
+    }
+
+    h ^= h >> 33;
+    h *= P64_2;
+    h ^= h >> 29;
+    h *= P64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static const uint32_t sha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define	ROR(x,n)	((x) >> (n) | (x) << (32 - (n)))
+
+void
+Sha256Init(Sha256 *s)
+{
+    s->h[0] = 0x6a09e667;
+    s->h[1] = 0xbb67ae85;
+    s->h[2] = 0x3c6ef372;
+    s->h[3] = 0xa54ff53a;
+    s->h[4] = 0x510e527f;
+    s->h[5] = 0x9b05688c;
+    s->h[6] = 0x1f83d9ab;
+    s->h[7] = 0x5be0cd19;
+    s->len = 0;
+}
+
+static void
+sha256Block(Sha256 *s, const uint8_t *p)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (i=0; i < 16; ++i) {
+	w[i] = (uint32_t)p[4*i] << 24 | p[4*i+1] << 16 | p[4*i+2] << 8 | p[4*i+3];
+    }
+    for (; i < 64; ++i) {
+	uint32_t s0 = ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3);
+	uint32_t s1 = ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10);
+	w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+    a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3];
+    e = s->h[4]; f = s->h[5]; g = s->h[6]; h = s->h[7];
+    for (i=0; i < 64; ++i) {
+	t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) +
+		sha256K[i] + w[i];
+	t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+	h = g; g = f; f = e; e = d + t1;
+	d = c; c = b; b = a; a = t1 + t2;
+    }
+    s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
+    s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
+}
+
+void
+Sha256Update(Sha256 *s, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t used = s->len % 64, n;
+
+    s->len += len;
+    if (used > 0) {
+	n = 64 - used < len ? 64 - used : len;
+	memcpy(s->buf + used, p, n);
+	p += n; len -= n;
+	if (used + n < 64) {
+	    return;
+	}
+	sha256Block(s, s->buf);
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+	sha256Block(s, p);
+    }
+    memcpy(s->buf, p, len);
+}
+
+void
+Sha256Final(Sha256 *s, uint8_t digest[32])
+{
+    uint8_t pad[72];
+    uint64_t bits = s->len * 8;
+    size_t n = 64 - (s->len + 8) % 64;
+    int i;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i=0; i < 8; ++i) {
+	pad[n + i] = bits >> (8*(7-i));
+    }
+    Sha256Update(s, pad, n + 8);
+    for (i=0; i < 32; ++i) {
+	digest[i] = s->h[i/4] >> (8*(3 - i%4));
+    }
+}
+
+int
+HashSize(HashType type)
+{
+    return type == HASH_SHA256 ? 32 : 8;
+}
+
+void
+HashSegment(HashType type, const void *data, size_t len, uint8_t *digest)
+{
+    Sha256 s;
+    uint64_t h;
+    int i;
+
+    if (type == HASH_SHA256) {
+	Sha256Init(&s);
+	Sha256Update(&s, data, len);
+	Sha256Final(&s, digest);
+    } else {
+	/* Big-endian, so the hex form reads like other xxHash tools */
+	h = Xxh64(data, len, 0);
+	for (i=0; i < 8; ++i) {
+	    digest[i] = h >> (8*(7-i));
+	}
+    }
+}
+
+void
+HashCombine(HashType type, const uint8_t *segments, size_t nsegments,
+	uint64_t length, uint8_t *digest)
+{
+    const size_t size = HashSize(type);
+    uint8_t len[8];
+    Sha256 s;
+    uint64_t h;
+    int i;
+
+    if (type == HASH_SHA256) {
+	for (i=0; i < 8; ++i) {
+	    len[i] = length >> (8*i);
+	}
+	Sha256Init(&s);
+	Sha256Update(&s, segments, nsegments * size);
+	Sha256Update(&s, len, 8);
+	Sha256Final(&s, digest);
+    } else {
+	/* The length goes in as the seed */
+	h = Xxh64(segments, nsegments * size, length);
+	for (i=0; i < 8; ++i) {
+	    digest[i] = h >> (8*(7-i));
+	}
+    }
+}
+
+size_t
+HashSegments(uint64_t length)
+{
+    return length == 0 ? 1 : (size_t)((length + HASH_SEGMENT - 1) / HASH_SEGMENT);
+}
+
+static void *
+runJob(void *arg)
+{
+    Job *job = arg;
+    const size_t nseg = HashSegments(job->length), size = HashSize(job->type);
+    uint8_t *buf;
+    uint64_t off;
+    size_t i, len;
+    ssize_t n;
+
+    if ((buf = malloc(HASH_SEGMENT)) == NULL) {
+	job->error = -1;
+	return NULL;
+    }
+    for (i = job->first; i < nseg; i += job->step) {
+	off = (uint64_t)i * HASH_SEGMENT;
+	len = job->length - off < HASH_SEGMENT ? job->length - off : HASH_SEGMENT;
+	n = pread(job->fd, buf, len, job->start + off);
+	if (n != (ssize_t)len) {
+	    job->error = -1;
+	    break;
+	}
+	HashSegment(job->type, buf, len, job->segments + i * size);
+    }
+    free(buf);
+    return NULL;
+}
+
+int
+HashFileRange(int fd, uint64_t start, uint64_t length, HashType type,
+	int threads, uint8_t *digest)
+{
+    const size_t nseg = HashSegments(length);
+    uint8_t *segments;
+    int t, started = 1, rval = 0;
+
+    if (threads < 1) {
+	threads = 1;
+    }
+    if ((size_t)threads > nseg) {
+	threads = nseg;
+    }
+    if ((segments = malloc(nseg * HashSize(type))) == NULL) {
+	return -1;
+    }
+    Job jobs[threads];
+    pthread_t tids[threads];
+    for (t=0; t < threads; ++t) {
+	jobs[t].fd = fd;
+	jobs[t].start = start;
+	jobs[t].length = length;
+	jobs[t].type = type;
+	jobs[t].segments = segments;
+	jobs[t].first = t;
+	jobs[t].step = threads;
+	jobs[t].error = 0;
+    }
+    for (t=1; t < threads; ++t) {
+	if (pthread_create(&tids[t], NULL, runJob, &jobs[t]) != 0) {
+	    break;
+	}
+	++started;
+    }
+    /* Do the share of any threads that could not be started */
+    for (t=started; t < threads; ++t) {
+	runJob(&jobs[t]);
+    }
+    runJob(&jobs[0]);
+    for (t=1; t < started; ++t) {
+	pthread_join(tids[t], NULL);
+    }
+
+    for (t=0; t < threads; ++t) {
+	if (jobs[t].error != 0) {
+	    rval = -1;
+	}
+    }
+    if (rval == 0) {
+	HashCombine(type, segments, nseg, length, digest);
+    }
+    free(segments);
+    return rval;
+}
+
+char *
+HashHex(HashType type, const uint8_t *digest, char *buffer)
+{
+    static const char hex[] = "0123456789abcdef";
+    int i, n = HashSize(type);
+
+    for (i=0; i < n; ++i) {
+	buffer[2*i] = hex[digest[i] >> 4];
+	buffer[2*i+1] = hex[digest[i] & 15];
+    }
+    buffer[2*n] = '\0';
+    return buffer;
+}
@@ -0,0 +1,87 @@
+#ifndef	LIBHASH_H
+#define	LIBHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Content hashes for large byte ranges, such as the data chunk
+ * of a .wav file.
+ *
+ * A range is cut into HASH_SEGMENT byte segments, which are hashed
+ * independently, so they can be hashed on several threads at once.
+ * The segment digests and the length of the range are then hashed
+ * together into the final digest (a two-level tree). The segment
+ * size is fixed, so the result does not depend on how many threads
+ * were used, but it is not the same as hashing the range in one go.
+ *
+ * HASH_XXH64 is the 64-bit xxHash, fast but not cryptographic.
+ * HASH_SHA256 is SHA-256, for when collisions must be out of reach.
+ */
+
+#define	HASH_SEGMENT	(4 << 20)	/* Bytes per segment */
+#define	HASH_MAX_DIGEST	32		/* Largest digest, in bytes */
+
+typedef enum {
+  HASH_XXH64, HASH_SHA256,
+} HashType;
+
+typedef struct sha256 {
+  uint32_t h[8];
+  uint64_t len;		/* # of bytes hashed */
+  uint8_t buf[64];
+} Sha256;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+/**
+ * 64-bit xxHash of a buffer
+ */
+extern	uint64_t Xxh64(const void *data, size_t len, uint64_t seed);
+
+extern	void	Sha256Init(Sha256 *);
+extern	void	Sha256Update(Sha256 *, const void *data, size_t len);
+extern	void	Sha256Final(Sha256 *, uint8_t digest[32]);
+
+/** Size of a digest, in bytes */
+extern	int	HashSize(HashType);
+
+/**
+ * Hash one segment, at most HASH_SEGMENT bytes.
+ */
+extern	void	HashSegment(HashType, const void *data, size_t len, uint8_t *digest);
+
+/**
+ * Combine the segment digests of a range into its digest.
+ * @param segments  nsegments digests, in order
+ * @param length    length of the range in bytes
+ */
+extern	void	HashCombine(HashType, const uint8_t *segments, size_t nsegments,
+			uint64_t length, uint8_t *digest);
+
+/** # of segments in a range of length bytes; at least 1 */
+extern	size_t	HashSegments(uint64_t length);
+
+/**
+ * Hash a byte range of a file, reading segments on up to threads
+ * threads with pread(2).
+ * @return 0 on success, -1 on read error or if out of memory
+ */
+extern	int	HashFileRange(int fd, uint64_t start, uint64_t length, HashType,
+			int threads, uint8_t *digest);
+
+/**
+ * Format a digest as lower case hex into buffer, which must hold
+ * 2*HashSize()+1 bytes.
+ * @return buffer
+ */
+extern	char	*HashHex(HashType, const uint8_t *digest, char *buffer);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBHASH_H */
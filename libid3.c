@@ -453,6 +453,21 @@ NewId3V2(void)
     return id3;
 }
 
+void
+FreeId3V2(Id3V2 *id3)
+{
+    Frame *frame, *next;
+
+    if (id3 == NULL) {
+	return;
+    }
+    for (frame = id3->frames; frame != NULL; frame = next) {
+	next = frame->next;
+	free(frame);
+    }
+    free(id3);
+}
+
 	/*** UTILITIES ***/
 
 static FrameType *
@@ -190,6 +190,11 @@ extern int WriteId3V2(FILE *src, FILE *ofile, Id3V2 *id3);
  */
 extern Id3V2 *NewId3V2(void);
 
+/**
+ * Free an Id3V2 structure and its frames.
+ */
+extern void FreeId3V2(Id3V2 *id3);
+
 #ifdef	__cplusplus
 }
 #endif
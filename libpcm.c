@@ -0,0 +1,493 @@
+/**
+ * @file
+ * Conversion between raw sample data and float, and streaming
+ * access to the samples in a data chunk.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libcodec.h"
+#include "myendian.h"
+
+#define	PCM_BUFSIZE	65536	/* Default raw buffer size, bytes */
+#define	CODEC_BUFSIZE	(256*1024)	/* Raw buffer size for ADPCM */
+
+const char *PcmError;
+
+bool
+PcmSupported(const FmtChunk *fmt)
+{
+    if (fmt->channels == 0 || fmt->block_align == 0) {
+	return false;
+    }
+    switch (FmtType(fmt)) {
+      case RIFF_PCM:
+	return fmt->bits_samp == 8 || fmt->bits_samp == 16 ||
+	    fmt->bits_samp == 24 || fmt->bits_samp == 32;
+      case RIFF_IEEE_FLOAT:
+	return fmt->bits_samp == 32 || fmt->bits_samp == 64;
+    }
+    return false;
+}
+
+bool
+PcmDecodable(const FmtChunk *fmt)
+{
+    return PcmSupported(fmt) || CodecSupported(fmt);
+}
+
+int
+PcmPrecision(const FmtChunk *fmt)
+{
+    switch (FmtType(fmt)) {
+      case RIFF_PCM:
+	return fmt->bits_samp;
+      case RIFF_IEEE_FLOAT:
+	return 0;
+    }
+    /* The codecs all decode to 16-bit values */
+    return 16;
+}
+
+
+	/*** SAMPLE CONVERSION */
+
+/* The loops below are kept simple, with no cross-iteration
+ * dependencies, so that the compiler can vectorize them.
+ */
+
+int
+PcmDecode(const FmtChunk *fmt, const void *in, float *out, size_t frames)
+{
+    size_t i, n = frames * fmt->channels;
+    const uint8_t *bytes = in;
+
+    if (CodecSupported(fmt) && CodecBlockFrames(fmt) == 1) {
+	DecodeG711Float(fmt, bytes, out, n);
+	return 0;
+    }
+    if (!PcmSupported(fmt)) {
+	PcmError = "Unsupported sample format";
+	return -1;
+    }
+
+    if (FmtType(fmt) == RIFF_IEEE_FLOAT) {
+	if (fmt->bits_samp == 32) {
+	    uint32_t v;
+	    float f;
+	    for (i=0; i < n; ++i) {
+		memcpy(&v, bytes + 4*i, 4);
+		v = swaple32(v);
+		memcpy(&f, &v, 4);
+		out[i] = f;
+	    }
+	} else {
+	    uint64_t v;
+	    double d;
+	    for (i=0; i < n; ++i) {
+		memcpy(&v, bytes + 8*i, 8);
+		v = swaple64(v);
+		memcpy(&d, &v, 8);
+		out[i] = (float)d;
+	    }
+	}
+	return 0;
+    }
+
+    switch (fmt->bits_samp) {
+      case 8:
+	for (i=0; i < n; ++i) {
+	    out[i] = ((int)bytes[i] - 128) * (1.0f/128);
+	}
+	break;
+      case 16:
+	for (i=0; i < n; ++i) {
+	    int16_t v = (int16_t)(bytes[2*i] | bytes[2*i+1] << 8);
+	    out[i] = v * (1.0f/32768);
+	}
+	break;
+      case 24:
+	for (i=0; i < n; ++i) {
+	    int32_t v = (int32_t)((uint32_t)bytes[3*i] << 8 |
+		(uint32_t)bytes[3*i+1] << 16 | (uint32_t)bytes[3*i+2] << 24);
+	    out[i] = (v >> 8) * (1.0f/8388608);
+	}
+	break;
+      case 32:
+	for (i=0; i < n; ++i) {
+	    int32_t v = (int32_t)((uint32_t)bytes[4*i] |
+		(uint32_t)bytes[4*i+1] << 8 | (uint32_t)bytes[4*i+2] << 16 |
+		(uint32_t)bytes[4*i+3] << 24);
+	    out[i] = v * (1.0f/2147483648.0f);
+	}
+	break;
+    }
+    return 0;
+}
+
+static inline int32_t
+clip(float x, float scale, int32_t lo, int32_t hi)
+{
+    float v = x * scale;
+    if (v < lo) return lo;
+    if (v > hi) return hi;
+    return (int32_t)lrintf(v);
+}
+
+int
+PcmEncode(const FmtChunk *fmt, const float *in, void *out, size_t frames)
+{
+    size_t i, n = frames * fmt->channels;
+    uint8_t *bytes = out;
+    int32_t v;
+
+    if (!PcmSupported(fmt)) {
+	PcmError = "Unsupported sample format";
+	return -1;
+    }
+
+    if (FmtType(fmt) == RIFF_IEEE_FLOAT) {
+	if (fmt->bits_samp == 32) {
+	    uint32_t u;
+	    for (i=0; i < n; ++i) {
+		memcpy(&u, &in[i], 4);
+		u = swaple32(u);
+		memcpy(bytes + 4*i, &u, 4);
+	    }
+	} else {
+	    uint64_t u;
+	    double d;
+	    for (i=0; i < n; ++i) {
+		d = in[i];
+		memcpy(&u, &d, 8);
+		u = swaple64(u);
+		memcpy(bytes + 8*i, &u, 8);
+	    }
+	}
+	return 0;
+    }
+
+    switch (fmt->bits_samp) {
+      case 8:
+	for (i=0; i < n; ++i) {
+	    bytes[i] = clip(in[i], 128, -128, 127) + 128;
+	}
+	break;
+      case 16:
+	for (i=0; i < n; ++i) {
+	    v = clip(in[i], 32768, -32768, 32767);
+	    bytes[2*i] = v & 0xff;
+	    bytes[2*i+1] = (v >> 8) & 0xff;
+	}
+	break;
+      case 24:
+	for (i=0; i < n; ++i) {
+	    v = clip(in[i], 8388608, -8388608, 8388607);
+	    bytes[3*i] = v & 0xff;
+	    bytes[3*i+1] = (v >> 8) & 0xff;
+	    bytes[3*i+2] = (v >> 16) & 0xff;
+	}
+	break;
+      case 32:
+	for (i=0; i < n; ++i) {
+	    /* float can't represent 2^31-1, so clip in double */
+	    double d = in[i] * 2147483648.0;
+	    v = d >= 2147483647.0 ? INT32_MAX :
+		d <= -2147483648.0 ? INT32_MIN : (int32_t)lrint(d);
+	    bytes[4*i] = v & 0xff;
+	    bytes[4*i+1] = (v >> 8) & 0xff;
+	    bytes[4*i+2] = (v >> 16) & 0xff;
+	    bytes[4*i+3] = (v >> 24) & 0xff;
+	}
+	break;
+    }
+    return 0;
+}
+
+void
+PcmSwapBytes(void *buffer, size_t n, int width)
+{
+    uint8_t *bytes = buffer, *p, t;
+    size_t i, words;
+    uint64_t x;
+    int j;
+
+    /* Eight bytes at a time: each step swaps neighbouring groups of
+     * bytes in every sample in the word at once, so the loop has no
+     * per-sample work and compilers vectorize it.
+     */
+    words = width == 2 || width == 4 || width == 8 ? n * width / 8 : 0;
+    for (i=0; i < words; ++i) {
+	memcpy(&x, bytes + 8*i, 8);
+	x = ((x << 8) & 0xFF00FF00FF00FF00ULL) |
+	    ((x >> 8) & 0x00FF00FF00FF00FFULL);
+	if (width >= 4) {
+	    x = ((x << 16) & 0xFFFF0000FFFF0000ULL) |
+		((x >> 16) & 0x0000FFFF0000FFFFULL);
+	}
+	if (width == 8) {
+	    x = (x << 32) | (x >> 32);
+	}
+	memcpy(bytes + 8*i, &x, 8);
+    }
+
+    /* The samples left over, and 24-bit samples */
+    for (i = words * 8 / width; i < n; ++i) {
+	p = bytes + i * width;
+	for (j=0; j < width/2; ++j) {
+	    t = p[j];
+	    p[j] = p[width-1-j];
+	    p[width-1-j] = t;
+	}
+    }
+}
+
+
+	/*** STREAMS */
+
+PcmStream *
+OpenPcmStream(FILE *file, WaveChunk *wave)
+{
+    PcmStream *stream = NULL;
+    FmtChunk *fc;
+    FactChunk *fact;
+    Chunk *dc;
+
+    if ((fc = (FmtChunk *)FindChunk(wave->children, "fmt ", NULL)) == NULL) {
+	PcmError = "Format chunk not found";
+	goto exit;
+    }
+    if ((dc = FindChunk(wave->children, "data", NULL)) == NULL) {
+	PcmError = "Data chunk not found";
+	goto exit;
+    }
+    if (fc->block_align == 0) {
+	PcmError = "Invalid block alignment";
+	goto exit;
+    }
+    if ((stream = malloc(sizeof(*stream))) == NULL) {
+	PcmError = "Out of memory";
+	goto exit;
+    }
+    stream->fd = fileno(file);
+    stream->fmt = fc;
+    stream->start = (off_t)dc->offset + 8;
+    stream->length = dc->length;
+    stream->frames = dc->length / fc->block_align;
+    stream->position = 0;
+    stream->block_frames = 1;
+    stream->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    stream->buffer = NULL;
+    stream->bufsize = 0;
+    stream->decoded = NULL;
+    stream->dec_first = stream->dec_count = 0;
+
+    if (CodecSupported(fc) && CodecBlockFrames(fc) > 1) {
+	/* The last block is usually padded; fact has the real length */
+	stream->block_frames = CodecBlockFrames(fc);
+	stream->frames = CodecFrames(fc, dc->length);
+	fact = (FactChunk *)FindChunk(wave->children, "fact", NULL);
+	if (fact != NULL && fact->n < stream->frames) {
+	    stream->frames = fact->n;
+	}
+    }
+
+exit:
+    return stream;
+}
+
+/**
+ * Read want bytes at offset into the data chunk.
+ * @return # of bytes read
+ */
+static size_t
+readAt(PcmStream *stream, void *buffer, size_t want, off_t offset)
+{
+    size_t got = 0;
+    ssize_t l;
+
+    offset += stream->start;
+    while (got < want) {
+	l = pread(stream->fd, (uint8_t *)buffer + got, want - got,
+		offset + got);
+	if (l < 0 && errno == EINTR) {
+	    continue;
+	}
+	if (l <= 0) {
+	    PcmError = l < 0 ? strerror(errno) : "Premature end of file";
+	    break;
+	}
+	got += l;
+    }
+    return got;
+}
+
+size_t
+ReadPcmFrames(PcmStream *stream, void *buffer, size_t frames)
+{
+    size_t align = stream->fmt->block_align;
+    size_t got;
+
+    if (stream->block_frames > 1) {
+	PcmError = "ADPCM data can only be read as float";
+	return 0;
+    }
+    if (frames > stream->frames - stream->position) {
+	frames = stream->frames - stream->position;
+    }
+    got = readAt(stream, buffer, frames * align,
+	    (off_t)stream->position * align);
+    frames = got / align;
+    stream->position += frames;
+    return frames;
+}
+
+/**
+ * Read and decode the run of ADPCM blocks that holds the
+ * current position.
+ */
+static int
+refill(PcmStream *stream)
+{
+    const FmtChunk *fmt = stream->fmt;
+    uint32_t block = stream->position / stream->block_frames;
+    off_t offset = (off_t)block * fmt->block_align;
+    size_t want, got;
+    long n;
+
+    want = stream->length - offset;
+    if (want > stream->bufsize) {
+	want = stream->bufsize;
+    }
+    if ((got = readAt(stream, stream->buffer, want, offset)) == 0) {
+	return -1;
+    }
+    n = DecodeBlocksFloat(fmt, stream->buffer, got, stream->decoded,
+	    stream->threads);
+    if (n < 0) {
+	PcmError = CodecError;
+	return -1;
+    }
+    stream->dec_first = block * stream->block_frames;
+    stream->dec_count = (uint32_t)n;
+    if (stream->dec_count > stream->frames - stream->dec_first) {
+	stream->dec_count = stream->frames - stream->dec_first;
+    }
+    if (stream->position >= stream->dec_first + stream->dec_count) {
+	PcmError = "Premature end of file";
+	return -1;
+    }
+    return 0;
+}
+
+/**
+ * ReadPcmFloat() for ADPCM: copy from the decoded blocks,
+ * decoding more as needed.
+ */
+static size_t
+readBlocks(PcmStream *stream, float *buffer, size_t frames)
+{
+    const int nc = stream->fmt->channels;
+    size_t total = 0, n;
+
+    if (stream->decoded == NULL) {
+	size_t blocks = stream->bufsize / stream->fmt->block_align;
+	stream->decoded = malloc(blocks * stream->block_frames * nc * sizeof(float));
+	if (stream->decoded == NULL) {
+	    PcmError = "Out of memory";
+	    return 0;
+	}
+    }
+
+    while (total < frames && stream->position < stream->frames) {
+	if (stream->position < stream->dec_first ||
+	    stream->position >= stream->dec_first + stream->dec_count)
+	{
+	    if (refill(stream) != 0) {
+		break;
+	    }
+	}
+	n = stream->dec_first + stream->dec_count - stream->position;
+	if (n > frames - total) {
+	    n = frames - total;
+	}
+	memcpy(buffer + total * nc,
+	    stream->decoded + (size_t)(stream->position - stream->dec_first) * nc,
+	    n * nc * sizeof(float));
+	total += n;
+	stream->position += n;
+    }
+    return total;
+}
+
+size_t
+ReadPcmFloat(PcmStream *stream, float *buffer, size_t frames)
+{
+    size_t align = stream->fmt->block_align;
+    size_t total = 0, n, l;
+
+    if (stream->buffer == NULL) {
+	size_t size = stream->block_frames > 1 ? CODEC_BUFSIZE : PCM_BUFSIZE;
+	stream->bufsize = size - size % align;
+	if (stream->bufsize == 0) {
+	    stream->bufsize = align;
+	}
+	if ((stream->buffer = malloc(stream->bufsize)) == NULL) {
+	    PcmError = "Out of memory";
+	    return 0;
+	}
+    }
+    if (stream->block_frames > 1) {
+	return readBlocks(stream, buffer, frames);
+    }
+
+    while (total < frames) {
+	n = frames - total;
+	if (n > stream->bufsize / align) {
+	    n = stream->bufsize / align;
+	}
+	if ((l = ReadPcmFrames(stream, stream->buffer, n)) == 0) {
+	    break;
+	}
+	if (PcmDecode(stream->fmt, stream->buffer,
+		buffer + total * stream->fmt->channels, l) != 0)
+	{
+	    break;
+	}
+	total += l;
+	if (l < n) {
+	    break;
+	}
+    }
+    return total;
+}
+
+int
+SeekPcmStream(PcmStream *stream, uint32_t frame)
+{
+    if (frame > stream->frames) {
+	PcmError = "Seek past end of data";
+	return -1;
+    }
+    stream->position = frame;
+    return 0;
+}
+
+void
+ClosePcmStream(PcmStream *stream)
+{
+    if (stream != NULL) {
+	free(stream->buffer);
+	free(stream->decoded);
+	free(stream);
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef	LIBPCM_H
+#define	LIBPCM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "libwav.h"
+
+/**
+ * Streaming access to the samples in a data chunk. Reads are
+ * done with pread(2), so the stream does not disturb the
+ * position of the FILE it was opened from, and several streams
+ * may read the same file at once.
+ */
+typedef struct pcm_stream {
+  int fd;		/* File descriptor of the source file */
+  const FmtChunk *fmt;	/* Format of the samples */
+  off_t start;		/* File offset of the first sample */
+  uint32_t frames;	/* Total # of sample frames in the data chunk */
+  uint32_t position;	/* Next frame to be read */
+  uint32_t length;	/* Length of the data chunk in bytes */
+  uint32_t block_frames;	/* Frames per block_align bytes; >1 for ADPCM */
+  int threads;		/* Max threads for decoding ADPCM */
+  uint8_t *buffer;	/* Raw bytes, used by ReadPcmFloat() */
+  size_t bufsize;
+  float *decoded;	/* Decoded ADPCM blocks */
+  uint32_t dec_first;	/* First frame in decoded */
+  uint32_t dec_count;	/* # of frames in decoded */
+} PcmStream;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern const char *PcmError;	/* Error text from last failure */
+
+/**
+ * Return true if samples in this format can be converted
+ * to and from float by this library.
+ */
+extern	bool	PcmSupported(const FmtChunk *fmt);
+
+/**
+ * Return true if samples in this format can be read as float:
+ * everything PcmSupported() accepts, plus G.711 and ADPCM.
+ */
+extern	bool	PcmDecodable(const FmtChunk *fmt);
+
+/**
+ * Return the # of bits it takes to hold the decoded samples of this
+ * format exactly: bits_samp for PCM, 16 for G.711 and ADPCM, and 0
+ * for float, which no integer word length holds. A conversion to at
+ * least this many bits loses nothing and needs no dither.
+ */
+extern	int	PcmPrecision(const FmtChunk *fmt);
+
+/**
+ * Convert interleaved raw samples to interleaved float samples
+ * in the range [-1,1).
+ * @param fmt     format of the raw samples
+ * @param in      raw sample data, as found in the file
+ * @param out     receives frames * channels float samples
+ * @param frames  number of sample frames to convert
+ * @return 0 on success, -1 if the format is not supported
+ *
+ * G.711 is accepted; ADPCM is not, as it must be decoded a block
+ * at a time, see libcodec.h or ReadPcmFloat().
+ */
+extern	int	PcmDecode(const FmtChunk *fmt, const void *in, float *out, size_t frames);
+
+/**
+ * Convert interleaved float samples to raw samples. Values out
+ * of range are clipped. No dither is applied.
+ */
+extern	int	PcmEncode(const FmtChunk *fmt, const float *in, void *out, size_t frames);
+
+/**
+ * Reverse the byte order of n samples of width bytes each, in place,
+ * e.g. to convert between AIFF and .wav samples. Samples of 2, 4 and
+ * 8 bytes are swapped a 64-bit word at a time.
+ */
+extern	void	PcmSwapBytes(void *buffer, size_t n, int width);
+
+/**
+ * Open a stream on the first data chunk of a wave file.
+ * @param file  the file that was passed to OpenWaveFile()
+ * @param wave  the result of OpenWaveFile()
+ * @return new stream, or NULL on failure
+ */
+extern	PcmStream *OpenPcmStream(FILE *file, WaveChunk *wave);
+
+/**
+ * Read up to frames sample frames of raw data into buffer. Not
+ * available for ADPCM streams.
+ * @return number of frames read, 0 at end of data
+ */
+extern	size_t	ReadPcmFrames(PcmStream *, void *buffer, size_t frames);
+
+/**
+ * Read up to frames sample frames, converted to float. ADPCM is
+ * decoded many blocks at a time, using up to stream->threads
+ * threads.
+ * @return number of frames read, 0 at end of data
+ */
+extern	size_t	ReadPcmFloat(PcmStream *, float *buffer, size_t frames);
+
+/**
+ * Set the position of the next frame to be read.
+ */
+extern	int	SeekPcmStream(PcmStream *, uint32_t frame);
+
+extern	void	ClosePcmStream(PcmStream *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBPCM_H */
@@ -0,0 +1,433 @@
+/**
+ * @file
+ * Build and read multi-resolution waveform peak files. See libpeaks.h
+ * for the file format.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "libpeaks.h"
+#include "myendian.h"
+
+/* Inline functions and macros */
+
+static inline uint32_t
+readUInt32(void *buffer)
+{
+    uint8_t *bytes = buffer;
+    return bytes[0] | bytes[1]<<8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static inline uint16_t
+readUInt16(void *buffer)
+{
+    uint8_t *bytes = buffer;
+    return bytes[0] | bytes[1]<<8;
+}
+
+static inline void
+writeUInt32(void *buffer, uint32_t val)
+{
+    uint8_t *bytes = buffer;
+    bytes[0] = val & 0xff;
+    bytes[1] = (val>>8) & 0xff;
+    bytes[2] = (val>>16) & 0xff;
+    bytes[3] = (val>>24) & 0xff;
+}
+
+static inline void
+writeUInt16(void *buffer, uint16_t val)
+{
+    uint8_t *bytes = buffer;
+    bytes[0] = val & 0xff;
+    bytes[1] = (val>>8) & 0xff;
+}
+
+/* Scale a min or max to int16, rounding outward so that a peak
+ * is never drawn smaller than it is.
+ */
+static inline int16_t
+quantMin(float x)
+{
+    x = floorf(x * 32767);
+    return x < -32768 ? -32768 : x > 32767 ? 32767 : (int16_t)x;
+}
+
+static inline int16_t
+quantMax(float x)
+{
+    x = ceilf(x * 32767);
+    return x < -32768 ? -32768 : x > 32767 ? 32767 : (int16_t)x;
+}
+
+/* Internal type definitions */
+
+typedef struct builder_level {
+  int16_t *data;	/* bins * channels * {min,max} */
+  uint32_t bins;	/* # of bins allocated */
+  uint32_t used;	/* # of bins filled */
+  bool pending;		/* acc holds half of the next bin */
+  int16_t *acc;
+} BuilderLevel;
+
+struct peak_builder {
+  int channels;
+  uint32_t sample_rate;
+  uint32_t frames;
+  uint32_t base;
+  int n_levels;
+  uint32_t count;	/* # of frames in the current level 0 bin */
+  float *mn, *mx;	/* Current level 0 bin, per channel */
+  int16_t *bin;		/* Scratch space for one bin */
+  BuilderLevel levels[PEAK_MAX_LEVELS];
+};
+
+const char *PeakError;
+
+
+	/*** BUILD */
+
+PeakBuilder *
+NewPeakBuilder(int channels, uint32_t sample_rate, uint32_t frames,
+	uint32_t base, int n_levels)
+{
+    PeakBuilder *pb;
+    uint64_t spb;
+    int i;
+
+    if (channels <= 0 || base == 0 || (base & (base-1)) != 0) {
+	PeakError = "Bin size must be a power of two";
+	return NULL;
+    }
+    if (n_levels <= 0) {
+	/* Keep adding levels until a single bin covers the file */
+	for (n_levels = 1, spb = base;
+	     spb < frames && n_levels < PEAK_MAX_LEVELS;
+	     spb *= 2, ++n_levels)
+	  ;
+    }
+    if (n_levels > PEAK_MAX_LEVELS ||
+	((uint64_t)base << (n_levels-1)) > UINT32_MAX)
+    {
+	PeakError = "Too many levels";
+	return NULL;
+    }
+
+    if ((pb = calloc(1, sizeof(*pb))) == NULL) {
+	PeakError = "Out of memory";
+	return NULL;
+    }
+    pb->channels = channels;
+    pb->sample_rate = sample_rate;
+    pb->frames = frames;
+    pb->base = base;
+    pb->n_levels = n_levels;
+    pb->mn = malloc(channels * sizeof(float));
+    pb->mx = malloc(channels * sizeof(float));
+    pb->bin = malloc(channels * 2 * sizeof(int16_t));
+    if (pb->mn == NULL || pb->mx == NULL || pb->bin == NULL) {
+	goto fail;
+    }
+
+    /* The size of every level is known in advance */
+    for (i=0; i < n_levels; ++i) {
+	BuilderLevel *bl = &pb->levels[i];
+	spb = (uint64_t)base << i;
+	bl->bins = (frames + spb - 1) / spb;
+	bl->data = malloc((bl->bins ? bl->bins : 1) * channels * 2 * sizeof(int16_t));
+	bl->acc = malloc(channels * 2 * sizeof(int16_t));
+	if (bl->data == NULL || bl->acc == NULL) {
+	    goto fail;
+	}
+    }
+    return pb;
+
+fail:
+    PeakError = "Out of memory";
+    FreePeakBuilder(pb);
+    return NULL;
+}
+
+/**
+ * Store one finished bin in a level, and pass it up to the next.
+ */
+static void
+emitBin(PeakBuilder *pb, int level, const int16_t *bin)
+{
+    BuilderLevel *bl = &pb->levels[level];
+    size_t n = pb->channels * 2;
+    int i;
+
+    if (bl->used < bl->bins) {
+	memcpy(bl->data + bl->used * n, bin, n * sizeof(*bin));
+	++bl->used;
+    }
+
+    if (++level >= pb->n_levels) {
+	return;
+    }
+    bl = &pb->levels[level];
+    if (!bl->pending) {
+	memcpy(bl->acc, bin, n * sizeof(*bin));
+	bl->pending = true;
+    } else {
+	for (i=0; i < n; i += 2) {
+	    if (bin[i] < bl->acc[i]) bl->acc[i] = bin[i];
+	    if (bin[i+1] > bl->acc[i+1]) bl->acc[i+1] = bin[i+1];
+	}
+	bl->pending = false;
+	emitBin(pb, level, bl->acc);
+    }
+}
+
+static void
+emitBase(PeakBuilder *pb)
+{
+    int c;
+    for (c=0; c < pb->channels; ++c) {
+	pb->bin[2*c] = quantMin(pb->mn[c]);
+	pb->bin[2*c+1] = quantMax(pb->mx[c]);
+    }
+    emitBin(pb, 0, pb->bin);
+    pb->count = 0;
+}
+
+int
+AddPeakFrames(PeakBuilder *pb, const float *samples, size_t frames)
+{
+    int nc = pb->channels;
+    size_t run, f;
+    int c;
+
+    while (frames > 0) {
+	if (pb->count == 0) {
+	    for (c=0; c < nc; ++c) {
+		pb->mn[c] = pb->mx[c] = samples[c];
+	    }
+	}
+	run = pb->base - pb->count;
+	if (run > frames) {
+	    run = frames;
+	}
+	if (nc == 1) {
+	    float mn = pb->mn[0], mx = pb->mx[0];
+	    for (f=0; f < run; ++f) {
+		mn = samples[f] < mn ? samples[f] : mn;
+		mx = samples[f] > mx ? samples[f] : mx;
+	    }
+	    pb->mn[0] = mn;
+	    pb->mx[0] = mx;
+	} else {
+	    for (f=0; f < run; ++f) {
+		const float *s = samples + f * nc;
+		for (c=0; c < nc; ++c) {
+		    pb->mn[c] = s[c] < pb->mn[c] ? s[c] : pb->mn[c];
+		    pb->mx[c] = s[c] > pb->mx[c] ? s[c] : pb->mx[c];
+		}
+	    }
+	}
+	samples += run * nc;
+	frames -= run;
+	pb->count += run;
+	if (pb->count == pb->base) {
+	    emitBase(pb);
+	}
+    }
+    return 0;
+}
+
+void *
+FinishPeaks(PeakBuilder *pb, size_t *len)
+{
+    uint8_t *rval, *ptr;
+    size_t binSize = pb->channels * 2 * sizeof(int16_t);
+    size_t total;
+    uint32_t offset;
+    int i, j, n;
+
+    /* Flush the partial bins, bottom up */
+    if (pb->count > 0) {
+	emitBase(pb);
+    }
+    for (i=1; i < pb->n_levels; ++i) {
+	if (pb->levels[i].pending) {
+	    pb->levels[i].pending = false;
+	    emitBin(pb, i, pb->levels[i].acc);
+	}
+    }
+
+    total = PEAK_HEADER_SIZE + pb->n_levels * PEAK_LEVEL_SIZE;
+    for (i=0; i < pb->n_levels; ++i) {
+	total += pb->levels[i].used * binSize;
+    }
+    if ((rval = malloc(total)) == NULL) {
+	PeakError = "Out of memory";
+	return NULL;
+    }
+
+    memcpy(rval, PEAK_MAGIC, 4);
+    writeUInt16(rval+4, PEAK_VERSION);
+    writeUInt16(rval+6, pb->channels);
+    writeUInt32(rval+8, pb->sample_rate);
+    writeUInt32(rval+12, pb->frames);
+    writeUInt32(rval+16, pb->base);
+    writeUInt16(rval+20, pb->n_levels);
+    writeUInt16(rval+22, 0);
+
+    ptr = rval + PEAK_HEADER_SIZE;
+    offset = PEAK_HEADER_SIZE + pb->n_levels * PEAK_LEVEL_SIZE;
+    for (i=0; i < pb->n_levels; ++i) {
+	writeUInt32(ptr, pb->base << i);
+	writeUInt32(ptr+4, pb->levels[i].used);
+	writeUInt32(ptr+8, offset);
+	ptr += PEAK_LEVEL_SIZE;
+	offset += pb->levels[i].used * binSize;
+    }
+    for (i=0; i < pb->n_levels; ++i) {
+	n = pb->levels[i].used * pb->channels * 2;
+	for (j=0; j < n; ++j) {
+	    writeUInt16(ptr, (uint16_t)pb->levels[i].data[j]);
+	    ptr += 2;
+	}
+    }
+
+    *len = total;
+    return rval;
+}
+
+void
+FreePeakBuilder(PeakBuilder *pb)
+{
+    int i;
+
+    if (pb == NULL) {
+	return;
+    }
+    for (i=0; i < PEAK_MAX_LEVELS; ++i) {
+	free(pb->levels[i].data);
+	free(pb->levels[i].acc);
+    }
+    free(pb->mn);
+    free(pb->mx);
+    free(pb->bin);
+    free(pb);
+}
+
+
+	/*** READ */
+
+PeakFile *
+OpenPeakFile(int fd, off_t offset)
+{
+    PeakFile *pf = NULL;
+    uint8_t header[PEAK_HEADER_SIZE];
+    uint8_t *table = NULL;
+    size_t tlen;
+    int i, n;
+
+    if (pread(fd, header, sizeof(header), offset) != sizeof(header)) {
+	PeakError = "Short peak file";
+	goto exit;
+    }
+    if (memcmp(header, PEAK_MAGIC, 4) != 0) {
+	PeakError = "Not a peak file";
+	goto exit;
+    }
+    if (readUInt16(header+4) != PEAK_VERSION) {
+	PeakError = "Unsupported peak file version";
+	goto exit;
+    }
+    n = readUInt16(header+20);
+    if (n == 0 || n > PEAK_MAX_LEVELS) {
+	PeakError = "Invalid level count in peak file";
+	goto exit;
+    }
+    tlen = n * PEAK_LEVEL_SIZE;
+    if ((table = malloc(tlen)) == NULL ||
+	(pf = malloc(sizeof(*pf) + n * sizeof(PeakLevel))) == NULL)
+    {
+	PeakError = "Out of memory";
+	goto exit;
+    }
+    if (pread(fd, table, tlen, offset + PEAK_HEADER_SIZE) != tlen) {
+	PeakError = "Short peak file";
+	free(pf);
+	pf = NULL;
+	goto exit;
+    }
+
+    pf->fd = fd;
+    pf->base_offset = offset;
+    pf->channels = readUInt16(header+6);
+    pf->sample_rate = readUInt32(header+8);
+    pf->frames = readUInt32(header+12);
+    pf->n_levels = n;
+    for (i=0; i < n; ++i) {
+	pf->levels[i].samples_per_bin = readUInt32(table + i*PEAK_LEVEL_SIZE);
+	pf->levels[i].bins = readUInt32(table + i*PEAK_LEVEL_SIZE + 4);
+	pf->levels[i].offset = readUInt32(table + i*PEAK_LEVEL_SIZE + 8);
+    }
+
+exit:
+    free(table);
+    return pf;
+}
+
+int
+PeakLevelFor(const PeakFile *pf, double samples_per_pixel)
+{
+    int i;
+
+    for (i = pf->n_levels - 1; i > 0; --i) {
+	if (pf->levels[i].samples_per_bin <= samples_per_pixel) {
+	    break;
+	}
+    }
+    return i;
+}
+
+int
+ReadPeaks(PeakFile *pf, int level, uint32_t first, uint32_t count,
+	int16_t *out)
+{
+    const PeakLevel *pl;
+    size_t binSize = pf->channels * 2 * sizeof(int16_t);
+    size_t len, i;
+    ssize_t l;
+
+    if (level < 0 || level >= pf->n_levels) {
+	PeakError = "No such level";
+	return -1;
+    }
+    pl = &pf->levels[level];
+    if (first >= pl->bins) {
+	return 0;
+    }
+    if (count > pl->bins - first) {
+	count = pl->bins - first;
+    }
+    len = count * binSize;
+    l = pread(pf->fd, out, len,
+	pf->base_offset + pl->offset + (off_t)first * binSize);
+    if (l != len) {
+	PeakError = l < 0 ? strerror(errno) : "Short peak file";
+	return -1;
+    }
+    for (i=0; i < len/2; ++i) {
+	out[i] = (int16_t)swaple16((uint16_t)out[i]);
+    }
+    return count;
+}
+
+void
+ClosePeakFile(PeakFile *pf)
+{
+    free(pf);
+}
@@ -0,0 +1,123 @@
+#ifndef	LIBPEAKS_H
+#define	LIBPEAKS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Waveform peak files.
+ *
+ * A peak file is a pyramid of min/max pairs for each channel. Level 0
+ * summarizes "base" sample frames per bin, and each level above it
+ * summarizes twice as many as the level below. A renderer picks the
+ * level closest to its samples-per-pixel ratio and reads just the
+ * window it needs, so drawing an overview costs O(pixels).
+ *
+ * The file is stored either as a sidecar file or as the payload
+ * of a private "wpks" chunk in the wave file. All values are
+ * little-endian:
+ *
+ *	magic		"WPKS"
+ *	version		uint16, currently 1
+ *	channels	uint16
+ *	sample_rate	uint32
+ *	frames		uint32, total sample frames in the source
+ *	base		uint32, sample frames per bin at level 0
+ *	n_levels	uint16
+ *	reserved	uint16
+ *	level table	n_levels * {samples/bin, # of bins, offset}, uint32
+ *	level data	bins * channels * {min, max}, int16
+ *
+ * Level offsets are relative to the start of the peak data.
+ */
+
+#define	PEAK_TAG	"wpks"	/* Chunk id when embedded in a wave file */
+#define	PEAK_MAGIC	"WPKS"
+#define	PEAK_VERSION	1
+#define	PEAK_HEADER_SIZE 24
+#define	PEAK_LEVEL_SIZE	12
+#define	PEAK_MAX_LEVELS	24
+
+typedef struct peak_level {
+  uint32_t samples_per_bin;
+  uint32_t bins;
+  uint32_t offset;	/* Relative to start of peak data */
+} PeakLevel;
+
+/**
+ * An open peak file, as returned by OpenPeakFile()
+ */
+typedef struct peak_file {
+  int fd;
+  off_t base_offset;	/* Location of the peak data in the file */
+  uint16_t channels;
+  uint32_t sample_rate;
+  uint32_t frames;
+  uint16_t n_levels;
+  PeakLevel levels[];
+} PeakFile;
+
+typedef struct peak_builder PeakBuilder;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern const char *PeakError;	/* Error text from last failure */
+
+/**
+ * Start building a peak pyramid.
+ * @param channels     # of channels in the source
+ * @param sample_rate  source sample rate, for information only
+ * @param frames       # of sample frames that will be supplied
+ * @param base         frames per bin at level 0, a power of two
+ * @param n_levels     # of levels, or 0 to go until one bin remains
+ */
+extern	PeakBuilder *NewPeakBuilder(int channels, uint32_t sample_rate,
+			uint32_t frames, uint32_t base, int n_levels);
+
+/**
+ * Feed interleaved float samples to the builder, in order.
+ */
+extern	int	AddPeakFrames(PeakBuilder *, const float *samples, size_t frames);
+
+/**
+ * Finish the pyramid and return it as a block of bytes in peak file
+ * format, suitable for writing as a sidecar file or as a chunk.
+ * The caller frees the result.
+ */
+extern	void	*FinishPeaks(PeakBuilder *, size_t *len);
+
+extern	void	FreePeakBuilder(PeakBuilder *);
+
+/**
+ * Open peak data for reading.
+ * @param fd      open file descriptor
+ * @param offset  where the peak data starts: 0 for a sidecar file,
+ *                chunk offset + 8 for an embedded chunk
+ */
+extern	PeakFile *OpenPeakFile(int fd, off_t offset);
+
+/**
+ * Choose the coarsest level that still has at least one bin per
+ * pixel when drawing samples_per_pixel frames per pixel.
+ */
+extern	int	PeakLevelFor(const PeakFile *, double samples_per_pixel);
+
+/**
+ * Read count bins starting at bin first from a level, with a
+ * single pread(2). Output is count * channels {min,max} pairs.
+ * @return # of bins read, or -1 on error
+ */
+extern	int	ReadPeaks(PeakFile *, int level, uint32_t first, uint32_t count,
+			int16_t *out);
+
+extern	void	ClosePeakFile(PeakFile *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBPEAKS_H */
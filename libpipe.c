@@ -0,0 +1,572 @@
+/**
+ * @file
+ * Reading, transforming and writing samples on several threads at
+ * once.
+ *
+ * The blocks move between threads through rings: the free buffers,
+ * the blocks the reader has read, the output of each stage. Every
+ * ring can hold every block, so a push never has to wait; a pop
+ * sleeps on the ring's condition variable until a block arrives or
+ * the pipeline stops. A block is only a pointer, so the lock is held
+ * for a few instructions.
+ *
+ * Blocks are numbered as they are read. A parallel stage's workers
+ * take them in any order, so the next serial stage and PipeSource()
+ * park blocks that are early until the one they need arrives.
+ *
+ * If the reader or every thread of some stage cannot be started,
+ * the threads that did start are stopped before any block is handed
+ * out, and PipeSource() reads and transforms each block itself.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libpipe.h"
+
+/* Per thread, as the stages set it on the workers */
+_Thread_local const char *PipeError = NULL;
+
+typedef struct block {
+  uint64_t seq;		/* # in the input, from 0 */
+  uint8_t *data;	/* Contents */
+  uint8_t *spare;	/* Where the next stage puts its output */
+  size_t len;		/* Bytes in data */
+} Block;
+
+typedef struct ring {
+  Block **cells;
+  int size;		/* Room for every block */
+  int head;		/* Next cell to pop */
+  int count;		/* # of blocks in the ring */
+  pthread_mutex_t lock;
+  pthread_cond_t ready;	/* A block was pushed, or the pipeline stopped */
+} Ring;
+
+/* Blocks taken in order by a serial stage or PipeSource() */
+typedef struct order {
+  Block **pending;	/* Blocks that came early, by seq % nblocks */
+  uint64_t next;	/* seq of the next block */
+} Order;
+
+typedef struct stage {
+  PipeFunc func;
+  void *ctx;
+  bool serial;
+  atomic_uint_fast64_t claimed;	/* Parallel: # of blocks taken */
+  int running;		/* # of threads started */
+  Order order;		/* Serial */
+} Stage;
+
+typedef struct worker {
+  Pipeline *pl;
+  int stage;		/* -1 for the reader */
+} Worker;
+
+struct pipeline {
+  int fd;
+  off_t start;
+  uint64_t length;
+  size_t block, bufsize;
+  int threads;
+  Stage **stages;
+  int nstages;
+  uint64_t nTotal;	/* # of blocks in the input */
+  Block *blocks;
+  int nblocks;
+  uint8_t *buffers;
+  Ring *rings;		/* Free buffers, then the input of each stage,
+			   then the output of the last */
+  pthread_t *tids;
+  Worker *workers;
+  int nthreads;		/* # started */
+  bool started;
+  bool alone;		/* No threads: PipeSource() does the work */
+  atomic_bool stop;	/* Error, or FreePipeline() */
+  _Atomic(const char *) error;	/* First error */
+  Order order;		/* PipeSource() */
+  Block *current;	/* Block being copied out */
+  size_t used;		/* Bytes of it already copied */
+};
+
+static void *readerThread(void *arg);
+static void *stageThread(void *arg);
+static int startThreads(Pipeline *pl);
+static void stopThreads(Pipeline *pl);
+static Block *takeInOrder(Pipeline *pl, Ring *ring, Order *order);
+static Block *runAlone(Pipeline *pl);
+static void fail(Pipeline *pl, const char *error);
+
+
+	/*** RINGS ***/
+
+static int
+initRing(Ring *ring, int n)
+{
+    if ((ring->cells = malloc(n * sizeof(Block *))) == NULL) {
+	return -1;
+    }
+    ring->size = n;
+    ring->head = ring->count = 0;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->ready, NULL);
+    return 0;
+}
+
+static void
+freeRing(Ring *ring)
+{
+    if (ring->cells != NULL) {
+	pthread_mutex_destroy(&ring->lock);
+	pthread_cond_destroy(&ring->ready);
+	free(ring->cells);
+    }
+}
+
+/**
+ * Add a block to a ring. It is never full, as each ring has room for
+ * every block.
+ */
+static void
+push(Ring *ring, Block *block)
+{
+    pthread_mutex_lock(&ring->lock);
+    ring->cells[(ring->head + ring->count++) % ring->size] = block;
+    pthread_cond_signal(&ring->ready);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+/**
+ * Take a block from a ring, waiting for one if need be.
+ * @return the block, or NULL if the pipeline is stopping
+ */
+static Block *
+waitPop(Pipeline *pl, Ring *ring)
+{
+    Block *block = NULL;
+
+    pthread_mutex_lock(&ring->lock);
+    while (ring->count == 0 && !atomic_load(&pl->stop)) {
+	pthread_cond_wait(&ring->ready, &ring->lock);
+    }
+    if (ring->count > 0) {
+	block = ring->cells[ring->head];
+	ring->head = (ring->head + 1) % ring->size;
+	--ring->count;
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return block;
+}
+
+/**
+ * Wake every thread waiting on a ring, to see that pl->stop is set.
+ */
+static void
+wakeAll(Pipeline *pl)
+{
+    int i;
+
+    for (i=0; pl->rings != NULL && i < pl->nstages + 2; ++i) {
+	if (pl->rings[i].cells != NULL) {
+	    pthread_mutex_lock(&pl->rings[i].lock);
+	    pthread_cond_broadcast(&pl->rings[i].ready);
+	    pthread_mutex_unlock(&pl->rings[i].lock);
+	}
+    }
+}
+
+	/*** PIPELINE ***/
+
+Pipeline *
+NewPipeline(int fd, off_t start, uint64_t length, size_t block, size_t bufsize,
+	int threads)
+{
+    Pipeline *pl;
+
+    if (block == 0 || bufsize < block ||
+	(pl = calloc(1, sizeof(*pl))) == NULL)
+    {
+	PipeError = block == 0 || bufsize < block ? "Bad block size" :
+			"Out of memory";
+	return NULL;
+    }
+    pl->fd = fd;
+    pl->start = start;
+    pl->length = length;
+    pl->block = block;
+    pl->bufsize = bufsize;
+    pl->threads = threads > 0 ? threads : 1;
+    pl->nTotal = (length + block - 1) / block;
+    atomic_init(&pl->stop, false);
+    atomic_init(&pl->error, NULL);
+    return pl;
+}
+
+int
+PipeAddStage(Pipeline *pl, PipeFunc func, void *ctx, bool serial)
+{
+    Stage **stages, *stage;
+
+    stages = realloc(pl->stages, (pl->nstages + 1) * sizeof(Stage *));
+    if (stages == NULL || (stage = calloc(1, sizeof(*stage))) == NULL) {
+	PipeError = "Out of memory";
+	if (stages != NULL) {
+	    pl->stages = stages;
+	}
+	return -1;
+    }
+    stage->func = func;
+    stage->ctx = ctx;
+    stage->serial = serial;
+    atomic_init(&stage->claimed, 0);
+    stages[pl->nstages++] = stage;
+    pl->stages = stages;
+    return 0;
+}
+
+long
+PipeSource(void *ctx, void *buffer, size_t len)
+{
+    Pipeline *pl = ctx;
+    uint8_t *out = buffer;
+    size_t copied = 0, n;
+
+    if (!pl->started && startThreads(pl) != 0) {
+	return -1;
+    }
+    while (copied < len) {
+	if (pl->current == NULL) {
+	    if (pl->order.next >= pl->nTotal) {
+		break;
+	    }
+	    pl->current = pl->alone ? runAlone(pl) :
+		takeInOrder(pl, &pl->rings[pl->nstages + 1], &pl->order);
+	    if (pl->current == NULL) {
+		PipeError = atomic_load(&pl->error);
+		return -1;
+	    }
+	    pl->used = 0;
+	}
+	n = pl->current->len - pl->used;
+	if (n > len - copied) {
+	    n = len - copied;
+	}
+	memcpy(out + copied, pl->current->data + pl->used, n);
+	copied += n;
+	pl->used += n;
+	if (pl->used == pl->current->len) {
+	    /* Back to the reader */
+	    if (!pl->alone) {
+		push(&pl->rings[0], pl->current);
+	    }
+	    pl->current = NULL;
+	}
+    }
+    return copied;
+}
+
+void
+FreePipeline(Pipeline *pl)
+{
+    int i;
+
+    if (pl == NULL) {
+	return;
+    }
+    stopThreads(pl);
+    if (pl->rings != NULL) {
+	for (i=0; i < pl->nstages + 2; ++i) {
+	    freeRing(&pl->rings[i]);
+	}
+    }
+    for (i=0; i < pl->nstages; ++i) {
+	free(pl->stages[i]->order.pending);
+	free(pl->stages[i]);
+    }
+    free(pl->order.pending);
+    free(pl->stages);
+    free(pl->rings);
+    free(pl->blocks);
+    free(pl->buffers);
+    free(pl->tids);
+    free(pl->workers);
+    free(pl);
+}
+
+/**
+ * Allocate the blocks and rings, and start the reader and a thread
+ * for each serial stage and pl->threads for each parallel one. If the
+ * reader or every thread of a stage cannot be started, the rest are
+ * stopped and PipeSource() does the work on its own.
+ * @return 0 on success, else -1 with PipeError set
+ */
+static int
+startThreads(Pipeline *pl)
+{
+    const int nrings = pl->nstages + 2;
+    int i, n, nthreads = 1;
+    bool missing;
+
+    pl->started = true;
+    for (i=0; i < pl->nstages; ++i) {
+	nthreads += pl->stages[i]->serial ? 1 : pl->threads;
+    }
+    /* Enough blocks to keep every thread busy, and some queued */
+    pl->nblocks = nthreads + pl->threads + 2;
+    pl->blocks = calloc(pl->nblocks, sizeof(Block));
+    pl->buffers = malloc(2 * pl->bufsize * pl->nblocks);
+    pl->rings = calloc(nrings, sizeof(Ring));
+    pl->tids = calloc(nthreads, sizeof(pthread_t));
+    pl->workers = calloc(nthreads, sizeof(Worker));
+    pl->order.pending = calloc(pl->nblocks, sizeof(Block *));
+    if (pl->blocks == NULL || pl->buffers == NULL || pl->rings == NULL ||
+	pl->tids == NULL || pl->workers == NULL || pl->order.pending == NULL)
+    {
+	PipeError = "Out of memory";
+	return -1;
+    }
+    for (i=0; i < nrings; ++i) {
+	if (initRing(&pl->rings[i], pl->nblocks) != 0) {
+	    PipeError = "Out of memory";
+	    return -1;
+	}
+    }
+    for (i=0; i < pl->nstages; ++i) {
+	if (pl->stages[i]->serial &&
+	    (pl->stages[i]->order.pending = calloc(pl->nblocks, sizeof(Block *))) == NULL)
+	{
+	    PipeError = "Out of memory";
+	    return -1;
+	}
+    }
+    for (i=0; i < pl->nblocks; ++i) {
+	pl->blocks[i].data = pl->buffers + 2 * i * pl->bufsize;
+	pl->blocks[i].spare = pl->blocks[i].data + pl->bufsize;
+    }
+
+    pl->workers[0].pl = pl;
+    pl->workers[0].stage = -1;
+    for (i=0, n=1; i < pl->nstages; ++i) {
+	int j, count = pl->stages[i]->serial ? 1 : pl->threads;
+	for (j=0; j < count; ++j, ++n) {
+	    pl->workers[n].pl = pl;
+	    pl->workers[n].stage = i;
+	}
+    }
+    /* The workers of a parallel stage share out its blocks, so any
+     * one of them can do the work of those that did not start.
+     */
+    for (i=0; i < nthreads; ++i) {
+	if (pthread_create(&pl->tids[pl->nthreads], NULL,
+		i == 0 ? readerThread : stageThread, &pl->workers[i]) == 0)
+	{
+	    if (i > 0) {
+		pl->stages[pl->workers[i].stage]->running++;
+	    }
+	    pl->nthreads++;
+	} else if (i == 0) {
+	    break;
+	}
+    }
+    missing = pl->nthreads == 0;		/* The reader */
+    for (i=0; i < pl->nstages; ++i) {
+	if (pl->stages[i]->running == 0) {
+	    missing = true;
+	}
+    }
+    if (missing) {
+	/* No block has been handed out yet, so nothing is lost */
+	stopThreads(pl);
+	atomic_store(&pl->stop, false);
+	pl->alone = true;
+	return 0;
+    }
+
+    /* Let the reader go */
+    for (i=0; i < pl->nblocks; ++i) {
+	push(&pl->rings[0], &pl->blocks[i]);
+    }
+    return 0;
+}
+
+/**
+ * Stop the threads and wait for them.
+ */
+static void
+stopThreads(Pipeline *pl)
+{
+    int i;
+
+    atomic_store(&pl->stop, true);
+    wakeAll(pl);
+    for (i=0; i < pl->nthreads; ++i) {
+	pthread_join(pl->tids[i], NULL);
+    }
+    pl->nthreads = 0;
+}
+
+/**
+ * Record the first error and stop every thread.
+ */
+static void
+fail(Pipeline *pl, const char *error)
+{
+    const char *none = NULL;
+
+    atomic_compare_exchange_strong(&pl->error, &none, error);
+    atomic_store(&pl->stop, true);
+    wakeAll(pl);
+}
+
+/**
+ * Take the block after the last one taken from a ring whose blocks
+ * may arrive out of order.
+ * @return the block, or NULL if the pipeline is stopping
+ */
+static Block *
+takeInOrder(Pipeline *pl, Ring *ring, Order *order)
+{
+    const size_t slot = order->next % pl->nblocks;
+    Block *block;
+
+    /* At most nblocks are in flight, so the slots do not collide */
+    while (order->pending[slot] == NULL) {
+	if ((block = waitPop(pl, ring)) == NULL) {
+	    return NULL;
+	}
+	order->pending[block->seq % pl->nblocks] = block;
+    }
+    block = order->pending[slot];
+    order->pending[slot] = NULL;
+    order->next++;
+    return block;
+}
+
+/**
+ * Read block # seq of the input.
+ * @return 0 on success, else -1 with the pipeline stopped
+ */
+static int
+readBlock(Pipeline *pl, Block *block, uint64_t seq)
+{
+    uint64_t offset = seq * pl->block;
+    size_t len, got;
+    ssize_t l;
+
+    len = pl->length - offset < pl->block ? pl->length - offset : pl->block;
+    for (got = 0; got < len; got += l) {
+	l = pread(pl->fd, block->data + got, len - got,
+		    pl->start + offset + got);
+	if (l <= 0) {
+	    fail(pl, l == 0 ? "Short file" : "Error reading file");
+	    return -1;
+	}
+    }
+    block->seq = seq;
+    block->len = len;
+    return 0;
+}
+
+static void *
+readerThread(void *arg)
+{
+    Pipeline *pl = ((Worker *)arg)->pl;
+    Block *block;
+    uint64_t seq;
+
+    for (seq = 0; seq < pl->nTotal; ++seq) {
+	if ((block = waitPop(pl, &pl->rings[0])) == NULL ||
+	    readBlock(pl, block, seq) != 0)
+	{
+	    break;
+	}
+	push(&pl->rings[1], block);
+    }
+    return NULL;
+}
+
+/**
+ * Run a block through a stage, leaving the result in its data.
+ * @return 0 on success, else -1 with the pipeline stopped
+ */
+static int
+runStage(Pipeline *pl, Stage *stage, Block *block)
+{
+    uint8_t *t;
+    long l;
+
+    l = stage->func(stage->ctx, block->data, block->len, block->spare,
+		pl->bufsize);
+    if (l < 0 || (size_t)l > pl->bufsize) {
+	fail(pl, l < 0 && PipeError != NULL ? PipeError : "Transform failed");
+	return -1;
+    }
+    t = block->data;
+    block->data = block->spare;
+    block->spare = t;
+    block->len = l;
+    return 0;
+}
+
+static void *
+stageThread(void *arg)
+{
+    Worker *worker = arg;
+    Pipeline *pl = worker->pl;
+    Stage *stage = pl->stages[worker->stage];
+    Ring *in = &pl->rings[worker->stage + 1];
+    Ring *out = &pl->rings[worker->stage + 2];
+    Block *block;
+    uint64_t i;
+
+    if (stage->serial) {
+	for (i=0; i < pl->nTotal; ++i) {
+	    if ((block = takeInOrder(pl, in, &stage->order)) == NULL ||
+		runStage(pl, stage, block) != 0)
+	    {
+		break;
+	    }
+	    push(out, block);
+	}
+    } else {
+	/* Workers share out the blocks by count; each waits for one */
+	while (atomic_fetch_add(&stage->claimed, 1) < pl->nTotal) {
+	    if ((block = waitPop(pl, in)) == NULL ||
+		runStage(pl, stage, block) != 0)
+	    {
+		break;
+	    }
+	    push(out, block);
+	}
+    }
+    return NULL;
+}
+
+/**
+ * Read the next block and run it through every stage, without threads.
+ * @return the block, or NULL on error
+ */
+static Block *
+runAlone(Pipeline *pl)
+{
+    Block *block = &pl->blocks[0];
+    int i;
+
+    if (readBlock(pl, block, pl->order.next) != 0) {
+	return NULL;
+    }
+    for (i=0; i < pl->nstages; ++i) {
+	if (runStage(pl, pl->stages[i], block) != 0) {
+	    return NULL;
+	}
+    }
+    pl->order.next++;
+    return block;
+}
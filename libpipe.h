@@ -0,0 +1,80 @@
+#ifndef	LIBPIPE_H
+#define	LIBPIPE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "libwav.h"
+
+/**
+ * Running a transform of the samples on several threads while the
+ * file is read and written.
+ *
+ * A reader thread reads the input a block at a time into a fixed set
+ * of buffers, the stages transform each block, and the thread that
+ * calls WriteWaveFile() takes the blocks in order through PipeSource(),
+ * the data source of the output's data chunk, so the rest of the
+ * file is written as usual. The threads pass blocks to each other
+ * through bounded rings, and a buffer goes back to the reader once
+ * its block has been written. If the threads cannot be started,
+ * PipeSource() reads and transforms the blocks itself.
+ *
+ * A parallel stage runs on several blocks at once, on a pool of
+ * worker threads, and must not keep state from block to block. A
+ * serial stage has a thread of its own and sees the blocks in order,
+ * so it may. Either way, the blocks come out in order.
+ */
+
+/**
+ * Transform one block: len bytes at in, with the result in out, which
+ * holds size bytes. The last block of the input may be short.
+ * @return # of bytes in out, or -1 on error with PipeError set
+ */
+typedef long (*PipeFunc)(void *ctx, const void *in, size_t len, void *out,
+			size_t size);
+
+typedef struct pipeline Pipeline;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern _Thread_local const char *PipeError; /* Last failure on this thread */
+
+/**
+ * Create a pipeline that reads length bytes from fd at start, block
+ * bytes at a time.
+ * @param block    bytes per block, a multiple of the size of a frame
+ * @param bufsize  size of the buffers, at least block and the most
+ *                 any stage makes of a block
+ * @param threads  # of workers for the parallel stages
+ * @return new pipeline, or NULL if out of memory
+ */
+extern	Pipeline *NewPipeline(int fd, off_t start, uint64_t length, size_t block,
+			size_t bufsize, int threads);
+
+/**
+ * Add a stage after those already added. ctx is passed to func; a
+ * parallel stage shares it between its threads.
+ * @return 0 on success, -1 if out of memory
+ */
+extern	int	PipeAddStage(Pipeline *, PipeFunc func, void *ctx, bool serial);
+
+/**
+ * Data source for a DataChunk, with the pipeline as its source_ctx.
+ * The threads start on the first call.
+ */
+extern	long	PipeSource(void *ctx, void *buffer, size_t len);
+
+/**
+ * Stop the threads and free the pipeline.
+ */
+extern	void	FreePipeline(Pipeline *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBPIPE_H */
@@ -0,0 +1,333 @@
+/**
+ * @file
+ * Channel remixing and deinterleaving.
+ *
+ * Remix matrices are usually sparse (a reorder is one gain of 1 per
+ * row, a 5.1 downmix is three per row), so each output channel keeps
+ * only its nonzero terms.
+ *
+ * Mixing adds one input into an accumulator. The usual layouts, stereo
+ * into stereo and mono into stereo, are done four samples at a time
+ * with SSE.
+ *
+ * Deinterleaving is a strided copy per channel. It is done in tiles
+ * of frames so the interleaved input stays in cache while every
+ * channel takes its turn, and the sample size is a constant in each
+ * inner loop so the compiler can turn the copies into plain loads and
+ * stores.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#ifdef	__SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "libremix.h"
+
+#define	TILE_FRAMES	1024	/* Frames deinterleaved at a time */
+
+/* Internal type definitions */
+
+typedef struct term {
+  int in;		/* Input channel */
+  float gain;
+} Term;
+
+struct remixer {
+  int in_channels;
+  int out_channels;
+  int *nterms;		/* # of terms per output channel */
+  Term *terms;		/* out_channels * in_channels, only nterms used */
+};
+
+const char *RemixError;
+
+static float *
+parseMap(const char *spec, int nin, int *nout)
+{
+    float *m = NULL;
+    const char *p;
+    char *end;
+    int n, o;
+    long c;
+
+    for (n=1, p=spec; *p != '\0'; ++p) {
+	if (*p == ',') ++n;
+    }
+    if ((m = calloc((size_t)n * nin, sizeof(float))) == NULL) {
+	RemixError = "Out of memory";
+	return NULL;
+    }
+    for (o=0, p=spec; o < n; ++o) {
+	c = strtol(p, &end, 10);
+	if (end == p || c < 1 || c > nin || (*end != ',' && *end != '\0')) {
+	    RemixError = "Invalid channel number in map";
+	    free(m);
+	    return NULL;
+	}
+	m[o * nin + c - 1] = 1;
+	p = end + 1;
+    }
+    *nout = n;
+    return m;
+}
+
+static float *
+parseMatrix(const char *spec, int nin, int *nout)
+{
+    float *m = NULL;
+    const char *p;
+    char *end;
+    int n, o, i;
+
+    for (n=1, p=spec; *p != '\0'; ++p) {
+	if (*p == ';') ++n;
+    }
+    if ((m = calloc((size_t)n * nin, sizeof(float))) == NULL) {
+	RemixError = "Out of memory";
+	return NULL;
+    }
+    for (o=0, p=spec; o < n; ++o) {
+	for (i=0; i < nin; ++i) {
+	    m[o * nin + i] = strtof(p, &end);
+	    if (end == p) {
+		goto fail;
+	    }
+	    p = end;
+	    if (i < nin-1) {
+		if (*p++ != ',') goto fail;
+	    }
+	}
+	if (*p != (o < n-1 ? ';' : '\0')) {
+	    goto fail;
+	}
+	++p;
+    }
+    *nout = n;
+    return m;
+
+fail:
+    RemixError = "Each matrix row needs one gain per input channel";
+    free(m);
+    return NULL;
+}
+
+float *
+ParseRemixMatrix(const char *spec, int nin, int *nout)
+{
+    float *m;
+    int i;
+
+    if (strcmp(spec, "mono") == 0) {
+	if ((m = malloc(nin * sizeof(float))) == NULL) {
+	    RemixError = "Out of memory";
+	    return NULL;
+	}
+	for (i=0; i < nin; ++i) {
+	    m[i] = 1.0f / nin;
+	}
+	*nout = 1;
+	return m;
+    }
+    if (strcmp(spec, "stereo") == 0) {
+	if (nin == 2) {
+	    return parseMap("1,2", nin, nout);
+	}
+	if (nin != 6) {
+	    RemixError = "stereo downmix needs 2 or 6 input channels";
+	    return NULL;
+	}
+	return parseMatrix("1,0,0.7071,0,0.7071,0;0,1,0.7071,0,0,0.7071",
+		nin, nout);
+    }
+    if (strncmp(spec, "map:", 4) == 0) {
+	return parseMap(spec+4, nin, nout);
+    }
+    if (strncmp(spec, "matrix:", 7) == 0) {
+	return parseMatrix(spec+7, nin, nout);
+    }
+    RemixError = "Unknown remix; use mono, stereo, map:... or matrix:...";
+    return NULL;
+}
+
+Remixer *
+NewRemixer(int nin, int nout, const float *matrix)
+{
+    Remixer *r;
+    int o, i, n;
+
+    if ((r = calloc(1, sizeof(*r))) == NULL) {
+	return NULL;
+    }
+    r->in_channels = nin;
+    r->out_channels = nout;
+    r->nterms = calloc(nout, sizeof(int));
+    r->terms = malloc((size_t)nout * nin * sizeof(Term));
+    if (r->nterms == NULL || r->terms == NULL) {
+	FreeRemixer(r);
+	return NULL;
+    }
+    for (o=0; o < nout; ++o) {
+	Term *t = r->terms + (size_t)o * nin;
+	for (i=0, n=0; i < nin; ++i) {
+	    if (matrix[o * nin + i] != 0) {
+		t[n].in = i;
+		t[n].gain = matrix[o * nin + i];
+		++n;
+	    }
+	}
+	r->nterms[o] = n;
+    }
+    return r;
+}
+
+void
+RemixFrames(const Remixer *r, const float *in, float *out, size_t frames)
+{
+    const int nin = r->in_channels, nout = r->out_channels;
+    size_t f;
+    int o, k;
+
+    for (o=0; o < nout; ++o) {
+	const Term *t = r->terms + (size_t)o * nin;
+	const int n = r->nterms[o];
+	float *y = out + o;
+	if (n == 0) {
+	    for (f=0; f < frames; ++f) {
+		y[f * nout] = 0;
+	    }
+	} else if (n == 1 && t[0].gain == 1.0f) {
+	    const float *x = in + t[0].in;
+	    for (f=0; f < frames; ++f) {
+		y[f * nout] = x[f * nin];
+	    }
+	} else {
+	    for (f=0; f < frames; ++f) {
+		const float *x = in + f * nin;
+		float sum = 0;
+		for (k=0; k < n; ++k) {
+		    sum += t[k].gain * x[t[k].in];
+		}
+		y[f * nout] = sum;
+	    }
+	}
+    }
+}
+
+void
+FreeRemixer(Remixer *r)
+{
+    if (r != NULL) {
+	free(r->nterms);
+	free(r->terms);
+	free(r);
+    }
+}
+
+void
+MixFrames(float *acc, int nout, const float *in, int nin, const float *gains,
+	size_t frames)
+{
+    size_t i = 0, f, n = frames * nout;
+    int c;
+
+#ifdef	__SSE2__
+    if (nin == nout && (nout == 1 || nout == 2 || nout == 4)) {
+	/* The gains repeat every 4 samples */
+	__m128 g = _mm_setr_ps(gains[0], gains[1 % nout], gains[2 % nout],
+		gains[3 % nout]);
+	for (; i + 4 <= n; i += 4) {
+	    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+		    _mm_mul_ps(g, _mm_loadu_ps(in + i))));
+	}
+    } else if (nin == 1 && nout == 2) {
+	/* Each mono sample pairs up with the left and right gains */
+	__m128 g = _mm_setr_ps(gains[0], gains[1], gains[0], gains[1]);
+	for (; i + 8 <= n; i += 8) {
+	    __m128 x = _mm_loadu_ps(in + i/2);
+	    __m128 lo = _mm_unpacklo_ps(x, x), hi = _mm_unpackhi_ps(x, x);
+	    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+		    _mm_mul_ps(g, lo)));
+	    _mm_storeu_ps(acc + i + 4, _mm_add_ps(_mm_loadu_ps(acc + i + 4),
+		    _mm_mul_ps(g, hi)));
+	}
+    }
+#endif
+    for (f = i / nout; f < frames; ++f) {
+	const float *x = in + f * nin;
+	float *y = acc + f * nout;
+	for (c=0; c < nout; ++c) {
+	    y[c] += gains[c] * x[nin == 1 ? 0 : c];
+	}
+    }
+}
+
+/* Strided copy of one channel, for a fixed sample type */
+#define	SPLIT(type)							\
+    {									\
+	const type *x = (const type *)in + c;				\
+	type *y = (type *)out[c] + f0;					\
+	for (f=0; f < n; ++f) {						\
+	    y[f] = x[f * channels];					\
+	}								\
+    }
+
+void
+Deinterleave(const void *vin, void **out, int channels, int size,
+	size_t frames)
+{
+    size_t f0, f, n;
+    int c;
+
+    for (f0=0; f0 < frames; f0 += n) {
+	const uint8_t *in = (const uint8_t *)vin + f0 * channels * size;
+	n = frames - f0 < TILE_FRAMES ? frames - f0 : TILE_FRAMES;
+
+#ifdef	__SSE2__
+	if (channels == 2 && size == 2) {
+	    /* The common case: 16-bit stereo, 8 frames per iteration */
+	    int16_t *l = (int16_t *)out[0] + f0, *r = (int16_t *)out[1] + f0;
+	    for (f=0; f + 8 <= n; f += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(in + 4*f));
+		__m128i b = _mm_loadu_si128((const __m128i *)(in + 4*f + 16));
+		/* Sign-extend the left samples and shift down the right,
+		 * then pack each set back to 16 bits.
+		 */
+		__m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+		__m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+		__m128i ra = _mm_srai_epi32(a, 16);
+		__m128i rb = _mm_srai_epi32(b, 16);
+		_mm_storeu_si128((__m128i *)(l + f), _mm_packs_epi32(la, lb));
+		_mm_storeu_si128((__m128i *)(r + f), _mm_packs_epi32(ra, rb));
+	    }
+	    for (; f < n; ++f) {
+		memcpy(l + f, in + 4*f, 2);
+		memcpy(r + f, in + 4*f + 2, 2);
+	    }
+	    continue;
+	}
+#endif
+
+	for (c=0; c < channels; ++c) {
+	    switch (size) {
+	      case 1: SPLIT(uint8_t); break;
+	      case 2: SPLIT(uint16_t); break;
+	      case 4: SPLIT(uint32_t); break;
+	      case 8: SPLIT(uint64_t); break;
+	      default:
+		{
+		    const uint8_t *x = in + c * size;
+		    uint8_t *y = (uint8_t *)out[c] + f0 * size;
+		    for (f=0; f < n; ++f) {
+			memcpy(y + f * size, x + f * channels * size, size);
+		    }
+		}
+		break;
+	    }
+	}
+    }
+}
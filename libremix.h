@@ -0,0 +1,76 @@
+#ifndef	LIBREMIX_H
+#define	LIBREMIX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Channel remixing and deinterleaving.
+ *
+ * A remix is an out_channels x in_channels gain matrix, stored by
+ * rows: out[o] = sum(matrix[o*in_channels + i] * in[i]).
+ */
+
+typedef struct remixer Remixer;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern const char *RemixError;	/* Error text from last failure */
+
+/**
+ * Build a matrix from a text description:
+ *
+ *	mono		average of all channels
+ *	stereo		ITU downmix of 5.1 (L R C LFE Ls Rs); LFE is dropped
+ *	map:3,1,2	reorder or select channels, numbered from 1
+ *	matrix:a,b;c,d	explicit gains, one row per output channel
+ *
+ * @param spec          the description
+ * @param in_channels   # of input channels
+ * @param out_channels  receives # of output channels
+ * @return malloc'd matrix, or NULL on error
+ */
+extern	float	*ParseRemixMatrix(const char *spec, int in_channels, int *out_channels);
+
+/**
+ * Create a remixer. The matrix is copied.
+ * @return new remixer, or NULL if out of memory
+ */
+extern	Remixer	*NewRemixer(int in_channels, int out_channels, const float *matrix);
+
+/**
+ * Remix interleaved float frames.
+ */
+extern	void	RemixFrames(const Remixer *, const float *in, float *out, size_t frames);
+
+extern	void	FreeRemixer(Remixer *);
+
+/**
+ * Add frames, scaled, into an accumulator:
+ * acc[f*out_channels + c] += gains[c] * in[f*in_channels + c], where
+ * a mono input feeds every output channel.
+ * @param in_channels  1 or out_channels
+ * @param gains        one gain per output channel
+ */
+extern	void	MixFrames(float *acc, int out_channels, const float *in,
+			int in_channels, const float *gains, size_t frames);
+
+/**
+ * Split interleaved samples into one buffer per channel.
+ * @param in        interleaved samples
+ * @param out       one output buffer per channel
+ * @param channels  # of channels
+ * @param size      bytes per sample, e.g. 3 for 24-bit
+ * @param frames    # of frames
+ */
+extern	void	Deinterleave(const void *in, void **out, int channels, int size,
+			size_t frames);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBREMIX_H */
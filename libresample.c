@@ -0,0 +1,387 @@
+/**
+ * @file
+ * Streaming polyphase sample rate converter.
+ *
+ * Conceptually the input is upsampled by L (by inserting zeros),
+ * lowpass filtered, and downsampled by M. Only the filter taps that
+ * land on real input samples are ever computed: output sample n sits
+ * at n*M in the upsampled domain, which selects input index i and
+ * filter phase p = (n*M) mod L. The phases are stored reversed so that
+ * every output is a straight dot product over contiguous input.
+ *
+ * Each channel keeps its own input history, and all channels share
+ * the index/phase schedule, so channels can be handed to different
+ * threads with no further coordination.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#ifdef	__SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "libresample.h"
+
+#define	NA(a)	(sizeof(a)/sizeof(a[0]))
+
+/* Internal type definitions */
+
+struct resampler {
+  int channels;
+  int nthreads;
+  int taps;		/* Taps per phase */
+  int half;		/* Look-ahead, in input samples */
+  uint32_t L, M;	/* Interpolation and decimation factors */
+  float *bank;		/* L phases of taps coefficients, reversed */
+  float **hist;		/* Per channel input history */
+  size_t histLen;	/* # of samples in each history */
+  size_t histCap;
+  int64_t inBase;	/* Absolute input index of hist[c][0] */
+  uint64_t inCount;	/* Total input frames received */
+  uint64_t outPos;	/* Absolute index of the next output frame */
+  int32_t *index;	/* Schedule for the current block: first input */
+  uint32_t *phase;	/*   ...and filter phase of each output */
+  size_t schedCap;
+};
+
+typedef struct job {
+  const Resampler *r;
+  int first;		/* First channel */
+  int step;		/* Channel increment */
+  size_t count;		/* # of outputs */
+  float *out;
+} Job;
+
+static const struct {
+  const char *name;
+  int taps;
+  double beta;		/* Kaiser window parameter */
+  double rolloff;	/* Passband edge, fraction of the lower Nyquist */
+} presets[] = {
+  {"fast", 16, 6.0, 0.85},
+  {"medium", 32, 8.5, 0.91},
+  {"best", 64, 11.0, 0.95},
+};
+
+const char *ResampleError;
+
+static uint32_t
+gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+	uint32_t t = a % b;
+	a = b;
+	b = t;
+    }
+    return a;
+}
+
+/**
+ * Zeroth order modified Bessel function of the first kind
+ */
+static double
+besselI0(double x)
+{
+    double sum = 1, term = 1;
+    int k;
+    for (k=1; k < 50; ++k) {
+	term *= (x / (2*k)) * (x / (2*k));
+	sum += term;
+	if (term < sum * 1e-12) {
+	    break;
+	}
+    }
+    return sum;
+}
+
+/**
+ * Compute the filter and split it into reversed phases
+ */
+static void
+makeBank(Resampler *r, double beta, double rolloff)
+{
+    const int taps = r->taps;
+    const uint32_t L = r->L;
+    const double fc = 0.5 * rolloff / (L > r->M ? L : r->M);
+    const double radius = (double)r->half * L;
+    const double i0beta = besselI0(beta);
+    uint32_t p;
+    int j, k;
+
+    for (p=0; p < L; ++p) {
+	double sum = 0;
+	float *phase = r->bank + (size_t)p * taps;
+	for (k=0; k < taps; ++k) {
+	    double x = (double)p + (double)k * L - radius;
+	    double w, s, t;
+	    t = x / radius;
+	    w = fabs(t) >= 1 ? 0 : besselI0(beta * sqrt(1 - t*t)) / i0beta;
+	    s = x == 0 ? 1 : sin(M_PI * 2*fc * x) / (M_PI * 2*fc * x);
+	    j = taps - 1 - k;
+	    phase[j] = (float)(w * s);
+	    sum += w * s;
+	}
+	/* Unity gain at DC for every phase */
+	for (j=0; j < taps; ++j) {
+	    phase[j] = (float)(phase[j] / sum);
+	}
+    }
+}
+
+Resampler *
+NewResampler(int channels, uint32_t in_rate, uint32_t out_rate,
+	ResampleQuality quality, int threads)
+{
+    Resampler *r;
+    uint32_t g;
+    int c;
+
+    if (channels <= 0 || in_rate == 0 || out_rate == 0) {
+	ResampleError = "Invalid sample rate";
+	return NULL;
+    }
+    if (quality < 0 || quality >= NA(presets)) {
+	ResampleError = "Invalid quality";
+	return NULL;
+    }
+    g = gcd(in_rate, out_rate);
+    if (out_rate / g > RESAMPLE_MAX_PHASES) {
+	ResampleError = "Sample rate ratio is too complex";
+	return NULL;
+    }
+
+    if ((r = calloc(1, sizeof(*r))) == NULL) {
+	goto fail;
+    }
+    r->channels = channels;
+    r->nthreads = threads < 1 ? 1 : threads > channels ? channels : threads;
+    r->L = out_rate / g;
+    r->M = in_rate / g;
+    r->taps = presets[quality].taps;
+    r->half = r->taps / 2;
+    if ((r->bank = malloc((size_t)r->L * r->taps * sizeof(float))) == NULL) {
+	goto fail;
+    }
+    makeBank(r, presets[quality].beta, presets[quality].rolloff);
+
+    /* History starts with enough zeros for the first output */
+    r->histCap = RESAMPLE_MAX_BLOCK + 2 * r->taps;
+    r->histLen = r->taps - 1 - r->half;
+    r->inBase = -(int64_t)r->histLen;
+    if ((r->hist = calloc(channels, sizeof(float *))) == NULL) {
+	goto fail;
+    }
+    for (c=0; c < channels; ++c) {
+	if ((r->hist[c] = calloc(r->histCap, sizeof(float))) == NULL) {
+	    goto fail;
+	}
+    }
+    r->schedCap = ResampleOutputMax(r, RESAMPLE_MAX_BLOCK + r->taps);
+    r->index = malloc(r->schedCap * sizeof(*r->index));
+    r->phase = malloc(r->schedCap * sizeof(*r->phase));
+    if (r->index == NULL || r->phase == NULL) {
+	goto fail;
+    }
+    return r;
+
+fail:
+    ResampleError = "Out of memory";
+    FreeResampler(r);
+    return NULL;
+}
+
+uint64_t
+ResampleLength(const Resampler *r, uint64_t in_frames)
+{
+    return (in_frames * r->L + r->M - 1) / r->M;
+}
+
+size_t
+ResampleOutputMax(const Resampler *r, size_t in_frames)
+{
+    return (size_t)(((uint64_t)in_frames * r->L) / r->M + 2);
+}
+
+static inline float
+dot(const float *h, const float *x, int n)
+{
+    int k = 0;
+#ifdef	__SSE__
+    __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+    float tmp[4];
+    for (; k + 8 <= n; k += 8) {
+	a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(h+k), _mm_loadu_ps(x+k)));
+	a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(h+k+4), _mm_loadu_ps(x+k+4)));
+    }
+    _mm_storeu_ps(tmp, _mm_add_ps(a0, a1));
+    float sum = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+#else
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (; k + 4 <= n; k += 4) {
+	s0 += h[k] * x[k];
+	s1 += h[k+1] * x[k+1];
+	s2 += h[k+2] * x[k+2];
+	s3 += h[k+3] * x[k+3];
+    }
+    float sum = (s0 + s1) + (s2 + s3);
+#endif
+    for (; k < n; ++k) {
+	sum += h[k] * x[k];
+    }
+    return sum;
+}
+
+/**
+ * Run the schedule for a subset of the channels
+ */
+static void *
+runJob(void *arg)
+{
+    Job *job = arg;
+    const Resampler *r = job->r;
+    const int nc = r->channels, taps = r->taps;
+    size_t j;
+    int c;
+
+    for (c = job->first; c < nc; c += job->step) {
+	const float *x = r->hist[c];
+	float *out = job->out + c;
+	for (j=0; j < job->count; ++j) {
+	    out[j * nc] = dot(r->bank + (size_t)r->phase[j] * taps,
+		x + r->index[j], taps);
+	}
+    }
+    return NULL;
+}
+
+size_t
+Resample(Resampler *r, const float *in, size_t frames, float *out)
+{
+    const int nc = r->channels;
+    const uint32_t L = r->L, M = r->M;
+    uint64_t limit = UINT64_MAX;
+    int64_t inEnd, i, keep, drop;
+    uint32_t p;
+    size_t count = 0, f;
+    int c, t;
+
+    if (in == NULL) {
+	/* Flush: look-ahead worth of zeros, and stop at the exact length */
+	frames = r->taps;
+	limit = ResampleLength(r, r->inCount) - r->outPos;
+    } else {
+	if (frames > RESAMPLE_MAX_BLOCK) {
+	    frames = RESAMPLE_MAX_BLOCK;
+	}
+	r->inCount += frames;
+    }
+
+    for (c=0; c < nc; ++c) {
+	float *h = r->hist[c] + r->histLen;
+	if (in == NULL) {
+	    memset(h, 0, frames * sizeof(float));
+	} else {
+	    for (f=0; f < frames; ++f) {
+		h[f] = in[f * nc + c];
+	    }
+	}
+    }
+    r->histLen += frames;
+    inEnd = r->inBase + (int64_t)r->histLen;
+
+    /* Build the schedule shared by all channels */
+    i = (int64_t)((r->outPos * M) / L) + r->half;
+    p = (uint32_t)((r->outPos * M) % L);
+    while (i < inEnd && count < limit && count < r->schedCap) {
+	r->index[count] = (int32_t)(i - (r->taps - 1) - r->inBase);
+	r->phase[count] = p;
+	++count;
+	p += M;
+	i += p / L;
+	p %= L;
+    }
+
+    if (count > 0) {
+	Job jobs[r->nthreads];
+	pthread_t tids[r->nthreads];
+	int started = 1;
+	for (t=0; t < r->nthreads; ++t) {
+	    jobs[t].r = r;
+	    jobs[t].first = t;
+	    jobs[t].step = r->nthreads;
+	    jobs[t].count = count;
+	    jobs[t].out = out;
+	}
+	for (t=1; t < r->nthreads; ++t) {
+	    if (pthread_create(&tids[t], NULL, runJob, &jobs[t]) != 0) {
+		break;
+	    }
+	    ++started;
+	}
+	if (started < r->nthreads) {
+	    /* Couldn't get all the threads; do their share here */
+	    for (t=started; t < r->nthreads; ++t) {
+		runJob(&jobs[t]);
+	    }
+	}
+	runJob(&jobs[0]);
+	for (t=1; t < started; ++t) {
+	    pthread_join(tids[t], NULL);
+	}
+	r->outPos += count;
+    }
+
+    /* Discard history that no future output needs */
+    keep = (int64_t)((r->outPos * M) / L) + r->half - (r->taps - 1);
+    drop = keep - r->inBase;
+    if (drop > (int64_t)r->histLen) {
+	drop = r->histLen;
+    }
+    if (drop > 0) {
+	for (c=0; c < nc; ++c) {
+	    memmove(r->hist[c], r->hist[c] + drop,
+		(r->histLen - drop) * sizeof(float));
+	}
+	r->histLen -= drop;
+	r->inBase += drop;
+    }
+
+    return count;
+}
+
+void
+FreeResampler(Resampler *r)
+{
+    int c;
+
+    if (r == NULL) {
+	return;
+    }
+    if (r->hist != NULL) {
+	for (c=0; c < r->channels; ++c) {
+	    free(r->hist[c]);
+	}
+	free(r->hist);
+    }
+    free(r->bank);
+    free(r->index);
+    free(r->phase);
+    free(r);
+}
+
+int
+ResampleQualityFromName(const char *name)
+{
+    int i;
+    for (i=0; i < NA(presets); ++i) {
+	if (strcasecmp(name, presets[i].name) == 0) {
+	    return i;
+	}
+    }
+    return -1;
+}
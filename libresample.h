@@ -0,0 +1,81 @@
+#ifndef	LIBRESAMPLE_H
+#define	LIBRESAMPLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Streaming polyphase sample rate converter.
+ *
+ * The ratio out_rate/in_rate is reduced to L/M. The anti-aliasing
+ * filter is a Kaiser-windowed sinc computed once per converter and
+ * split into L phases, so each output sample is a single dot product
+ * of "taps" input samples with one precomputed phase.
+ */
+
+typedef enum {
+  RESAMPLE_FAST,	/* 16 taps/phase, ~60 dB stop band */
+  RESAMPLE_MEDIUM,	/* 32 taps/phase, ~85 dB stop band */
+  RESAMPLE_BEST,	/* 64 taps/phase, ~110 dB stop band */
+} ResampleQuality;
+
+#define	RESAMPLE_MAX_BLOCK	16384	/* Max input frames per call */
+#define	RESAMPLE_MAX_PHASES	4096	/* Largest L supported */
+
+typedef struct resampler Resampler;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern const char *ResampleError;	/* Error text from last failure */
+
+/**
+ * Create a converter.
+ * @param channels  # of interleaved channels
+ * @param in_rate   input sample rate
+ * @param out_rate  output sample rate
+ * @param quality   filter quality preset
+ * @param threads   max # of threads; channels are divided among them
+ * @return new converter, or NULL if the ratio is not supported
+ */
+extern	Resampler *NewResampler(int channels, uint32_t in_rate, uint32_t out_rate,
+			ResampleQuality quality, int threads);
+
+/**
+ * # of output frames produced for a file of in_frames input frames
+ */
+extern	uint64_t ResampleLength(const Resampler *, uint64_t in_frames);
+
+/**
+ * Max # of output frames a call to Resample() with this many input
+ * frames can return.
+ */
+extern	size_t	ResampleOutputMax(const Resampler *, size_t in_frames);
+
+/**
+ * Convert a block of interleaved input. Output is delayed by half
+ * the filter length; call Resample() with in == NULL at end of input
+ * to flush the rest.
+ * @param in      interleaved input, or NULL to flush
+ * @param frames  # of input frames, at most RESAMPLE_MAX_BLOCK
+ * @param out     receives interleaved output; must have room for
+ *                ResampleOutputMax(frames) frames
+ * @return # of output frames
+ */
+extern	size_t	Resample(Resampler *, const float *in, size_t frames, float *out);
+
+extern	void	FreeResampler(Resampler *);
+
+/**
+ * Parse a quality name: fast, medium, best.
+ * @return the value, or -1 if the name is not recognized
+ */
+extern	int	ResampleQualityFromName(const char *name);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBRESAMPLE_H */
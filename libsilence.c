@@ -0,0 +1,197 @@
+/**
+ * @file
+ * Find leading, trailing and interior silence in a data chunk.
+ *
+ * The scan never looks at samples one at a time except at the
+ * boundary of a silent run. Leading silence is found with a forward
+ * threshold scan. After that, the scanner checks windows of
+ * min_length frames with a backward scan: in sound, the last loud
+ * sample of the window is found almost immediately and the scan skips
+ * ahead to it. Only a window that turns out to be completely silent
+ * starts a run, which is then extended with a forward scan.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#ifdef	__SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "libpcm.h"
+#include "libsilence.h"
+
+#define	BLOCK_FRAMES	65536	/* Frames scanned at a time */
+
+const char *SilenceError;
+
+
+	/*** THRESHOLD SCANS */
+
+long
+FirstAbove(const float *x, long n, float threshold)
+{
+    long i = 0;
+#ifdef	__SSE2__
+    const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 thr = _mm_set1_ps(threshold);
+    for (; i + 16 <= n; i += 16) {
+	__m128 a = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(x+i), mask), thr);
+	__m128 b = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(x+i+4), mask), thr);
+	__m128 c = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(x+i+8), mask), thr);
+	__m128 d = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(x+i+12), mask), thr);
+	if (_mm_movemask_ps(_mm_or_ps(_mm_or_ps(a, b), _mm_or_ps(c, d))) != 0) {
+	    break;
+	}
+    }
+#endif
+    for (; i < n; ++i) {
+	if (fabsf(x[i]) > threshold) {
+	    return i;
+	}
+    }
+    return -1;
+}
+
+long
+LastAbove(const float *x, long n, float threshold)
+{
+    long i = n;
+#ifdef	__SSE2__
+    const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 thr = _mm_set1_ps(threshold);
+    for (; i >= 16; i -= 16) {
+	__m128 a = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(x+i-16), mask), thr);
+	__m128 b = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(x+i-12), mask), thr);
+	__m128 c = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(x+i-8), mask), thr);
+	__m128 d = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(x+i-4), mask), thr);
+	if (_mm_movemask_ps(_mm_or_ps(_mm_or_ps(a, b), _mm_or_ps(c, d))) != 0) {
+	    break;
+	}
+    }
+#endif
+    while (--i >= 0) {
+	if (fabsf(x[i]) > threshold) {
+	    return i;
+	}
+    }
+    return -1;
+}
+
+
+	/*** SCANNER */
+
+static int
+addRun(SilenceInfo *si, int *alloc, int64_t start, int64_t end)
+{
+    if (si->n_runs >= *alloc) {
+	int n = *alloc ? *alloc * 2 : 64;
+	SilenceRun *runs = realloc(si->runs, n * sizeof(*runs));
+	if (runs == NULL) {
+	    SilenceError = "Out of memory";
+	    return -1;
+	}
+	si->runs = runs;
+	*alloc = n;
+    }
+    si->runs[si->n_runs].start = (uint32_t)start;
+    si->runs[si->n_runs].length = (uint32_t)(end - start);
+    ++si->n_runs;
+    return 0;
+}
+
+SilenceInfo *
+FindSilence(PcmStream *stream, float threshold, uint32_t min_length)
+{
+    SilenceInfo *si = NULL;
+    float *buffer = NULL;
+    int nc = stream->fmt->channels;
+    int64_t bstart0;		/* Where the scan started */
+    int64_t bstart, bend;	/* Frames currently in the buffer */
+    int64_t pos;		/* Next frame to examine */
+    int64_t lastLoud = -1;	/* Most recent loud frame */
+    bool leading = true;
+    int alloc = 0;
+    long i;
+    size_t n;
+
+    if (min_length == 0) {
+	min_length = 1;
+    }
+    if ((si = calloc(1, sizeof(*si))) == NULL ||
+	(buffer = malloc(BLOCK_FRAMES * nc * sizeof(float))) == NULL)
+    {
+	SilenceError = "Out of memory";
+	goto fail;
+    }
+
+    bstart0 = bstart = pos = stream->position;
+    lastLoud = pos - 1;
+    while ((n = ReadPcmFloat(stream, buffer, BLOCK_FRAMES)) > 0) {
+	bend = bstart + n;
+	while (pos < bend) {
+	    const float *x = buffer + (pos - bstart) * nc;
+	    if (leading || pos - lastLoud - 1 >= min_length) {
+		/* In a run that counts; look for where it ends */
+		i = FirstAbove(x, (bend - pos) * nc, threshold);
+		if (i < 0) {
+		    pos = bend;
+		    break;
+		}
+		i = pos + i / nc;
+		if (leading) {
+		    si->lead = (uint32_t)(i - bstart0);
+		    leading = false;
+		} else if (addRun(si, &alloc, lastLoud + 1, i) != 0) {
+		    goto fail;
+		}
+		lastLoud = i;
+		pos = i + 1;
+	    } else {
+		/* Check the rest of a window of min_length frames */
+		int64_t end = lastLoud + 1 + min_length;
+		if (end > bend) {
+		    end = bend;
+		}
+		i = LastAbove(x, (end - pos) * nc, threshold);
+		if (i >= 0) {
+		    lastLoud = pos + i / nc;
+		    pos = lastLoud + 1;
+		} else {
+		    pos = end;
+		}
+	    }
+	}
+	bstart = bend;
+    }
+    if (stream->position < stream->frames) {
+	SilenceError = PcmError;
+	goto fail;
+    }
+
+    si->frames = (uint32_t)(pos - bstart0);
+    if (leading) {
+	si->lead = si->frames;
+    } else {
+	si->trail = (uint32_t)(pos - lastLoud - 1);
+    }
+    free(buffer);
+    return si;
+
+fail:
+    free(buffer);
+    FreeSilenceInfo(si);
+    return NULL;
+}
+
+void
+FreeSilenceInfo(SilenceInfo *si)
+{
+    if (si != NULL) {
+	free(si->runs);
+	free(si);
+    }
+}
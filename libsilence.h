@@ -0,0 +1,59 @@
+#ifndef	LIBSILENCE_H
+#define	LIBSILENCE_H
+
+#include <stdint.h>
+
+#include "libpcm.h"
+
+/**
+ * A stretch of silence, in sample frames
+ */
+typedef struct silence_run {
+  uint32_t start;
+  uint32_t length;
+} SilenceRun;
+
+/**
+ * Result of scanning a data chunk for silence. A frame is silent
+ * if no channel exceeds the threshold.
+ */
+typedef struct silence_info {
+  uint32_t frames;	/* Total frames scanned */
+  uint32_t lead;	/* # of silent frames at the start */
+  uint32_t trail;	/* # of silent frames at the end */
+  int n_runs;		/* Interior runs at least min_length long */
+  SilenceRun *runs;
+} SilenceInfo;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern const char *SilenceError;	/* Error text from last failure */
+
+/**
+ * Scan a stream from its current position to the end.
+ * @param stream      samples to scan
+ * @param threshold   largest absolute sample value considered silent,
+ *                    1.0 = full scale
+ * @param min_length  shortest interior run to report, in frames
+ * @return scan results, or NULL on failure. A file that is entirely
+ *         silent is reported as all lead, no trail.
+ */
+extern	SilenceInfo *FindSilence(PcmStream *stream, float threshold, uint32_t min_length);
+
+extern	void	FreeSilenceInfo(SilenceInfo *);
+
+/**
+ * Index of the first/last sample in x[0..n) whose absolute value
+ * exceeds threshold, or -1 if there is none.
+ */
+extern	long	FirstAbove(const float *x, long n, float threshold);
+extern	long	LastAbove(const float *x, long n, float threshold);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBSILENCE_H */
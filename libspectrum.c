@@ -0,0 +1,424 @@
+/**
+ * @file
+ * Short-time spectrum analysis.
+ *
+ * Mono samples collect in buf until a whole batch of frames is
+ * covered, that is (batch-1) * hop + fft_size samples. The batch is
+ * divided among the workers, each of which windows, transforms and
+ * measures its frames into the shared row buffer and adds their power
+ * to its own per-bin totals. The rows are then passed on in order and
+ * the samples that later frames still need are moved to the front.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "libspectrum.h"
+#include "libfft.h"
+
+#define	BATCH_FRAMES	32	/* Frames per worker per batch */
+#define	FLOOR_POWER	1e-20f	/* -200 dB, so silence has a level */
+
+typedef struct worker {
+  struct spectrum *s;
+  int first, count;	/* Frames of the batch to do */
+  float *x, *re, *im;	/* Scratch */
+  double *power;	/* Total power per bin */
+} Worker;
+
+struct spectrum {
+  Fft *fft;
+  int n;		/* FFT size */
+  int hop;
+  int bins;		/* n/2 + 1 */
+  int channels;
+  int batch;		/* Frames per batch */
+  float *window;
+  float scale;		/* Power of a full-scale sine at its peak -> 1 */
+  float *buf;		/* Mono samples from frame 'frames' on */
+  size_t cap;		/* Samples needed for a batch */
+  size_t have;		/* Samples in buf */
+  float *rows;		/* batch * bins levels */
+  uint64_t frames;	/* # of frames done */
+  SpectrumRow row;
+  void *ctx;
+  int nworkers;
+  Worker workers[];
+};
+
+const char *SpectrumError = NULL;
+
+Spectrum *
+NewSpectrum(int fft_size, int hop, int channels, int threads,
+	SpectrumRow row, void *ctx)
+{
+    Spectrum *s;
+    double sum = 0;
+    int i;
+
+    if (fft_size < 64 || fft_size > 65536 || (fft_size & (fft_size-1)) != 0) {
+	SpectrumError = "FFT size must be a power of 2 from 64 to 65536";
+	return NULL;
+    }
+    if (hop < 1 || hop > fft_size) {
+	SpectrumError = "Hop must be from 1 to the FFT size";
+	return NULL;
+    }
+    if (channels < 1) {
+	SpectrumError = "No channels";
+	return NULL;
+    }
+    if (threads < 1) threads = 1;
+
+    if ((s = calloc(1, sizeof(*s) + threads * sizeof(Worker))) == NULL) {
+	SpectrumError = "Out of memory";
+	return NULL;
+    }
+    s->n = fft_size;
+    s->hop = hop;
+    s->bins = fft_size / 2 + 1;
+    s->channels = channels;
+    s->nworkers = threads;
+    s->batch = threads * BATCH_FRAMES;
+    s->cap = (size_t)(s->batch - 1) * hop + fft_size;
+    s->row = row;
+    s->ctx = ctx;
+    s->fft = NewFft(fft_size);
+    s->window = malloc(fft_size * sizeof(float));
+    s->buf = malloc(s->cap * sizeof(float));
+    s->rows = malloc((size_t)s->batch * s->bins * sizeof(float));
+    if (s->fft == NULL || s->window == NULL || s->buf == NULL ||
+	s->rows == NULL)
+    {
+	goto nomem;
+    }
+    for (i=0; i < threads; ++i) {
+	Worker *w = &s->workers[i];
+	w->s = s;
+	w->x = malloc(fft_size * sizeof(float));
+	w->re = malloc(s->bins * sizeof(float));
+	w->im = malloc(s->bins * sizeof(float));
+	w->power = calloc(s->bins, sizeof(double));
+	if (w->x == NULL || w->re == NULL || w->im == NULL || w->power == NULL) {
+	    goto nomem;
+	}
+    }
+
+    /* Periodic 4-term Blackman-Harris window. Its sidelobes are 92 dB
+     * down, so a cutoff is not hidden under the leakage from the band
+     * below it.
+     */
+    for (i=0; i < fft_size; ++i) {
+	double x = 2 * M_PI * i / fft_size;
+	s->window[i] = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2*x)
+	    - 0.01168 * cos(3*x);
+	sum += s->window[i];
+    }
+    s->scale = (float)(4 / (sum * sum));
+    return s;
+
+nomem:
+    SpectrumError = "Out of memory";
+    FreeSpectrum(s);
+    return NULL;
+}
+
+static void *
+transformJob(void *arg)
+{
+    Worker *w = arg;
+    Spectrum *s = w->s;
+    int f, i, k;
+
+    for (f = w->first; f < w->first + w->count; ++f) {
+	const float *in = s->buf + (size_t)f * s->hop;
+	float *db = s->rows + (size_t)f * s->bins;
+	for (i=0; i < s->n; ++i) {
+	    w->x[i] = in[i] * s->window[i];
+	}
+	RealFft(s->fft, w->x, w->re, w->im);
+	for (k=0; k < s->bins; ++k) {
+	    float p = (w->re[k] * w->re[k] + w->im[k] * w->im[k]) * s->scale;
+	    w->power[k] += p;
+	    db[k] = 10 * log10f(p + FLOOR_POWER);
+	}
+    }
+    return NULL;
+}
+
+/**
+ * Transform the first nf frames in buf and pass on their rows.
+ */
+static void
+processBatch(Spectrum *s, int nf)
+{
+    int t, nt, started, per, f;
+
+    nt = (nf + BATCH_FRAMES - 1) / BATCH_FRAMES;
+    if (nt > s->nworkers) nt = s->nworkers;
+    pthread_t tids[nt];
+
+    per = (nf + nt - 1) / nt;
+    for (t=0, f=0; t < nt; ++t, f += per) {
+	s->workers[t].first = f;
+	s->workers[t].count = f >= nf ? 0 : nf - f < per ? nf - f : per;
+    }
+    for (started=1; started < nt; ++started) {
+	if (pthread_create(&tids[started], NULL, transformJob,
+		&s->workers[started]) != 0)
+	{
+	    break;
+	}
+    }
+    /* Do the share of any threads that could not be started */
+    for (t=started; t < nt; ++t) {
+	transformJob(&s->workers[t]);
+    }
+    transformJob(&s->workers[0]);
+    for (t=1; t < started; ++t) {
+	pthread_join(tids[t], NULL);
+    }
+
+    if (s->row != NULL) {
+	for (f=0; f < nf; ++f) {
+	    s->row(s->ctx, s->frames + f, s->rows + (size_t)f * s->bins, s->bins);
+	}
+    }
+    s->frames += nf;
+}
+
+/**
+ * Drop the samples before frame nf of buf.
+ */
+static void
+advance(Spectrum *s, int nf)
+{
+    size_t adv = (size_t)nf * s->hop;
+
+    if (adv >= s->have) {
+	s->have = 0;
+    } else {
+	memmove(s->buf, s->buf + adv, (s->have - adv) * sizeof(float));
+	s->have -= adv;
+    }
+}
+
+int
+SpectrumWrite(Spectrum *s, const float *samples, size_t frames)
+{
+    const int nc = s->channels;
+    const float gain = 1.0f / nc;
+    size_t i;
+    int c;
+
+    for (i=0; i < frames; ++i, samples += nc) {
+	float v = samples[0];
+	for (c=1; c < nc; ++c) {
+	    v += samples[c];
+	}
+	s->buf[s->have++] = v * gain;
+	if (s->have == s->cap) {
+	    processBatch(s, s->batch);
+	    advance(s, s->batch);
+	}
+    }
+    return 0;
+}
+
+int
+SpectrumFinish(Spectrum *s)
+{
+    int nf;
+
+    while (s->have > 0) {
+	nf = (s->have + s->hop - 1) / s->hop;
+	if (nf > s->batch) nf = s->batch;
+	memset(s->buf + s->have, 0, (s->cap - s->have) * sizeof(float));
+	processBatch(s, nf);
+	advance(s, nf);
+    }
+    return 0;
+}
+
+/* Rates that material is commonly upsampled from */
+static const uint32_t sourceRates[] = {
+  8000, 11025, 16000, 22050, 24000, 32000, 44100, 48000, 88200, 96000,
+};
+
+static int
+cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Fall in level across d bins either side of bin b
+ */
+static double
+dropAt(const double *level, int bins, int b, int d)
+{
+    int lo = b - d < 0 ? 0 : b - d;
+    int hi = b + d >= bins ? bins - 1 : b + d;
+
+    return level[lo] - level[hi];
+}
+
+/**
+ * The average spectrum is smoothed over about 500 Hz, in power, so a
+ * step in level still reads 3 dB down right at the step. The floor is
+ * the median level of the top 3% of the band.
+ *
+ * Upsampled and lossy material shows a brick-wall cutoff: a drop of
+ * 25 dB or more within 2 kHz, where natural roll-off is far gentler.
+ * The cutoff is where the drop across +-1 kHz is steepest, and the
+ * bandwidth is the last frequency within 3 dB of the level below it.
+ * Without one, the bandwidth is Nyquist if the floor is within 60 dB
+ * of the loudest part of the spectrum, and so is content, or else the
+ * highest frequency more than 10 dB above the floor.
+ */
+int
+SpectrumSummary(const Spectrum *s, uint32_t sample_rate, SpectralSummary *sum)
+{
+    const int bins = s->bins;
+    const double binHz = (double)sample_rate / s->n;
+    const double nyquist = sample_rate / 2.0;
+    double *level, *top, *acc;
+    double lmax = -INFINITY, best, drop;
+    int i, k, w, lo, hi, ntop, b, d;
+
+    memset(sum, 0, sizeof(*sum));
+    sum->frames = s->frames;
+    sum->verdict = SPECTRUM_SILENT;
+    if (s->frames == 0) {
+	return 0;
+    }
+    level = malloc(bins * sizeof(double));
+    top = malloc(bins * sizeof(double));
+    acc = malloc((bins + 1) * sizeof(double));
+    if (level == NULL || top == NULL || acc == NULL) {
+	SpectrumError = "Out of memory";
+	free(level);
+	free(top);
+	free(acc);
+	return -1;
+    }
+
+    /* Running sums of average power, for smoothing */
+    acc[0] = 0;
+    for (k=0; k < bins; ++k) {
+	double p = 0;
+	for (i=0; i < s->nworkers; ++i) {
+	    p += s->workers[i].power[k];
+	}
+	acc[k+1] = acc[k] + p / s->frames;
+    }
+    w = (int)(250 / binHz);
+    if (w < 1) w = 1;
+    for (k=0; k < bins; ++k) {
+	lo = k - w < 0 ? 0 : k - w;
+	hi = k + w >= bins ? bins - 1 : k + w;
+	level[k] = 10 * log10((acc[hi+1] - acc[lo]) / (hi + 1 - lo) + FLOOR_POWER);
+	if (level[k] > lmax) lmax = level[k];
+    }
+    if (lmax < -140) {
+	goto exit;
+    }
+
+    ntop = bins * 3 / 100;
+    if (ntop < 3) ntop = 3;
+    memcpy(top, level + bins - ntop, ntop * sizeof(double));
+    qsort(top, ntop, sizeof(double), cmpDouble);
+    sum->floor_db = top[ntop / 2];
+
+    /* The steepest drop, and where it starts */
+    d = (int)(1000 / binHz);
+    if (d < 1) d = 1;
+    b = 0;
+    for (k=d; k + d < bins; ++k) {
+	drop = level[k-d] - level[k+d];
+	if (drop > sum->drop_db) {
+	    sum->drop_db = drop;
+	    b = k;
+	}
+    }
+    if (sum->drop_db >= 25) {
+	for (k = b + d; k > b - d && level[k] < level[b-d] - 3; --k)
+	  ;
+	b = k;
+    } else if (sum->floor_db > lmax - 60) {
+	/* The top of the band is content, not a floor */
+	b = bins - 1;
+	sum->drop_db = dropAt(level, bins, b, d);
+    } else {
+	for (b = bins - 1; b > 0 && level[b] <= sum->floor_db + 10; --b)
+	  ;
+	sum->drop_db = dropAt(level, bins, b, d);
+    }
+    sum->bandwidth = b * binHz;
+
+    if (sum->bandwidth >= 0.9 * nyquist) {
+	sum->verdict = SPECTRUM_FULL;
+	goto exit;
+    }
+    if (sum->drop_db < 25) {
+	sum->verdict = SPECTRUM_ROLLOFF;
+	goto exit;
+    }
+
+    /* Resamplers cut off a little below the old Nyquist frequency, and
+     * the level near the cutoff is only measured to about 250 Hz
+     */
+    best = INFINITY;
+    for (i=0; i < (int)(sizeof(sourceRates)/sizeof(sourceRates[0])); ++i) {
+	double half = sourceRates[i] / 2.0;
+	if (sourceRates[i] < sample_rate &&
+	    sum->bandwidth >= 0.85 * half && sum->bandwidth <= 1.03 * half &&
+	    fabs(sum->bandwidth - half) < best)
+	{
+	    best = fabs(sum->bandwidth - half);
+	    sum->source_rate = sourceRates[i];
+	}
+    }
+    if (sum->source_rate != 0) {
+	sum->verdict = SPECTRUM_UPSAMPLED;
+    } else if (sum->bandwidth >= 11000 && sum->bandwidth < 20500) {
+	sum->verdict = SPECTRUM_LOSSY;
+    } else {
+	sum->verdict = SPECTRUM_LIMITED;
+    }
+
+exit:
+    free(level);
+    free(top);
+    free(acc);
+    return 0;
+}
+
+static void
+freeWorker(Worker *w)
+{
+    free(w->x);
+    free(w->re);
+    free(w->im);
+    free(w->power);
+}
+
+void
+FreeSpectrum(Spectrum *s)
+{
+    int i;
+
+    if (s != NULL) {
+	for (i=0; i < s->nworkers; ++i) {
+	    freeWorker(&s->workers[i]);
+	}
+	FreeFft(s->fft);
+	free(s->window);
+	free(s->buf);
+	free(s->rows);
+	free(s);
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef	LIBSPECTRUM_H
+#define	LIBSPECTRUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Short-time spectrum analysis.
+ *
+ * Samples are mixed to mono and cut into Blackman-Harris windowed
+ * frames of fft_size samples, one every hop samples. Frame i starts
+ * at sample i * hop; the last frames are padded with zeros. Frames are
+ * transformed in batches, spread over several threads, and handed
+ * back in order as rows of fft_size/2+1 levels in dB. A full-scale
+ * sine reads 0 dB at its peak.
+ *
+ * The average power of every bin is kept, and SpectrumSummary()
+ * estimates from it the bandwidth of the material and whether that
+ * looks like the result of upsampling or of a lossy codec.
+ */
+
+typedef struct spectrum Spectrum;
+
+/**
+ * Called with each row, in frame order.
+ */
+typedef void (*SpectrumRow)(void *ctx, uint64_t frame, const float *db, int bins);
+
+typedef enum {
+  SPECTRUM_SILENT,	/* Nothing to measure */
+  SPECTRUM_FULL,	/* Content up to Nyquist */
+  SPECTRUM_ROLLOFF,	/* Content fades out gently before Nyquist */
+  SPECTRUM_UPSAMPLED,	/* Brick-wall cutoff at a lower rate's Nyquist */
+  SPECTRUM_LOSSY,	/* Brick-wall cutoff where lossy encoders put one */
+  SPECTRUM_LIMITED,	/* Brick-wall cutoff elsewhere */
+} SpectrumVerdict;
+
+typedef struct spectral_summary {
+  uint64_t frames;	/* # of spectrum frames analyzed */
+  double bandwidth;	/* Highest frequency clearly above the floor, Hz */
+  double floor_db;	/* Average level just below Nyquist */
+  double drop_db;	/* Fall in level across +-1 kHz of the bandwidth */
+  SpectrumVerdict verdict;
+  uint32_t source_rate;	/* Likely original rate, if SPECTRUM_UPSAMPLED */
+} SpectralSummary;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern const char *SpectrumError;	/* Error text from last failure */
+
+/**
+ * Start an analysis.
+ * @param fft_size  frame length, a power of 2 from 64 to 65536
+ * @param hop       samples between frame starts, 1 to fft_size
+ * @param channels  # of interleaved channels that will be supplied
+ * @param threads   max # of threads to transform on
+ * @param row       called with every row, or NULL
+ * @return new analyzer, or NULL on error
+ */
+extern	Spectrum *NewSpectrum(int fft_size, int hop, int channels, int threads,
+			SpectrumRow row, void *ctx);
+
+/**
+ * Analyze interleaved samples. Rows are produced a batch at a time.
+ * @return 0 on success, -1 on error
+ */
+extern	int	SpectrumWrite(Spectrum *, const float *samples, size_t frames);
+
+/**
+ * Analyze the frames that remain, padding with zeros.
+ * @return 0 on success, -1 on error
+ */
+extern	int	SpectrumFinish(Spectrum *);
+
+/**
+ * Summarize everything analyzed so far.
+ * @return 0 on success, -1 if out of memory
+ */
+extern	int	SpectrumSummary(const Spectrum *, uint32_t sample_rate,
+			SpectralSummary *);
+
+extern	void	FreeSpectrum(Spectrum *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBSPECTRUM_H */
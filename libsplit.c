@@ -0,0 +1,368 @@
+/**
+ * @file
+ * Cutting a .wav file into new files without decoding it.
+ *
+ * The new files are built from chunks that refer back to the input:
+ * the data chunk of each is a range of the input's data chunk, which
+ * libwav copies by file descriptor when the file is written. Each
+ * writer thread opens the inputs itself, so no file position is
+ * shared.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "libsplit.h"
+#include "libid3.h"
+
+const char *SplitError = NULL;
+
+typedef struct job {
+  SplitOutput *outputs;
+  int n;
+  int first, step;	/* Outputs this job writes */
+} Job;
+
+/* ID3 frames for the INFO tags */
+static const struct {
+  const char *info, *id3;
+} id3Tags[] = {
+  {"INAM", "TIT2"},
+  {"IART", "TPE1"},
+  {"IPRD", "TALB"},
+  {"ITRK", "TRCK"},
+  {"ICRD", "TYER"},
+  {"IGNR", "TCON"},
+};
+
+#define	NA(a)	(sizeof(a)/sizeof(a[0]))
+
+static TextChunk *newText(const char *tag, const char *value, size_t len);
+static TextFrame *newTextFrame(const char *tag, const char *value, size_t len);
+static void *writeJob(void *arg);
+
+
+int
+SplitFrames(WaveChunk *waveFile, uint32_t *frames)
+{
+    FmtChunk *fmt = (FmtChunk *)FindChunk(waveFile->children, "fmt ", NULL);
+    Chunk *data = FindChunk(waveFile->children, "data", NULL);
+    uint16_t type;
+
+    if (fmt == NULL || data == NULL) {
+	SplitError = fmt == NULL ? "No fmt chunk" : "No data chunk";
+	return -1;
+    }
+    type = FmtType(fmt);
+    if ((type != RIFF_PCM && type != RIFF_IEEE_FLOAT && type != RIFF_ALAW &&
+	 type != RIFF_MULAW) || fmt->block_align == 0)
+    {
+	SplitError = "Format cannot be cut without decoding";
+	return -1;
+    }
+    *frames = data->length / fmt->block_align;
+    return 0;
+}
+
+ListChunk *
+SplitCopyInfo(WaveChunk *waveFile)
+{
+    ListChunk *iinfo = (ListChunk *)FindChunk(waveFile->children, "LIST", "INFO");
+    ListChunk *info;
+    Chunk *child, **tail;
+    TextChunk *text;
+
+    if ((info = (ListChunk *)newChunk("LIST", 4, 0, sizeof(*info))) == NULL) {
+	return NULL;
+    }
+    memcpy(info->type, "INFO", 4);
+    info->children = NULL;
+    tail = &info->children;
+    for (child = iinfo != NULL ? iinfo->children : NULL; child != NULL;
+	 child = child->next)
+    {
+	text = newText(child->identifier, ((TextChunk *)child)->string,
+		strnlen(((TextChunk *)child)->string, child->length));
+	if (text == NULL) {
+	    FreeChunk(&info->header);
+	    return NULL;
+	}
+	*tail = &text->header;
+	tail = &text->header.next;
+    }
+    return info;
+}
+
+int
+SplitSetInfo(ListChunk *info, const char *tag, const char *value)
+{
+    Chunk **ptr;
+    TextChunk *text;
+
+    if ((text = newText(tag, value, strlen(value))) == NULL) {
+	return -1;
+    }
+    for (ptr = &info->children; *ptr != NULL; ptr = &(*ptr)->next) {
+	if (strncasecmp((*ptr)->identifier, tag, 4) == 0) {
+	    text->header.next = (*ptr)->next;
+	    free(*ptr);
+	    break;
+	}
+    }
+    *ptr = &text->header;
+    return 0;
+}
+
+Chunk *
+SplitId3(const ListChunk *info)
+{
+    Id3v2Chunk *ic;
+    Id3V2 *id3;
+    Frame **tail;
+    TextFrame *tf;
+    Chunk *child;
+    size_t i;
+
+    if ((ic = (Id3v2Chunk *)newChunk("id3 ", 0, 0, sizeof(*ic))) == NULL) {
+	return NULL;
+    }
+    if ((id3 = ic->id3v2 = NewId3V2()) == NULL) {
+	free(ic);
+	return NULL;
+    }
+    tail = &id3->frames;
+    for (i=0; i < NA(id3Tags); ++i) {
+	child = FindChunk(info->children, id3Tags[i].info, NULL);
+	if (child == NULL || ((TextChunk *)child)->string[0] == '\0') {
+	    continue;
+	}
+	tf = newTextFrame(id3Tags[i].id3, ((TextChunk *)child)->string,
+		strnlen(((TextChunk *)child)->string, child->length));
+	if (tf == NULL) {
+	    FreeChunk(&ic->header);
+	    return NULL;
+	}
+	*tail = &tf->header;
+	tail = &tf->header.next;
+	id3->size += ID3_FRAME_SIZE + tf->header.length;
+    }
+    ic->header.length = ID3_HEADER_SIZE + id3->size + (id3->size%2);
+    return &ic->header;
+}
+
+WaveChunk *
+SplitWave(WaveChunk *waveFile, uint32_t start, uint32_t end, Chunk *tags)
+{
+    const FmtChunk *ifmt = (FmtChunk *)FindChunk(waveFile->children, "fmt ", NULL);
+    const Chunk *idata = FindChunk(waveFile->children, "data", NULL);
+    const uint32_t align = ifmt->block_align;
+    WaveChunk *wave;
+    FmtChunk *fmt;
+    DataChunk *data;
+
+    wave = (WaveChunk *)newChunk("RIFF", 4, 0, sizeof(*wave));
+    fmt = (FmtChunk *)newChunk("fmt ", 16, 0, sizeof(*fmt));
+    data = newDataChunk("data", (end - start) * align,
+		idata->offset + start * align);
+    if (wave == NULL || fmt == NULL || data == NULL) {
+	free(wave);
+	free(fmt);
+	free(data);
+	return NULL;
+    }
+    memcpy(wave->type, "WAVE", 4);
+    *fmt = *ifmt;
+    if (ifmt->ext != NULL) {
+	/* Each file has its own copy of any extension */
+	if ((fmt->ext = malloc(ifmt->ext_len)) == NULL) {
+	    free(wave);
+	    free(fmt);
+	    free(data);
+	    return NULL;
+	}
+	memcpy(fmt->ext, ifmt->ext, ifmt->ext_len);
+    }
+    wave->children = &fmt->header;
+    fmt->header.next = &data->header;
+    data->header.next = tags;
+
+    if (FindChunk(waveFile->children, "bsum", NULL) != NULL &&
+	AddChecksums(wave, 0) != 0)
+    {
+	data->header.next = NULL;	/* The caller still has the tags */
+	FreeWaveFile(wave);
+	return NULL;
+    }
+    return wave;
+}
+
+int
+SplitWrite(SplitOutput *outputs, int n, int threads)
+{
+    const int nthreads = threads < n ? (threads > 0 ? threads : 1) : n;
+    int i, started, rval = 0;
+
+    if (n <= 0) {
+	return 0;
+    }
+    {
+	pthread_t tids[nthreads];
+	Job jobs[nthreads];
+	for (i=0; i < nthreads; ++i) {
+	    jobs[i].outputs = outputs;
+	    jobs[i].n = n;
+	    jobs[i].first = i;
+	    jobs[i].step = nthreads;
+	}
+	for (started = 1; started < nthreads; ++started) {
+	    if (pthread_create(&tids[started], NULL, writeJob, &jobs[started]) != 0) {
+		break;
+	    }
+	}
+	/* Jobs whose threads did not start are run here */
+	for (i = started; i < nthreads; ++i) {
+	    writeJob(&jobs[i]);
+	}
+	writeJob(&jobs[0]);
+	for (i=1; i < started; ++i) {
+	    pthread_join(tids[i], NULL);
+	}
+    }
+
+    for (i=0; i < n; ++i) {
+	if (outputs[i].rval > rval) {
+	    rval = outputs[i].rval;
+	}
+    }
+    return rval;
+}
+
+void
+SplitFree(SplitOutput *outputs, int n)
+{
+    int i;
+
+    if (outputs == NULL) {
+	return;
+    }
+    for (i=0; i < n; ++i) {
+	free(outputs[i].filename);
+	FreeWaveFile(outputs[i].wave);
+    }
+    free(outputs);
+}
+
+/**
+ * Write every step'th output. The input stays open while
+ * consecutive outputs share it.
+ */
+static void *
+writeJob(void *arg)
+{
+    Job *job = arg;
+    SplitOutput *out;
+    const char *source = NULL;
+    FILE *ifile = NULL, *ofile;
+    int i;
+
+    for (i = job->first; i < job->n; i += job->step) {
+	out = &job->outputs[i];
+	if (source == NULL || strcmp(source, out->source) != 0) {
+	    if (ifile != NULL) {
+		fclose(ifile);
+	    }
+	    source = out->source;
+	    if ((ifile = fopen(source, "rb")) == NULL) {
+		fprintf(stderr, "Cannot open %s: %s\n", source, strerror(errno));
+	    }
+	}
+	if (ifile == NULL) {
+	    out->rval = 4;
+	    continue;
+	}
+	if ((ofile = fopen(out->filename, "wb")) == NULL) {
+	    fprintf(stderr, "Unable to open %s for write: %s\n",
+		out->filename, strerror(errno));
+	    out->rval = 3;
+	    continue;
+	}
+	if (WriteWaveFile(out->wave, ifile, ofile) != 0) {
+	    fprintf(stderr, "%s: %s\n", out->filename, WaveError);
+	    out->rval = 3;
+	}
+	if (fclose(ofile) != 0) {
+	    fprintf(stderr, "Error writing %s: %s\n", out->filename,
+		strerror(errno));
+	    out->rval = 3;
+	}
+    }
+    if (ifile != NULL) {
+	fclose(ifile);
+    }
+    return NULL;
+}
+
+/**
+ * A text chunk holding len bytes of value, nul-terminated
+ * and padded to an even length.
+ */
+static TextChunk *
+newText(const char *tag, const char *value, size_t len)
+{
+    TextChunk *text;
+    size_t l = len + 1;
+
+    l += l%2;
+    if ((text = (TextChunk *)newChunk(tag, l, 0, sizeof(Chunk) + l)) != NULL) {
+	memset(text->string, 0, l);
+	memcpy(text->string, value, len);
+    }
+    return text;
+}
+
+/**
+ * An ID3 text frame. Tags are usually UTF-8, which ID3v2.3 does not
+ * allow, so the value is converted to Latin-1, with '?' for
+ * characters that Latin-1 does not have.
+ */
+static TextFrame *
+newTextFrame(const char *tag, const char *value, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)value, *end = p + len;
+    TextFrame *tf;
+    uint8_t *q;
+
+    if ((tf = malloc(sizeof(*tf) + len + 1)) == NULL) {
+	return NULL;
+    }
+    for (q = tf->string; p < end; ++q) {
+	if (*p < 0x80) {
+	    *q = *p++;
+	} else if ((*p & 0xe0) == 0xc0 && p + 1 < end && (p[1] & 0xc0) == 0x80) {
+	    /* Two bytes, U+0080 to U+07FF */
+	    *q = (p[0] & 0x1f) < 4 ? (p[0] & 0x1f) << 6 | (p[1] & 0x3f) : '?';
+	    p += 2;
+	} else if (*p >= 0xc0) {
+	    /* Longer sequences are never Latin-1 */
+	    *q = '?';
+	    for (++p; p < end && (*p & 0xc0) == 0x80; ++p)
+	      ;
+	} else {
+	    /* Not UTF-8, assume it was Latin-1 already */
+	    *q = *p++;
+	}
+    }
+    *q = '\0';
+    memcpy(tf->header.identifier, tag, 4);
+    tf->header.length = (q - tf->string) + 2;	/* Encoding and nul */
+    tf->header.flags = 0;
+    tf->header.offset = 0;
+    tf->header.next = NULL;
+    tf->encoding = ID3_ENCODING_LATIN1;
+    return tf;
+}
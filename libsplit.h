@@ -0,0 +1,87 @@
+#ifndef	LIBSPLIT_H
+#define	LIBSPLIT_H
+
+#include <stdint.h>
+
+#include "libwav.h"
+
+/**
+ * Cutting a .wav file into new files without decoding it.
+ *
+ * Each new file is a copy of the input's format chunk, a data chunk
+ * that refers to a range of frames of the input's data, and whatever
+ * tag chunks the caller adds. Writing it copies the range with
+ * libwav's file range copy, so the samples never pass through a
+ * decoder, and the files are written on several threads.
+ */
+
+typedef struct split_output {
+  const char *source;	/* Input file name */
+  char *filename;	/* Output file name */
+  WaveChunk *wave;	/* From SplitWave() */
+  int rval;		/* Exit code of writing it */
+} SplitOutput;
+
+#ifdef	__cplusplus
+extern	"C"
+{
+#endif
+
+extern const char *SplitError;	/* Error text from last failure */
+
+/**
+ * Check that the data of a file can be cut at any frame: PCM, float
+ * or G.711, with a nonzero block_align.
+ * @param frames  receives the # of frames in the data
+ * @return 0 if so, else -1 with SplitError set
+ */
+extern	int	SplitFrames(WaveChunk *waveFile, uint32_t *frames);
+
+/**
+ * Copy the input's LIST/INFO chunk.
+ * @return the copy, empty if the input has none, or NULL if out of
+ *         memory
+ */
+extern	ListChunk *SplitCopyInfo(WaveChunk *waveFile);
+
+/**
+ * Set an INFO tag, replacing any with the same tag.
+ * @return 0 on success, -1 if out of memory
+ */
+extern	int	SplitSetInfo(ListChunk *info, const char *tag, const char *value);
+
+/**
+ * Build an "id3 " chunk with the ID3 equivalents of the INFO tags
+ * that have them: INAM is TIT2, IART is TPE1, IPRD is TALB, ITRK is
+ * TRCK, ICRD is TYER and IGNR is TCON.
+ * @return new chunk, or NULL if out of memory
+ */
+extern	Chunk	*SplitId3(const ListChunk *info);
+
+/**
+ * Build a new file holding frames start up to end of the input.
+ * @param tags  chunks to add after the data, e.g. from SplitCopyInfo()
+ *              and SplitId3(), linked by their next fields. The new
+ *              file owns them; on failure the caller still does.
+ * @return the new file, or NULL if out of memory
+ */
+extern	WaveChunk *SplitWave(WaveChunk *waveFile, uint32_t start, uint32_t end,
+			Chunk *tags);
+
+/**
+ * Write the files, on up to threads threads. Messages are printed
+ * for files that fail, and their rval is set.
+ * @return the highest rval
+ */
+extern	int	SplitWrite(SplitOutput *outputs, int n, int threads);
+
+/**
+ * Free the file names and files of n outputs, and the outputs array.
+ */
+extern	void	SplitFree(SplitOutput *outputs, int n);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* LIBSPLIT_H */
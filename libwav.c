@@ -1,4 +1,7 @@
 
+#ifdef	LINUX
+#define	_GNU_SOURCE	/* copy_file_range() */
+#endif
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
@@ -9,6 +12,9 @@
 #include <getopt.h>
 #include <inttypes.h>
 #include <err.h>
+#include <pthread.h>
+#include <math.h>
+#include <sys/stat.h>
 
 #include "libwav.h"
 #include "libid3.h"
@@ -47,6 +53,58 @@ writeUInt16(void *buffer, uint16_t val)
     bytes[1] = (val>>8) & 0xff;
 }
 
+static inline uint32_t
+readUInt32BE(void *buffer)
+{
+    uint8_t *bytes = buffer;
+    return (uint32_t)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+}
+
+static inline uint16_t
+readUInt16BE(void *buffer)
+{
+    uint8_t *bytes = buffer;
+    return bytes[0] << 8 | bytes[1];
+}
+
+static inline void
+writeUInt32BE(void *buffer, uint32_t val)
+{
+    uint8_t *bytes = buffer;
+    bytes[0] = (val>>24) & 0xff;
+    bytes[1] = (val>>16) & 0xff;
+    bytes[2] = (val>>8) & 0xff;
+    bytes[3] = val & 0xff;
+}
+
+static inline void
+writeUInt16BE(void *buffer, uint16_t val)
+{
+    uint8_t *bytes = buffer;
+    bytes[0] = (val>>8) & 0xff;
+    bytes[1] = val & 0xff;
+}
+
+/* True while an AIFF file is read or written: IFF is big-endian */
+static _Thread_local bool bigEndian;
+
+/* Chunk lengths and other numbers in the byte order of the file */
+static inline uint32_t
+readFileUInt32(void *buffer)
+{
+    return bigEndian ? readUInt32BE(buffer) : readUInt32(buffer);
+}
+
+static inline void
+writeFileUInt32(void *buffer, uint32_t val)
+{
+    if (bigEndian) {
+	writeUInt32BE(buffer, val);
+    } else {
+	writeUInt32(buffer, val);
+    }
+}
+
 #define	NA(a)	(sizeof(a)/sizeof(a[0]))
 
 /* Internal type definitions */
@@ -65,30 +123,45 @@ static Chunk *readChunk(FILE *, uint32_t offset);
 static Chunk *readList(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
 static Chunk *readFmt(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
 static Chunk *readData(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
-#if 0
 static Chunk *readCues(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
 static Chunk *readLabl(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
 static Chunk *readLtxt(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
-#endif
 static Chunk *readText(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
 static Chunk *readId3(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
 //static Chunk *readInt16(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
 static Chunk *readInt32(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
+static Chunk *readChecksum(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
+static Chunk *readBext(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
+static Chunk *readSmpl(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
+static Chunk *readInst(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
+static Chunk *readComm(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
+static Chunk *readSsnd(FILE *, uint32_t offset, const char *, ChunkType *, uint32_t);
+static ChunkType *findChunkType(const char *tag);
 
 static void writeWave(WaveChunk *, FILE *src, FILE *dst, uint32_t *offset);
 static void writeChunk(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
 static void writeList(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
 static void writeFmt(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
 static void writeData(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
-#if 0
+static int copyRange(FILE *src, off_t start, FILE *dst, size_t len);
+static void copyData(Chunk *, FILE *src, off_t start, size_t len, FILE *dst);
 static void writeCues(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
 static void writeLabl(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
 static void writeLtxt(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
-#endif
 static void writeText(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
 static void writeId3(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
 //static void writeInt16(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
 static void writeInt32(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
+static void writeChecksum(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
+static void writeBext(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
+static void writeSmpl(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
+static void writeInst(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
+static void writeComm(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
+static void writeSsnd(Chunk *, FILE *src, FILE *dst, uint32_t *offset);
+static void writeSamples(Chunk *, FILE *src, off_t start, size_t len, FILE *dst);
+static void writeBytes(Chunk *, const void *buffer, size_t len, FILE *dst);
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t *p, size_t len);
 
 
 const char *WaveError;
@@ -111,11 +184,17 @@ OpenWaveFile(FILE *ifile)
 	goto exit;
     }
 
-    if (memcmp(buffer, "RIFF", 4) != 0) {
-	WaveError = "File does not seem to be a RIFF file";
+    if (memcmp(buffer, "RIFF", 4) == 0) {
+	bigEndian = false;
+    } else if (memcmp(buffer, "FORM", 4) == 0 &&
+	       (memcmp(buffer+8, "AIFF", 4) == 0 || memcmp(buffer+8, "AIFC", 4) == 0))
+    {
+	bigEndian = true;
+    } else {
+	WaveError = "File does not seem to be a RIFF or AIFF file";
 	goto exit;
     }
-    fileLen = readUInt32(buffer+4);
+    fileLen = readFileUInt32(buffer+4);
 
     rval = (WaveChunk *)newChunk(buffer, fileLen, 0, sizeof(*rval));
     if (rval == NULL) {
@@ -137,7 +216,8 @@ OpenWaveFile(FILE *ifile)
 	}
 	*children = child;
 	children = &child->next;
-	offset += 8 + child->length;
+	/* Odd length chunks are followed by a pad byte */
+	offset += 8 + child->length + (child->length & 1);
     }
 
 exit:
@@ -175,22 +255,56 @@ static ChunkType chunkTypes[] = {
     {"ITRK", "Track", readText, writeText},
     {"fact", "Samples", readInt32, writeInt32},
     {"slnt", "Silence", readInt32, writeInt32},
-#if 0
+    {"bsum", "Block checksums", readChecksum, writeChecksum},
     {"cue ", "Cues", readCues, writeCues},
     {"labl", "Label", readLabl, writeLabl},
     {"note", "Note", readLabl, writeLabl},
-    {"ltxt", "?", readLtxt, writeLtxt},
-#endif
+    {"ltxt", "Labeled text", readLtxt, writeLtxt},
     {"id3 ", "ID3 data", readId3, writeId3},
+    {"bext", "Broadcast extension", readBext, writeBext},
+    {"iXML", "iXML metadata", readText, writeText},
+    {"smpl", "Sampler", readSmpl, writeSmpl},
+    {"inst", "Instrument", readInst, writeInst},
+};
+
+/* The chunks of AIFF and AIFC files */
+static ChunkType aiffChunkTypes[] = {
+    {"COMM", "Common", readComm, writeComm},
+    {"SSND", "Sound data", readSsnd, writeSsnd},
+    {"FVER", "Format version", readInt32, writeInt32},
+    {"NAME", "Name", readText, writeText},
+    {"AUTH", "Author", readText, writeText},
+    {"(c) ", "Copyright", readText, writeText},
+    {"ANNO", "Annotation", readText, writeText},
+    {"ID3 ", "ID3 data", readId3, writeId3},
 };
 
+/**
+ * Look up a chunk tag in the table for the kind of file being read
+ * or written.
+ * @return the chunk type, or NULL if it is not known
+ */
+static ChunkType *
+findChunkType(const char *tag)
+{
+    ChunkType *types = bigEndian ? aiffChunkTypes : chunkTypes;
+    size_t i, n = bigEndian ? NA(aiffChunkTypes) : NA(chunkTypes);
+
+    for (i=0; i < n; ++i) {
+	if (strncasecmp(tag, types[i].tag, 4) == 0) {
+	    return &types[i];
+	}
+    }
+    return NULL;
+}
+
 static Chunk *
 readChunk(FILE *ifile, uint32_t offset)
 {
     Chunk *chunk = NULL;
+    ChunkType *chunkType;
     char buffer[8];
     uint32_t chunkLen;
-    int i;
 
     if (fseek(ifile, (long)offset, SEEK_SET) != 0) {
 	WaveError = "OpenWaveFile: fseek failed";
@@ -205,13 +319,10 @@ readChunk(FILE *ifile, uint32_t offset)
      * function to read it in.
      */
 
-    chunkLen = readUInt32(buffer+4);
+    chunkLen = readFileUInt32(buffer+4);
 
-    for (i=0; i < NA(chunkTypes); ++i) {
-	if (strncasecmp(buffer, chunkTypes[i].tag, 4) == 0) {
-	    chunk = chunkTypes[i].reader(ifile, offset, buffer, &chunkTypes[i], chunkLen);
-	    break;
-	}
+    if ((chunkType = findChunkType(buffer)) != NULL) {
+	chunk = chunkType->reader(ifile, offset, buffer, chunkType, chunkLen);
     }
     if (chunk == NULL) {
 	/* Unknown chunk type, return a generic chunk. We read
@@ -261,7 +372,7 @@ readList(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, ui
 	}
 	*children = child;
 	children = &child->next;
-	off2 += 8 + child->length;
+	off2 += 8 + child->length + (child->length & 1);
     }
 
 exit:
@@ -278,9 +389,12 @@ readFmt(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uin
     FmtChunk *fc;
     uint8_t buffer[16];
 
+    /* A short one is read as zeros rather than left as an unknown
+     * chunk, so that a "fmt " chunk is always a FmtChunk.
+     */
+    memset(buffer, 0, sizeof(buffer));
     if (fread(buffer, 1, 16, ifile) != 16) {
 	WaveError = "Short file";
-	goto exit;
     }
 
     if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*fc))) == NULL) {
@@ -294,6 +408,22 @@ readFmt(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uin
     fc->bytes_sec = readUInt32(buffer+8);
     fc->block_align = readUInt16(buffer+12);
     fc->bits_samp = readUInt16(buffer+14);
+    fc->ext_len = 0;
+    fc->ext = NULL;
+
+    /* Keep any extension (cbSize and what follows) as raw bytes */
+    if (chunkLen > 16) {
+	fc->ext_len = chunkLen - 16 > 0xffff ? 0xffff : chunkLen - 16;
+	if ((fc->ext = malloc(fc->ext_len)) == NULL) {
+	    WaveError = "Out of memory";
+	    fc->ext_len = 0;
+	} else if (fread(fc->ext, 1, fc->ext_len, ifile) != fc->ext_len) {
+	    WaveError = "Short file";
+	    free(fc->ext);
+	    fc->ext = NULL;
+	    fc->ext_len = 0;
+	}
+    }
 
 exit:
     return chunk;
@@ -307,39 +437,118 @@ exit:
 static Chunk *
 readData(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
 {
-    Chunk *chunk = NULL;
-    DataChunk *dc;
+    return (Chunk *)newDataChunk(tag, chunkLen, offset);
+}
 
-    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*dc))) == NULL) {
+/**
+ * Read a cue chunk: a count, then 24 bytes per cue point
+ */
+static Chunk *
+readCues(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
+{
+    Chunk *chunk = NULL;
+    CueChunk *cc;
+    uint8_t buffer[24];
+    uint32_t i, n = 0;
+
+    if (chunkLen >= 4 && fread(buffer, 1, 4, ifile) == 4) {
+	n = readUInt32(buffer);
+	if (n > (chunkLen - 4) / 24) {
+	    n = (chunkLen - 4) / 24;
+	}
+    }
+    if ((chunk = newChunk(tag, chunkLen, offset,
+		sizeof(*cc) + n * sizeof(Cue))) == NULL)
+    {
 	goto exit;
     }
-    dc = (DataChunk *)chunk;
+    cc = (CueChunk *)chunk;
+    cc->n_cues = n;
+    memset(cc->cues, 0, n * sizeof(Cue));
 
-    dc->data = NULL;
+    for (i=0; i < n; ++i) {
+	if (fread(buffer, 1, 24, ifile) != 24) {
+	    WaveError = "Short file";
+	    goto exit;
+	}
+	cc->cues[i].name = readUInt32(buffer);
+	cc->cues[i].position = readUInt32(buffer+4);
+	memcpy(cc->cues[i].fcc_chunk, buffer+8, 4);
+	cc->cues[i].chunk_start = readUInt32(buffer+12);
+	cc->cues[i].block_start = readUInt32(buffer+16);
+	cc->cues[i].sample_offset = readUInt32(buffer+20);
+    }
 
 exit:
     return chunk;
 }
 
-#if 0
-static Chunk *
-readCues(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
-{
-    return NULL;
-}
-
+/**
+ * Read a labl or note chunk: a cue point name and text. The text
+ * is nul-terminated even if the file's is not.
+ */
 static Chunk *
 readLabl(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
 {
-    return NULL;
+    Chunk *chunk = NULL;
+    LablChunk *lc;
+    uint8_t buffer[4];
+    uint32_t len = chunkLen > 4 ? chunkLen - 4 : 0;
+
+    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*lc) + len + 1)) == NULL) {
+	goto exit;
+    }
+    lc = (LablChunk *)chunk;
+    lc->name = 0;
+    memset(lc->label, 0, len + 1);
+
+    if (fread(buffer, 1, 4, ifile) != 4 ||
+	fread(lc->label, 1, len, ifile) != len)
+    {
+	WaveError = "Short file";
+	goto exit;
+    }
+    lc->name = readUInt32(buffer);
+
+exit:
+    return chunk;
 }
 
+/**
+ * Read an ltxt chunk: a cue point name, the length of the region
+ * that starts there, its purpose, language information, then text.
+ */
 static Chunk *
 readLtxt(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
 {
-    return NULL;
+    Chunk *chunk = NULL;
+    LtxtChunk *lc;
+    uint8_t buffer[20];
+    uint32_t len = chunkLen > 20 ? chunkLen - 20 : 0;
+
+    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*lc) + len + 1)) == NULL) {
+	goto exit;
+    }
+    lc = (LtxtChunk *)chunk;
+    memset(buffer, 0, sizeof(buffer));
+    memset(lc->data, 0, len + 1);
+
+    if (fread(buffer, 1, 20, ifile) != 20 ||
+	fread(lc->data, 1, len, ifile) != len)
+    {
+	WaveError = "Short file";
+    }
+    lc->name = readUInt32(buffer);
+    lc->sample_length = readUInt32(buffer+4);
+    memcpy(lc->purpose, buffer+8, 4);
+    lc->country = readUInt16(buffer+12);
+    lc->language = readUInt16(buffer+14);
+    lc->dialext = readUInt16(buffer+16);
+    lc->codepage = readUInt16(buffer+18);
+
+exit:
+    return chunk;
 }
-#endif
 
 static Chunk *
 readId3(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
@@ -348,7 +557,7 @@ readId3(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uin
     Id3v2Chunk *ic;
     uint8_t *buffer = NULL;
 
-    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*chunk))) == NULL) {
+    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*ic))) == NULL) {
 	goto exit;
     }
     ic = (Id3v2Chunk *)chunk;
@@ -361,7 +570,8 @@ exit:
 }
 
 /**
- * Read a text that contains a single string
+ * Read a text that contains a single string. It is nul-terminated
+ * even if the file's is not.
  */
 static Chunk *
 readText(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
@@ -369,10 +579,11 @@ readText(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, ui
     Chunk *chunk = NULL;
     TextChunk *tc;
 
-    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*chunk)+chunkLen)) == NULL) {
+    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*chunk)+chunkLen+1)) == NULL) {
 	goto exit;
     }
     tc = (TextChunk *)chunk;
+    tc->string[chunkLen] = '\0';
 
     if (fread(tc->string, 1, chunkLen, ifile) != chunkLen) {
 	WaveError = "Short file";
@@ -410,197 +621,797 @@ readInt32(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, u
 	WaveError = "Short file";
 	goto exit;
     }
-    ic->n = readUInt32(buffer);
+    ic->n = readFileUInt32(buffer);
 
 exit:
     return chunk;
 }
 
+/**
+ * Read a checksum chunk. A damaged one is kept, with a block size
+ * of 0, so that it is rebuilt when the file is written.
+ */
+static Chunk *
+readChecksum(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
+{
+    Chunk *chunk = NULL;
+    ChecksumChunk *cs;
+    uint8_t buffer[16], *crcs = NULL;
+    uint32_t i, count;
 
-	/*** WRITE WAV FILE */
+    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*cs))) == NULL) {
+	goto exit;
+    }
+    cs = (ChecksumChunk *)chunk;
+    cs->block = cs->data_length = cs->count = 0;
+    cs->crcs = NULL;
 
-static void computeSizes(Chunk *);
+    if (chunkLen < 16 || fread(buffer, 1, 16, ifile) != 16 ||
+	readUInt32(buffer) != 1)
+    {
+	goto exit;
+    }
+    count = readUInt32(buffer+12);
+    if ((chunkLen - 16) / 4 < count ||
+	(crcs = malloc((size_t)count * 4 + 1)) == NULL ||
+	(cs->crcs = malloc((size_t)count * sizeof(uint32_t) + 1)) == NULL ||
+	fread(crcs, 4, count, ifile) != count)
+    {
+	goto exit;
+    }
+    for (i=0; i < count; ++i) {
+	cs->crcs[i] = readUInt32(crcs + 4*i);
+    }
+    cs->block = readUInt32(buffer+4);
+    cs->data_length = readUInt32(buffer+8);
+    cs->count = count;
 
-void
-WriteWaveFile(WaveChunk *wave, FILE *src, FILE *dst)
+exit:
+    free(crcs);
+    return chunk;
+}
+
+/**
+ * Read a "bext" chunk. A short one is read as far as it goes.
+ */
+static Chunk *
+readBext(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
 {
-    uint32_t offset = 0;
+    Chunk *chunk = NULL;
+    BextChunk *bc;
+    uint8_t buffer[BEXT_SIZE];
+    uint32_t len = chunkLen > BEXT_SIZE ? chunkLen - BEXT_SIZE : 0;
 
-    /* Recurse through all of the data structures, writing
-     * to the output file. We need to recompute the
-     * offset as we go, replacing the offsets in the chunk
-     * headers.
-     */
+    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*bc) + len + 1)) == NULL) {
+	goto exit;
+    }
+    bc = (BextChunk *)chunk;
+    memset(buffer, 0, sizeof(buffer));
+    memset(bc->coding_history, 0, len + 1);
 
-    computeSizes((Chunk *)wave);
-    writeWave(wave, src, dst, &offset);
+    if (fread(buffer, 1, chunkLen < BEXT_SIZE ? chunkLen : BEXT_SIZE, ifile) !=
+	    (chunkLen < BEXT_SIZE ? chunkLen : BEXT_SIZE) ||
+	fread(bc->coding_history, 1, len, ifile) != len)
+    {
+	WaveError = "Short file";
+    }
+    memcpy(bc->description, buffer, 256);
+    bc->description[256] = '\0';
+    memcpy(bc->originator, buffer+256, 32);
+    bc->originator[32] = '\0';
+    memcpy(bc->originator_reference, buffer+288, 32);
+    bc->originator_reference[32] = '\0';
+    memcpy(bc->origination_date, buffer+320, 10);
+    bc->origination_date[10] = '\0';
+    memcpy(bc->origination_time, buffer+330, 8);
+    bc->origination_time[8] = '\0';
+    bc->time_reference = readUInt32(buffer+338) |
+			(uint64_t)readUInt32(buffer+342) << 32;
+    bc->version = readUInt16(buffer+346);
+    memcpy(bc->umid, buffer+348, 64);
+    bc->loudness_value = (int16_t)readUInt16(buffer+412);
+    bc->loudness_range = (int16_t)readUInt16(buffer+414);
+    bc->max_true_peak_level = (int16_t)readUInt16(buffer+416);
+    bc->max_momentary_loudness = (int16_t)readUInt16(buffer+418);
+    bc->max_short_term_loudness = (int16_t)readUInt16(buffer+420);
+    memcpy(bc->reserved, buffer+422, 180);
+
+exit:
+    return chunk;
 }
 
 /**
- * Compute the length value of this chunk.
+ * Read a "smpl" chunk: 36 bytes of fields, the loops, then any
+ * sampler data. The # of loops is limited to what the chunk holds.
  */
-static void
-computeSizes(Chunk *chunk)
+static Chunk *
+readSmpl(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
 {
-    Chunk *child = NULL;
-    uint32_t length = 0;
-    /* The vast majority of the time, this value is already
-     * in the header and doesn't need to be changed.
-     * The exception is wave headers and list headers,
-     * which need to sum up their children.
-     */
-    if (strncasecmp(chunk->identifier, "riff", 4) == 0 ||
-        strncasecmp(chunk->identifier, "list", 4) == 0)
-    {
-	ListChunk *lc = (ListChunk *)chunk;
-	child = lc->children;
-	length = 4;
+    Chunk *chunk = NULL;
+    SmplChunk *sc;
+    uint8_t buffer[36];
+    uint32_t i, n = 0, len = 0;
+
+    memset(buffer, 0, sizeof(buffer));
+    if (chunkLen >= 36 && fread(buffer, 1, 36, ifile) == 36) {
+	n = readUInt32(buffer+28);
+	if (n > (chunkLen - 36) / 24) {
+	    n = (chunkLen - 36) / 24;
+	}
+	len = chunkLen - 36 - 24 * n;
     }
-
-    if (child != NULL)
-    {
-	for (; child != NULL; child = child->next) {
-	    computeSizes(child);
-	    length += child->length + 8;
+    if ((chunk = (Chunk *)NewSmplChunk(n, len)) == NULL) {
+	goto exit;
+    }
+    memcpy(chunk->identifier, tag, 4);
+    chunk->length = chunkLen;
+    chunk->offset = offset;
+    sc = (SmplChunk *)chunk;
+    sc->manufacturer = readUInt32(buffer);
+    sc->product = readUInt32(buffer+4);
+    sc->sample_period = readUInt32(buffer+8);
+    sc->midi_unity_note = readUInt32(buffer+12);
+    sc->midi_pitch_fraction = readUInt32(buffer+16);
+    sc->smpte_format = readUInt32(buffer+20);
+    sc->smpte_offset = readUInt32(buffer+24);
+
+    for (i=0; i < n; ++i) {
+	if (fread(buffer, 1, 24, ifile) != 24) {
+	    WaveError = "Short file";
+	    goto exit;
 	}
-	chunk->length = length;
+	sc->loops[i].name = readUInt32(buffer);
+	sc->loops[i].type = readUInt32(buffer+4);
+	sc->loops[i].start = readUInt32(buffer+8);
+	sc->loops[i].end = readUInt32(buffer+12);
+	sc->loops[i].fraction = readUInt32(buffer+16);
+	sc->loops[i].play_count = readUInt32(buffer+20);
+    }
+    if (fread(sc->sampler_data, 1, len, ifile) != len) {
+	WaveError = "Short file";
     }
-}
 
+exit:
+    return chunk;
+}
 
-static void
-writeWave(WaveChunk *wave, FILE *src, FILE *dst, uint32_t *offset)
+/**
+ * Read an "inst" chunk, seven bytes.
+ */
+static Chunk *
+readInst(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
 {
-    Chunk *child;
-    uint8_t buffer[12];
-
-    memcpy(buffer, wave->header.identifier, 4);
-    writeUInt32(buffer+4, wave->header.length);
-    memcpy(buffer+8, wave->type, 4);
-    fwrite(buffer, 1, sizeof(buffer), dst);
-    *offset += sizeof(buffer);
+    Chunk *chunk = NULL;
+    InstChunk *ic;
+    uint8_t buffer[7];
 
-    for (child = wave->children; child != NULL; child = child->next)
+    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*ic))) == NULL) {
+	goto exit;
+    }
+    ic = (InstChunk *)chunk;
+    memset(buffer, 0, sizeof(buffer));
+    if (fread(buffer, 1, chunkLen < 7 ? chunkLen : 7, ifile) !=
+	    (chunkLen < 7 ? chunkLen : 7))
     {
-	writeChunk(child, src, dst, offset);
+	WaveError = "Short file";
     }
+    ic->unshifted_note = buffer[0];
+    ic->fine_tune = (int8_t)buffer[1];
+    ic->gain = (int8_t)buffer[2];
+    ic->low_note = buffer[3];
+    ic->high_note = buffer[4];
+    ic->low_velocity = buffer[5];
+    ic->high_velocity = buffer[6];
 
+exit:
+    return chunk;
 }
 
-static void
-writeChunk(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
+/**
+ * Read an 80-bit IEEE extended float, as AIFF stores the sample rate.
+ */
+static double
+readExtended(uint8_t *buffer)
 {
-    int i;
+    int exponent = (buffer[0] & 0x7f) << 8 | buffer[1];
+    uint64_t mantissa = (uint64_t)readUInt32BE(buffer+2) << 32 |
+			readUInt32BE(buffer+6);
+    double value;
 
-    for (i=0; i < NA(chunkTypes); ++i) {
-	if (strncasecmp(chunk->identifier, chunkTypes[i].tag, 4) == 0) {
-	    chunkTypes[i].writer(chunk, src, dst, offset);
-	    return;
-	}
+    if (exponent == 0 && mantissa == 0) {
+	return 0;
     }
-
-    /* Unknown chunk type, return a generic chunk. We read
-     * the header, but leave the data in the file.
-     */
-    writeData(chunk, src, dst, offset);
+    value = ldexp((double)mantissa, exponent - 16383 - 63);
+    return buffer[0] & 0x80 ? -value : value;
 }
 
 static void
-writeList(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
+writeExtended(uint8_t *buffer, double value)
 {
-    ListChunk *lc = (ListChunk *)chunk;
-    Chunk *child;
-    char buffer[12];
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool negative = value < 0;
 
-    memcpy(buffer, chunk->identifier, 4);
-    writeUInt32(buffer+4, chunk->length);
-    memcpy(buffer+8, lc->type, 4);
-    fwrite(buffer, 1, sizeof(buffer), dst);
-    *offset += sizeof(buffer);
-    for (child = lc->children; child != NULL; child = child->next)
-    {
-	writeChunk(child, src, dst, offset);
+    memset(buffer, 0, 10);
+    if (negative) {
+	value = -value;
+    }
+    if (value > 0) {
+	/* value = m * 2^e, with m in [0.5,1) */
+	mantissa = (uint64_t)ldexp(frexp(value, &exponent), 64);
+	exponent += 16383 - 1;
     }
+    buffer[0] = (negative ? 0x80 : 0) | (exponent >> 8 & 0x7f);
+    buffer[1] = exponent & 0xff;
+    writeUInt32BE(buffer+2, (uint32_t)(mantissa >> 32));
+    writeUInt32BE(buffer+6, (uint32_t)mantissa);
 }
 
-static void
-writeFmt(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
+/**
+ * Read a "COMM" chunk: 18 bytes, plus the compression type and a
+ * Pascal string naming it in AIFC files.
+ */
+static Chunk *
+readComm(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
 {
-    FmtChunk *fc = (FmtChunk *)chunk;
-    char buffer[24];
-
-    memcpy(buffer, chunk->identifier, 4);
-    writeUInt32(buffer+4, 16);
+    Chunk *chunk = NULL;
+    CommChunk *cc;
+    uint8_t buffer[22+256];
+    size_t len = chunkLen < sizeof(buffer) ? chunkLen : sizeof(buffer);
 
-    writeUInt16(buffer+8, fc->type);
-    writeUInt16(buffer+10, fc->channels);
-    writeUInt32(buffer+12, fc->sample_rate);
-    writeUInt32(buffer+16, fc->bytes_sec);
-    writeUInt16(buffer+20, fc->block_align);
-    writeUInt16(buffer+22, fc->bits_samp);
+    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*cc))) == NULL) {
+	goto exit;
+    }
+    cc = (CommChunk *)chunk;
+    memset(buffer, 0, sizeof(buffer));
+    if (chunkLen < 18 || fread(buffer, 1, len, ifile) != len) {
+	WaveError = "Short file";
+    }
+    cc->channels = readUInt16BE(buffer);
+    cc->frames = readUInt32BE(buffer+2);
+    cc->bits_samp = readUInt16BE(buffer+6);
+    cc->sample_rate = readExtended(buffer+8);
+    memcpy(cc->compression, buffer+18, 4);
+    len = len > 23 ? buffer[22] : 0;
+    if (len > 0) {
+	memcpy(cc->compression_name, buffer+23, len);
+    }
+    cc->compression_name[len] = '\0';
 
-    fwrite(buffer, 1, sizeof(buffer), dst);
-    *offset += sizeof(buffer);
+exit:
+    return chunk;
 }
 
 /**
- * Write a data chunk. This is the only write function that
- * references the source file, and only if the "data" field
- * is NULL.
+ * Read an "SSND" chunk. Like readData(), this only notes where the
+ * samples are.
+ */
+static Chunk *
+readSsnd(FILE *ifile, uint32_t offset, const char *tag, ChunkType *chunkType, uint32_t chunkLen)
+{
+    Chunk *chunk = NULL;
+    SsndChunk *sc;
+    uint8_t buffer[8];
+
+    if ((chunk = newChunk(tag, chunkLen, offset, sizeof(*sc))) == NULL) {
+	goto exit;
+    }
+    sc = (SsndChunk *)chunk;
+    memset(&sc->data.data, 0, sizeof(*sc) - sizeof(Chunk));
+    if (chunkLen < 8 || fread(buffer, 1, 8, ifile) != 8) {
+	WaveError = "Short file";
+	goto exit;
+    }
+    sc->data_offset = readUInt32BE(buffer);
+    sc->block_size = readUInt32BE(buffer+4);
+    if (sc->data_offset > chunkLen - 8) {
+	sc->data_offset = chunkLen - 8;
+    }
+
+exit:
+    return chunk;
+}
+
+
+	/*** WRITE WAV FILE */
+
+static void computeSizes(Chunk *);
+static ChecksumChunk *prepareChecksums(WaveChunk *);
+
+/* Per thread, so that several files can be written at once */
+static _Thread_local bool writeFailed;
+static _Thread_local ChecksumChunk *checksums;	/* Being computed */
+static _Thread_local Chunk *summedData;		/* The data they cover */
+
+int
+WriteWaveFile(WaveChunk *wave, FILE *src, FILE *dst)
+{
+    uint32_t offset = 0;
+
+    writeFailed = false;
+    summedData = NULL;
+    bigEndian = strncasecmp(wave->header.identifier, "FORM", 4) == 0;
+    checksums = prepareChecksums(wave);
+
+    /* Recurse through all of the data structures, writing
+     * to the output file. We need to recompute the
+     * offset as we go, replacing the offsets in the chunk
+     * headers.
+     */
+
+    computeSizes((Chunk *)wave);
+    writeWave(wave, src, dst, &offset);
+    checksums = NULL;
+    summedData = NULL;
+    if (!writeFailed && ferror(dst)) {
+	WaveError = "Write error";
+	writeFailed = true;
+    }
+    return writeFailed ? -1 : 0;
+}
+
+/**
+ * Get a checksum chunk ready to be filled in as the data is written:
+ * it must come after the data chunk, and be sized for its length.
+ * @return the checksum chunk, or NULL if there is none
+ */
+static ChecksumChunk *
+prepareChecksums(WaveChunk *wave)
+{
+    Chunk **ptr, **sumPtr = NULL, *data = NULL;
+    ChecksumChunk *cs;
+    FmtChunk *fc;
+    uint32_t align, *crcs;
+
+    for (ptr = &wave->children; *ptr != NULL; ptr = &(*ptr)->next) {
+	if (sumPtr == NULL && strncasecmp((*ptr)->identifier, "bsum", 4) == 0) {
+	    sumPtr = ptr;
+	} else if (data == NULL && strncasecmp((*ptr)->identifier, "data", 4) == 0) {
+	    data = *ptr;
+	}
+    }
+    if (sumPtr == NULL) {
+	return NULL;
+    }
+    cs = (ChecksumChunk *)*sumPtr;
+    cs->count = cs->data_length = 0;
+    cs->header.length = 16;
+    if (data == NULL) {
+	return NULL;
+    }
+    if (data->next != (Chunk *)cs) {
+	*sumPtr = cs->header.next;
+	cs->header.next = data->next;
+	data->next = (Chunk *)cs;
+    }
+
+    if (cs->block == 0) {
+	fc = (FmtChunk *)FindChunk(wave->children, "fmt ", NULL);
+	align = fc != NULL && fc->block_align > 0 ? fc->block_align : 1;
+	cs->block = CHECKSUM_BLOCK / align * align;
+	if (cs->block == 0) {
+	    cs->block = align;
+	}
+    }
+    cs->count = data->length / cs->block + (data->length % cs->block != 0);
+    if ((crcs = realloc(cs->crcs, cs->count * sizeof(uint32_t) + 1)) == NULL) {
+	WaveError = "Out of memory";
+	writeFailed = true;
+	cs->count = 0;
+	return NULL;
+    }
+    cs->crcs = crcs;
+    memset(crcs, 0, cs->count * sizeof(uint32_t));
+    cs->data_length = data->length;
+    cs->header.length = 16 + 4 * cs->count;
+    cs->crc = cs->used = cs->done = 0;
+    summedData = data;
+    return cs;
+}
+
+/**
+ * Compute the length value of this chunk.
+ */
+static void
+computeSizes(Chunk *chunk)
+{
+    Chunk *child = NULL;
+    uint32_t length = 0;
+
+    if (strncasecmp(chunk->identifier, "cue ", 4) == 0) {
+	chunk->length = 4 + 24 * ((CueChunk *)chunk)->n_cues;
+	return;
+    }
+    if (strncasecmp(chunk->identifier, "smpl", 4) == 0) {
+	chunk->length = 36 + 24 * ((SmplChunk *)chunk)->n_loops +
+			((SmplChunk *)chunk)->sampler_data_len;
+	return;
+    }
+    if (strncasecmp(chunk->identifier, "comm", 4) == 0 && bigEndian) {
+	CommChunk *cc = (CommChunk *)chunk;
+	size_t len = strnlen(cc->compression_name, 255);
+	/* AIFC adds the compression type and a padded Pascal string */
+	chunk->length = cc->compression[0] == '\0' ? 18 :
+			22 + len + 1 + (len + 1) % 2;
+	return;
+    }
+    /* The vast majority of the time, this value is already
+     * in the header and doesn't need to be changed.
+     * The exception is wave headers and list headers,
+     * which need to sum up their children.
+     */
+    if (strncasecmp(chunk->identifier, "riff", 4) == 0 ||
+        strncasecmp(chunk->identifier, "form", 4) == 0 ||
+        strncasecmp(chunk->identifier, "list", 4) == 0)
+    {
+	ListChunk *lc = (ListChunk *)chunk;
+	child = lc->children;
+	length = 4;
+    }
+
+    if (child != NULL)
+    {
+	for (; child != NULL; child = child->next) {
+	    computeSizes(child);
+	    length += child->length + 8 + (child->length & 1);
+	}
+	chunk->length = length;
+    }
+}
+
+
+static void
+writeWave(WaveChunk *wave, FILE *src, FILE *dst, uint32_t *offset)
+{
+    Chunk *child;
+    uint8_t buffer[12];
+
+    memcpy(buffer, wave->header.identifier, 4);
+    writeFileUInt32(buffer+4, wave->header.length);
+    memcpy(buffer+8, wave->type, 4);
+    fwrite(buffer, 1, sizeof(buffer), dst);
+    *offset += sizeof(buffer);
+
+    for (child = wave->children; child != NULL; child = child->next)
+    {
+	writeChunk(child, src, dst, offset);
+    }
+
+}
+
+static void
+writeChunk(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
+{
+    ChunkType *chunkType;
+
+    if ((chunkType = findChunkType(chunk->identifier)) != NULL) {
+	chunkType->writer(chunk, src, dst, offset);
+    } else {
+	/* Unknown chunk type, return a generic chunk. We read
+	 * the header, but leave the data in the file.
+	 */
+	writeData(chunk, src, dst, offset);
+    }
+
+    /* Odd length chunks are followed by a pad byte */
+    if (chunk->length & 1) {
+	putc(0, dst);
+	*offset += 1;
+    }
+}
+
+static void
+writeList(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
+{
+    ListChunk *lc = (ListChunk *)chunk;
+    Chunk *child;
+    char buffer[12];
+
+    memcpy(buffer, chunk->identifier, 4);
+    writeUInt32(buffer+4, chunk->length);
+    memcpy(buffer+8, lc->type, 4);
+    fwrite(buffer, 1, sizeof(buffer), dst);
+    *offset += sizeof(buffer);
+    for (child = lc->children; child != NULL; child = child->next)
+    {
+	writeChunk(child, src, dst, offset);
+    }
+}
+
+static void
+writeFmt(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
+{
+    FmtChunk *fc = (FmtChunk *)chunk;
+    char buffer[24];
+    uint32_t len = chunk->length < 16 ? 16 : chunk->length;
+    uint32_t i;
+
+    memcpy(buffer, chunk->identifier, 4);
+    writeUInt32(buffer+4, len);
+
+    writeUInt16(buffer+8, fc->type);
+    writeUInt16(buffer+10, fc->channels);
+    writeUInt32(buffer+12, fc->sample_rate);
+    writeUInt32(buffer+16, fc->bytes_sec);
+    writeUInt16(buffer+20, fc->block_align);
+    writeUInt16(buffer+22, fc->bits_samp);
+
+    fwrite(buffer, 1, sizeof(buffer), dst);
+    *offset += sizeof(buffer);
+
+    /* The extension is written only if the length allows for it */
+    for (i = 16; i < len; ++i) {
+	putc(fc->ext != NULL && i-16 < fc->ext_len ? fc->ext[i-16] : 0, dst);
+    }
+    *offset += len - 16;
+}
+
+/**
+ * Write a data chunk. This is the only write function that
+ * references the source file, and only if the "data", "source"
+ * and "segments" fields are NULL.
  */
 static void
 writeData(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
 {
-    DataChunk *dc = (DataChunk *)chunk;
     char buffer[8];
 
     memcpy(buffer, chunk->identifier, 4);
-    writeUInt32(buffer+4, chunk->length);
+    writeFileUInt32(buffer+4, chunk->length);
     fwrite(buffer, 1, sizeof(buffer), dst);
     *offset += sizeof(buffer);
 
+    writeSamples(chunk, src, (off_t)chunk->offset + 8, chunk->length, dst);
+    if (chunk == summedData && checksums->used > 0) {
+	/* The last, short block */
+	checksums->crcs[checksums->done++] = checksums->crc;
+	checksums->used = 0;
+    }
+    *offset += chunk->length;
+}
+
+/**
+ * Write len bytes of a data chunk's contents: from its data, source
+ * or segments if they are set, else from src at start.
+ */
+static void
+writeSamples(Chunk *chunk, FILE *src, off_t start, size_t len, FILE *dst)
+{
+    DataChunk *dc = (DataChunk *)chunk;
+
     if (dc->data != NULL)
     {
-	fwrite(dc->data, 1, chunk->length, dst);
+	writeBytes(chunk, dc->data, len, dst);
     }
-    else
+    else if (dc->source != NULL)
     {
-	/* Copy from src => dst */
-	char buf2[1024];
-	size_t len = (size_t) chunk->length;
-	size_t l;
-	fseek(src, (long)(chunk->offset+8), SEEK_SET);
-	while (len > 0) {
-	    l = len > sizeof(buf2) ? sizeof(buf2) : len;
-	    l = fread(buf2, 1, l, src);
-	    if (l == 0) {
-		fprintf(stderr, "Error reading data from source file, %s\n",
-		    strerror(errno));
+	/* Let the source produce the data */
+	size_t bufsize = 65536;
+	uint8_t *buf2 = malloc(bufsize);
+	long l;
+	if (buf2 == NULL) {
+	    WaveError = "Out of memory";
+	    writeFailed = true;
+	    bufsize = 0;
+	}
+	while (len > 0 && bufsize > 0) {
+	    l = dc->source(dc->source_ctx, buf2, len > bufsize ? bufsize : len);
+	    if (l <= 0) {
+		WaveError = "Data source failed";
+		writeFailed = true;
 		break;
 	    }
-	    fwrite(buf2, 1, l, dst);
+	    writeBytes(chunk, buf2, l, dst);
 	    len -= l;
 	}
+	/* Keep the file structure valid even if the data came up short */
+	for (; len > 0; --len) {
+	    writeBytes(chunk, "", 1, dst);
+	}
+	free(buf2);
+    }
+    else if (dc->segments != NULL)
+    {
+	/* Pieces of other files, end to end */
+	uint32_t i;
+	for (i=0; i < dc->n_segments; ++i) {
+	    copyData(chunk, dc->segments[i].file, dc->segments[i].offset,
+		dc->segments[i].length, dst);
+	}
+    }
+    else
+    {
+	copyData(chunk, src, start, len, dst);
+    }
+}
+
+/**
+ * Copy len bytes of src from start to dst, as part of chunk: by file
+ * range copy if the data need not be summed, else through stdio.
+ */
+static void
+copyData(Chunk *chunk, FILE *src, off_t start, size_t len, FILE *dst)
+{
+    char buf2[1024];
+    size_t l;
+
+    if (chunk != summedData && copyRange(src, start, dst, len) == 0) {
+	/* Copied without going through stdio */
+	return;
+    }
+    fseeko(src, start, SEEK_SET);
+    while (len > 0) {
+	l = len > sizeof(buf2) ? sizeof(buf2) : len;
+	l = fread(buf2, 1, l, src);
+	if (l == 0) {
+	    fprintf(stderr, "Error reading data from source file, %s\n",
+		strerror(errno));
+	    WaveError = "Error reading data from source file";
+	    writeFailed = true;
+	    break;
+	}
+	writeBytes(chunk, buf2, l, dst);
+	len -= l;
+    }
+}
+
+/**
+ * Copy a range of the source file to the end of dst by file
+ * descriptor: with copy_file_range(2) on Linux, so the kernel can
+ * share or copy the blocks without them passing through this
+ * process, else with large preads and pwrites. dst is flushed
+ * first and left positioned after the copy.
+ * @return 0 if the data was copied or the write failed part way,
+ *         -1 if nothing was written, e.g. because src or dst is
+ *         not a regular file, so the caller should copy it
+ */
+static int
+copyRange(FILE *src, off_t start, FILE *dst, size_t len)
+{
+    const size_t bufsize = 1 << 20;
+    struct stat st;
+    uint8_t *buf;
+    size_t done = 0;
+    ssize_t n;
+    off_t pos;
+
+    if (src == NULL || fflush(dst) != 0 ||
+	fstat(fileno(dst), &st) != 0 || !S_ISREG(st.st_mode) ||
+	(pos = ftello(dst)) < 0)
+    {
+	return -1;
+    }
+#ifdef	LINUX
+    {
+	loff_t in = start, out = pos;
+	while (done < len) {
+	    n = copy_file_range(fileno(src), &in, fileno(dst), &out,
+		    len - done, 0);
+	    if (n <= 0) {
+		break;
+	    }
+	    done += n;
+	}
+    }
+#endif
+    /* Not Linux, or a file system that can't do it */
+    if (done < len && (buf = malloc(bufsize)) != NULL) {
+	while (done < len) {
+	    n = pread(fileno(src), buf, len - done > bufsize ? bufsize : len - done,
+		    start + done);
+	    if (n <= 0 || pwrite(fileno(dst), buf, n, pos + done) != n) {
+		break;
+	    }
+	    done += n;
+	}
+	free(buf);
+    }
+    if (done == 0 && len > 0) {
+	return -1;
+    }
+    if (done < len) {
+	fprintf(stderr, "Error copying data from source file, %s\n",
+	    strerror(errno));
+	WaveError = "Error reading data from source file";
+	writeFailed = true;
+    }
+    /* Leave a hole for any part that failed, to keep the structure */
+    fseeko(dst, pos + len, SEEK_SET);
+    return 0;
+}
+
+/**
+ * Write part of a chunk's data, summing it if it is the data
+ * that checksums are being computed for.
+ */
+static void
+writeBytes(Chunk *chunk, const void *buffer, size_t len, FILE *dst)
+{
+    ChecksumChunk *cs = checksums;
+    const uint8_t *p = buffer;
+    size_t n;
+
+    fwrite(buffer, 1, len, dst);
+    if (chunk != summedData) {
+	return;
+    }
+    while (len > 0 && cs->done < cs->count) {
+	n = cs->block - cs->used < len ? cs->block - cs->used : len;
+	cs->crc = crc32Update(cs->crc, p, n);
+	cs->used += n;
+	p += n;
+	len -= n;
+	if (cs->used == cs->block) {
+	    cs->crcs[cs->done++] = cs->crc;
+	    cs->crc = cs->used = 0;
+	}
     }
-    *offset += chunk->length;
 }
 
-#if 0
 static void
 writeCues(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
 {
+    CueChunk *cc = (CueChunk *)chunk;
+    uint8_t buffer[24];
+    uint32_t i;
+
+    memcpy(buffer, chunk->identifier, 4);
+    writeUInt32(buffer+4, chunk->length);
+    writeUInt32(buffer+8, cc->n_cues);
+    fwrite(buffer, 1, 12, dst);
+    for (i=0; i < cc->n_cues; ++i) {
+	writeUInt32(buffer, cc->cues[i].name);
+	writeUInt32(buffer+4, cc->cues[i].position);
+	memcpy(buffer+8, cc->cues[i].fcc_chunk, 4);
+	writeUInt32(buffer+12, cc->cues[i].chunk_start);
+	writeUInt32(buffer+16, cc->cues[i].block_start);
+	writeUInt32(buffer+20, cc->cues[i].sample_offset);
+	fwrite(buffer, 1, 24, dst);
+    }
+    *offset += 12 + 24 * cc->n_cues;
 }
 
+/**
+ * Write a labl or note chunk. The length of the text is taken from
+ * the chunk length.
+ */
 static void
 writeLabl(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
 {
+    LablChunk *lc = (LablChunk *)chunk;
+    uint8_t buffer[12];
+
+    memcpy(buffer, chunk->identifier, 4);
+    writeUInt32(buffer+4, chunk->length);
+    writeUInt32(buffer+8, lc->name);
+    fwrite(buffer, 1, chunk->length < 4 ? 8 + chunk->length : 12, dst);
+    if (chunk->length > 4) {
+	fwrite(lc->label, 1, chunk->length - 4, dst);
+    }
+    *offset += 8 + chunk->length;
 }
 
 static void
 writeLtxt(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
 {
+    LtxtChunk *lc = (LtxtChunk *)chunk;
+    uint8_t buffer[28];
+
+    memcpy(buffer, chunk->identifier, 4);
+    writeUInt32(buffer+4, chunk->length);
+    writeUInt32(buffer+8, lc->name);
+    writeUInt32(buffer+12, lc->sample_length);
+    memcpy(buffer+16, lc->purpose, 4);
+    writeUInt16(buffer+20, lc->country);
+    writeUInt16(buffer+22, lc->language);
+    writeUInt16(buffer+24, lc->dialext);
+    writeUInt16(buffer+26, lc->codepage);
+    fwrite(buffer, 1, chunk->length < 20 ? 8 + chunk->length : 28, dst);
+    if (chunk->length > 20) {
+	fwrite(lc->data, 1, chunk->length - 20, dst);
+    }
+    *offset += 8 + chunk->length;
 }
-#endif
 
 /**
  * Write an "id3 " chunk to the file. Write the 8-bye header
@@ -615,7 +1426,7 @@ writeId3(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
     static uint8_t pad = 0;
 
     memcpy(buffer, chunk->identifier, 4);
-    writeUInt32(buffer+4, chunk->length);
+    writeFileUInt32(buffer+4, chunk->length);
     fwrite(buffer, 1, sizeof(buffer), dst);
 
     l = WriteId3V2(src, dst, ic->id3v2);
@@ -631,7 +1442,7 @@ writeText(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
     char buffer[8];
 
     memcpy(buffer, chunk->identifier, 4);
-    writeUInt32(buffer+4, chunk->length);
+    writeFileUInt32(buffer+4, chunk->length);
 
     fwrite(buffer, 1, sizeof(buffer), dst);
     fwrite(tc->string, 1, chunk->length, dst);
@@ -652,30 +1463,949 @@ writeInt32(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
     char buffer[12];
 
     memcpy(buffer, chunk->identifier, 4);
-    writeUInt32(buffer+4, 4);
-    writeUInt32(buffer+8, ic->n);
+    writeFileUInt32(buffer+4, 4);
+    writeFileUInt32(buffer+8, ic->n);
 
     fwrite(buffer, 1, sizeof(buffer), dst);
     *offset += sizeof(buffer);
 }
 
-
-	/*** UTILITIES ***/
-
 /**
- * Allocate the space for a chunk, and initialize the header
- * @param tag     chunk tag, 4 characters
- * @param length  Number of data bytes after the header
- * @param offset  File offset of the data, if applicable
- * @param size    Amount of space to allocate for this chunk
+ * Write a checksum chunk. The checksums were computed as the data
+ * chunk was written, see prepareChecksums().
  */
-Chunk *
-newChunk(const char *tag, uint32_t length, uint32_t offset, size_t size)
+static void
+writeChecksum(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
 {
-    Chunk *chunk;
+    ChecksumChunk *cs = (ChecksumChunk *)chunk;
+    uint8_t buffer[24];
+    uint32_t i;
 
-    if ((chunk = malloc(size)) == NULL) {
-	WaveError = "Out of memory";
+    memcpy(buffer, chunk->identifier, 4);
+    writeUInt32(buffer+4, 16 + 4 * cs->count);
+    writeUInt32(buffer+8, 1);
+    writeUInt32(buffer+12, cs->block);
+    writeUInt32(buffer+16, cs->data_length);
+    writeUInt32(buffer+20, cs->count);
+    fwrite(buffer, 1, sizeof(buffer), dst);
+    for (i=0; i < cs->count; ++i) {
+	writeUInt32(buffer, cs->crcs[i]);
+	fwrite(buffer, 1, 4, dst);
+    }
+    *offset += sizeof(buffer) + 4 * cs->count;
+}
+
+/**
+ * Copy a text field into its fixed-width place, which is zeroed. The
+ * field fills it without a nul if it is that long.
+ */
+static void
+putField(uint8_t *buffer, const char *field, size_t width)
+{
+    memcpy(buffer, field, strnlen(field, width));
+}
+
+/**
+ * Write a "bext" chunk: the fixed fields, then the coding history
+ * padded with nuls to the chunk length.
+ */
+static void
+writeBext(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
+{
+    BextChunk *bc = (BextChunk *)chunk;
+    uint8_t buffer[8 + BEXT_SIZE];
+    uint32_t len, i;
+
+    memset(buffer, 0, sizeof(buffer));
+    memcpy(buffer, chunk->identifier, 4);
+    writeUInt32(buffer+4, chunk->length);
+    putField(buffer+8, bc->description, 256);
+    putField(buffer+8+256, bc->originator, 32);
+    putField(buffer+8+288, bc->originator_reference, 32);
+    putField(buffer+8+320, bc->origination_date, 10);
+    putField(buffer+8+330, bc->origination_time, 8);
+    writeUInt32(buffer+8+338, (uint32_t)bc->time_reference);
+    writeUInt32(buffer+8+342, (uint32_t)(bc->time_reference >> 32));
+    writeUInt16(buffer+8+346, bc->version);
+    memcpy(buffer+8+348, bc->umid, 64);
+    writeUInt16(buffer+8+412, (uint16_t)bc->loudness_value);
+    writeUInt16(buffer+8+414, (uint16_t)bc->loudness_range);
+    writeUInt16(buffer+8+416, (uint16_t)bc->max_true_peak_level);
+    writeUInt16(buffer+8+418, (uint16_t)bc->max_momentary_loudness);
+    writeUInt16(buffer+8+420, (uint16_t)bc->max_short_term_loudness);
+    memcpy(buffer+8+422, bc->reserved, 180);
+    fwrite(buffer, 1, chunk->length < BEXT_SIZE ? 8 + chunk->length : sizeof(buffer),
+	dst);
+
+    if (chunk->length > BEXT_SIZE) {
+	len = strlen(bc->coding_history);
+	if (len > chunk->length - BEXT_SIZE) {
+	    len = chunk->length - BEXT_SIZE;
+	}
+	fwrite(bc->coding_history, 1, len, dst);
+	for (i = BEXT_SIZE + len; i < chunk->length; ++i) {
+	    putc(0, dst);
+	}
+    }
+    *offset += 8 + chunk->length;
+}
+
+static void
+writeSmpl(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
+{
+    SmplChunk *sc = (SmplChunk *)chunk;
+    uint8_t buffer[44];
+    uint32_t i;
+
+    memcpy(buffer, chunk->identifier, 4);
+    writeUInt32(buffer+4, chunk->length);
+    writeUInt32(buffer+8, sc->manufacturer);
+    writeUInt32(buffer+12, sc->product);
+    writeUInt32(buffer+16, sc->sample_period);
+    writeUInt32(buffer+20, sc->midi_unity_note);
+    writeUInt32(buffer+24, sc->midi_pitch_fraction);
+    writeUInt32(buffer+28, sc->smpte_format);
+    writeUInt32(buffer+32, sc->smpte_offset);
+    writeUInt32(buffer+36, sc->n_loops);
+    writeUInt32(buffer+40, sc->sampler_data_len);
+    fwrite(buffer, 1, 44, dst);
+    for (i=0; i < sc->n_loops; ++i) {
+	writeUInt32(buffer, sc->loops[i].name);
+	writeUInt32(buffer+4, sc->loops[i].type);
+	writeUInt32(buffer+8, sc->loops[i].start);
+	writeUInt32(buffer+12, sc->loops[i].end);
+	writeUInt32(buffer+16, sc->loops[i].fraction);
+	writeUInt32(buffer+20, sc->loops[i].play_count);
+	fwrite(buffer, 1, 24, dst);
+    }
+    fwrite(sc->sampler_data, 1, sc->sampler_data_len, dst);
+    *offset += 8 + chunk->length;
+}
+
+static void
+writeInst(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
+{
+    InstChunk *ic = (InstChunk *)chunk;
+    uint8_t buffer[15];
+
+    memcpy(buffer, chunk->identifier, 4);
+    writeUInt32(buffer+4, 7);
+    buffer[8] = ic->unshifted_note;
+    buffer[9] = (uint8_t)ic->fine_tune;
+    buffer[10] = (uint8_t)ic->gain;
+    buffer[11] = ic->low_note;
+    buffer[12] = ic->high_note;
+    buffer[13] = ic->low_velocity;
+    buffer[14] = ic->high_velocity;
+    fwrite(buffer, 1, sizeof(buffer), dst);
+    *offset += sizeof(buffer);
+}
+
+static void
+writeComm(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
+{
+    CommChunk *cc = (CommChunk *)chunk;
+    uint8_t buffer[8+22+256];
+    size_t len;
+
+    memcpy(buffer, chunk->identifier, 4);
+    writeUInt32BE(buffer+4, chunk->length);
+    writeUInt16BE(buffer+8, cc->channels);
+    writeUInt32BE(buffer+10, cc->frames);
+    writeUInt16BE(buffer+14, cc->bits_samp);
+    writeExtended(buffer+16, cc->sample_rate);
+    if (chunk->length > 18) {
+	len = strnlen(cc->compression_name, 255);
+	memcpy(buffer+26, cc->compression, 4);
+	buffer[30] = len;
+	memcpy(buffer+31, cc->compression_name, len);
+	buffer[31+len] = '\0';		/* Pad to even, if needed */
+    }
+    len = chunk->length < 22+256 ? chunk->length : 22+256;
+    fwrite(buffer, 1, 8 + len, dst);
+    *offset += 8 + len;
+}
+
+static void
+writeSsnd(Chunk *chunk, FILE *src, FILE *dst, uint32_t *offset)
+{
+    SsndChunk *sc = (SsndChunk *)chunk;
+    uint8_t buffer[16];
+
+    memcpy(buffer, chunk->identifier, 4);
+    writeUInt32BE(buffer+4, chunk->length);
+    writeUInt32BE(buffer+8, sc->data_offset);
+    writeUInt32BE(buffer+12, sc->block_size);
+    fwrite(buffer, 1, sizeof(buffer), dst);
+    *offset += sizeof(buffer);
+
+    writeSamples(chunk, src, (off_t)chunk->offset + 16, chunk->length - 8, dst);
+    *offset += chunk->length - 8;
+}
+
+int
+UpdateChunk(FILE *file, Chunk *chunk, uint32_t length)
+{
+    uint32_t offset = chunk->offset;
+    ChunkType *chunkType = findChunkType(chunk->identifier);
+
+    if (chunkType == NULL || chunkType->writer == writeData ||
+	chunkType->writer == writeList || chunkType->writer == writeChecksum ||
+	chunkType->writer == writeSsnd)
+    {
+	WaveError = "This kind of chunk cannot be updated in place";
+	return -1;
+    }
+    if (chunk->offset == 0 || chunk->length != length) {
+	WaveError = "The chunk has changed size, the file must be rewritten";
+	return -1;
+    }
+    if (fseeko(file, (off_t)chunk->offset, SEEK_SET) != 0) {
+	WaveError = "Cannot seek in file";
+	return -1;
+    }
+    writeChunk(chunk, NULL, file, &offset);
+    if (fflush(file) != 0) {
+	WaveError = "Error writing file";
+	return -1;
+    }
+    return 0;
+}
+
+
+	/*** CHECKSUMS ***/
+
+static uint32_t crcTable[8][256];
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void
+crcInit(void)
+{
+    uint32_t c;
+    int i, j;
+
+    for (i=0; i < 256; ++i) {
+	for (c = i, j = 0; j < 8; ++j) {
+	    c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+	}
+	crcTable[0][i] = c;
+    }
+    for (i=0; i < 256; ++i) {
+	for (j=1; j < 8; ++j) {
+	    c = crcTable[j-1][i];
+	    crcTable[j][i] = crcTable[0][c & 0xff] ^ (c >> 8);
+	}
+    }
+}
+
+/**
+ * Continue a CRC-32 (as in zip and PNG; start with 0). Takes eight
+ * bytes at a time through eight tables.
+ */
+static uint32_t
+crc32Update(uint32_t crc, const uint8_t *p, size_t len)
+{
+    pthread_once(&crcOnce, crcInit);
+    crc = ~crc;
+    for (; len >= 8; p += 8, len -= 8) {
+	uint32_t lo = crc ^ readUInt32((void *)p);
+	uint32_t hi = readUInt32((void *)(p + 4));
+	crc = crcTable[7][lo & 0xff] ^ crcTable[6][(lo >> 8) & 0xff] ^
+	      crcTable[5][(lo >> 16) & 0xff] ^ crcTable[4][lo >> 24] ^
+	      crcTable[3][hi & 0xff] ^ crcTable[2][(hi >> 8) & 0xff] ^
+	      crcTable[1][(hi >> 16) & 0xff] ^ crcTable[0][hi >> 24];
+    }
+    for (; len > 0; ++p, --len) {
+	crc = crcTable[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+int
+AddChecksums(WaveChunk *wave, uint32_t block)
+{
+    FmtChunk *fc;
+    ChecksumChunk *cs;
+    Chunk **ptr;
+
+    cs = (ChecksumChunk *)FindChunk(wave->children, "bsum", NULL);
+    if (cs == NULL) {
+	if ((cs = (ChecksumChunk *)newChunk("bsum", 16, 0, sizeof(*cs))) == NULL) {
+	    return -1;
+	}
+	cs->block = cs->data_length = cs->count = 0;
+	cs->crcs = NULL;
+	for (ptr = &wave->children; *ptr != NULL; ptr = &(*ptr)->next)
+	  ;
+	*ptr = (Chunk *)cs;
+    }
+    if (block > 0) {
+	fc = (FmtChunk *)FindChunk(wave->children, "fmt ", NULL);
+	if (fc != NULL && fc->block_align > 0) {
+	    block = block < fc->block_align ? fc->block_align :
+		block / fc->block_align * fc->block_align;
+	}
+	cs->block = block;
+    }
+    return 0;
+}
+
+typedef struct verify_job {
+  int fd;
+  const ChecksumChunk *cs;
+  uint64_t start;	/* File offset of the data */
+  uint32_t length;	/* Length of the data now */
+  uint32_t first, step;	/* Blocks first, first+step, ... */
+  uint8_t *bad;
+  long nbad;
+  bool error;		/* Out of memory */
+} VerifyJob;
+
+static void *
+verifyJob(void *arg)
+{
+    VerifyJob *job = arg;
+    const ChecksumChunk *cs = job->cs;
+    uint8_t *buffer;
+    uint32_t b, off, len;
+
+    if ((buffer = malloc(cs->block)) == NULL) {
+	job->error = true;
+	return NULL;
+    }
+    for (b = job->first; b < cs->count; b += job->step) {
+	off = b * cs->block;
+	len = cs->data_length - off < cs->block ? cs->data_length - off : cs->block;
+	job->bad[b] = off + len > job->length ||
+	    pread(job->fd, buffer, len, job->start + off) != (ssize_t)len ||
+	    crc32Update(0, buffer, len) != cs->crcs[b];
+	job->nbad += job->bad[b];
+    }
+    free(buffer);
+    return NULL;
+}
+
+long
+VerifyChecksums(WaveChunk *wave, FILE *file, int threads, uint8_t *bad)
+{
+    ChecksumChunk *cs;
+    Chunk *data;
+    long nbad = 0;
+    int t, started = 1;
+
+    cs = (ChecksumChunk *)FindChunk(wave->children, "bsum", NULL);
+    data = FindChunk(wave->children, "data", NULL);
+    if (cs == NULL) {
+	WaveError = "No checksum chunk";
+	return -1;
+    }
+    if (cs->block == 0 || cs->data_length > (uint64_t)cs->count * cs->block ||
+	(cs->count > 0 && cs->data_length <= (uint64_t)(cs->count - 1) * cs->block))
+    {
+	WaveError = "Checksum chunk is damaged";
+	return -1;
+    }
+    if (data == NULL) {
+	WaveError = "Data chunk not found";
+	return -1;
+    }
+    if (threads < 1) {
+	threads = 1;
+    }
+    if ((uint32_t)threads > cs->count) {
+	threads = cs->count > 0 ? cs->count : 1;
+    }
+
+    VerifyJob jobs[threads];
+    pthread_t tids[threads];
+    for (t=0; t < threads; ++t) {
+	jobs[t].fd = fileno(file);
+	jobs[t].cs = cs;
+	jobs[t].start = (uint64_t)data->offset + 8;
+	jobs[t].length = data->length;
+	jobs[t].first = t;
+	jobs[t].step = threads;
+	jobs[t].bad = bad;
+	jobs[t].nbad = 0;
+	jobs[t].error = false;
+    }
+    for (t=1; t < threads; ++t) {
+	if (pthread_create(&tids[t], NULL, verifyJob, &jobs[t]) != 0) {
+	    break;
+	}
+	++started;
+    }
+    /* Do the share of any threads that could not be started */
+    for (t=started; t < threads; ++t) {
+	verifyJob(&jobs[t]);
+    }
+    verifyJob(&jobs[0]);
+    for (t=1; t < started; ++t) {
+	pthread_join(tids[t], NULL);
+    }
+    for (t=0; t < threads; ++t) {
+	if (jobs[t].error) {
+	    WaveError = "Out of memory";
+	    return -1;
+	}
+	nbad += jobs[t].nbad;
+    }
+    return nbad;
+}
+
+
+	/*** REPAIR ***/
+
+static inline uint64_t
+readUInt64(void *buffer)
+{
+    uint8_t *bytes = buffer;
+    return readUInt32(bytes) | (uint64_t)readUInt32(bytes+4) << 32;
+}
+
+/**
+ * True if the bytes look like a chunk tag: letters, digits and
+ * spaces, as every tag in use is. Audio samples rarely do.
+ */
+static bool
+isChunkTag(const uint8_t *buffer)
+{
+    int i;
+
+    for (i=0; i < 4; ++i) {
+	if (!isalnum(buffer[i]) && buffer[i] != ' ') {
+	    return false;
+	}
+    }
+    return true;
+}
+
+/**
+ * True if a chunk header that fits in the file starts at offset.
+ */
+static bool
+tagAt(int fd, uint64_t offset, uint64_t fileLen)
+{
+    uint8_t buffer[8];
+
+    return offset + 8 <= fileLen && pread(fd, buffer, 8, offset) == 8 &&
+	isChunkTag(buffer);
+}
+
+/**
+ * Return the end of the chunk at offset with this length: after its
+ * pad byte if the length is odd, unless the writer left the pad
+ * byte out, as some do.
+ */
+static uint64_t
+chunkEnd(int fd, uint64_t offset, uint64_t length, uint64_t fileLen)
+{
+    uint64_t end = offset + 8 + length;
+
+    if ((length & 1) && !(tagAt(fd, end, fileLen) && !tagAt(fd, end + 1, fileLen))) {
+	end += 1;
+    }
+    return end;
+}
+
+static void
+addRepair(WaveRepair *repairs, int *n, const char *field, uint64_t offset,
+	int width, uint64_t old_value, uint64_t new_value)
+{
+    if (old_value != new_value && *n < MAX_WAVE_REPAIRS) {
+	repairs[*n].field = field;
+	repairs[*n].offset = offset;
+	repairs[*n].width = width;
+	repairs[*n].old_value = old_value;
+	repairs[*n].new_value = new_value;
+	++*n;
+    }
+}
+
+int
+FindWaveRepairs(FILE *file, WaveRepair *repairs, uint64_t *trailing)
+{
+    const int fd = fileno(file);
+    struct stat st;
+    uint8_t buffer[40];
+    uint64_t fileLen, offset, end, length, avail, frames = 0;
+    uint64_t ds64 = 0, fact = 0, data = 0;	/* Chunk offsets, 0 if none */
+    uint64_t ds64Riff = 0, ds64Data = 0, ds64Samples = 0, dataLen = 0;
+    uint32_t riffLen, chunkLen, dataChunkLen = 0, factLen = 0;
+    uint16_t type = 0, align = 0, spb = 0;
+    bool rf64, stale = false;
+    int n = 0;
+
+    if (fstat(fd, &st) != 0) {
+	WaveError = "Cannot get the size of the file";
+	return -1;
+    }
+    fileLen = st.st_size;
+    if (pread(fd, buffer, 12, 0) != 12 || memcmp(buffer+8, "WAVE", 4) != 0 ||
+	(memcmp(buffer, "RIFF", 4) != 0 && memcmp(buffer, "RF64", 4) != 0 &&
+	 memcmp(buffer, "BW64", 4) != 0))
+    {
+	WaveError = "File does not seem to be a RIFF or RF64 .wav file";
+	return -1;
+    }
+    rf64 = memcmp(buffer, "RIFF", 4) != 0;
+    riffLen = readUInt32(buffer+4);
+
+    /* Walk the chunks as far as they make sense */
+    for (end = offset = 12; !stale && offset + 8 <= fileLen; offset = end)
+    {
+	if (pread(fd, buffer, 8, offset) != 8 || !isChunkTag(buffer)) {
+	    break;
+	}
+	chunkLen = readUInt32(buffer+4);
+	length = chunkLen;
+	if (memcmp(buffer, "data", 4) == 0) {
+	    data = offset;
+	    dataChunkLen = chunkLen;
+	    if (rf64 && chunkLen == 0xffffffff) {
+		length = ds64Data;
+	    }
+	    /* A recorder that stopped early leaves the length 0 or
+	     * stale, and the data runs to the end of the file. Any
+	     * other length is believed, even if what follows is not a
+	     * chunk: some writers pad the file out. So is a length of
+	     * 0 with another chunk right after it.
+	     */
+	    avail = fileLen - offset - 8;
+	    if (length > avail ||
+		(length == 0 && avail > 0 && !tagAt(fd, offset + 8, fileLen)))
+	    {
+		if (align == 0) {
+		    WaveError = "No fmt chunk before the data";
+		    return -1;
+		}
+		length = avail;
+		if (!rf64 && length > 0xffffffff - offset) {
+		    /* Keep the RIFF length in 32 bits */
+		    length = 0xffffffff - offset;
+		}
+		length -= length % align;
+		stale = true;
+	    }
+	    dataLen = length;
+	} else if (offset + 8 + length > fileLen) {
+	    /* Cut off; leave it out of the RIFF chunk */
+	    break;
+	} else if (memcmp(buffer, "fmt ", 4) == 0 && length >= 16) {
+	    memset(buffer, 0, sizeof(buffer));
+	    if (pread(fd, buffer, length < 40 ? length : 40, offset + 8) < 16) {
+		break;
+	    }
+	    type = readUInt16(buffer);
+	    align = readUInt16(buffer+12);
+	    spb = readUInt16(buffer+18);	/* ADPCM: samples per block */
+	    if (type == RIFF_EXTENSIBLE) {
+		type = readUInt16(buffer+24);
+	    }
+	} else if (memcmp(buffer, "fact", 4) == 0 && length >= 4) {
+	    if (pread(fd, buffer, 4, offset + 8) != 4) {
+		break;
+	    }
+	    fact = offset;
+	    factLen = readUInt32(buffer);
+	} else if (memcmp(buffer, "ds64", 4) == 0 && length >= 24) {
+	    if (pread(fd, buffer, 24, offset + 8) != 24) {
+		break;
+	    }
+	    ds64 = offset;
+	    ds64Riff = readUInt64(buffer);
+	    ds64Data = readUInt64(buffer+8);
+	    ds64Samples = readUInt64(buffer+16);
+	}
+	end = chunkEnd(fd, offset, length, fileLen);
+    }
+    if (end > fileLen) {
+	end = fileLen;		/* Missing pad byte */
+    }
+    *trailing = fileLen - end;
+    if (data == 0) {
+	WaveError = "No data chunk";
+	return -1;
+    }
+    if (rf64 && ds64 == 0) {
+	WaveError = "RF64 file without a ds64 chunk";
+	return -1;
+    }
+
+    /* # of frames, if the format has a fixed number per block */
+    switch (type) {
+      case RIFF_PCM:
+      case RIFF_IEEE_FLOAT:
+      case RIFF_ALAW:
+      case RIFF_MULAW:
+	frames = dataLen / align;
+	break;
+      case RIFF_MS_ADPCM:
+      case RIFF_IMA_ADPCM:
+	frames = (dataLen / align) * spb;
+	break;
+    }
+
+    /* A RIFF length that takes in the trailing bytes is left be */
+    if (rf64) {
+	addRepair(repairs, &n, "RIFF length", 4, 4, riffLen, 0xffffffff);
+	if (stale || ds64Riff < end - 8 || ds64Riff > fileLen - 8) {
+	    addRepair(repairs, &n, "ds64 RIFF length", ds64 + 8, 8,
+		ds64Riff, end - 8);
+	}
+	addRepair(repairs, &n, "ds64 data length", ds64 + 16, 8, ds64Data, dataLen);
+	if (frames > 0 && (stale || ds64Samples > frames)) {
+	    addRepair(repairs, &n, "ds64 sample count", ds64 + 24, 8,
+		ds64Samples, frames);
+	}
+	addRepair(repairs, &n, "data length", data + 4, 4, dataChunkLen, 0xffffffff);
+    } else {
+	if (stale || riffLen < end - 8 || riffLen > fileLen - 8) {
+	    addRepair(repairs, &n, "RIFF length", 4, 4, riffLen, end - 8);
+	}
+	addRepair(repairs, &n, "data length", data + 4, 4, dataChunkLen, dataLen);
+    }
+    if (fact != 0 && frames > 0 && (stale || factLen > frames)) {
+	addRepair(repairs, &n, "fact sample count", fact + 8, 4, factLen,
+	    frames < 0xffffffff ? frames : 0xffffffff);
+    }
+    return n;
+}
+
+int
+ApplyWaveRepairs(FILE *file, const WaveRepair *repairs, int n)
+{
+    uint8_t buffer[8];
+    int i;
+
+    for (i=0; i < n; ++i) {
+	writeUInt32(buffer, (uint32_t)repairs[i].new_value);
+	writeUInt32(buffer+4, (uint32_t)(repairs[i].new_value >> 32));
+	if (pwrite(fileno(file), buffer, repairs[i].width,
+		(off_t)repairs[i].offset) != repairs[i].width)
+	{
+	    WaveError = "Error writing file";
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+
+	/*** MARKERS ***/
+
+static int
+compareMarkers(const void *a, const void *b)
+{
+    const Marker *m1 = a, *m2 = b;
+
+    if (m1->position != m2->position) {
+	return m1->position < m2->position ? -1 : 1;
+    }
+    return m1->name < m2->name ? -1 : m1->name > m2->name;
+}
+
+static inline size_t
+hashName(uint32_t name)
+{
+    uint32_t h = name * 0x9E3779B1u;
+    return h ^ (h >> 16);
+}
+
+MarkerIndex *
+NewMarkerIndex(WaveChunk *wave)
+{
+    MarkerIndex *mi;
+    CueChunk *cc;
+    Chunk *list, *child;
+    Marker *m;
+    size_t i, j, size;
+
+    if ((mi = calloc(1, sizeof(*mi))) == NULL) {
+	WaveError = "Out of memory";
+	return NULL;
+    }
+    cc = (CueChunk *)FindChunk(wave->children, "cue ", NULL);
+    if (cc == NULL || cc->n_cues == 0) {
+	return mi;
+    }
+
+    for (size = 2; size < 2 * (size_t)cc->n_cues; size *= 2)
+      ;
+    mi->markers = malloc(cc->n_cues * sizeof(Marker));
+    mi->table = calloc(size, sizeof(uint32_t));
+    if (mi->markers == NULL || mi->table == NULL) {
+	WaveError = "Out of memory";
+	FreeMarkerIndex(mi);
+	return NULL;
+    }
+    mi->count = cc->n_cues;
+    mi->mask = size - 1;
+    for (i=0; i < mi->count; ++i) {
+	m = &mi->markers[i];
+	m->name = cc->cues[i].name;
+	m->position = cc->cues[i].sample_offset;
+	m->length = 0;
+	m->label = m->note = NULL;
+	m->ltxt = NULL;
+    }
+    qsort(mi->markers, mi->count, sizeof(Marker), compareMarkers);
+
+    /* Where a name is used twice, the first in order wins */
+    for (i=0; i < mi->count; ++i) {
+	for (j = hashName(mi->markers[i].name) & mi->mask; mi->table[j] != 0;
+	     j = (j + 1) & mi->mask)
+	{
+	    if (mi->markers[mi->table[j] - 1].name == mi->markers[i].name) {
+		break;
+	    }
+	}
+	if (mi->table[j] == 0) {
+	    mi->table[j] = i + 1;
+	}
+    }
+
+    /* Join the labels, notes and regions */
+    for (list = wave->children; list != NULL; list = list->next) {
+	if (strncasecmp(list->identifier, "list", 4) != 0 ||
+	    strncasecmp(((ListChunk *)list)->type, "adtl", 4) != 0)
+	{
+	    continue;
+	}
+	for (child = ((ListChunk *)list)->children; child != NULL; child = child->next) {
+	    if (strncasecmp(child->identifier, "labl", 4) == 0) {
+		if ((m = (Marker *)FindMarker(mi, ((LablChunk *)child)->name)) != NULL) {
+		    m->label = ((LablChunk *)child)->label;
+		}
+	    } else if (strncasecmp(child->identifier, "note", 4) == 0) {
+		if ((m = (Marker *)FindMarker(mi, ((NoteChunk *)child)->name)) != NULL) {
+		    m->note = ((NoteChunk *)child)->label;
+		}
+	    } else if (strncasecmp(child->identifier, "ltxt", 4) == 0) {
+		if ((m = (Marker *)FindMarker(mi, ((LtxtChunk *)child)->name)) != NULL) {
+		    m->ltxt = (LtxtChunk *)child;
+		    m->length = m->ltxt->sample_length;
+		}
+	    }
+	}
+    }
+    return mi;
+}
+
+const Marker *
+FindMarker(const MarkerIndex *mi, uint32_t name)
+{
+    size_t j;
+
+    if (mi->count == 0) {
+	return NULL;
+    }
+    for (j = hashName(name) & mi->mask; mi->table[j] != 0; j = (j + 1) & mi->mask) {
+	if (mi->markers[mi->table[j] - 1].name == name) {
+	    return &mi->markers[mi->table[j] - 1];
+	}
+    }
+    return NULL;
+}
+
+/**
+ * Index of the first marker at or after position
+ */
+static size_t
+lowerBound(const MarkerIndex *mi, uint32_t position)
+{
+    size_t lo = 0, hi = mi->count, mid;
+
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (mi->markers[mid].position < position) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    return lo;
+}
+
+size_t
+MarkersInRange(const MarkerIndex *mi, uint32_t start, uint32_t end, size_t *first)
+{
+    size_t i = lowerBound(mi, start);
+
+    *first = i;
+    return end > start ? lowerBound(mi, end) - i : 0;
+}
+
+void
+FreeMarkerIndex(MarkerIndex *mi)
+{
+    if (mi != NULL) {
+	free(mi->markers);
+	free(mi->table);
+	free(mi);
+    }
+}
+
+int
+RebaseMarkers(WaveChunk *waveFile, uint32_t start, uint32_t end)
+{
+    MarkerIndex *mi;
+    const Marker *m;
+    CueChunk *cue = NULL;
+    ListChunk *adtl = NULL;
+    LablChunk *labl;
+    LtxtChunk *ltxt;
+    Chunk **ptr, **tail, **data, *old, *child;
+    uint32_t pos, len;
+    uint64_t rend;
+    size_t i, first, n, kept = 0;
+    int rval = -1;
+
+    if ((mi = NewMarkerIndex(waveFile)) == NULL) {
+	return -1;
+    }
+    if (mi->count == 0) {
+	FreeMarkerIndex(mi);
+	return 0;
+    }
+    if ((data = FindChunkPtr(&waveFile->children, "data", NULL)) == NULL) {
+	WaveError = "The data chunk is not at the top level";
+	FreeMarkerIndex(mi);
+	return -1;
+    }
+
+    /* Points and regions that start in the excerpt, then regions that
+     * start before it and reach into it
+     */
+    n = MarkersInRange(mi, start, end, &first);
+    for (i=0; i < first; ++i) {
+	m = &mi->markers[i];
+	n += m->length > 0 && m->position + (uint64_t)m->length > start;
+    }
+    if ((cue = NewCueChunk(n)) == NULL ||
+	(adtl = (ListChunk *)newChunk("LIST", 4, 0, sizeof(*adtl))) == NULL)
+    {
+	goto exit;
+    }
+    memcpy(adtl->type, "adtl", 4);
+    adtl->children = NULL;
+    tail = &adtl->children;
+
+    for (i=0; i < mi->count && kept < n; ++i) {
+	m = &mi->markers[i];
+	if (m->position >= end) {
+	    break;
+	}
+	if (m->position < start &&
+	    (m->length == 0 || m->position + (uint64_t)m->length <= start))
+	{
+	    continue;
+	}
+	pos = m->position > start ? m->position - start : 0;
+	cue->cues[kept].name = m->name;
+	cue->cues[kept].position = pos;
+	memcpy(cue->cues[kept].fcc_chunk, "data", 4);
+	cue->cues[kept].sample_offset = pos;
+	++kept;
+
+	if (m->label != NULL) {
+	    if ((labl = NewLablChunk("labl", m->name, m->label)) == NULL) {
+		goto exit;
+	    }
+	    *tail = &labl->header;
+	    tail = &labl->header.next;
+	}
+	if (m->note != NULL) {
+	    if ((labl = NewLablChunk("note", m->name, m->note)) == NULL) {
+		goto exit;
+	    }
+	    *tail = &labl->header;
+	    tail = &labl->header.next;
+	}
+	if (m->ltxt != NULL) {
+	    /* The region is what is left of it in the excerpt */
+	    len = m->ltxt->header.length > 20 ? m->ltxt->header.length - 20 : 0;
+	    ltxt = (LtxtChunk *)newChunk("ltxt", 20 + len, 0, sizeof(*ltxt) + len + 1);
+	    if (ltxt == NULL) {
+		goto exit;
+	    }
+	    memcpy(ltxt, m->ltxt, sizeof(*ltxt) + len + 1);
+	    ltxt->header.next = NULL;
+	    if (m->length > 0) {
+		rend = (uint64_t)m->position + m->length;
+		ltxt->sample_length = (rend < end ? rend : end) - (pos + start);
+	    }
+	    *tail = &ltxt->header;
+	    tail = &ltxt->header.next;
+	}
+    }
+    cue->n_cues = kept;
+
+    /* Out with the old, keeping what is not a marker's label */
+    if ((ptr = FindChunkPtr(&waveFile->children, "cue ", NULL)) != NULL) {
+	old = *ptr;
+	*ptr = old->next;
+	FreeChunk(old);
+    }
+    while ((ptr = FindChunkPtr(&waveFile->children, "LIST", "adtl")) != NULL) {
+	old = *ptr;
+	*ptr = old->next;
+	while ((child = ((ListChunk *)old)->children) != NULL) {
+	    ((ListChunk *)old)->children = child->next;
+	    child->next = NULL;
+	    if (strncasecmp(child->identifier, "labl", 4) == 0 ||
+		strncasecmp(child->identifier, "note", 4) == 0 ||
+		strncasecmp(child->identifier, "ltxt", 4) == 0)
+	    {
+		FreeChunk(child);
+	    } else {
+		*tail = child;
+		tail = &child->next;
+	    }
+	}
+	FreeChunk(old);
+    }
+
+    /* In with the new, after the data, whose link may have been in
+     * a chunk that is gone
+     */
+    data = FindChunkPtr(&waveFile->children, "data", NULL);
+    if (adtl->children != NULL) {
+	adtl->header.next = (*data)->next;
+	(*data)->next = &adtl->header;
+	adtl = NULL;
+    }
+    if (kept > 0) {
+	cue->header.next = (*data)->next;
+	(*data)->next = &cue->header;
+	cue = NULL;
+    }
+    rval = 0;
+
+exit:
+    FreeChunk((Chunk *)cue);
+    FreeChunk((Chunk *)adtl);
+    FreeMarkerIndex(mi);
+    return rval;
+}
+
+
+	/*** UTILITIES ***/
+
+/**
+ * Allocate the space for a chunk, and initialize the header
+ * @param tag     chunk tag, 4 characters
+ * @param length  Number of data bytes after the header
+ * @param offset  File offset of the data, if applicable
+ * @param size    Amount of space to allocate for this chunk
+ */
+Chunk *
+newChunk(const char *tag, uint32_t length, uint32_t offset, size_t size)
+{
+    Chunk *chunk;
+
+    if ((chunk = malloc(size)) == NULL) {
+	WaveError = "Out of memory";
 	goto exit;
     }
     memcpy(chunk->identifier, tag, 4);
@@ -686,3 +2416,320 @@ newChunk(const char *tag, uint32_t length, uint32_t offset, size_t size)
 exit:
     return chunk;
 }
+
+void
+FreeChunk(Chunk *chunk)
+{
+    Chunk *child, *next;
+
+    if (chunk == NULL) {
+	return;
+    }
+    if (strncasecmp(chunk->identifier, "list", 4) == 0) {
+	for (child = ((ListChunk *)chunk)->children; child != NULL; child = next) {
+	    next = child->next;
+	    FreeChunk(child);
+	}
+    } else if (strncasecmp(chunk->identifier, "fmt ", 4) == 0) {
+	free(((FmtChunk *)chunk)->ext);
+    } else if (strncasecmp(chunk->identifier, "bsum", 4) == 0) {
+	free(((ChecksumChunk *)chunk)->crcs);
+    } else if (strncasecmp(chunk->identifier, "id3 ", 4) == 0) {
+	FreeId3V2(((Id3v2Chunk *)chunk)->id3v2);
+    }
+    free(chunk);
+}
+
+void
+FreeWaveFile(WaveChunk *wave)
+{
+    Chunk *child, *next;
+
+    if (wave == NULL) {
+	return;
+    }
+    for (child = wave->children; child != NULL; child = next) {
+	next = child->next;
+	FreeChunk(child);
+    }
+    free(wave);
+}
+
+DataChunk *
+newDataChunk(const char *tag, uint32_t length, uint32_t offset)
+{
+    DataChunk *dc;
+
+    if ((dc = (DataChunk *)newChunk(tag, length, offset, sizeof(*dc))) != NULL) {
+	dc->data = NULL;
+	dc->source = NULL;
+	dc->source_ctx = NULL;
+	dc->segments = NULL;
+	dc->n_segments = 0;
+    }
+    return dc;
+}
+
+CueChunk *
+NewCueChunk(uint32_t n)
+{
+    CueChunk *cc;
+
+    cc = (CueChunk *)newChunk("cue ", 4 + 24 * n, 0, sizeof(*cc) + n * sizeof(Cue));
+    if (cc != NULL) {
+	cc->n_cues = n;
+	memset(cc->cues, 0, n * sizeof(Cue));
+    }
+    return cc;
+}
+
+SmplChunk *
+NewSmplChunk(uint32_t n, uint32_t sampler_data_len)
+{
+    SmplChunk *sc;
+    size_t size = sizeof(*sc) + n * sizeof(SampleLoop);
+
+    if ((sc = (SmplChunk *)newChunk("smpl", 36 + 24 * n + sampler_data_len, 0,
+				size + sampler_data_len + 1)) != NULL)
+    {
+	memset((char *)sc + sizeof(sc->header), 0,
+	    size + sampler_data_len - sizeof(sc->header));
+	sc->midi_unity_note = 60;
+	sc->n_loops = n;
+	sc->sampler_data_len = sampler_data_len;
+	sc->sampler_data = (uint8_t *)sc + size;
+    }
+    return sc;
+}
+
+InstChunk *
+NewInstChunk(void)
+{
+    InstChunk *ic;
+
+    if ((ic = (InstChunk *)newChunk("inst", 7, 0, sizeof(*ic))) != NULL) {
+	ic->unshifted_note = 60;
+	ic->fine_tune = ic->gain = 0;
+	ic->low_note = 0;
+	ic->high_note = 127;
+	ic->low_velocity = 1;
+	ic->high_velocity = 127;
+    }
+    return ic;
+}
+
+int
+AiffFormat(WaveChunk *wave, FmtChunk *fmt, bool *swap)
+{
+    CommChunk *cc = (CommChunk *)FindChunk(wave->children, "COMM", NULL);
+    const char *comp;
+
+    if (cc == NULL || FindChunk(wave->children, "SSND", NULL) == NULL) {
+	WaveError = cc == NULL ? "No COMM chunk" : "No SSND chunk";
+	return -1;
+    }
+    memset(fmt, 0, sizeof(*fmt));
+    memcpy(fmt->header.identifier, "fmt ", 4);
+    fmt->header.length = 16;
+    fmt->type = RIFF_PCM;
+    fmt->channels = cc->channels;
+    fmt->sample_rate = (uint32_t)lround(cc->sample_rate);
+    fmt->bits_samp = cc->bits_samp;
+    *swap = true;
+
+    comp = cc->compression;
+    if (comp[0] == '\0' || strncasecmp(comp, "NONE", 4) == 0 ||
+	strncmp(comp, "twos", 4) == 0)
+    {
+	/* Big-endian PCM */
+    } else if (strncmp(comp, "sowt", 4) == 0) {
+	*swap = false;
+    } else if (strncasecmp(comp, "fl32", 4) == 0) {
+	fmt->type = RIFF_IEEE_FLOAT;
+	fmt->bits_samp = 32;
+    } else if (strncasecmp(comp, "fl64", 4) == 0) {
+	fmt->type = RIFF_IEEE_FLOAT;
+	fmt->bits_samp = 64;
+    } else if (strncasecmp(comp, "ulaw", 4) == 0 ||
+	       strncasecmp(comp, "alaw", 4) == 0)
+    {
+	fmt->type = tolower(comp[0]) == 'u' ? RIFF_MULAW : RIFF_ALAW;
+	fmt->bits_samp = 8;
+	*swap = false;
+    } else {
+	WaveError = "Unsupported AIFC compression type";
+	return -1;
+    }
+    if (fmt->channels == 0 || fmt->bits_samp == 0 || fmt->bits_samp > 64) {
+	WaveError = "Bad COMM chunk";
+	return -1;
+    }
+    fmt->block_align = fmt->channels * ((fmt->bits_samp + 7) / 8);
+    fmt->bytes_sec = fmt->sample_rate * fmt->block_align;
+    return 0;
+}
+
+CommChunk *
+NewCommChunk(const FmtChunk *fmt, uint32_t frames, bool aifc)
+{
+    static const struct {
+      uint16_t type, bits;
+      const char *compression, *name;
+    } types[] = {
+      {RIFF_PCM, 0, "NONE", "not compressed"},
+      {RIFF_IEEE_FLOAT, 32, "fl32", "32-bit floating point"},
+      {RIFF_IEEE_FLOAT, 64, "fl64", "64-bit floating point"},
+      {RIFF_MULAW, 8, "ulaw", "\xb5Law 2:1"},
+      {RIFF_ALAW, 8, "alaw", "ALaw 2:1"},
+    };
+    const uint16_t type = FmtType(fmt);
+    CommChunk *cc;
+    size_t i;
+
+    for (i=0; i < NA(types); ++i) {
+	if (type == types[i].type &&
+	    (types[i].bits == 0 || types[i].bits == fmt->bits_samp))
+	{
+	    break;
+	}
+    }
+    if (i == NA(types) || fmt->bits_samp == 0 || fmt->bits_samp > 64) {
+	WaveError = "Format cannot be stored in an AIFF file";
+	return NULL;
+    }
+    if (i > 0 && !aifc) {
+	WaveError = "Only PCM can be stored in AIFF, use AIFC";
+	return NULL;
+    }
+    if ((cc = (CommChunk *)newChunk("COMM", 18, 0, sizeof(*cc))) == NULL) {
+	WaveError = "Out of memory";
+	return NULL;
+    }
+    cc->channels = fmt->channels;
+    cc->frames = frames;
+    cc->bits_samp = fmt->bits_samp;
+    cc->sample_rate = fmt->sample_rate;
+    memset(cc->compression, 0, sizeof(cc->compression));
+    cc->compression_name[0] = '\0';
+    if (aifc) {
+	memcpy(cc->compression, types[i].compression, 4);
+	strcpy(cc->compression_name, types[i].name);
+	cc->header.length = 22 + strlen(cc->compression_name) + 1;
+	cc->header.length += cc->header.length % 2;
+    }
+    return cc;
+}
+
+SsndChunk *
+NewSsndChunk(uint32_t length)
+{
+    SsndChunk *sc;
+
+    if ((sc = (SsndChunk *)newChunk("SSND", length + 8, 0, sizeof(*sc))) != NULL) {
+	memset(&sc->data.data, 0, sizeof(*sc) - sizeof(Chunk));
+    }
+    return sc;
+}
+
+BextChunk *
+NewBextChunk(const char *history)
+{
+    BextChunk *bc;
+    size_t len = strlen(history);
+
+    if ((bc = (BextChunk *)newChunk("bext", BEXT_SIZE + len, 0,
+				sizeof(*bc) + len + 1)) != NULL)
+    {
+	memset((char *)bc + sizeof(bc->header), 0,
+	    sizeof(*bc) - sizeof(bc->header));
+	bc->version = 2;
+	bc->loudness_value = bc->loudness_range = bc->max_true_peak_level =
+	    bc->max_momentary_loudness = bc->max_short_term_loudness =
+	    BEXT_NO_LOUDNESS;
+	memcpy(bc->coding_history, history, len + 1);
+    }
+    return bc;
+}
+
+LablChunk *
+NewLablChunk(const char *tag, uint32_t name, const char *text)
+{
+    LablChunk *lc;
+    size_t len = strlen(text) + 1;
+
+    if ((lc = (LablChunk *)newChunk(tag, 4 + len, 0, sizeof(*lc) + len)) != NULL) {
+	lc->name = name;
+	memcpy(lc->label, text, len);
+    }
+    return lc;
+}
+
+/**
+ * Recursively search for a chunk with this tag.
+ */
+Chunk *
+FindChunk(Chunk *list, const char *tag, const char *type)
+{
+    Chunk *chunk;
+
+    for (; list != NULL; list = list->next)
+    {
+	bool isList = strncasecmp(list->identifier, "list", 4) == 0;
+	if (strncasecmp(list->identifier, tag, 4) == 0) {
+	    if (!isList || type == NULL ||
+		strncasecmp(((ListChunk *)list)->type, type, 4) == 0)
+	    {
+		return list;
+	    }
+	}
+	if (isList) {
+	    chunk = FindChunk(((ListChunk *)list)->children, tag, type);
+	    if (chunk != NULL) {
+		return chunk;
+	    }
+	}
+    }
+    return NULL;
+}
+
+Chunk **
+FindChunkPtr(Chunk **list, const char *tag, const char *type)
+{
+    Chunk **ptr;
+
+    for (ptr = list; *ptr != NULL; ptr = &(*ptr)->next) {
+	if (strncasecmp((*ptr)->identifier, tag, 4) == 0 &&
+	    (type == NULL || strncasecmp((*ptr)->identifier, "list", 4) != 0 ||
+	     strncasecmp(((ListChunk *)*ptr)->type, type, 4) == 0))
+	{
+	    return ptr;
+	}
+    }
+    return NULL;
+}
+
+Chunk *
+ReplaceChunk(Chunk **list, Chunk *chunk)
+{
+    Chunk **ptr, *old;
+
+    if ((ptr = FindChunkPtr(list, chunk->identifier, NULL)) == NULL) {
+	return NULL;
+    }
+    old = *ptr;
+    chunk->next = old->next;
+    *ptr = chunk;
+    return old;
+}
+
+uint16_t
+FmtType(const FmtChunk *fc)
+{
+    /* cbSize, valid bits, channel mask, then the subformat GUID,
+     * which starts with the format code.
+     */
+    if (fc->type == RIFF_EXTENSIBLE && fc->ext != NULL && fc->ext_len >= 10) {
+	return readUInt16(fc->ext + 8);
+    }
+    return fc->type;
+}
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "libid3.h"
 
@@ -27,10 +28,14 @@ typedef struct fmt_chunk {
   uint32_t bytes_sec;	/* Average bytes/second */
   uint16_t block_align;	/* Channels * bits/sample/8 */
   uint16_t bits_samp;	/* Bits/sample, eg. 8 or 16 */
+  uint16_t ext_len;	/* # of bytes in ext */
+  uint8_t *ext;		/* Anything past the first 16 bytes, starting
+  			   with cbSize, or NULL */
 } FmtChunk;
 
 #define	RIFF_PCM		1
 #define	RIFF_MS_ADPCM		2
+#define	RIFF_IEEE_FLOAT		3
 #define	RIFF_ALAW		6
 #define	RIFF_MULAW		7
 #define	RIFF_CL_ADPCM		512
@@ -38,11 +43,35 @@ typedef struct fmt_chunk {
 #define	IBM_FORMAT_MULAW	0x0101
 #define	IBM_FORMAT_ALAW	0x0102
 #define	IBM_FORMAT_ADPCM	0x0103
+#define	RIFF_EXTENSIBLE		0xFFFE	/* Real type is in ext, see FmtType() */
+
+/**
+ * Function that produces the contents of a data chunk while it is
+ * being written, e.g. to convert the samples on the fly. It fills
+ * buffer with up to len bytes.
+ * @return # of bytes supplied, 0 at end of data, <0 on error
+ */
+typedef long (*DataSource)(void *ctx, void *buffer, size_t len);
+
+/**
+ * A range of bytes in another file, for data that is made up of
+ * pieces of several files, e.g. files joined end to end.
+ */
+typedef struct data_segment {
+  FILE *file;
+  uint32_t offset;	/* Of the first byte in file */
+  uint32_t length;
+} DataSegment;
 
 typedef struct data_chunk {
   Chunk header;
   void *data;	/* Pointer to raw audio data. If NULL, get the
-  		   data from the original file */
+  		   data from source, segments, or the original file */
+  DataSource source;	/* Called to produce the data, if not NULL */
+  void *source_ctx;	/* Passed to source */
+  DataSegment *segments;	/* Copied in order, if not NULL; their
+  				   lengths must add up to the chunk's */
+  uint32_t n_segments;
 } DataChunk;
 
 typedef struct cue {
@@ -89,6 +118,28 @@ typedef struct ltxt_chunk {
   uint8_t data[];
 } LtxtChunk;
 
+/**
+ * The cue points of a file joined with their labels, notes and
+ * regions from the LIST/adtl chunk, sorted by position, with a hash
+ * table to find a cue point by name.
+ */
+typedef struct marker {
+  uint32_t name;	/* Cue point id */
+  uint32_t position;	/* Sample frame, from sample_offset */
+  uint32_t length;	/* # of frames, from ltxt; 0 for a point */
+  const char *label;	/* From labl, or NULL */
+  const char *note;	/* From note, or NULL */
+  const LtxtChunk *ltxt;	/* or NULL */
+} Marker;
+
+typedef struct marker_index {
+  size_t count;
+  Marker *markers;	/* Sorted by position, then name */
+  /* Private */
+  uint32_t *table;	/* Open addressing, index+1 into markers */
+  size_t mask;
+} MarkerIndex;
+
 typedef struct file_chunk {
   Chunk header;
   uint32_t name;	/* Matches cue */
@@ -128,11 +179,155 @@ typedef struct text_chunk IsrcChunk;	/* Source */
 typedef struct text_chunk IsrfChunk;	/* Source Form */
 typedef struct text_chunk ItchChunk;	/* Technician */
 
+/**
+ * Block checksums of the data chunk, a private "bsum" chunk: a
+ * version (1), the block size in bytes, the length of the data,
+ * the # of blocks, then a CRC-32 of each block of the data.
+ *
+ * Whenever a file with this chunk is written, the checksums are
+ * computed from the data as it goes out, so they always match the
+ * data chunk of that file, whatever was done to the audio.
+ */
+typedef struct checksum_chunk {
+  Chunk header;
+  uint32_t block;	/* Bytes per block; 0 if the chunk is damaged */
+  uint32_t data_length;	/* Length of the data that was summed */
+  uint32_t count;	/* # of blocks */
+  uint32_t *crcs;	/* One CRC-32 per block */
+  uint32_t crc;		/* While writing: the block in progress */
+  uint32_t used;	/* # of bytes in it */
+  uint32_t done;	/* # of blocks finished */
+} ChecksumChunk;
+
+#define	CHECKSUM_BLOCK	(1 << 18)	/* Default bytes per block */
+
 typedef struct id3_chunk {
   Chunk header;
   Id3V2 *id3v2;
 } Id3v2Chunk;
 
+/**
+ * Sampler chunk: how to play the file as an instrument sample, and
+ * its loops. Loop ends are the last frame played, not one past it.
+ */
+#define	SMPL_LOOP_FORWARD	0
+#define	SMPL_LOOP_PINGPONG	1
+#define	SMPL_LOOP_BACKWARD	2
+
+typedef struct sample_loop {
+  uint32_t name;	/* Cue point id */
+  uint32_t type;	/* SMPL_LOOP_FORWARD etc. */
+  uint32_t start;	/* Sample frames */
+  uint32_t end;
+  uint32_t fraction;	/* Fine tuning of the end, /2^32 of a frame */
+  uint32_t play_count;	/* 0 for forever */
+} SampleLoop;
+
+typedef struct smpl_chunk {
+  Chunk header;
+  uint32_t manufacturer;	/* MMA manufacturer code, or 0 */
+  uint32_t product;
+  uint32_t sample_period;	/* ns per frame */
+  uint32_t midi_unity_note;	/* Note played at the recorded pitch */
+  uint32_t midi_pitch_fraction;	/* Above that note, /2^32 of a semitone */
+  uint32_t smpte_format;
+  uint32_t smpte_offset;
+  uint32_t n_loops;
+  uint32_t sampler_data_len;	/* Bytes of sampler_data */
+  uint8_t *sampler_data;	/* Manufacturer data, after the loops */
+  SampleLoop loops[];
+} SmplChunk;
+
+/**
+ * Instrument chunk: the key and velocity range a sample covers.
+ */
+typedef struct inst_chunk {
+  Chunk header;
+  uint8_t unshifted_note;	/* MIDI note */
+  int8_t fine_tune;	/* Cents */
+  int8_t gain;		/* dB */
+  uint8_t low_note;
+  uint8_t high_note;
+  uint8_t low_velocity;
+  uint8_t high_velocity;
+} InstChunk;
+
+/**
+ * Broadcast Wave Format description (EBU Tech 3285). The text fields
+ * are nul-terminated here and nul-padded in the file. The loudness
+ * fields are in hundredths, e.g. -2300 for -23 LUFS, and are defined
+ * from version 2 on; 0x7fff means not set. Everything but the coding
+ * history has a fixed size, so it can be changed with UpdateChunk().
+ */
+#define	BEXT_SIZE	602	/* Bytes before the coding history */
+#define	BEXT_NO_LOUDNESS	0x7fff
+
+typedef struct bext_chunk {
+  Chunk header;
+  char description[256+1];
+  char originator[32+1];
+  char originator_reference[32+1];
+  char origination_date[10+1];	/* yyyy-mm-dd */
+  char origination_time[8+1];	/* hh:mm:ss */
+  uint64_t time_reference;	/* Samples since midnight */
+  uint16_t version;
+  uint8_t umid[64];	/* SMPTE 330M, or zero */
+  int16_t loudness_value;	/* LUFS */
+  int16_t loudness_range;	/* LU */
+  int16_t max_true_peak_level;	/* dBTP */
+  int16_t max_momentary_loudness;	/* LUFS */
+  int16_t max_short_term_loudness;	/* LUFS */
+  uint8_t reserved[180];
+  char coding_history[];	/* nul-terminated, header.length - BEXT_SIZE
+  				   bytes in the file */
+} BextChunk;
+
+/**
+ * AIFF and AIFC files: the top level is a "FORM" chunk of type
+ * "AIFF" or "AIFC", and all numbers are big-endian. The format is in
+ * the COMM chunk and the samples in the SSND chunk. OpenWaveFile()
+ * and WriteWaveFile() read and write them like .wav files, using
+ * these chunks and the text chunks "NAME", "AUTH", "(c) " and "ANNO".
+ */
+typedef struct comm_chunk {
+  Chunk header;
+  uint16_t channels;
+  uint32_t frames;	/* # of sample frames */
+  uint16_t bits_samp;	/* Bits/sample, before any compression */
+  double sample_rate;	/* An 80-bit float in the file */
+  char compression[4];	/* AIFC only, e.g. "NONE" or "sowt"; all zero
+  			   for AIFF */
+  char compression_name[256];	/* AIFC only, nul-terminated */
+} CommChunk;
+
+/**
+ * The samples of an AIFF file. The DataChunk members work as for a
+ * .wav data chunk, but header.length includes the 8 bytes of
+ * data_offset and block_size, and the samples start data_offset
+ * bytes after those.
+ */
+typedef struct ssnd_chunk {
+  DataChunk data;
+  uint32_t data_offset;	/* Bytes before the first sample, usually 0 */
+  uint32_t block_size;	/* Usually 0 */
+} SsndChunk;
+
+#define	AIFC_VERSION	0xA2805140	/* The "FVER" value */
+
+/**
+ * A size field of a file that does not match the file, with the value
+ * it should have.
+ */
+typedef struct wave_repair {
+  const char *field;	/* e.g. "data length" */
+  uint64_t offset;	/* Of the field in the file */
+  int width;		/* 4 or 8 bytes */
+  uint64_t old_value;
+  uint64_t new_value;
+} WaveRepair;
+
+#define	MAX_WAVE_REPAIRS	8
+
 #ifdef	__cplusplus
 extern	"C"
 {
@@ -147,20 +342,213 @@ extern const char *WaveError;	/* Error text from last failure */
  */
 extern	WaveChunk *OpenWaveFile(FILE *ifile);
 
+/**
+ * Free what OpenWaveFile() returned, with all of its chunks.
+ */
+extern	void	FreeWaveFile(WaveChunk *wave);
+
+/**
+ * Return the sample format of a fmt chunk, e.g. RIFF_PCM. For
+ * WAVE_FORMAT_EXTENSIBLE files this is taken from the subformat.
+ */
+extern	uint16_t FmtType(const FmtChunk *);
+
 /**
  * Write a new .wav file to dst. The audio data is pulled from src
  * file if the "data" member of the data chunks is NULL. If none of
  * the data chunks are NULL, then src is not required and may be
  * NULL. The rest of the metadata is provided by the structures
  * pointed to by 'wave'.
+ * @return 0 on success, -1 if any audio data could not be
+ *         copied or produced
+ */
+extern	int	WriteWaveFile(WaveChunk *wave, FILE *src, FILE *dst);
+
+/**
+ * Add a checksum chunk, so that the next WriteWaveFile() stores
+ * checksums of the data. Any existing one is kept, with its block
+ * size if block is 0.
+ * @param block  bytes per block, rounded down to whole sample
+ *               frames, or 0 for about CHECKSUM_BLOCK
+ * @return 0 on success, -1 on error
  */
-extern	void	WriteWaveFile(WaveChunk *wave, FILE *src, FILE *dst);
+extern	int	AddChecksums(WaveChunk *wave, uint32_t block);
+
+/**
+ * Check the data of a file against its checksum chunk, reading
+ * blocks on up to threads threads. Blocks that are missing because
+ * the data is shorter than when it was summed count as bad.
+ * @param file  the file that was passed to OpenWaveFile()
+ * @param bad   receives 1 for each bad block and 0 for each good
+ *              one; it must hold ChecksumChunk.count bytes
+ * @return # of bad blocks, or -1 on error
+ */
+extern	long	VerifyChecksums(WaveChunk *wave, FILE *file, int threads,
+			uint8_t *bad);
+
+/**
+ * Build a marker index from the "cue " chunk and LIST/adtl chunks of
+ * a file, in O(n log n). A file without them gives an empty index.
+ * The index points into the chunks, which must not be freed first.
+ * @return new index, or NULL if out of memory
+ */
+extern	MarkerIndex *NewMarkerIndex(WaveChunk *wave);
+
+/**
+ * Find a marker by cue point name.
+ * @return the marker, or NULL if there is none
+ */
+extern	const Marker *FindMarker(const MarkerIndex *, uint32_t name);
+
+/**
+ * Find the markers with positions from start up to but not including
+ * end, by binary search.
+ * @param first  receives the index in markers of the first one
+ * @return # of markers in the range
+ */
+extern	size_t	MarkersInRange(const MarkerIndex *, uint32_t start, uint32_t end,
+			size_t *first);
+
+extern	void	FreeMarkerIndex(MarkerIndex *);
+
+/**
+ * Replace the cue points and their LIST/adtl chunk with those that
+ * fall in frames [start,end) of the data, moved to their positions
+ * relative to start. Regions that overlap the range are cut to fit.
+ * Other chunks in LIST/adtl, e.g. "file", are kept. The data chunk
+ * must be at the top level.
+ * @return 0 on success, else -1 with WaveError set
+ */
+extern	int	RebaseMarkers(WaveChunk *wave, uint32_t start, uint32_t end);
+
+/**
+ * Create a cue chunk with room for n cues, all zero.
+ */
+extern	CueChunk *NewCueChunk(uint32_t n);
+
+/**
+ * Create a "labl" or "note" chunk.
+ */
+extern	LablChunk *NewLablChunk(const char *tag, uint32_t name, const char *text);
+
+/**
+ * Create a "smpl" chunk with room for n loops, all zero, and
+ * sampler_data_len bytes of sampler data. The unity note is middle C.
+ */
+extern	SmplChunk *NewSmplChunk(uint32_t n, uint32_t sampler_data_len);
+
+/**
+ * Create an "inst" chunk covering every note and velocity, with the
+ * unshifted note middle C.
+ */
+extern	InstChunk *NewInstChunk(void);
+
+/**
+ * Describe the samples of an AIFF file as a .wav fmt chunk would:
+ * PCM, float, A-law or mu-law. AIFF PCM is signed even at 8 bits,
+ * and big-endian unless the compression type is "sowt".
+ * @param fmt   receives the format, with no extension
+ * @param swap  receives true if the samples are big-endian
+ * @return 0 on success, else -1 with WaveError set
+ */
+extern	int	AiffFormat(WaveChunk *wave, FmtChunk *fmt, bool *swap);
+
+/**
+ * Create a "COMM" chunk for frames frames of samples in the format
+ * fmt, which must be PCM, float, A-law or mu-law. Only PCM can be
+ * stored in AIFF; the others need AIFC.
+ * @return new chunk, or NULL with WaveError set
+ */
+extern	CommChunk *NewCommChunk(const FmtChunk *fmt, uint32_t frames, bool aifc);
+
+/**
+ * Create an "SSND" chunk for length bytes of samples.
+ */
+extern	SsndChunk *NewSsndChunk(uint32_t length);
+
+/**
+ * Create a version 2 "bext" chunk with the given coding history,
+ * empty text fields and no loudness values.
+ */
+extern	BextChunk *NewBextChunk(const char *history);
+
+/**
+ * Write a chunk over itself in the file it was read from, without
+ * rewriting the rest of the file, e.g. after changing fields of a
+ * "bext" chunk. Only chunks that are still the same length, and that
+ * libwav writes from their fields, can be updated: not data, lists or
+ * unknown chunks.
+ * @param file    the file, open for update
+ * @param length  the chunk's length when it was read
+ * @return 0 on success, else -1 with WaveError set
+ */
+extern	int	UpdateChunk(FILE *file, Chunk *chunk, uint32_t length);
+
+/**
+ * Find the size fields of a .wav or RF64 file that do not match its
+ * contents, e.g. after a recorder stopped without finishing the
+ * file: the RIFF length, the data length, the fact sample count and
+ * the lengths in ds64. A data length that runs past the end of the
+ * file, or is 0 and not followed by another chunk, is taken to be
+ * stale, and the data to run to the end of the file in whole blocks. Bytes after the last chunk that are not a
+ * chunk are left alone, e.g. padding. Only the chunk headers are
+ * read, not the file as OpenWaveFile() does.
+ * @param repairs   receives up to MAX_WAVE_REPAIRS fields
+ * @param trailing  receives the # of bytes after the last chunk
+ * @return # of fields that need repair, or -1 with WaveError set
+ */
+extern	int	FindWaveRepairs(FILE *file, WaveRepair *repairs,
+			uint64_t *trailing);
+
+/**
+ * Write the values from FindWaveRepairs() over the fields in place.
+ * @param file  open for update
+ * @return 0 on success, else -1 with WaveError set
+ */
+extern	int	ApplyWaveRepairs(FILE *file, const WaveRepair *repairs, int n);
 
 /**
  * Create a new empty chunk.
  */
 extern Chunk *newChunk(const char *tag, uint32_t length, uint32_t offset, size_t size);
 
+/**
+ * Create a new data chunk. The data will be copied from the source
+ * file at offset+8 unless the data, source or segments members are
+ * set.
+ */
+extern DataChunk *newDataChunk(const char *tag, uint32_t length, uint32_t offset);
+
+/**
+ * Recursively search a list of chunks for one with this tag. If
+ * tag is "LIST" and type is not NULL, the list type must match
+ * as well, e.g. FindChunk(wave->children, "LIST", "INFO").
+ * @return the first matching chunk or NULL
+ */
+extern Chunk *FindChunk(Chunk *list, const char *tag, const char *type);
+
+/**
+ * Find the link that points to a chunk in this list, not searching
+ * sub-lists, so that the chunk can be replaced or removed. tag and
+ * type are as for FindChunk().
+ * @return pointer to the link, or NULL
+ */
+extern Chunk **FindChunkPtr(Chunk **list, const char *tag, const char *type);
+
+/**
+ * Put chunk in the list in place of the first chunk with its tag.
+ * @return the chunk that was replaced, or NULL if there was none, in
+ *         which case the list is not changed
+ */
+extern Chunk *ReplaceChunk(Chunk **list, Chunk *chunk);
+
+/**
+ * Free a chunk that is not in a list, with its children and whatever
+ * libwav allocated for it. The data, source_ctx and segments of a data
+ * chunk belong to the caller and are not freed.
+ */
+extern void FreeChunk(Chunk *chunk);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,117 @@
+/**
+ * @file
+ * Check what FindWaveRepairs() finds in finished, padded and
+ * unfinished .wav files.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "../libwav.h"
+
+#define	DATA_LEN	4000	/* 1000 frames of 16-bit stereo */
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void
+put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v; p[1] = v >> 8;
+}
+
+/**
+ * Write a 16-bit stereo file with the given size fields and audio
+ * bytes of silence, followed by pad zero bytes.
+ */
+static FILE *
+makeFile(uint32_t riffLen, uint32_t dataLen, int audio, int pad)
+{
+    uint8_t hdr[44];
+    static uint8_t zero[DATA_LEN + 1024];
+    FILE *file = tmpfile();
+
+    if (file == NULL) {
+	perror("tmpfile");
+	exit(3);
+    }
+    memcpy(hdr, "RIFF", 4);
+    put32(hdr+4, riffLen);
+    memcpy(hdr+8, "WAVEfmt ", 8);
+    put32(hdr+16, 16);
+    put16(hdr+20, 1);			/* PCM */
+    put16(hdr+22, 2);			/* Channels */
+    put32(hdr+24, 44100);
+    put32(hdr+28, 44100 * 4);
+    put16(hdr+32, 4);			/* Block align */
+    put16(hdr+34, 16);
+    memcpy(hdr+36, "data", 4);
+    put32(hdr+40, dataLen);
+    fwrite(hdr, 1, sizeof(hdr), file);
+    fwrite(zero, 1, audio + pad, file);
+    fflush(file);
+    return file;
+}
+
+/**
+ * A finished file with no audio, then a LIST/INFO chunk.
+ */
+static FILE *
+makeEmpty(void)
+{
+    static const uint8_t info[] = "LIST\x0e\0\0\0INFOINAM\x02\0\0\0x";
+    FILE *file = makeFile(36 + sizeof(info), 0, 0, 0);
+
+    fwrite(info, 1, sizeof(info), file);
+    fflush(file);
+    return file;
+}
+
+/**
+ * @return 0 if FindWaveRepairs() finds nrepairs fields to fix and
+ *         trailing bytes after the last chunk, else 1
+ */
+static int
+check(const char *name, FILE *file, int nrepairs, uint64_t trailing)
+{
+    WaveRepair repairs[MAX_WAVE_REPAIRS];
+    uint64_t left;
+    int n, bad;
+
+    if ((n = FindWaveRepairs(file, repairs, &left)) < 0) {
+	fprintf(stderr, "%s: %s\n", name, WaveError);
+	exit(3);
+    }
+    bad = n != nrepairs || left != trailing;
+    printf("%s: %s: %d repairs, %" PRIu64 " trailing bytes\n",
+	bad ? "FAIL" : "ok", name, n, left);
+    fclose(file);
+    return bad;
+}
+
+int
+main(int argc, char **argv)
+{
+    int fails = 0;
+
+    fails += check("finished",
+	makeFile(36 + DATA_LEN, DATA_LEN, DATA_LEN, 0), 0, 0);
+    fails += check("padded",
+	makeFile(36 + DATA_LEN, DATA_LEN, DATA_LEN, 100), 0, 100);
+    fails += check("padded, RIFF over it",
+	makeFile(36 + DATA_LEN + 100, DATA_LEN, DATA_LEN, 100), 0, 100);
+    fails += check("unfinished", makeFile(0, 0, DATA_LEN, 0), 2, 0);
+    fails += check("unfinished, odd end", makeFile(0, 0, DATA_LEN, 3), 2, 3);
+    fails += check("data past the end",
+	makeFile(36 + DATA_LEN * 2, DATA_LEN * 2, DATA_LEN, 0), 2, 0);
+    fails += check("RIFF short of the data",
+	makeFile(36, DATA_LEN, DATA_LEN, 100), 1, 100);
+    fails += check("no audio, then tags", makeEmpty(), 0, 0);
+    return fails != 0;
+}
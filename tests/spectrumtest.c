@@ -0,0 +1,111 @@
+/**
+ * @file
+ * Check the bandwidth and verdict of SpectrumSummary() on noise that
+ * is band-limited with a brick wall at known frequencies.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "../libspectrum.h"
+#include "../libfft.h"
+
+#define	PERIOD	65536		/* Samples in one period of the noise */
+#define	SECONDS	4
+
+static uint32_t seed = 12345;
+
+static float
+uniform(void)
+{
+    seed = seed * 1664525 + 1013904223;
+    return (seed >> 8) / 16777216.0f - 0.5f;
+}
+
+/**
+ * One period of white noise with nothing above cutoff Hz. It repeats
+ * seamlessly, so the only edge in the spectrum is the cutoff.
+ */
+static float *
+bandLimited(uint32_t rate, double cutoff)
+{
+    Fft *fft = NewFft(PERIOD);
+    float *re = malloc((PERIOD/2 + 1) * sizeof(float));
+    float *im = malloc((PERIOD/2 + 1) * sizeof(float));
+    float *x = malloc(PERIOD * sizeof(float));
+    float peak = 0;
+    int k;
+
+    if (fft == NULL || re == NULL || im == NULL || x == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	exit(3);
+    }
+    for (k=0; k <= PERIOD/2; ++k) {
+	int keep = k > 0 && k * (double)rate / PERIOD <= cutoff;
+	re[k] = keep ? uniform() : 0;
+	im[k] = keep ? uniform() : 0;
+    }
+    InverseRealFft(fft, re, im, x);
+    for (k=0; k < PERIOD; ++k) {
+	if (fabsf(x[k]) > peak) peak = fabsf(x[k]);
+    }
+    for (k=0; k < PERIOD; ++k) {
+	x[k] *= 0.3f / peak;
+    }
+    FreeFft(fft);
+    free(re);
+    free(im);
+    return x;
+}
+
+/**
+ * @return 0 if the summary is as expected, else 1
+ */
+static int
+check(uint32_t rate, double cutoff, SpectrumVerdict verdict, uint32_t source)
+{
+    float *x = bandLimited(rate, cutoff);
+    Spectrum *s = NewSpectrum(2048, 512, 1, 4, NULL, NULL);
+    SpectralSummary sum;
+    double expect = cutoff < rate / 2.0 ? cutoff : rate / 2.0;
+    int i, bad;
+
+    if (s == NULL) {
+	fprintf(stderr, "%s\n", SpectrumError);
+	exit(3);
+    }
+    for (i=0; i < (int)(SECONDS * rate / PERIOD); ++i) {
+	SpectrumWrite(s, x, PERIOD);
+    }
+    SpectrumFinish(s);
+    if (SpectrumSummary(s, rate, &sum) != 0) {
+	fprintf(stderr, "%s\n", SpectrumError);
+	exit(3);
+    }
+    bad = sum.verdict != verdict || sum.source_rate != source ||
+	fabs(sum.bandwidth - expect) > 300;
+    printf("%s: %u Hz cut at %.0f Hz: bandwidth %.0f Hz, drop %.1f dB, "
+	"verdict %d from %u\n", bad ? "FAIL" : "ok", rate, cutoff,
+	sum.bandwidth, sum.drop_db, sum.verdict, sum.source_rate);
+    FreeSpectrum(s);
+    free(x);
+    return bad;
+}
+
+int
+main(int argc, char **argv)
+{
+    int fails = 0;
+
+    fails += check(96000, 22000, SPECTRUM_UPSAMPLED, 44100);
+    fails += check(96000, 23800, SPECTRUM_UPSAMPLED, 48000);
+    fails += check(96000, 16000, SPECTRUM_UPSAMPLED, 32000);
+    fails += check(96000, 9000, SPECTRUM_LIMITED, 0);
+    fails += check(96000, 48000, SPECTRUM_FULL, 0);
+    fails += check(48000, 20000, SPECTRUM_UPSAMPLED, 44100);
+    fails += check(44100, 17000, SPECTRUM_LOSSY, 0);
+    fails += check(44100, 22050, SPECTRUM_FULL, 0);
+    return fails != 0;
+}
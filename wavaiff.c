@@ -0,0 +1,415 @@
+static const char usage[] = "usage:\n"
+"	wavaiff [options] infile outfile\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-c	--aifc		Write an AIFC file instead of AIFF\n"
+"\n"
+"Converts an AIFF or AIFC file to .wav, or a .wav file to AIFF; the\n"
+"kind of input decides which. PCM, float, A-law and mu-law samples\n"
+"are supported. AIFF can only hold PCM, so -c is needed for the\n"
+"others; AIFC files with \"sowt\" (little-endian) samples are read too.\n"
+"\n"
+"The samples are not decoded: they are byte-swapped a 64-bit word at\n"
+"a time on the way through, or copied as they are when no swap is\n"
+"needed. The NAME, AUTH, ANNO and \"(c) \" chunks of an AIFF file and\n"
+"the INAM, IART, ICMT and ICOP tags of a .wav file are carried over to\n"
+"each other, as are ID3 tags.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libsplit.h"
+
+/**
+ * Reads the samples from the input, swapped into the byte order of
+ * the output, for the output's data chunk.
+ */
+typedef struct swapper {
+  int fd;
+  off_t position;	/* Of the next byte in the input */
+  uint32_t remaining;	/* Bytes left to read */
+  int width;		/* Bytes per sample */
+  bool swap;		/* Reverse the bytes of each sample */
+  bool flip;		/* 8-bit PCM: signed one side, unsigned the other */
+} Swapper;
+
+/* Text tags: .wav INFO tag and AIFF chunk */
+static const struct {
+  const char *info, *aiff;
+} textTags[] = {
+  {"INAM", "NAME"},
+  {"IART", "AUTH"},
+  {"ICMT", "ANNO"},
+  {"ICOP", "(c) "},
+};
+
+#define	NA(a)	(sizeof(a)/sizeof(a[0]))
+
+static WaveChunk *toWave(WaveChunk *aiffFile, FILE *ifile, Swapper *sw);
+static WaveChunk *toAiff(WaveChunk *waveFile, FILE *ifile, Swapper *sw);
+static Chunk *aiffText(const char *tag, const char *value);
+static Chunk *renameId3(WaveChunk *wave, const char *tag);
+static long swapSamples(void *ctx, void *buffer, size_t len);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"aifc", no_argument, NULL, 'c'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static bool aifc = false;
+
+
+int
+main(int argc, char **argv)
+{
+    const char *ifilename, *ofilename;
+    FILE *ifile, *ofile = NULL;
+    WaveChunk *inFile = NULL, *outFile = NULL;
+    Swapper sw;
+    struct stat ist, ost;
+    bool fromAiff;
+    int c;
+    int rval = 4;
+
+    while ((c = getopt_long(argc, argv, "hvc", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'c': aifc = true; break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (argc - optind != 2) {
+	fprintf(stderr, usage);
+	return 2;
+    }
+    ifilename = argv[optind++];
+    ofilename = argv[optind++];
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if (stat(ofilename, &ost) == 0 && fstat(fileno(ifile), &ist) == 0 &&
+	ost.st_dev == ist.st_dev && ost.st_ino == ist.st_ino)
+    {
+	fprintf(stderr, "Input file and output file cannot be the same\n");
+	rval = 2;
+	goto exit;
+    }
+    if ((inFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	goto exit;
+    }
+    fromAiff = strncasecmp(inFile->header.identifier, "FORM", 4) == 0;
+    if (fromAiff && aifc) {
+	fprintf(stderr, "%s is an AIFF file already; -c is for .wav input\n",
+	    ifilename);
+	rval = 2;
+	goto exit;
+    }
+    sw.fd = fileno(ifile);
+    outFile = fromAiff ? toWave(inFile, ifile, &sw) : toAiff(inFile, ifile, &sw);
+    if (outFile == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	goto exit;
+    }
+    if (verbose) {
+	printf("%s: %" PRIu32 " bytes of %d-byte samples, %s\n", ifilename,
+	    sw.remaining, sw.width, sw.swap ? "swapped" : "copied");
+    }
+
+    rval = 3;
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+    if (WriteWaveFile(outFile, ifile, ofile) != 0) {
+	fprintf(stderr, "%s: %s\n", ofilename, WaveError);
+	goto exit;
+    }
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    rval = 0;
+
+exit:
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    FreeWaveFile(outFile);
+    FreeWaveFile(inFile);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Build a .wav file from an AIFF one: fmt, data, INFO tags and id3.
+ * @return the new file, or NULL with WaveError set
+ */
+static WaveChunk *
+toWave(WaveChunk *aiffFile, FILE *ifile, Swapper *sw)
+{
+    CommChunk *comm = (CommChunk *)FindChunk(aiffFile->children, "COMM", NULL);
+    SsndChunk *ssnd = (SsndChunk *)FindChunk(aiffFile->children, "SSND", NULL);
+    WaveChunk *wave;
+    FmtChunk *fmt;
+    FactChunk *fact;
+    DataChunk *data;
+    ListChunk *info;
+    TextChunk *text;
+    Chunk *id3;
+    uint32_t length;
+    size_t i;
+
+    wave = (WaveChunk *)newChunk("RIFF", 4, 0, sizeof(*wave));
+    fmt = (FmtChunk *)newChunk("fmt ", 16, 0, sizeof(*fmt));
+    info = SplitCopyInfo(aiffFile);	/* Empty */
+    if (wave == NULL || fmt == NULL || info == NULL) {
+	WaveError = "Out of memory";
+	free(wave);
+	free(fmt);
+	FreeChunk((Chunk *)info);
+	return NULL;
+    }
+    memcpy(wave->type, "WAVE", 4);
+    wave->children = NULL;
+    if (AiffFormat(aiffFile, fmt, &sw->swap) != 0) {
+	free(fmt);
+	goto fail;
+    }
+    wave->children = &fmt->header;
+
+    /* COMM gives the # of frames, but a short file has fewer */
+    length = ssnd->data.header.length - 8 - ssnd->data_offset;
+    if (comm->frames < length / fmt->block_align) {
+	length = comm->frames * fmt->block_align;
+    }
+    length -= length % fmt->block_align;
+    if ((data = newDataChunk("data", length, 0)) == NULL) {
+	WaveError = "Out of memory";
+	goto fail;
+    }
+    fmt->header.next = &data->header;
+    sw->position = (off_t)ssnd->data.header.offset + 16 + ssnd->data_offset;
+    sw->remaining = length;
+    sw->width = fmt->block_align / fmt->channels;
+    sw->swap = sw->swap && sw->width > 1;
+    sw->flip = fmt->type == RIFF_PCM && sw->width == 1;
+    data->source = swapSamples;
+    data->source_ctx = sw;
+
+    for (i=0; i < NA(textTags); ++i) {
+	text = (TextChunk *)FindChunk(aiffFile->children, textTags[i].aiff, NULL);
+	if (text != NULL && text->string[0] != '\0' &&
+	    SplitSetInfo(info, textTags[i].info, text->string) != 0)
+	{
+	    WaveError = "Out of memory";
+	    goto fail;
+	}
+    }
+    /* Non-PCM formats need a fact chunk */
+    if (fmt->type != RIFF_PCM) {
+	if ((fact = (FactChunk *)newChunk("fact", 4, 0, sizeof(*fact))) == NULL) {
+	    WaveError = "Out of memory";
+	    goto fail;
+	}
+	fact->n = length / fmt->block_align;
+	fact->header.next = fmt->header.next;
+	fmt->header.next = &fact->header;
+    }
+    if (info->children != NULL) {
+	data->header.next = &info->header;
+    } else {
+	FreeChunk(&info->header);
+    }
+    if ((id3 = renameId3(aiffFile, "id3 ")) != NULL) {
+	id3->next = data->header.next;
+	data->header.next = id3;
+    }
+    return wave;
+
+fail:
+    FreeChunk(&info->header);
+    FreeWaveFile(wave);
+    return NULL;
+}
+
+/**
+ * Build an AIFF or AIFC file from a .wav file: FVER for AIFC, COMM,
+ * the text chunks, SSND and ID3.
+ * @return the new file, or NULL with WaveError set
+ */
+static WaveChunk *
+toAiff(WaveChunk *waveFile, FILE *ifile, Swapper *sw)
+{
+    FmtChunk *fmt = (FmtChunk *)FindChunk(waveFile->children, "fmt ", NULL);
+    Chunk *idata = FindChunk(waveFile->children, "data", NULL);
+    ListChunk *info = (ListChunk *)FindChunk(waveFile->children, "LIST", "INFO");
+    WaveChunk *wave;
+    IntChunk *fver = NULL;
+    CommChunk *comm;
+    SsndChunk *ssnd;
+    TextChunk *text;
+    Chunk **tail, *chunk;
+    uint32_t length;
+    uint16_t type;
+    size_t i;
+
+    if (fmt == NULL || idata == NULL) {
+	WaveError = fmt == NULL ? "No fmt chunk" : "No data chunk";
+	return NULL;
+    }
+    type = FmtType(fmt);
+    if (fmt->channels == 0 ||
+	fmt->block_align != fmt->channels * ((fmt->bits_samp + 7) / 8))
+    {
+	/* e.g. 24 bits in 32, which AIFF has no way to say */
+	WaveError = "Samples are padded or in blocks; convert them first";
+	return NULL;
+    }
+    length = idata->length - idata->length % fmt->block_align;
+    if ((comm = NewCommChunk(fmt, length / fmt->block_align, aifc)) == NULL) {
+	return NULL;
+    }
+    wave = (WaveChunk *)newChunk("FORM", 4, 0, sizeof(*wave));
+    ssnd = NewSsndChunk(length);
+    if (aifc) {
+	fver = (IntChunk *)newChunk("FVER", 4, 0, sizeof(*fver));
+    }
+    if (wave == NULL || ssnd == NULL || (aifc && fver == NULL)) {
+	WaveError = "Out of memory";
+	free(wave);
+	free(ssnd);
+	free(fver);
+	free(comm);
+	return NULL;
+    }
+    memcpy(wave->type, aifc ? "AIFC" : "AIFF", 4);
+    sw->position = (off_t)idata->offset + 8;
+    sw->remaining = length;
+    sw->width = fmt->block_align / fmt->channels;
+    sw->swap = (type == RIFF_PCM || type == RIFF_IEEE_FLOAT) && sw->width > 1;
+    sw->flip = type == RIFF_PCM && sw->width == 1;
+    ssnd->data.source = swapSamples;
+    ssnd->data.source_ctx = sw;
+
+    tail = &wave->children;
+    if (fver != NULL) {
+	fver->n = AIFC_VERSION;
+	*tail = &fver->header;
+	tail = &fver->header.next;
+    }
+    *tail = &comm->header;
+    tail = &comm->header.next;
+    for (i=0; info != NULL && i < NA(textTags); ++i) {
+	text = (TextChunk *)FindChunk(info->children, textTags[i].info, NULL);
+	if (text == NULL || text->string[0] == '\0') {
+	    continue;
+	}
+	if ((chunk = aiffText(textTags[i].aiff, text->string)) == NULL) {
+	    WaveError = "Out of memory";
+	    free(ssnd);
+	    FreeWaveFile(wave);
+	    return NULL;
+	}
+	*tail = chunk;
+	tail = &chunk->next;
+    }
+    *tail = &ssnd->data.header;
+    tail = &ssnd->data.header.next;
+    *tail = renameId3(waveFile, "ID3 ");
+    return wave;
+}
+
+/**
+ * An AIFF text chunk, which is not nul-terminated.
+ */
+static Chunk *
+aiffText(const char *tag, const char *value)
+{
+    size_t len = strlen(value);
+    TextChunk *text;
+
+    if ((text = (TextChunk *)newChunk(tag, len, 0, sizeof(Chunk) + len + 1)) == NULL) {
+	return NULL;
+    }
+    memcpy(text->string, value, len + 1);
+    return &text->header;
+}
+
+/**
+ * Take the ID3 chunk of a file, if it has one, out of it for the
+ * other kind of file, which spells its tag differently.
+ */
+static Chunk *
+renameId3(WaveChunk *wave, const char *tag)
+{
+    Chunk **ptr = FindChunkPtr(&wave->children, "id3 ", NULL);
+    Chunk *chunk;
+
+    if (ptr == NULL || ((Id3v2Chunk *)*ptr)->id3v2 == NULL) {
+	return NULL;
+    }
+    chunk = *ptr;
+    *ptr = chunk->next;
+    memcpy(chunk->identifier, tag, 4);
+    chunk->next = NULL;
+    return chunk;
+}
+
+/**
+ * Data source: read whole samples from the input and put them in the
+ * output's byte order.
+ */
+static long
+swapSamples(void *ctx, void *buffer, size_t len)
+{
+    Swapper *sw = ctx;
+    uint8_t *bytes = buffer;
+    ssize_t l;
+    size_t i;
+
+    if (len > sw->remaining) {
+	len = sw->remaining;
+    }
+    if (len >= sw->width) {
+	len -= len % sw->width;
+    }
+    if ((l = pread(sw->fd, buffer, len, sw->position)) <= 0) {
+	return -1;
+    }
+    l -= l % sw->width;
+    if (sw->swap) {
+	PcmSwapBytes(buffer, l / sw->width, sw->width);
+    }
+    if (sw->flip) {
+	for (i=0; i < l; ++i) {
+	    bytes[i] ^= 0x80;
+	}
+    }
+    sw->position += l;
+    sw->remaining -= l;
+    return l;
+}
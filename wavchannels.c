@@ -0,0 +1,700 @@
+static const char usage[] = "usage:\n"
+"	wavchannels -m remix [options] infile outfile\n"
+"	wavchannels -s [options] infile prefix\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-m	--remix spec	Remix the channels, see below\n"
+"	-s	--split		Split into one mono file per channel\n"
+"	-d	--dither type	Dither for integer output: none, rect, tpdf (tpdf)\n"
+"\n"
+"Remix specifications:\n"
+"	mono		Average of all channels\n"
+"	stereo		Downmix 5.1 (L R C LFE Ls Rs) to stereo\n"
+"	map:2,1		Reorder or select channels, numbered from 1\n"
+"	matrix:a,b;c,d	Explicit gains, one row per output channel\n"
+"\n"
+"A remix that only reorders, selects or silences channels copies the\n"
+"samples bit for bit. Any other remix is dithered for integer output.\n"
+"\n"
+"With -s, the file is read once and channel N is written to\n"
+"prefix_N.wav, all files at once. Split files are bit-exact copies of\n"
+"the input channels. All other chunks, including tags, are copied to\n"
+"every output file.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libdither.h"
+#include "libremix.h"
+
+#define	BLOCK_FRAMES	8192	/* Frames read at a time */
+#define	OUTPUT_BUFFER	(256*1024)	/* stdio buffer per split output */
+
+/**
+ * State for the data source that produces remixed samples
+ */
+typedef struct remix {
+  PcmStream *stream;
+  FmtChunk *fmt;	/* Output format */
+  Remixer *remixer;
+  Ditherer *dither;	/* NULL for a pick, float or 32-bit output */
+  int *pick;		/* Input channel of each output, -1 for silence,
+			 * if no output is a real mix; else NULL */
+  uint8_t *raw;		/* Input frames, for a pick */
+  float *inBuf;
+  float *outBuf;
+} Remix;
+
+/**
+ * The input file, read once and shared by all of the split outputs.
+ * Blocks are double buffered: while the writers drain one block, the
+ * next one is read and deinterleaved into the other slot.
+ */
+typedef struct splitter {
+  PcmStream *stream;
+  int channels;
+  int size;		/* Bytes per sample */
+  uint8_t *raw;		/* Interleaved block */
+  uint8_t *planes[2];	/* One block per slot, channel after channel */
+  size_t frames[2];	/* # of frames in each slot */
+  int users[2];		/* # of writers yet to finish with each slot */
+  uint64_t ready;	/* # of blocks made available so far */
+  bool eof;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} Splitter;
+
+/**
+ * One split output file. Each has its own thread, which parses the
+ * input's metadata for itself and writes through WriteWaveFile().
+ */
+typedef struct output {
+  Splitter *sp;
+  int channel;
+  const char *ifilename;
+  char *ofilename;
+  uint64_t block;	/* Block being consumed */
+  size_t used;		/* Bytes of it consumed */
+  bool holding;		/* True while block is in use */
+  uint32_t remaining;	/* Bytes still to be delivered */
+  int rval;
+  pthread_t tid;
+} Output;
+
+static int remixFile(const char *ifilename, const char *ofilename);
+static long remixSource(void *ctx, void *buffer, size_t len);
+static int *pickChannels(const float *matrix, int nin, int nout);
+static int splitFile(const char *ifilename, const char *prefix);
+static void *splitWriter(void *arg);
+static long splitSource(void *ctx, void *buffer, size_t len);
+static FmtChunk *replaceFmt(WaveChunk *, const FmtChunk *ifmt, int channels,
+			Chunk **old);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"remix", required_argument, NULL, 'm'},
+  {"split", no_argument, NULL, 's'},
+  {"dither", required_argument, NULL, 'd'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static const char *remixSpec = NULL;
+static bool split = false;
+static DitherType ditherType = DITHER_TPDF;
+
+
+int
+main(int argc, char **argv)
+{
+    int c, v;
+
+    while ((c = getopt_long(argc, argv, "hvm:sd:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'm': remixSpec = optarg; break;
+	case 's': split = true; break;
+	case 'd':
+	  if ((v = DitherTypeFromName(optarg)) < 0) {
+	      fprintf(stderr, "Unknown dither type \"%s\"\n", optarg);
+	      return 2;
+	  }
+	  ditherType = v;
+	  break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if ((remixSpec == NULL) == !split) {
+	fprintf(stderr, "Specify one of -m or -s\n");
+	return 2;
+    }
+    if (argc - optind != 2) {
+	fprintf(stderr, "Specify an input file and an output %s\n",
+	    split ? "prefix" : "file");
+	return 2;
+    }
+    if (strcmp(argv[optind], argv[optind+1]) == 0) {
+	fprintf(stderr,
+	    "Input file and output file cannot have the same name\n");
+	return 3;
+    }
+
+    if (split) {
+	return splitFile(argv[optind], argv[optind+1]);
+    }
+    return remixFile(argv[optind], argv[optind+1]);
+}
+
+static int
+remixFile(const char *ifilename, const char *ofilename)
+{
+    FILE *ifile, *ofile = NULL;
+    WaveChunk *waveFile;
+    Chunk *oldFmt = NULL;
+    FmtChunk *ofmt;
+    DataChunk *odata;
+    Remix rmx;
+    float *matrix = NULL;
+    uint64_t length;
+    int nout;
+    int rval = 3;
+
+    memset(&rmx, 0, sizeof(rmx));
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	rval = 4;
+	goto exit;
+    }
+    if ((rmx.stream = OpenPcmStream(ifile, waveFile)) == NULL ||
+	!PcmSupported(rmx.stream->fmt))
+    {
+	fprintf(stderr, "%s: %s\n", ifilename,
+	    rmx.stream == NULL ? PcmError : "Unsupported sample format");
+	rval = 4;
+	goto exit;
+    }
+    if (FindChunkPtr(&waveFile->children, "fmt ", NULL) == NULL ||
+	FindChunkPtr(&waveFile->children, "data", NULL) == NULL)
+    {
+	fprintf(stderr, "%s: fmt and data chunks must be at the top level\n",
+	    ifilename);
+	rval = 4;
+	goto exit;
+    }
+
+    matrix = ParseRemixMatrix(remixSpec, rmx.stream->fmt->channels, &nout);
+    if (matrix == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, RemixError);
+	rval = 2;
+	goto exit;
+    }
+    if ((rmx.remixer = NewRemixer(rmx.stream->fmt->channels, nout, matrix)) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+
+    /* The stream still reads with the old fmt chunk, so it is kept */
+    if ((ofmt = replaceFmt(waveFile, rmx.stream->fmt, nout, &oldFmt)) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    rmx.fmt = ofmt;
+    length = (uint64_t)rmx.stream->frames * ofmt->block_align;
+    if (length > UINT32_MAX - 1024) {
+	fprintf(stderr, "%s: output would be too large for a .wav file\n",
+	    ifilename);
+	goto exit;
+    }
+
+    if ((rmx.pick = pickChannels(matrix, rmx.stream->fmt->channels, nout)) != NULL) {
+	rmx.raw = malloc((size_t)BLOCK_FRAMES * rmx.stream->fmt->block_align);
+	if (rmx.raw == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+    } else {
+	if (ofmt->type == RIFF_PCM && ofmt->bits_samp <= 24) {
+	    rmx.dither = NewDitherer(nout, ofmt->bits_samp, ditherType,
+		    SHAPE_NONE, 0);
+	    if (rmx.dither == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		goto exit;
+	    }
+	}
+	rmx.inBuf = malloc(BLOCK_FRAMES * rmx.stream->fmt->channels * sizeof(float));
+	rmx.outBuf = malloc(BLOCK_FRAMES * nout * sizeof(float));
+	if (rmx.inBuf == NULL || rmx.outBuf == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+    }
+
+    odata = newDataChunk("data", (uint32_t)length, 0);
+    if (odata == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    FreeChunk(ReplaceChunk(&waveFile->children, (Chunk *)odata));
+    odata->source = remixSource;
+    odata->source_ctx = &rmx;
+
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+    if (WriteWaveFile(waveFile, ifile, ofile) != 0) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	goto exit;
+    }
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    if (verbose) {
+	printf("%s: %" PRIu32 " frames, %u to %d channels\n", ifilename,
+	    rmx.stream->frames, rmx.stream->fmt->channels, nout);
+    }
+    rval = 0;
+
+exit:
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    free(matrix);
+    free(rmx.pick);
+    free(rmx.raw);
+    free(rmx.inBuf);
+    free(rmx.outBuf);
+    FreeDitherer(rmx.dither);
+    FreeRemixer(rmx.remixer);
+    ClosePcmStream(rmx.stream);
+    FreeChunk(oldFmt);
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * If every row of the matrix is a single gain of 1, or all zero, the
+ * remix only moves samples around.
+ * @return malloc'd input channel of each output, -1 for silence, or
+ *         NULL if some output is a real mix or out of memory
+ */
+static int *
+pickChannels(const float *matrix, int nin, int nout)
+{
+    int *pick;
+    int o, i;
+
+    if ((pick = malloc(nout * sizeof(int))) == NULL) {
+	return NULL;
+    }
+    for (o=0; o < nout; ++o) {
+	pick[o] = -1;
+	for (i=0; i < nin; ++i) {
+	    if (matrix[o*nin + i] == 0) {
+		continue;
+	    }
+	    if (matrix[o*nin + i] != 1 || pick[o] >= 0) {
+		free(pick);
+		return NULL;
+	    }
+	    pick[o] = i;
+	}
+    }
+    return pick;
+}
+
+/**
+ * Copy the picked samples of each frame, byte for byte
+ */
+static void
+pickFrames(const Remix *rmx, const uint8_t *in, uint8_t *out, size_t frames)
+{
+    const int nin = rmx->stream->fmt->channels, nout = rmx->fmt->channels;
+    const int size = rmx->fmt->block_align / nout;
+    /* Unsigned 8-bit samples are silent at 0x80 */
+    const int silence = rmx->fmt->bits_samp == 8 ? 0x80 : 0;
+    size_t f;
+    int o;
+
+    for (f=0; f < frames; ++f) {
+	for (o=0; o < nout; ++o) {
+	    if (rmx->pick[o] < 0) {
+		memset(out, silence, size);
+	    } else {
+		memcpy(out, in + rmx->pick[o] * size, size);
+	    }
+	    out += size;
+	}
+	in += nin * size;
+    }
+}
+
+/**
+ * Data source: read, remix and requantize the next block
+ */
+static long
+remixSource(void *ctx, void *buffer, size_t len)
+{
+    Remix *rmx = ctx;
+    size_t frames = len / rmx->fmt->block_align;
+
+    if (frames > BLOCK_FRAMES) {
+	frames = BLOCK_FRAMES;
+    }
+    if (rmx->pick != NULL) {
+	if ((frames = ReadPcmFrames(rmx->stream, rmx->raw, frames)) == 0) {
+	    return -1;
+	}
+	pickFrames(rmx, rmx->raw, buffer, frames);
+	return frames * rmx->fmt->block_align;
+    }
+    if ((frames = ReadPcmFloat(rmx->stream, rmx->inBuf, frames)) == 0) {
+	return -1;
+    }
+    RemixFrames(rmx->remixer, rmx->inBuf, rmx->outBuf, frames);
+    if (rmx->dither != NULL) {
+	DitherFrames(rmx->dither, rmx->outBuf, buffer, frames);
+    } else {
+	PcmEncode(rmx->fmt, rmx->outBuf, buffer, frames);
+    }
+    return frames * rmx->fmt->block_align;
+}
+
+static int
+splitFile(const char *ifilename, const char *prefix)
+{
+    FILE *ifile;
+    WaveChunk *waveFile;
+    Splitter sp;
+    Output *outputs = NULL;
+    const FmtChunk *fmt;
+    size_t plen, n;
+    uint64_t b;
+    void **dst = NULL;
+    int nc = 0, c, width, started = 0;
+    int rval = 3;
+
+    memset(&sp, 0, sizeof(sp));
+    pthread_mutex_init(&sp.lock, NULL);
+    pthread_cond_init(&sp.cond, NULL);
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	rval = 4;
+	goto exit;
+    }
+    if ((sp.stream = OpenPcmStream(ifile, waveFile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, PcmError);
+	rval = 4;
+	goto exit;
+    }
+    if (FindChunkPtr(&waveFile->children, "fmt ", NULL) == NULL ||
+	FindChunkPtr(&waveFile->children, "data", NULL) == NULL)
+    {
+	fprintf(stderr, "%s: fmt and data chunks must be at the top level\n",
+	    ifilename);
+	rval = 4;
+	goto exit;
+    }
+    fmt = sp.stream->fmt;
+    if (fmt->channels == 0 || fmt->block_align % fmt->channels != 0 ||
+	sp.stream->block_frames > 1)
+    {
+	fprintf(stderr, "%s: cannot split this sample format\n", ifilename);
+	rval = 4;
+	goto exit;
+    }
+    nc = sp.channels = fmt->channels;
+    sp.size = fmt->block_align / nc;
+
+    sp.raw = malloc((size_t)BLOCK_FRAMES * fmt->block_align);
+    sp.planes[0] = malloc((size_t)BLOCK_FRAMES * fmt->block_align);
+    sp.planes[1] = malloc((size_t)BLOCK_FRAMES * fmt->block_align);
+    dst = malloc(2 * nc * sizeof(void *));
+    outputs = calloc(nc, sizeof(Output));
+    if (sp.raw == NULL || sp.planes[0] == NULL || sp.planes[1] == NULL ||
+	dst == NULL || outputs == NULL)
+    {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    for (c=0; c < nc; ++c) {
+	dst[c] = sp.planes[0] + (size_t)c * BLOCK_FRAMES * sp.size;
+	dst[nc + c] = sp.planes[1] + (size_t)c * BLOCK_FRAMES * sp.size;
+    }
+
+    /* Output names: prefix_1.wav, or prefix_01.wav etc. for more channels */
+    plen = strlen(prefix);
+    if (plen > 4 && strcmp(prefix + plen - 4, ".wav") == 0) {
+	plen -= 4;
+    }
+    width = snprintf(NULL, 0, "%d", nc);
+    for (c=0; c < nc; ++c) {
+	Output *o = &outputs[c];
+	o->sp = &sp;
+	o->channel = c;
+	o->ifilename = ifilename;
+	o->remaining = sp.stream->frames * sp.size;
+	if ((o->ofilename = malloc(plen + width + 6)) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+	sprintf(o->ofilename, "%.*s_%0*d.wav", (int)plen, prefix, width, c+1);
+    }
+
+    for (started=0; started < nc; ++started) {
+	if (pthread_create(&outputs[started].tid, NULL, splitWriter,
+		&outputs[started]) != 0)
+	{
+	    fprintf(stderr, "Unable to start a thread for each channel\n");
+	    goto exit;
+	}
+    }
+
+    /* Read and deinterleave; the writers take it from here */
+    for (b=0; ; ++b) {
+	int slot = b & 1;
+	pthread_mutex_lock(&sp.lock);
+	while (sp.users[slot] > 0) {
+	    pthread_cond_wait(&sp.cond, &sp.lock);
+	}
+	pthread_mutex_unlock(&sp.lock);
+
+	if ((n = ReadPcmFrames(sp.stream, sp.raw, BLOCK_FRAMES)) > 0) {
+	    Deinterleave(sp.raw, dst + slot * nc, nc, sp.size, n);
+	}
+
+	pthread_mutex_lock(&sp.lock);
+	if (n == 0) {
+	    sp.eof = true;
+	} else {
+	    sp.frames[slot] = n;
+	    sp.users[slot] = nc;
+	    sp.ready = b + 1;
+	}
+	pthread_cond_broadcast(&sp.cond);
+	pthread_mutex_unlock(&sp.lock);
+	if (n == 0) {
+	    break;
+	}
+    }
+    rval = 0;
+
+exit:
+    if (started < nc && started > 0) {
+	/* Let the writers that did start run out of data */
+	pthread_mutex_lock(&sp.lock);
+	sp.eof = true;
+	pthread_cond_broadcast(&sp.cond);
+	pthread_mutex_unlock(&sp.lock);
+	rval = 3;
+    }
+    for (c=0; c < started; ++c) {
+	pthread_join(outputs[c].tid, NULL);
+	if (outputs[c].rval > rval) {
+	    rval = outputs[c].rval;
+	}
+	if (verbose && outputs[c].rval == 0) {
+	    printf("%s\n", outputs[c].ofilename);
+	}
+    }
+    if (outputs != NULL) {
+	for (c=0; c < nc; ++c) {
+	    free(outputs[c].ofilename);
+	}
+	free(outputs);
+    }
+    free(dst);
+    free(sp.raw);
+    free(sp.planes[0]);
+    free(sp.planes[1]);
+    ClosePcmStream(sp.stream);
+    FreeWaveFile(waveFile);
+    pthread_mutex_destroy(&sp.lock);
+    pthread_cond_destroy(&sp.cond);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Thread that writes one split output file. It always consumes its
+ * share of every block, even after an error, so that the reader and
+ * the other writers are never left waiting for it.
+ */
+static void *
+splitWriter(void *arg)
+{
+    Output *o = arg;
+    FILE *ifile, *ofile = NULL;
+    WaveChunk *waveFile = NULL;
+    Chunk *old = NULL;
+    FmtChunk *ofmt;
+    DataChunk *odata;
+    char scratch[4096];
+    long l;
+
+    o->rval = 3;
+
+    /* The metadata is parsed again here so that every thread has
+     * its own chunk tree and its own FILE to copy chunks from.
+     */
+    if ((ifile = fopen(o->ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", o->ifilename, strerror(errno));
+	o->rval = 4;
+	goto exit;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL ||
+	(ofmt = (FmtChunk *)FindChunk(waveFile->children, "fmt ", NULL)) == NULL)
+    {
+	fprintf(stderr, "%s: %s\n", o->ifilename, WaveError);
+	o->rval = 4;
+	goto exit;
+    }
+    if ((ofmt = replaceFmt(waveFile, ofmt, 1, &old)) == NULL ||
+	(odata = newDataChunk("data", o->remaining, 0)) == NULL)
+    {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    FreeChunk(old);
+    FreeChunk(ReplaceChunk(&waveFile->children, (Chunk *)odata));
+    odata->source = splitSource;
+    odata->source_ctx = o;
+
+    if ((ofile = fopen(o->ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    o->ofilename, strerror(errno));
+	goto exit;
+    }
+    setvbuf(ofile, NULL, _IOFBF, OUTPUT_BUFFER);
+    if (WriteWaveFile(waveFile, ifile, ofile) != 0) {
+	fprintf(stderr, "%s: %s\n", o->ofilename, WaveError);
+	goto exit;
+    }
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", o->ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    o->rval = 0;
+
+exit:
+    FreeWaveFile(waveFile);
+    while (o->remaining > 0) {
+	l = splitSource(o, scratch,
+		o->remaining < sizeof(scratch) ? o->remaining : sizeof(scratch));
+	if (l <= 0) {
+	    break;
+	}
+    }
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    if (ifile != NULL) {
+	fclose(ifile);
+    }
+    return NULL;
+}
+
+/**
+ * Data source: hand out this output's channel of the current block,
+ * waiting for the reader when the block is used up.
+ */
+static long
+splitSource(void *ctx, void *buffer, size_t len)
+{
+    Output *o = ctx;
+    Splitter *sp = o->sp;
+    int slot = o->block & 1;
+    size_t avail;
+
+    if (!o->holding) {
+	pthread_mutex_lock(&sp->lock);
+	while (sp->ready <= o->block && !sp->eof) {
+	    pthread_cond_wait(&sp->cond, &sp->lock);
+	}
+	if (sp->ready <= o->block) {
+	    pthread_mutex_unlock(&sp->lock);
+	    return -1;
+	}
+	pthread_mutex_unlock(&sp->lock);
+	o->holding = true;
+	o->used = 0;
+    }
+
+    avail = sp->frames[slot] * sp->size - o->used;
+    if (len > avail) {
+	len = avail;
+    }
+    memcpy(buffer, sp->planes[slot] + (size_t)o->channel * BLOCK_FRAMES * sp->size
+	+ o->used, len);
+    o->used += len;
+    o->remaining -= len;
+
+    if (o->used == sp->frames[slot] * sp->size) {
+	pthread_mutex_lock(&sp->lock);
+	if (--sp->users[slot] == 0) {
+	    pthread_cond_broadcast(&sp->cond);
+	}
+	pthread_mutex_unlock(&sp->lock);
+	o->holding = false;
+	++o->block;
+    }
+    return len;
+}
+
+/**
+ * Put a new fmt chunk in the tree, the same as ifmt but with a
+ * different number of channels.
+ * @param old  receives the fmt chunk it replaces, for the caller to free
+ */
+static FmtChunk *
+replaceFmt(WaveChunk *waveFile, const FmtChunk *ifmt, int channels, Chunk **old)
+{
+    FmtChunk *ofmt;
+
+    if ((ofmt = (FmtChunk *)newChunk("fmt ", 16, 0, sizeof(*ofmt))) == NULL) {
+	return NULL;
+    }
+    *ofmt = *ifmt;
+    /* The extension, if any, describes the old channel layout */
+    ofmt->header.length = 16;
+    ofmt->type = FmtType(ifmt);
+    ofmt->ext = NULL;
+    ofmt->ext_len = 0;
+    ofmt->block_align = ifmt->block_align / ifmt->channels * channels;
+    ofmt->channels = channels;
+    ofmt->bytes_sec = ofmt->block_align * ofmt->sample_rate;
+    *old = ReplaceChunk(&waveFile->children, (Chunk *)ofmt);
+    return ofmt;
+}
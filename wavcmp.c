@@ -0,0 +1,473 @@
+static const char usage[] = "usage:\n"
+"	wavcmp [options] file1 file2\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Also show the formats\n"
+"	-q	--quiet		No output, only the exit status\n"
+"	-e	--exact		Stop at the first difference\n"
+"	-t	--tolerance dB	Pass if no sample differs by more than this,\n"
+"				in dB below full scale, e.g. -t -96\n"
+"\n"
+"Compares the audio in two files, which may be .wav or FLAC, and may\n"
+"use different sample formats: a 16-bit file and a 24-bit or float\n"
+"copy of it have the same audio. Reports the largest difference, the\n"
+"RMS of the difference and the first sample that differs.\n"
+"\n"
+"When both are .wav files in the same format, the data chunks are\n"
+"compared first, byte for byte; if they match, the rest of the files\n"
+"are compared to tell \"identical\" from \"only metadata differs\".\n"
+"\n"
+"Samples are compared as 32-bit float, which is exact for up to 24\n"
+"bits; 32-bit integer samples are compared to 24 bits.\n"
+"\n"
+"Exit status is 0 if the audio is the same (or within -t), 1 if it\n"
+"differs, 2 for usage errors and 4 if a file can't be read.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <sys/stat.h>
+#ifdef	__SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libflac.h"
+
+#define	BLOCK_FRAMES	4096	/* Frames compared at a time */
+#define	RAW_BLOCK	(1<<20)	/* Bytes compared at a time */
+
+/**
+ * One file being compared
+ */
+typedef struct source {
+  const char *filename;
+  FILE *file;
+  WaveChunk *wave;	/* .wav files */
+  PcmStream *stream;
+  FlacDecoder *flac;	/* FLAC files */
+  int32_t *ibuf;
+  uint32_t sample_rate;
+  int channels;
+  uint64_t frames;	/* 0 if a FLAC stream doesn't say */
+  float *buf;		/* BLOCK_FRAMES frames */
+} Source;
+
+/**
+ * Running comparison of two sample streams
+ */
+typedef struct diff {
+  float max;		/* Largest absolute difference */
+  double sumsq;		/* Sum of squared differences */
+  uint64_t samples;	/* # of samples compared */
+  int64_t first;	/* Index of the first sample that differs, or -1 */
+} Diff;
+
+static int openSource(Source *);
+static void closeSource(Source *);
+static long readBlock(Source *, size_t frames);
+static int compareFiles(Source *, Source *);
+static int compareRaw(int fd1, off_t off1, int fd2, off_t off2, off_t len);
+static void diffBlock(const float *a, const float *b, size_t n, Diff *);
+static const char *describe(const Source *);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"quiet", no_argument, NULL, 'q'},
+  {"exact", no_argument, NULL, 'e'},
+  {"tolerance", required_argument, NULL, 't'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static bool quiet = false;
+static bool exact = false;
+static float tolerance = 0;
+
+
+int
+main(int argc, char **argv)
+{
+    Source s1, s2;
+    char *end;
+    double db;
+    int c, rval;
+
+    while ((c = getopt_long(argc, argv, "hvqet:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'q': quiet = true; break;
+	case 'e': exact = true; break;
+	case 't':
+	  db = strtod(optarg, &end);
+	  if (end == optarg || *end != '\0' || db > 0) {
+	      fprintf(stderr, "Tolerance must be in dB, 0 or less\n");
+	      return 2;
+	  }
+	  tolerance = (float)pow(10, db / 20);
+	  break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (argc - optind != 2) {
+	fprintf(stderr, "Specify two files to compare\n");
+	return 2;
+    }
+
+    memset(&s1, 0, sizeof(s1));
+    memset(&s2, 0, sizeof(s2));
+    s1.filename = argv[optind];
+    s2.filename = argv[optind+1];
+    if ((rval = openSource(&s1)) == 0 && (rval = openSource(&s2)) == 0) {
+	rval = compareFiles(&s1, &s2);
+    }
+    closeSource(&s1);
+    closeSource(&s2);
+    return rval;
+}
+
+/**
+ * Open a .wav or FLAC file.
+ * @return 0 on success, else an exit code, with a message printed
+ */
+static int
+openSource(Source *src)
+{
+    char magic[4];
+    size_t n;
+
+    if ((src->file = fopen(src->filename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", src->filename, strerror(errno));
+	return 4;
+    }
+    n = fread(magic, 1, sizeof(magic), src->file);
+    rewind(src->file);
+    if (n == 4 && memcmp(magic, "RIFF", 4) == 0) {
+	if ((src->wave = OpenWaveFile(src->file)) == NULL) {
+	    fprintf(stderr, "%s: %s\n", src->filename, WaveError);
+	    return 4;
+	}
+	if ((src->stream = OpenPcmStream(src->file, src->wave)) == NULL) {
+	    fprintf(stderr, "%s: %s\n", src->filename, PcmError);
+	    return 4;
+	}
+	if (!PcmDecodable(src->stream->fmt)) {
+	    fprintf(stderr, "%s: unsupported sample format %d\n",
+		src->filename, src->stream->fmt->type);
+	    return 4;
+	}
+	src->sample_rate = src->stream->fmt->sample_rate;
+	src->channels = src->stream->fmt->channels;
+	src->frames = src->stream->frames;
+    } else if (n == 4 &&
+	(memcmp(magic, "fLaC", 4) == 0 || memcmp(magic, "ID3", 3) == 0))
+    {
+	if ((src->flac = OpenFlacDecoder(src->file)) == NULL) {
+	    fprintf(stderr, "%s: %s\n", src->filename, FlacError);
+	    return 4;
+	}
+	src->sample_rate = src->flac->sample_rate;
+	src->channels = src->flac->channels;
+	src->frames = src->flac->frames;
+	src->ibuf = malloc(BLOCK_FRAMES * src->channels * sizeof(int32_t));
+	if (src->ibuf == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    return 3;
+	}
+    } else {
+	fprintf(stderr, "%s: not a .wav or FLAC file\n", src->filename);
+	return 4;
+    }
+    if ((src->buf = malloc(BLOCK_FRAMES * src->channels * sizeof(float))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	return 3;
+    }
+    return 0;
+}
+
+static void
+closeSource(Source *src)
+{
+    ClosePcmStream(src->stream);
+    FreeWaveFile(src->wave);
+    if (src->flac != NULL) {
+	CloseFlacDecoder(src->flac);
+    }
+    if (src->file != NULL) {
+	fclose(src->file);
+    }
+    free(src->ibuf);
+    free(src->buf);
+}
+
+/**
+ * Read the next frames into src->buf, as float.
+ * @return # of frames read, less than frames only at the end, or -1
+ *         on error, with a message printed
+ */
+static long
+readBlock(Source *src, size_t frames)
+{
+    const int nc = src->channels;
+    size_t got = 0, i;
+    long n;
+    float scale;
+
+    while (got < frames) {
+	if (src->stream != NULL) {
+	    n = ReadPcmFloat(src->stream, src->buf + got * nc, frames - got);
+	} else if ((n = FlacDecode(src->flac, src->ibuf, frames - got)) > 0) {
+	    scale = 1.0f / (1 << (src->flac->bits - 1));
+	    for (i=0; i < (size_t)n * nc; ++i) {
+		src->buf[got * nc + i] = src->ibuf[i] * scale;
+	    }
+	}
+	if (n < 0) {
+	    fprintf(stderr, "%s: %s\n", src->filename, FlacError);
+	    return -1;
+	}
+	if (n == 0) {
+	    /* ReadPcmFloat() only says it failed by stopping early */
+	    if (src->stream != NULL &&
+		src->stream->position < src->stream->frames)
+	    {
+		fprintf(stderr, "%s: %s\n", src->filename,
+		    PcmError != NULL ? PcmError : "Premature end of file");
+		return -1;
+	    }
+	    break;
+	}
+	got += n;
+    }
+    return got;
+}
+
+/**
+ * True if the samples of two .wav files are stored the same way
+ */
+static bool
+sameFormat(const FmtChunk *f1, const FmtChunk *f2)
+{
+    return f1->type == f2->type && f1->channels == f2->channels &&
+	f1->sample_rate == f2->sample_rate &&
+	f1->block_align == f2->block_align &&
+	f1->bits_samp == f2->bits_samp && f1->ext_len == f2->ext_len &&
+	(f1->ext_len == 0 || memcmp(f1->ext, f2->ext, f1->ext_len) == 0);
+}
+
+static int
+compareFiles(Source *s1, Source *s2)
+{
+    const int nc = s1->channels;
+    const char *name1 = s1->filename, *name2 = s2->filename;
+    struct stat st1, st2;
+    long n1 = 0, n2 = 0;
+    bool shorter;
+    Diff diff;
+    int rc;
+
+    if (verbose && !quiet) {
+	printf("%s: %s\n", name1, describe(s1));
+	printf("%s: %s\n", name2, describe(s2));
+    }
+    if (s1->sample_rate != s2->sample_rate || s1->channels != s2->channels) {
+	if (!quiet) {
+	    printf("%s and %s differ: %" PRIu32 " Hz, %d channels vs %"
+		PRIu32 " Hz, %d channels\n", name1, name2,
+		s1->sample_rate, s1->channels, s2->sample_rate, s2->channels);
+	}
+	return 1;
+    }
+
+    /* Same format: the data chunks can be compared as they are, and
+     * if they match, so can everything around them.
+     */
+    if (s1->stream != NULL && s2->stream != NULL &&
+	sameFormat(s1->stream->fmt, s2->stream->fmt) &&
+	s1->stream->length == s2->stream->length)
+    {
+	const PcmStream *p1 = s1->stream, *p2 = s2->stream;
+	rc = compareRaw(p1->fd, p1->start, p2->fd, p2->start, p1->length);
+	if (rc < 0) {
+	    return 4;
+	}
+	if (rc == 0) {
+	    if (fstat(p1->fd, &st1) != 0 || fstat(p2->fd, &st2) != 0) {
+		fprintf(stderr, "Cannot stat %s: %s\n", name1, strerror(errno));
+		return 4;
+	    }
+	    rc = 1;
+	    if (st1.st_size == st2.st_size && p1->start == p2->start) {
+		off_t tail = p1->start + p1->length;
+		if ((rc = compareRaw(p1->fd, 0, p2->fd, 0, p1->start)) == 0) {
+		    rc = compareRaw(p1->fd, tail, p2->fd, tail, st1.st_size - tail);
+		}
+		if (rc < 0) {
+		    return 4;
+		}
+	    }
+	    if (!quiet) {
+		printf(rc == 0 ? "%s and %s are identical\n" :
+		    "%s and %s: audio is identical, only metadata differs\n",
+		    name1, name2);
+	    }
+	    return 0;
+	}
+    }
+
+    /* Decode both and compare samples */
+    memset(&diff, 0, sizeof(diff));
+    diff.first = -1;
+    for (;;) {
+	if ((n1 = readBlock(s1, BLOCK_FRAMES)) < 0 ||
+	    (n2 = readBlock(s2, BLOCK_FRAMES)) < 0)
+	{
+	    return 4;
+	}
+	diffBlock(s1->buf, s2->buf, (size_t)(n1 < n2 ? n1 : n2) * nc, &diff);
+	if (n1 != n2 || n1 < BLOCK_FRAMES || (exact && diff.first >= 0)) {
+	    break;
+	}
+    }
+    shorter = n1 != n2 ||
+	(s1->frames != s2->frames && s1->frames != 0 && s2->frames != 0);
+
+    rc = diff.max > tolerance || shorter;
+    if (quiet) {
+	return rc;
+    }
+    if (shorter && s1->frames != 0 && s2->frames != 0) {
+	printf("%s and %s differ in length: %" PRIu64 " vs %" PRIu64 " frames\n",
+	    name1, name2, s1->frames, s2->frames);
+    } else if (shorter) {
+	printf("%s and %s differ in length\n", name1, name2);
+    }
+    if (diff.first < 0) {
+	printf(shorter ?
+	    "%s and %s: the audio they share is identical\n" :
+	    "%s and %s: audio is identical in different formats\n",
+	    name1, name2);
+	return rc;
+    }
+    printf("%s and %s: audio differs%s from frame %" PRId64 ", channel %d\n",
+	name1, name2, rc ? "" : " within tolerance",
+	diff.first / nc, (int)(diff.first % nc) + 1);
+    if (!exact) {
+	printf("  max difference %.6g (%.1f dBFS), RMS difference %.1f dBFS\n",
+	    diff.max, 20 * log10(diff.max),
+	    10 * log10(diff.sumsq / diff.samples));
+    }
+    return rc;
+}
+
+/**
+ * Compare byte ranges of two files.
+ * @return 0 if equal, 1 if not, -1 on error, with a message printed
+ */
+static int
+compareRaw(int fd1, off_t off1, int fd2, off_t off2, off_t len)
+{
+    static uint8_t *buf1 = NULL, *buf2 = NULL;
+    off_t done;
+    size_t want;
+
+    if (buf1 == NULL) {
+	buf1 = malloc(RAW_BLOCK);
+	buf2 = malloc(RAW_BLOCK);
+	if (buf1 == NULL || buf2 == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    return -1;
+	}
+    }
+    for (done = 0; done < len; done += want) {
+	errno = 0;
+	want = len - done < RAW_BLOCK ? len - done : RAW_BLOCK;
+	if (pread(fd1, buf1, want, off1 + done) != (ssize_t)want ||
+	    pread(fd2, buf2, want, off2 + done) != (ssize_t)want)
+	{
+	    fprintf(stderr, "Read error: %s\n",
+		errno != 0 ? strerror(errno) : "unexpected end of file");
+	    return -1;
+	}
+	if (memcmp(buf1, buf2, want) != 0) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/**
+ * Accumulate the difference between n samples. The largest difference
+ * and the sum of squares are taken four samples at a time; the block
+ * is searched for the first difference only if it has one.
+ */
+static void
+diffBlock(const float *a, const float *b, size_t n, Diff *diff)
+{
+    float max = 0, sum = 0, d;
+    size_t i = 0;
+
+#ifdef	__SSE__
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 vmax = _mm_setzero_ps(), vsum = _mm_setzero_ps();
+    float lanes[4];
+    for (; i + 4 <= n; i += 4) {
+	__m128 v = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+	vsum = _mm_add_ps(vsum, _mm_mul_ps(v, v));
+	vmax = _mm_max_ps(vmax, _mm_andnot_ps(sign, v));
+    }
+    _mm_storeu_ps(lanes, vmax);
+    max = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+    _mm_storeu_ps(lanes, vsum);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; ++i) {
+	d = a[i] - b[i];
+	sum += d * d;
+	if (fabsf(d) > max) max = fabsf(d);
+    }
+
+    if (max > 0 && diff->first < 0) {
+	for (i=0; i < n && a[i] == b[i]; ++i)
+	  ;
+	diff->first = diff->samples + i;
+    }
+    if (max > diff->max) {
+	diff->max = max;
+    }
+    diff->sumsq += sum;
+    diff->samples += n;
+}
+
+static const char *
+describe(const Source *src)
+{
+    static char buffer[80];
+    const FmtChunk *fmt;
+
+    if (src->flac != NULL) {
+	snprintf(buffer, sizeof(buffer), "FLAC, %d-bit, %" PRIu32 " Hz, "
+	    "%d channels, %" PRIu64 " frames", src->flac->bits,
+	    src->sample_rate, src->channels, src->frames);
+    } else {
+	fmt = src->stream->fmt;
+	snprintf(buffer, sizeof(buffer), ".wav, %s %d-bit, %" PRIu32 " Hz, "
+	    "%d channels, %" PRIu64 " frames",
+	    FmtType(fmt) == RIFF_IEEE_FLOAT ? "float" :
+	    FmtType(fmt) == RIFF_PCM ? "PCM" : "format",
+	    fmt->bits_samp, src->sample_rate, src->channels, src->frames);
+    }
+    return buffer;
+}
@@ -0,0 +1,431 @@
+static const char usage[] = "usage:\n"
+"	wavconcat [options] -o outfile input ...\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-o	--output file	Output file\n"
+"	-m	--metadata N	Take tags and other chunks from input N (1)\n"
+"	-c	--chapters	Add a cue point at the start of each input,\n"
+"				labelled with its file name\n"
+"\n"
+"Joins .wav files end to end, e.g. the recordings of one session or the\n"
+"chapters of a book, without decoding them. The inputs must have the\n"
+"same format: sample type, sample rate, channels and bits per sample.\n"
+"If they don't, the difference is reported and nothing is written;\n"
+"use wavconvert or wavresample first.\n"
+"\n"
+"The output is written in one pass, with the data of each input copied\n"
+"as it is by file range copies. Cue points and regions of every input\n"
+"are kept, moved to where the input starts in the output and numbered\n"
+"in order.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "libwav.h"
+#include "libsplit.h"
+
+typedef struct input {
+  const char *filename;
+  FILE *file;
+  WaveChunk *wave;
+  const FmtChunk *fmt;
+  uint32_t offset;	/* Of the samples in the file */
+  uint32_t frames;
+  uint32_t start;	/* Output frame where it starts */
+} Input;
+
+static int openInput(Input *input);
+static bool formatDiffers(const FmtChunk *f1, const FmtChunk *f2,
+		char *buffer, size_t len);
+static int mergeMarkers(WaveChunk *waveFile, Input *inputs, int ninputs);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"output", required_argument, NULL, 'o'},
+  {"metadata", required_argument, NULL, 'm'},
+  {"chapters", no_argument, NULL, 'c'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static const char *ofilename = NULL;
+static int metaInput = 1;
+static bool chapters = false;
+
+
+int
+main(int argc, char **argv)
+{
+    Input *inputs = NULL, *meta;
+    int ninputs;
+    FILE *ofile = NULL;
+    const FmtChunk *fmt;
+    FactChunk *fact;
+    DataChunk *data;
+    DataSegment *segments = NULL;
+    struct stat ist, ost;
+    uint64_t frames = 0;
+    char why[128];
+    int c, i;
+    int rval = 4;
+
+    while ((c = getopt_long(argc, argv, "hvo:m:c", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'o': ofilename = optarg; break;
+	case 'm': metaInput = atoi(optarg); break;
+	case 'c': chapters = true; break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    ninputs = argc - optind;
+    if (ofilename == NULL || ninputs < 1) {
+	fprintf(stderr, usage);
+	return 2;
+    }
+    if (metaInput < 1 || metaInput > ninputs) {
+	fprintf(stderr, "--metadata must be from 1 to %d\n", ninputs);
+	return 2;
+    }
+    if ((inputs = calloc(ninputs, sizeof(Input))) == NULL ||
+	(segments = calloc(ninputs, sizeof(DataSegment))) == NULL)
+    {
+	fprintf(stderr, "Out of memory\n");
+	return 3;
+    }
+
+    /* Every input must match the first */
+    for (i=0; i < ninputs; ++i) {
+	inputs[i].filename = argv[optind + i];
+	if ((rval = openInput(&inputs[i])) != 0) {
+	    goto exit;
+	}
+	rval = 4;
+	if (stat(ofilename, &ost) == 0 &&
+	    fstat(fileno(inputs[i].file), &ist) == 0 &&
+	    ost.st_dev == ist.st_dev && ost.st_ino == ist.st_ino)
+	{
+	    fprintf(stderr, "%s is also an input file\n", ofilename);
+	    rval = 2;
+	    goto exit;
+	}
+	if (i > 0 &&
+	    formatDiffers(inputs[i].fmt, inputs[0].fmt, why, sizeof(why)))
+	{
+	    fprintf(stderr, "%s: format differs from %s: %s\n",
+		inputs[i].filename, inputs[0].filename, why);
+	    goto exit;
+	}
+	inputs[i].start = (uint32_t)frames;
+	frames += inputs[i].frames;
+	/* With room for the header and other chunks */
+	if (frames * inputs[0].fmt->block_align > UINT32_MAX - (1 << 20)) {
+	    fprintf(stderr, "The output would be too big for a .wav file\n");
+	    rval = 2;
+	    goto exit;
+	}
+	segments[i].file = inputs[i].file;
+	segments[i].offset = inputs[i].offset;
+	segments[i].length = inputs[i].frames * inputs[i].fmt->block_align;
+	if (verbose) {
+	    printf("%s: %" PRIu32 " frames at %" PRIu32 " (%.3fs)\n",
+		inputs[i].filename, inputs[i].frames, inputs[i].start,
+		(double)inputs[i].start / inputs[i].fmt->sample_rate);
+	}
+    }
+    fmt = inputs[0].fmt;
+    if (verbose) {
+	printf("%s: %" PRIu64 " frames (%.3fs)\n", ofilename, frames,
+	    (double)frames / fmt->sample_rate);
+    }
+
+    /* The output takes the chunks of the metadata source, with all
+     * of the inputs as its data
+     */
+    meta = &inputs[metaInput - 1];
+    if ((data = newDataChunk("data", frames * fmt->block_align, 0)) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	rval = 3;
+	goto exit;
+    }
+    data->segments = segments;
+    data->n_segments = ninputs;
+    FreeChunk(ReplaceChunk(&meta->wave->children, &data->header));
+    if ((fact = (FactChunk *)FindChunk(meta->wave->children, "fact", NULL)) != NULL) {
+	fact->n = frames;
+    }
+    if (mergeMarkers(meta->wave, inputs, ninputs) != 0) {
+	fprintf(stderr, "Out of memory\n");
+	rval = 3;
+	goto exit;
+    }
+
+    rval = 3;
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+    if (WriteWaveFile(meta->wave, meta->file, ofile) != 0) {
+	fprintf(stderr, "%s: %s\n", ofilename, WaveError);
+	goto exit;
+    }
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    rval = 0;
+
+exit:
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    for (i=0; i < ninputs; ++i) {
+	FreeWaveFile(inputs[i].wave);
+	if (inputs[i].file != NULL) {
+	    fclose(inputs[i].file);
+	}
+    }
+    free(inputs);
+    free(segments);
+    return rval;
+}
+
+/**
+ * Open an input and find its samples.
+ * @return 0 on success, else the exit code, with a message printed
+ */
+static int
+openInput(Input *input)
+{
+    const Chunk *data;
+
+    if ((input->file = fopen(input->filename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", input->filename, strerror(errno));
+	return 4;
+    }
+    if ((input->wave = OpenWaveFile(input->file)) == NULL) {
+	fprintf(stderr, "%s: %s\n", input->filename, WaveError);
+	return 4;
+    }
+    if (SplitFrames(input->wave, &input->frames) != 0) {
+	fprintf(stderr, "%s: %s\n", input->filename, SplitError);
+	return 4;
+    }
+    if (FindChunkPtr(&input->wave->children, "data", NULL) == NULL) {
+	fprintf(stderr, "%s: the data chunk must be at the top level\n",
+	    input->filename);
+	return 4;
+    }
+    input->fmt = (FmtChunk *)FindChunk(input->wave->children, "fmt ", NULL);
+    data = FindChunk(input->wave->children, "data", NULL);
+    input->offset = data->offset + 8;
+    return 0;
+}
+
+/**
+ * Compare the way two files store their samples.
+ * @param buffer  receives the first difference, if there is one
+ * @return true if they differ
+ */
+static bool
+formatDiffers(const FmtChunk *f1, const FmtChunk *f2, char *buffer, size_t len)
+{
+    if (FmtType(f1) != FmtType(f2)) {
+	snprintf(buffer, len, "sample format %d vs %d", FmtType(f1), FmtType(f2));
+    } else if (f1->sample_rate != f2->sample_rate) {
+	snprintf(buffer, len, "%" PRIu32 " Hz vs %" PRIu32 " Hz",
+	    f1->sample_rate, f2->sample_rate);
+    } else if (f1->channels != f2->channels) {
+	snprintf(buffer, len, "%d channels vs %d",
+	    f1->channels, f2->channels);
+    } else if (f1->bits_samp != f2->bits_samp ||
+	       f1->block_align != f2->block_align)
+    {
+	snprintf(buffer, len, "%d bits per sample vs %d",
+	    f1->bits_samp, f2->bits_samp);
+    } else if (f1->type != f2->type || f1->ext_len != f2->ext_len ||
+	       (f1->ext_len > 0 && memcmp(f1->ext, f2->ext, f1->ext_len) != 0))
+    {
+	snprintf(buffer, len, "format extensions differ (valid bits or "
+	    "channel layout)");
+    } else {
+	return false;
+    }
+    return true;
+}
+
+/**
+ * Replace the cue points and their LIST/adtl chunk with those of all
+ * the inputs, moved to where each input starts, and numbered from 1
+ * in order. Regions are cut to the end of their input.
+ * @return 0 on success, -1 if out of memory
+ */
+static int
+mergeMarkers(WaveChunk *waveFile, Input *inputs, int ninputs)
+{
+    MarkerIndex **mis;
+    const Marker *m;
+    CueChunk *cue = NULL;
+    ListChunk *adtl = NULL;
+    LablChunk *labl;
+    LtxtChunk *ltxt;
+    Chunk **ptr, **tail, *old, *child;
+    char name[256];
+    const char *base;
+    uint32_t pos, len, id = 0;
+    size_t j, n = 0;
+    int i, rval = -1;
+
+    if ((mis = calloc(ninputs, sizeof(*mis))) == NULL) {
+	return -1;
+    }
+    for (i=0; i < ninputs; ++i) {
+	if ((mis[i] = NewMarkerIndex(inputs[i].wave)) == NULL) {
+	    goto exit;
+	}
+	n += mis[i]->count + chapters;
+    }
+    if (n == 0) {
+	rval = 0;
+	goto exit;
+    }
+    if ((cue = NewCueChunk(n)) == NULL ||
+	(adtl = (ListChunk *)newChunk("LIST", 4, 0, sizeof(*adtl))) == NULL)
+    {
+	goto exit;
+    }
+    memcpy(adtl->type, "adtl", 4);
+    adtl->children = NULL;
+    tail = &adtl->children;
+
+    for (i=0; i < ninputs; ++i) {
+	if (chapters) {
+	    /* The file name without its directory or ".wav" */
+	    base = strrchr(inputs[i].filename, '/');
+	    base = base != NULL ? base + 1 : inputs[i].filename;
+	    snprintf(name, sizeof(name), "%s", base);
+	    len = strlen(name);
+	    if (len > 4 && strcasecmp(name + len - 4, ".wav") == 0) {
+		name[len - 4] = '\0';
+	    }
+	    cue->cues[id].name = id + 1;
+	    cue->cues[id].position = inputs[i].start;
+	    memcpy(cue->cues[id].fcc_chunk, "data", 4);
+	    cue->cues[id].sample_offset = inputs[i].start;
+	    if ((labl = NewLablChunk("labl", ++id, name)) == NULL) {
+		goto exit;
+	    }
+	    *tail = &labl->header;
+	    tail = &labl->header.next;
+	}
+
+	for (j=0; j < mis[i]->count; ++j) {
+	    m = &mis[i]->markers[j];
+	    if (m->position >= inputs[i].frames) {
+		break;
+	    }
+	    pos = inputs[i].start + m->position;
+	    cue->cues[id].name = id + 1;
+	    cue->cues[id].position = pos;
+	    memcpy(cue->cues[id].fcc_chunk, "data", 4);
+	    cue->cues[id].sample_offset = pos;
+	    ++id;
+
+	    if (m->label != NULL) {
+		if ((labl = NewLablChunk("labl", id, m->label)) == NULL) {
+		    goto exit;
+		}
+		*tail = &labl->header;
+		tail = &labl->header.next;
+	    }
+	    if (m->note != NULL) {
+		if ((labl = NewLablChunk("note", id, m->note)) == NULL) {
+		    goto exit;
+		}
+		*tail = &labl->header;
+		tail = &labl->header.next;
+	    }
+	    if (m->ltxt != NULL) {
+		len = m->ltxt->header.length > 20 ? m->ltxt->header.length - 20 : 0;
+		ltxt = (LtxtChunk *)newChunk("ltxt", 20 + len, 0, sizeof(*ltxt) + len + 1);
+		if (ltxt == NULL) {
+		    goto exit;
+		}
+		memcpy(ltxt, m->ltxt, sizeof(*ltxt) + len + 1);
+		ltxt->header.next = NULL;
+		ltxt->name = id;
+		if (m->length > inputs[i].frames - m->position) {
+		    ltxt->sample_length = inputs[i].frames - m->position;
+		}
+		*tail = &ltxt->header;
+		tail = &ltxt->header.next;
+	    }
+	}
+    }
+    cue->n_cues = id;
+
+    /* Out with the old, keeping what is not a marker's label */
+    if ((ptr = FindChunkPtr(&waveFile->children, "cue ", NULL)) != NULL) {
+	old = *ptr;
+	*ptr = old->next;
+	FreeChunk(old);
+    }
+    while ((ptr = FindChunkPtr(&waveFile->children, "LIST", "adtl")) != NULL) {
+	old = *ptr;
+	*ptr = old->next;
+	while ((child = ((ListChunk *)old)->children) != NULL) {
+	    ((ListChunk *)old)->children = child->next;
+	    child->next = NULL;
+	    if (strncasecmp(child->identifier, "labl", 4) == 0 ||
+		strncasecmp(child->identifier, "note", 4) == 0 ||
+		strncasecmp(child->identifier, "ltxt", 4) == 0)
+	    {
+		FreeChunk(child);
+	    } else {
+		*tail = child;
+		tail = &child->next;
+	    }
+	}
+	FreeChunk(old);
+    }
+
+    /* In with the new, after the data */
+    ptr = FindChunkPtr(&waveFile->children, "data", NULL);
+    if (adtl->children != NULL) {
+	adtl->header.next = (*ptr)->next;
+	(*ptr)->next = &adtl->header;
+	adtl = NULL;
+    }
+    if (id > 0) {
+	cue->header.next = (*ptr)->next;
+	(*ptr)->next = &cue->header;
+	cue = NULL;
+    }
+    rval = 0;
+
+exit:
+    FreeChunk((Chunk *)cue);
+    FreeChunk((Chunk *)adtl);
+    for (i=0; i < ninputs; ++i) {
+	FreeMarkerIndex(mis[i]);
+    }
+    free(mis);
+    return rval;
+}
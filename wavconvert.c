@@ -0,0 +1,438 @@
+static const char usage[] = "usage:\n"
+"	wavconvert [options] infile outfile\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-b	--bits N	Output bits per sample: 8, 16, 24 or 32 (16)\n"
+"	-f	--float		Write 32-bit IEEE float samples\n"
+"	-a	--adpcm		Write IMA ADPCM, 4 bits per sample\n"
+"	-d	--dither type	Dither: none, rect, tpdf (tpdf)\n"
+"	-s	--shape type	Noise shaping: none, simple, ew (none)\n"
+"	-S	--seed N	Random seed for the dither\n"
+"	-j	--threads N	Max threads (# of CPUs)\n"
+"\n"
+"Converts the samples in a .wav file to a different word length in a\n"
+"single pass. All other chunks, including the INFO and ID3 tags, are\n"
+"copied to the output unchanged. The input may also be A-law, mu-law,\n"
+"IMA ADPCM or Microsoft ADPCM.\n"
+"\n"
+"Dither and noise shaping apply to 8, 16 and 24 bit output that is\n"
+"shorter than the input's samples; a longer word is exact and is left\n"
+"alone. \"simple\" is a first order high-pass curve. \"ew\" is a 5-tap\n"
+"E-weighted curve designed for 44.1 kHz; it pushes the noise into the\n"
+"range where the ear is least sensitive.\n"
+"\n"
+"The input is read, decoded on several threads, and dithered and\n"
+"written at the same time, so the conversion keeps pace with the disk.\n"
+"\n"
+"IMA ADPCM output is a quarter the size of 16-bit PCM. The samples are\n"
+"dithered to 16 bits first. Blocks are encoded independently, many at a\n"
+"time in parallel.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libdither.h"
+#include "libcodec.h"
+#include "libpipe.h"
+
+#define	BLOCK_FRAMES	8192	/* Frames converted at a time */
+#define	ADPCM_BLOCKS	256	/* ADPCM blocks encoded at a time */
+
+/**
+ * State for the data source that produces the converted samples
+ */
+typedef struct convert {
+  PcmStream *stream;
+  FmtChunk *fmt;	/* Output format */
+  Ditherer *dither;	/* NULL unless the word gets shorter, or ADPCM */
+  float *buffer;
+  int16_t *pcm;		/* ADPCM: samples to be encoded */
+  uint8_t *coded;	/* ADPCM: encoded blocks */
+  size_t codedLen;	/* ADPCM: bytes in coded */
+  size_t codedUsed;	/* ADPCM: bytes already returned */
+  Pipeline *pipe;	/* Unless the input is ADPCM or the output is */
+} Convert;
+
+static int convertFile(const char *ifilename, const char *ofilename);
+static long convertSource(void *ctx, void *buffer, size_t len);
+static long adpcmSource(void *ctx, void *buffer, size_t len);
+static long decodeStage(void *ctx, const void *in, size_t len, void *out, size_t size);
+static long encodeStage(void *ctx, const void *in, size_t len, void *out, size_t size);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"bits", required_argument, NULL, 'b'},
+  {"float", no_argument, NULL, 'f'},
+  {"adpcm", no_argument, NULL, 'a'},
+  {"dither", required_argument, NULL, 'd'},
+  {"shape", required_argument, NULL, 's'},
+  {"seed", required_argument, NULL, 'S'},
+  {"threads", required_argument, NULL, 'j'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static int bits = 16;
+static bool useFloat = false;
+static bool useAdpcm = false;
+static DitherType ditherType = DITHER_TPDF;
+static NoiseShape noiseShape = SHAPE_NONE;
+static uint32_t seed = 0;
+static int nThreads = 0;
+
+
+int
+main(int argc, char **argv)
+{
+    int c, v;
+
+    while ((c = getopt_long(argc, argv, "hvb:fad:s:S:j:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'b': bits = atoi(optarg); break;
+	case 'f': useFloat = true; break;
+	case 'a': useAdpcm = true; break;
+	case 'd':
+	  if ((v = DitherTypeFromName(optarg)) < 0) {
+	      fprintf(stderr, "Unknown dither type \"%s\"\n", optarg);
+	      return 2;
+	  }
+	  ditherType = v;
+	  break;
+	case 's':
+	  if ((v = NoiseShapeFromName(optarg)) < 0) {
+	      fprintf(stderr, "Unknown noise shaping \"%s\"\n", optarg);
+	      return 2;
+	  }
+	  noiseShape = v;
+	  break;
+	case 'S': seed = strtoul(optarg, NULL, 0); break;
+	case 'j': nThreads = atoi(optarg); break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (bits != 8 && bits != 16 && bits != 24 && bits != 32) {
+	fprintf(stderr, "Bits per sample must be 8, 16, 24 or 32\n");
+	return 2;
+    }
+    if (useFloat && useAdpcm) {
+	fprintf(stderr, "Specify only one of -f and -a\n");
+	return 2;
+    }
+    if (nThreads <= 0) {
+	nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (argc - optind != 2) {
+	fprintf(stderr, "Specify an input file and an output file\n");
+	return 2;
+    }
+    if (strcmp(argv[optind], argv[optind+1]) == 0) {
+	fprintf(stderr,
+	    "Input file and output file cannot have the same name\n");
+	return 3;
+    }
+
+    return convertFile(argv[optind], argv[optind+1]);
+}
+
+static int
+convertFile(const char *ifilename, const char *ofilename)
+{
+    FILE *ifile, *ofile = NULL;
+    WaveChunk *waveFile;
+    Chunk *oldFmt = NULL;
+    FmtChunk *ofmt;
+    DataChunk *odata;
+    FactChunk *fact;
+    Convert conv;
+    uint64_t length;
+    uint32_t spb = 1;
+    int rval = 3, prec;
+    bool lossy;
+
+    memset(&conv, 0, sizeof(conv));
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	rval = 4;
+	goto exit;
+    }
+    if ((conv.stream = OpenPcmStream(ifile, waveFile)) == NULL ||
+	!PcmDecodable(conv.stream->fmt))
+    {
+	fprintf(stderr, "%s: %s\n", ifilename,
+	    conv.stream == NULL ? PcmError : "Unsupported sample format");
+	rval = 4;
+	goto exit;
+    }
+    if (FindChunkPtr(&waveFile->children, "fmt ", NULL) == NULL ||
+	FindChunkPtr(&waveFile->children, "data", NULL) == NULL)
+    {
+	fprintf(stderr, "%s: fmt and data chunks must be at the top level\n",
+	    ifilename);
+	rval = 4;
+	goto exit;
+    }
+
+    /* The input stream keeps the original format chunk; the tree
+     * gets a new one describing the output.
+     */
+    if ((ofmt = (FmtChunk *)newChunk("fmt ", 16, 0, sizeof(*ofmt))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    *ofmt = *conv.stream->fmt;
+    ofmt->header.length = 16;
+    ofmt->ext = NULL;
+    ofmt->ext_len = 0;
+    ofmt->type = useFloat ? RIFF_IEEE_FLOAT : RIFF_PCM;
+    ofmt->bits_samp = useFloat ? 32 : bits;
+    ofmt->block_align = ofmt->channels * ofmt->bits_samp / 8;
+    ofmt->bytes_sec = ofmt->block_align * ofmt->sample_rate;
+    /* The stream still reads with the old one, so it is kept */
+    oldFmt = ReplaceChunk(&waveFile->children, (Chunk *)ofmt);
+    conv.fmt = ofmt;
+    length = (uint64_t)conv.stream->frames * ofmt->block_align;
+    if (useAdpcm) {
+	if (SetImaFmt(ofmt, ofmt->channels, ofmt->sample_rate, 0) != 0) {
+	    fprintf(stderr, "%s: %s\n", ifilename, CodecError);
+	    goto exit;
+	}
+	/* Whole blocks; the fact chunk has the real length */
+	spb = CodecBlockFrames(ofmt);
+	length = ((uint64_t)conv.stream->frames + spb - 1) / spb *
+		ofmt->block_align;
+    }
+    if (length > UINT32_MAX - 1024) {
+	fprintf(stderr, "%s: output would be too large for a .wav file\n",
+	    ifilename);
+	goto exit;
+    }
+
+    /* A longer word loses nothing, so it gets plain rounding, which
+     * is exact. The ADPCM encoder always takes 16-bit samples.
+     */
+    prec = PcmPrecision(conv.stream->fmt);
+    lossy = prec == 0 || prec > (useAdpcm ? 16 : ofmt->bits_samp);
+    if (useAdpcm || (ofmt->type == RIFF_PCM && ofmt->bits_samp <= 24 && lossy)) {
+	conv.dither = NewDitherer(ofmt->channels, useAdpcm ? 16 : ofmt->bits_samp,
+		lossy ? ditherType : DITHER_NONE, lossy ? noiseShape : SHAPE_NONE,
+		seed);
+	if (conv.dither == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+    }
+    if (useAdpcm) {
+	conv.buffer = malloc(ADPCM_BLOCKS * spb * ofmt->channels * sizeof(float));
+	conv.pcm = malloc(ADPCM_BLOCKS * spb * ofmt->channels * sizeof(int16_t));
+	conv.coded = malloc(ADPCM_BLOCKS * ofmt->block_align);
+	if (conv.buffer == NULL || conv.pcm == NULL || conv.coded == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+    } else if (conv.stream->block_frames == 1) {
+	/* Decode blocks on many threads, then dither them in order */
+	const FmtChunk *ifmt = conv.stream->fmt;
+	size_t frameSize = ofmt->channels * sizeof(float);
+	if (ifmt->block_align > frameSize) {
+	    frameSize = ifmt->block_align;
+	}
+	conv.pipe = NewPipeline(conv.stream->fd, conv.stream->start,
+		(uint64_t)conv.stream->frames * ifmt->block_align,
+		BLOCK_FRAMES * ifmt->block_align, BLOCK_FRAMES * frameSize, nThreads);
+	if (conv.pipe == NULL ||
+	    PipeAddStage(conv.pipe, decodeStage, (void *)ifmt, false) != 0 ||
+	    PipeAddStage(conv.pipe, encodeStage, &conv, true) != 0)
+	{
+	    fprintf(stderr, "%s\n", PipeError);
+	    goto exit;
+	}
+    } else if ((conv.buffer = malloc(BLOCK_FRAMES * ofmt->channels * sizeof(float))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+
+    odata = newDataChunk("data", (uint32_t)length, 0);
+    if (odata == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    odata->source = useAdpcm ? adpcmSource :
+			conv.pipe != NULL ? PipeSource : convertSource;
+    odata->source_ctx = conv.pipe != NULL ? (void *)conv.pipe : &conv;
+    FreeChunk(ReplaceChunk(&waveFile->children, (Chunk *)odata));
+
+    /* Non-PCM formats need a fact chunk */
+    fact = (FactChunk *)FindChunk(waveFile->children, "fact", NULL);
+    if (ofmt->type != RIFF_PCM && fact == NULL) {
+	fact = (FactChunk *)newChunk("fact", 4, 0, sizeof(*fact));
+	if (fact == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+	fact->header.next = ofmt->header.next;
+	ofmt->header.next = (Chunk *)fact;
+    }
+    if (fact != NULL) {
+	fact->n = conv.stream->frames;
+    }
+
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+    if (WriteWaveFile(waveFile, ifile, ofile) != 0) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	goto exit;
+    }
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    if (verbose) {
+	printf("%s: %" PRIu32 " frames, %u to %u bits\n", ifilename,
+	    conv.stream->frames, conv.stream->fmt->bits_samp, ofmt->bits_samp);
+    }
+    rval = 0;
+
+exit:
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    free(conv.buffer);
+    free(conv.pcm);
+    free(conv.coded);
+    FreePipeline(conv.pipe);
+    FreeDitherer(conv.dither);
+    ClosePcmStream(conv.stream);
+    FreeChunk(oldFmt);
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Data source: read, convert and requantize the next block
+ */
+static long
+convertSource(void *ctx, void *buffer, size_t len)
+{
+    Convert *conv = ctx;
+    size_t frames = len / conv->fmt->block_align;
+
+    if (frames > BLOCK_FRAMES) {
+	frames = BLOCK_FRAMES;
+    }
+    if ((frames = ReadPcmFloat(conv->stream, conv->buffer, frames)) == 0) {
+	return -1;
+    }
+    if (conv->dither != NULL) {
+	DitherFrames(conv->dither, conv->buffer, buffer, frames);
+    } else {
+	PcmEncode(conv->fmt, conv->buffer, buffer, frames);
+    }
+    return frames * conv->fmt->block_align;
+}
+
+/**
+ * Pipeline stage: decode a block of the input to float. Blocks are
+ * independent, so this runs on many at once.
+ */
+static long
+decodeStage(void *ctx, const void *in, size_t len, void *out, size_t size)
+{
+    const FmtChunk *fmt = ctx;
+    size_t frames = len / fmt->block_align;
+
+    if (PcmDecode(fmt, in, out, frames) != 0) {
+	PipeError = PcmError;
+	return -1;
+    }
+    return frames * fmt->channels * sizeof(float);
+}
+
+/**
+ * Pipeline stage: requantize a block. The noise shaping carries over
+ * from block to block, so this sees them in order.
+ */
+static long
+encodeStage(void *ctx, const void *in, size_t len, void *out, size_t size)
+{
+    Convert *conv = ctx;
+    size_t frames = len / (conv->fmt->channels * sizeof(float));
+
+    if (conv->dither != NULL) {
+	DitherFrames(conv->dither, in, out, frames);
+    } else {
+	PcmEncode(conv->fmt, in, out, frames);
+    }
+    return frames * conv->fmt->block_align;
+}
+
+/**
+ * Data source for ADPCM output: read, dither to 16 bits and encode
+ * a batch of blocks whenever the last batch has been used up.
+ */
+static long
+adpcmSource(void *ctx, void *buffer, size_t len)
+{
+    Convert *conv = ctx;
+    const int nc = conv->fmt->channels;
+    const size_t spb = CodecBlockFrames(conv->fmt);
+    size_t frames, padded, i;
+    uint8_t *bytes = (uint8_t *)conv->pcm;
+    long l;
+
+    if (conv->codedUsed >= conv->codedLen) {
+	frames = ReadPcmFloat(conv->stream, conv->buffer, ADPCM_BLOCKS * spb);
+	if (frames == 0) {
+	    return -1;
+	}
+	/* Dither to little-endian bytes, then to int16 in place */
+	DitherFrames(conv->dither, conv->buffer, bytes, frames);
+	for (i=0; i < frames * nc; ++i) {
+	    conv->pcm[i] = (int16_t)(bytes[2*i] | bytes[2*i+1] << 8);
+	}
+	/* Pad the last block by repeating the last frame */
+	padded = (frames + spb - 1) / spb * spb;
+	for (i = frames * nc; i < padded * nc; ++i) {
+	    conv->pcm[i] = conv->pcm[i - nc];
+	}
+	if ((l = EncodeImaBlocks(conv->fmt, conv->pcm, padded, conv->coded,
+		nThreads)) < 0)
+	{
+	    return -1;
+	}
+	conv->codedLen = l;
+	conv->codedUsed = 0;
+    }
+
+    if (len > conv->codedLen - conv->codedUsed) {
+	len = conv->codedLen - conv->codedUsed;
+    }
+    memcpy(buffer, conv->coded + conv->codedUsed, len);
+    conv->codedUsed += len;
+    return len;
+}
@@ -0,0 +1,431 @@
+static const char usage[] = "usage:\n"
+"	wavconvolve -i ir.wav [options] infile outfile\n"
+"	wavconvolve -i ir.wav -o dir [options] file ...\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-i	--ir file	Impulse response\n"
+"	-o	--outdir dir	Write each output file to dir, under its own name\n"
+"	-g	--gain dB	Output gain (0)\n"
+"	-t	--trim		Keep the input length; drop the tail\n"
+"	-b	--block N	Partition size, a power of 2 (chosen from IR length)\n"
+"	-j	--threads N	Max threads, one per channel (# of CPUs)\n"
+"	-d	--dither type	Dither for integer output: none, rect, tpdf (tpdf)\n"
+"\n"
+"Convolves .wav files with an impulse response, e.g. a room response or\n"
+"a speaker correction filter, in a single streaming pass. The impulse\n"
+"response may have one channel, applied to every channel, or one\n"
+"channel per channel of the input, and must have the same sample rate.\n"
+"Its spectra are computed once and used for every file.\n"
+"\n"
+"The output has the input's sample format and all of its other chunks,\n"
+"including tags. It is longer than the input by the length of the\n"
+"impulse response less one, unless -t is given. Samples that clip are\n"
+"counted and reported.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libdither.h"
+#include "libconvolve.h"
+
+#define	CHUNK_FRAMES	32768	/* Frames convolved per call, at least */
+
+/**
+ * State for the data source that produces the convolved samples
+ */
+typedef struct conv {
+  PcmStream *stream;
+  Convolver *convolver;
+  Ditherer *dither;
+  size_t blocks;	/* Blocks per call */
+  size_t block;		/* Frames per block */
+  float *inBuf;
+  float *outBuf;
+  size_t outAvail;	/* Frames in outBuf */
+  size_t outUsed;	/* Frames already returned */
+  uint64_t remaining;	/* Frames still to be returned */
+  bool clip;		/* Output is an integer format */
+  uint64_t clipped;	/* # of samples out of range */
+} Conv;
+
+static bool sameFile(const char *a, const char *b);
+static IrSpectra *loadIr(const char *filename);
+static int convolveFile(const char *ifilename, const char *ofilename);
+static long convolveSource(void *ctx, void *buffer, size_t len);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"ir", required_argument, NULL, 'i'},
+  {"outdir", required_argument, NULL, 'o'},
+  {"gain", required_argument, NULL, 'g'},
+  {"trim", no_argument, NULL, 't'},
+  {"block", required_argument, NULL, 'b'},
+  {"threads", required_argument, NULL, 'j'},
+  {"dither", required_argument, NULL, 'd'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static const char *irFile = NULL;
+static const char *outDir = NULL;
+static double gainDb = 0;
+static bool trim = false;
+static int blockSize = 0;
+static int nThreads = 0;
+static DitherType ditherType = DITHER_TPDF;
+
+static IrSpectra *irSpectra;
+static uint32_t irRate;
+
+
+int
+main(int argc, char **argv)
+{
+    int c, v;
+    int rval = 0;
+    char *ofilename;
+    const char *base;
+
+    while ((c = getopt_long(argc, argv, "hvi:o:g:tb:j:d:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'i': irFile = optarg; break;
+	case 'o': outDir = optarg; break;
+	case 'g': gainDb = atof(optarg); break;
+	case 't': trim = true; break;
+	case 'b': blockSize = atoi(optarg); break;
+	case 'j': nThreads = atoi(optarg); break;
+	case 'd':
+	  if ((v = DitherTypeFromName(optarg)) < 0) {
+	      fprintf(stderr, "Unknown dither type \"%s\"\n", optarg);
+	      return 2;
+	  }
+	  ditherType = v;
+	  break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (irFile == NULL) {
+	fprintf(stderr, "Specify the impulse response with -i\n");
+	return 2;
+    }
+    if (nThreads <= 0) {
+	nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (outDir == NULL) {
+	if (argc - optind != 2) {
+	    fprintf(stderr, "Specify an input file and an output file\n");
+	    return 2;
+	}
+	if (strcmp(argv[optind], argv[optind+1]) == 0) {
+	    fprintf(stderr,
+		"Input file and output file cannot have the same name\n");
+	    return 3;
+	}
+    } else if (optind >= argc) {
+	fprintf(stderr, "Specify at least one file name\n");
+	return 2;
+    }
+
+    if ((irSpectra = loadIr(irFile)) == NULL) {
+	return 4;
+    }
+
+    if (outDir == NULL) {
+	rval = convolveFile(argv[optind], argv[optind+1]);
+    } else {
+	for (; optind < argc; ++optind) {
+	    base = strrchr(argv[optind], '/');
+	    base = base != NULL ? base + 1 : argv[optind];
+	    if ((ofilename = malloc(strlen(outDir) + strlen(base) + 2)) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		rval |= 3;
+		break;
+	    }
+	    sprintf(ofilename, "%s/%s", outDir, base);
+	    if (sameFile(argv[optind], ofilename)) {
+		fprintf(stderr, "%s: output would overwrite the input\n",
+		    argv[optind]);
+		rval |= 3;
+	    } else {
+		rval |= convolveFile(argv[optind], ofilename);
+	    }
+	    free(ofilename);
+	}
+    }
+    FreeIrSpectra(irSpectra);
+    return rval;
+}
+
+/**
+ * True if both names refer to the same existing file
+ */
+static bool
+sameFile(const char *a, const char *b)
+{
+    struct stat sa, sb;
+
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 &&
+	sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+/**
+ * Read an impulse response and compute its spectra.
+ * @return the spectra, or NULL on error, with a message printed
+ */
+static IrSpectra *
+loadIr(const char *filename)
+{
+    FILE *file;
+    WaveChunk *waveFile;
+    PcmStream *stream = NULL;
+    IrSpectra *ir = NULL;
+    float *samples = NULL;
+    size_t n, got = 0;
+
+    if ((file = fopen(filename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+	return NULL;
+    }
+    if ((waveFile = OpenWaveFile(file)) == NULL) {
+	fprintf(stderr, "%s: %s\n", filename, WaveError);
+	goto exit;
+    }
+    if ((stream = OpenPcmStream(file, waveFile)) == NULL ||
+	!PcmDecodable(stream->fmt))
+    {
+	fprintf(stderr, "%s: %s\n", filename,
+	    stream == NULL ? PcmError : "Unsupported sample format");
+	goto exit;
+    }
+    samples = malloc(((size_t)stream->frames + 1) * stream->fmt->channels
+	    * sizeof(float));
+    if (samples == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    while (got < stream->frames &&
+	   (n = ReadPcmFloat(stream, samples + got * stream->fmt->channels,
+		stream->frames - got)) > 0)
+    {
+	got += n;
+    }
+    if (got < stream->frames) {
+	fprintf(stderr, "%s: %s\n", filename, PcmError);
+	goto exit;
+    }
+    ir = NewIrSpectra(samples, got, stream->fmt->channels, blockSize,
+	    (float)pow(10, gainDb / 20));
+    if (ir == NULL) {
+	fprintf(stderr, "%s: %s\n", filename, ConvolveError);
+	goto exit;
+    }
+    irRate = stream->fmt->sample_rate;
+    if (verbose) {
+	printf("%s: %zu frames, %d channels, block size %d\n",
+	    filename, got, stream->fmt->channels, IrBlock(ir));
+    }
+
+exit:
+    free(samples);
+    ClosePcmStream(stream);
+    FreeWaveFile(waveFile);
+    fclose(file);
+    return ir;
+}
+
+static int
+convolveFile(const char *ifilename, const char *ofilename)
+{
+    FILE *ifile, *ofile = NULL;
+    WaveChunk *waveFile;
+    const FmtChunk *fmt;
+    DataChunk *odata;
+    FactChunk *fact;
+    Conv conv;
+    uint64_t outFrames;
+    int rval = 3;
+
+    memset(&conv, 0, sizeof(conv));
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	rval = 4;
+	goto exit;
+    }
+    if ((conv.stream = OpenPcmStream(ifile, waveFile)) == NULL ||
+	!PcmSupported(conv.stream->fmt))
+    {
+	fprintf(stderr, "%s: %s\n", ifilename,
+	    conv.stream == NULL ? PcmError : "Unsupported sample format");
+	rval = 4;
+	goto exit;
+    }
+    if (FindChunkPtr(&waveFile->children, "data", NULL) == NULL) {
+	fprintf(stderr, "%s: data chunk must be at the top level\n", ifilename);
+	rval = 4;
+	goto exit;
+    }
+    fmt = conv.stream->fmt;
+    if (fmt->sample_rate != irRate) {
+	fprintf(stderr, "%s: sample rate %" PRIu32 " does not match the "
+	    "impulse response, %" PRIu32 "\n", ifilename, fmt->sample_rate, irRate);
+	rval = 4;
+	goto exit;
+    }
+
+    if ((conv.convolver = NewConvolver(irSpectra, fmt->channels, nThreads)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, ConvolveError);
+	rval = 4;
+	goto exit;
+    }
+    conv.block = IrBlock(irSpectra);
+    conv.blocks = (CHUNK_FRAMES + conv.block - 1) / conv.block;
+    conv.inBuf = malloc(conv.blocks * conv.block * fmt->channels * sizeof(float));
+    conv.outBuf = malloc(conv.blocks * conv.block * fmt->channels * sizeof(float));
+    if (conv.inBuf == NULL || conv.outBuf == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    conv.clip = FmtType(fmt) != RIFF_IEEE_FLOAT;
+    /* Every output sample is a long sum of products, never exact */
+    if (FmtType(fmt) == RIFF_PCM && fmt->bits_samp <= 24) {
+	conv.dither = NewDitherer(fmt->channels, fmt->bits_samp,
+		ditherType, SHAPE_NONE, 0);
+	if (conv.dither == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+    }
+
+    outFrames = conv.stream->frames;
+    if (!trim && outFrames > 0) {
+	outFrames += IrLength(irSpectra) - 1;
+    }
+    if (outFrames * fmt->block_align > UINT32_MAX - 1024) {
+	fprintf(stderr, "%s: output would be too large for a .wav file\n",
+	    ifilename);
+	goto exit;
+    }
+    conv.remaining = outFrames;
+    if ((fact = (FactChunk *)FindChunk(waveFile->children, "fact", NULL)) != NULL) {
+	fact->n = (uint32_t)outFrames;
+    }
+
+    odata = newDataChunk("data", (uint32_t)(outFrames * fmt->block_align), 0);
+    if (odata == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    odata->source = convolveSource;
+    odata->source_ctx = &conv;
+    FreeChunk(ReplaceChunk(&waveFile->children, (Chunk *)odata));
+
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+    if (WriteWaveFile(waveFile, ifile, ofile) != 0) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	goto exit;
+    }
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    if (verbose) {
+	printf("%s: %" PRIu32 " frames to %" PRIu64 " frames\n",
+	    ifilename, conv.stream->frames, outFrames);
+    }
+    if (conv.clipped > 0) {
+	fprintf(stderr, "%s: %" PRIu64 " samples clipped\n",
+	    ofilename, conv.clipped);
+    }
+    rval = 0;
+
+exit:
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    free(conv.inBuf);
+    free(conv.outBuf);
+    FreeDitherer(conv.dither);
+    FreeConvolver(conv.convolver);
+    ClosePcmStream(conv.stream);
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Data source: return convolved frames, convolving another chunk of
+ * input whenever the output buffer has been used up. Past the end of
+ * the input, zeros are fed in to get the tail.
+ */
+static long
+convolveSource(void *ctx, void *buffer, size_t len)
+{
+    Conv *conv = ctx;
+    const FmtChunk *fmt = conv->stream->fmt;
+    const int nc = fmt->channels;
+    size_t frames = len / fmt->block_align;
+    size_t i, n, got, want = conv->blocks * conv->block;
+
+    if (conv->remaining == 0) {
+	return -1;
+    }
+    if (conv->outUsed >= conv->outAvail) {
+	for (got = 0; got < want; got += n) {
+	    n = ReadPcmFloat(conv->stream, conv->inBuf + got * nc, want - got);
+	    if (n == 0) break;
+	}
+	if (got < want && conv->stream->position < conv->stream->frames) {
+	    return -1;
+	}
+	memset(conv->inBuf + got * nc, 0, (want - got) * nc * sizeof(float));
+	ConvolveBlocks(conv->convolver, conv->inBuf, conv->blocks, conv->outBuf);
+	conv->outUsed = 0;
+	conv->outAvail = want < conv->remaining ? want : (size_t)conv->remaining;
+	if (conv->clip) {
+	    n = conv->outAvail * nc;
+	    for (i=0; i < n; ++i) {
+		if (fabsf(conv->outBuf[i]) > 1.0f) ++conv->clipped;
+	    }
+	}
+    }
+
+    if (frames > conv->outAvail - conv->outUsed) {
+	frames = conv->outAvail - conv->outUsed;
+    }
+    if (conv->dither != NULL) {
+	DitherFrames(conv->dither, conv->outBuf + conv->outUsed * nc, buffer, frames);
+    } else {
+	PcmEncode(fmt, conv->outBuf + conv->outUsed * nc, buffer, frames);
+    }
+    conv->outUsed += frames;
+    conv->remaining -= frames;
+    return frames * fmt->block_align;
+}
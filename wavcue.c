@@ -0,0 +1,648 @@
+static const char usage[] = "usage:\n"
+"	wavcue [options] sheet.cue ...\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-l	--list		List the tracks and exit\n"
+"	-r	--record file	Disc record to take the tags from\n"
+"	-n	--no-id3	Write INFO tags only\n"
+"	-j	--threads N	Max files written at once (# of CPUs)\n"
+"\n"
+"Splits disc images into tracks as described by their CUE sheets. Each\n"
+"sheet must name one .wav file, which holds the whole disc; track N is\n"
+"written to the image's name without \".wav\" plus \"-NN.wav\". A track\n"
+"runs from its INDEX 01 to the next track's, so pregaps stay with the\n"
+"track before, as on the disc. Audio before track 1 is not written.\n"
+"\n"
+"The samples are copied as they are, without decoding, and the tracks of\n"
+"all the sheets are written in parallel.\n"
+"\n"
+"Each track gets the image's INFO tags, with INAM, IART, IPRD (album),\n"
+"ITRK, ICRD and IGNR set, and the same tags as ID3 (TIT2, TPE1, TALB,\n"
+"TRCK, TYER, TCON). They come from the disc record, an xmcd file such\n"
+"as \"cdinfo.py -c sheet.cue\" saves next to the sheet as sheet.cddb,\n"
+"and from the sheet's TITLE, PERFORMER and REM DATE/GENRE lines where\n"
+"the record has no value.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "libwav.h"
+#include "libsplit.h"
+
+#define	CD_FRAMES	75	/* CD frames per second, as in MM:SS:FF */
+
+typedef struct track {
+  int number;		/* From TRACK */
+  uint32_t index;	/* INDEX 01, in CD frames */
+  bool indexed;		/* INDEX 01 was given */
+  char *title, *performer;
+} Track;
+
+typedef struct sheet {
+  char *file;		/* The image, relative to the current directory */
+  char *title, *performer, *date, *genre;
+  Track *tracks;
+  int ntracks;
+} Sheet;
+
+static int readSheet(const char *filename, Sheet *sheet);
+static int readRecord(const char *filename, Sheet *sheet);
+static int splitImage(const char *sheetname, Sheet *sheet);
+static void freeSheet(Sheet *sheet);
+static char *getField(char **line);
+static char *dirName(const char *filename);
+static char *replaceExt(const char *filename, const char *ext, const char *new);
+static int setString(char **dst, const char *value, bool append);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"list", no_argument, NULL, 'l'},
+  {"record", required_argument, NULL, 'r'},
+  {"no-id3", no_argument, NULL, 'n'},
+  {"threads", required_argument, NULL, 'j'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static bool listOnly = false;
+static const char *recordFile = NULL;
+static bool noId3 = false;
+static int nThreads = 0;
+
+static SplitOutput *outputs = NULL;
+static int nOutputs = 0, maxOutputs = 0;
+
+
+int
+main(int argc, char **argv)
+{
+    Sheet *sheets, *sheet;
+    char *record;
+    struct stat st;
+    int c, i, nsheets = 0, rval = 0;
+
+    while ((c = getopt_long(argc, argv, "hvlr:nj:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'l': listOnly = true; break;
+	case 'r': recordFile = optarg; break;
+	case 'n': noId3 = true; break;
+	case 'j': nThreads = atoi(optarg); break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (optind >= argc) {
+	fprintf(stderr, "Specify at least one CUE sheet\n");
+	return 2;
+    }
+    if (recordFile != NULL && argc - optind > 1) {
+	fprintf(stderr, "--record can only be used with one sheet\n");
+	return 2;
+    }
+    if (nThreads <= 0) {
+	nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nThreads <= 0) nThreads = 1;
+    }
+
+    /* The outputs refer to the sheets' image names until written */
+    if ((sheets = calloc(argc - optind, sizeof(Sheet))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	return 3;
+    }
+    for (; optind < argc; ++optind) {
+	sheet = &sheets[nsheets++];
+	if ((c = readSheet(argv[optind], sheet)) != 0) {
+	    rval = c > rval ? c : rval;
+	    continue;
+	}
+	/* The record is optional unless named */
+	if (recordFile != NULL) {
+	    c = readRecord(recordFile, sheet);
+	} else if ((record = replaceExt(argv[optind], ".cue", ".cddb")) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    rval = 3;
+	    goto exit;
+	} else {
+	    c = stat(record, &st) == 0 ? readRecord(record, sheet) : 0;
+	    free(record);
+	}
+	if (c == 0) {
+	    c = splitImage(argv[optind], sheet);
+	}
+	rval = c > rval ? c : rval;
+    }
+
+    if (!listOnly && (c = SplitWrite(outputs, nOutputs, nThreads)) > rval) {
+	rval = c;
+    }
+
+exit:
+    SplitFree(outputs, nOutputs);
+    for (i=0; i < nsheets; ++i) {
+	freeSheet(&sheets[i]);
+    }
+    free(sheets);
+    return rval;
+}
+
+/**
+ * Parse a CUE sheet. Only the commands that matter for splitting
+ * are read; the rest are ignored.
+ * @return 0 on success, else an exit code, with a message printed
+ */
+static int
+readSheet(const char *filename, Sheet *sheet)
+{
+    FILE *ifile;
+    char buffer[1024], *line, *cmd, *arg;
+    char *dir = NULL;
+    Track *track = NULL;
+    unsigned int n, mm, ss, ff;
+    int i, lineno = 0, maxTracks = 0, rval = 4;
+    bool inTrack = false;
+
+    if ((ifile = fopen(filename, "r")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+	return 4;
+    }
+    while (fgets(buffer, sizeof(buffer), ifile) != NULL) {
+	line = buffer;
+	if (++lineno == 1 && memcmp(line, "\xef\xbb\xbf", 3) == 0) {
+	    line += 3;		/* UTF-8 BOM */
+	}
+	if ((cmd = getField(&line)) == NULL) {
+	    continue;
+	}
+	if (strcasecmp(cmd, "FILE") == 0) {
+	    if (sheet->file != NULL) {
+		fprintf(stderr, "%s:%d: only one FILE per sheet is supported\n",
+		    filename, lineno);
+		goto exit;
+	    }
+	    if ((arg = getField(&line)) == NULL) {
+		fprintf(stderr, "%s:%d: FILE needs a name\n", filename, lineno);
+		goto exit;
+	    }
+	    /* The name is relative to the sheet */
+	    if ((dir = dirName(filename)) == NULL ||
+		(sheet->file = malloc(strlen(dir) + strlen(arg) + 1)) == NULL)
+	    {
+		fprintf(stderr, "Out of memory\n");
+		rval = 3;
+		goto exit;
+	    }
+	    strcpy(sheet->file, arg[0] == '/' ? "" : dir);
+	    strcat(sheet->file, arg);
+	} else if (strcasecmp(cmd, "TRACK") == 0) {
+	    if (sheet->ntracks >= maxTracks) {
+		maxTracks = maxTracks == 0 ? 32 : maxTracks * 2;
+		if ((track = realloc(sheet->tracks, maxTracks * sizeof(Track))) == NULL) {
+		    fprintf(stderr, "Out of memory\n");
+		    rval = 3;
+		    goto exit;
+		}
+		sheet->tracks = track;
+	    }
+	    track = &sheet->tracks[sheet->ntracks++];
+	    memset(track, 0, sizeof(*track));
+	    inTrack = true;
+	    arg = getField(&line);
+	    track->number = arg != NULL ? atoi(arg) : sheet->ntracks;
+	    arg = getField(&line);
+	    if (arg != NULL && strcasecmp(arg, "AUDIO") != 0) {
+		/* Data tracks are not in the image */
+		--sheet->ntracks;
+		track = NULL;
+	    }
+	} else if (strcasecmp(cmd, "INDEX") == 0 && track != NULL) {
+	    if ((arg = getField(&line)) == NULL || (n = atoi(arg)) != 1) {
+		continue;
+	    }
+	    if ((arg = getField(&line)) == NULL ||
+		sscanf(arg, "%u:%u:%u", &mm, &ss, &ff) != 3 ||
+		ss >= 60 || ff >= CD_FRAMES)
+	    {
+		fprintf(stderr, "%s:%d: bad INDEX time\n", filename, lineno);
+		goto exit;
+	    }
+	    track->index = (mm * 60 + ss) * CD_FRAMES + ff;
+	    track->indexed = true;
+	} else if (strcasecmp(cmd, "TITLE") == 0 || strcasecmp(cmd, "PERFORMER") == 0) {
+	    bool title = toupper(cmd[0]) == 'T';
+	    if ((arg = getField(&line)) == NULL || (inTrack && track == NULL)) {
+		continue;
+	    }
+	    if (setString(track == NULL ?
+			(title ? &sheet->title : &sheet->performer) :
+			(title ? &track->title : &track->performer), arg, false) != 0)
+	    {
+		fprintf(stderr, "Out of memory\n");
+		rval = 3;
+		goto exit;
+	    }
+	} else if (strcasecmp(cmd, "REM") == 0 && !inTrack &&
+		   (cmd = getField(&line)) != NULL &&
+		   (arg = getField(&line)) != NULL)
+	{
+	    if ((strcasecmp(cmd, "DATE") == 0 && setString(&sheet->date, arg, false) != 0) ||
+		(strcasecmp(cmd, "GENRE") == 0 && setString(&sheet->genre, arg, false) != 0))
+	    {
+		fprintf(stderr, "Out of memory\n");
+		rval = 3;
+		goto exit;
+	    }
+	}
+    }
+
+    if (sheet->file == NULL || sheet->ntracks == 0) {
+	fprintf(stderr, "%s: no %s\n", filename,
+	    sheet->file == NULL ? "FILE" : "audio tracks");
+	goto exit;
+    }
+    for (i=0; i < sheet->ntracks; ++i) {
+	track = &sheet->tracks[i];
+	if (!track->indexed ||
+	    (i > 0 && track->index <= track[-1].index))
+	{
+	    fprintf(stderr, "%s: track %d has %s INDEX 01\n", filename,
+		track->number, track->indexed ? "an out of order" : "no");
+	    goto exit;
+	}
+    }
+    rval = 0;
+
+exit:
+    free(dir);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Read a disc record in xmcd format, as saved by cdinfo.py, and take
+ * the disc and track names from it:
+ *
+ *	DTITLE=Artist / Album
+ *	DYEAR=1996
+ *	DGENRE=Rock
+ *	TTITLE0=First track
+ *
+ * A key may be repeated to continue a long value. Track titles of
+ * the form "Artist / Title" are split, for compilations.
+ * @return 0 on success, else an exit code, with a message printed
+ */
+static int
+readRecord(const char *filename, Sheet *sheet)
+{
+    FILE *ifile;
+    char buffer[1024], *value, *p;
+    char *dtitle = NULL, **dst;
+    char last[sizeof(buffer)] = "";
+    Track *track;
+    int i, n, rval = 3;
+    bool append;
+
+    if ((ifile = fopen(filename, "r")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+	return 4;
+    }
+    while (fgets(buffer, sizeof(buffer), ifile) != NULL) {
+	buffer[strcspn(buffer, "\r\n")] = '\0';
+	if (buffer[0] == '#' || (value = strchr(buffer, '=')) == NULL) {
+	    continue;
+	}
+	*value++ = '\0';
+	append = strcmp(buffer, last) == 0;
+	strcpy(last, buffer);
+	dst = NULL;
+	if (strcmp(buffer, "DTITLE") == 0) {
+	    dst = &dtitle;
+	} else if (strcmp(buffer, "DYEAR") == 0) {
+	    dst = &sheet->date;
+	} else if (strcmp(buffer, "DGENRE") == 0) {
+	    dst = &sheet->genre;
+	} else if (sscanf(buffer, "TTITLE%d", &n) == 1 && n >= 0 &&
+		   n < sheet->ntracks)
+	{
+	    dst = &sheet->tracks[n].title;
+	}
+	if (dst != NULL && value[0] != '\0' &&
+	    setString(dst, value, append) != 0)
+	{
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+    }
+
+    /* "Artist / Album", or just the album */
+    if (dtitle != NULL) {
+	if ((p = strstr(dtitle, " / ")) != NULL) {
+	    *p = '\0';
+	    if (setString(&sheet->performer, dtitle, false) != 0 ||
+		setString(&sheet->title, p + 3, false) != 0)
+	    {
+		fprintf(stderr, "Out of memory\n");
+		goto exit;
+	    }
+	} else if (setString(&sheet->title, dtitle, false) != 0) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+    }
+    for (i=0; i < sheet->ntracks; ++i) {
+	track = &sheet->tracks[i];
+	if (track->title != NULL && (p = strstr(track->title, " / ")) != NULL) {
+	    *p = '\0';
+	    if (setString(&track->performer, track->title, false) != 0) {
+		fprintf(stderr, "Out of memory\n");
+		goto exit;
+	    }
+	    memmove(track->title, p + 3, strlen(p + 3) + 1);
+	}
+    }
+    rval = 0;
+
+exit:
+    free(dtitle);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Work out the tracks of an image and queue them to be written.
+ * @return 0 on success, else an exit code, with a message printed
+ */
+static int
+splitImage(const char *sheetname, Sheet *sheet)
+{
+    FILE *ifile;
+    WaveChunk *waveFile;
+    FmtChunk *fmt;
+    ListChunk *info = NULL;
+    Chunk *id3 = NULL;
+    SplitOutput *out;
+    Track *track;
+    struct stat ist, ost;
+    char *prefix = NULL, *filename = NULL, number[16];
+    uint32_t frames, start, end;
+    size_t len;
+    int i, rval = 4;
+
+    if ((ifile = fopen(sheet->file, "rb")) == NULL) {
+	fprintf(stderr, "%s: cannot open %s: %s\n", sheetname, sheet->file,
+	    strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", sheet->file, WaveError);
+	goto exit;
+    }
+    if (SplitFrames(waveFile, &frames) != 0) {
+	fprintf(stderr, "%s: %s\n", sheet->file, SplitError);
+	goto exit;
+    }
+    fmt = (FmtChunk *)FindChunk(waveFile->children, "fmt ", NULL);
+    fstat(fileno(ifile), &ist);
+    if (nOutputs + sheet->ntracks > maxOutputs) {
+	maxOutputs = (nOutputs + sheet->ntracks) * 2;
+	if ((out = realloc(outputs, maxOutputs * sizeof(SplitOutput))) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    rval = 3;
+	    goto exit;
+	}
+	outputs = out;
+    }
+    if ((prefix = replaceExt(sheet->file, ".wav", "-")) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	rval = 3;
+	goto exit;
+    }
+    if (listOnly || verbose) {
+	printf("%s: %s%s%s\n", sheet->file,
+	    sheet->performer != NULL ? sheet->performer : "",
+	    sheet->performer != NULL ? " / " : "",
+	    sheet->title != NULL ? sheet->title : "");
+    }
+
+    for (i=0; i < sheet->ntracks; ++i) {
+	track = &sheet->tracks[i];
+	/* MM:SS:FF to sample frames */
+	start = (uint64_t)track->index * fmt->sample_rate / CD_FRAMES;
+	end = i + 1 < sheet->ntracks ?
+	    (uint64_t)track[1].index * fmt->sample_rate / CD_FRAMES : frames;
+	if (end > frames || start >= end) {
+	    fprintf(stderr, "%s: track %d is past the end of %s\n", sheetname,
+		track->number, sheet->file);
+	    goto exit;
+	}
+
+	snprintf(number, sizeof(number), "%d", track->number);
+	len = strlen(prefix) + strlen(number) + 8;
+	if ((filename = malloc(len)) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    rval = 3;
+	    goto exit;
+	}
+	snprintf(filename, len, "%s%s%s.wav", prefix,
+	    strlen(number) < 2 ? "0" : "", number);
+	if (stat(filename, &ost) == 0 &&
+	    ost.st_dev == ist.st_dev && ost.st_ino == ist.st_ino)
+	{
+	    fprintf(stderr, "%s would overwrite %s\n", filename, sheet->file);
+	    rval = 2;
+	    goto exit;
+	}
+	if (listOnly || verbose) {
+	    printf("  %s: %u-%u (%.3f-%.3fs) %s\n", filename, start, end - 1,
+		(double)start / fmt->sample_rate, (double)end / fmt->sample_rate,
+		track->title != NULL ? track->title : "");
+	}
+	if (listOnly) {
+	    free(filename);
+	    filename = NULL;
+	    continue;
+	}
+
+	/* The tags, from the record or the sheet */
+	if ((info = SplitCopyInfo(waveFile)) == NULL ||
+	    SplitSetInfo(info, "ITRK", number) != 0 ||
+	    (track->title != NULL &&
+	     SplitSetInfo(info, "INAM", track->title) != 0) ||
+	    ((track->performer != NULL || sheet->performer != NULL) &&
+	     SplitSetInfo(info, "IART", track->performer != NULL ?
+		track->performer : sheet->performer) != 0) ||
+	    (sheet->title != NULL &&
+	     SplitSetInfo(info, "IPRD", sheet->title) != 0) ||
+	    (sheet->date != NULL && SplitSetInfo(info, "ICRD", sheet->date) != 0) ||
+	    (sheet->genre != NULL && SplitSetInfo(info, "IGNR", sheet->genre) != 0))
+	{
+	    fprintf(stderr, "Out of memory\n");
+	    rval = 3;
+	    goto exit;
+	}
+	if (!noId3) {
+	    if ((id3 = SplitId3(info)) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		rval = 3;
+		goto exit;
+	    }
+	    info->header.next = id3;
+	}
+	out = &outputs[nOutputs];
+	memset(out, 0, sizeof(*out));
+	if ((out->wave = SplitWave(waveFile, start, end, &info->header)) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    rval = 3;
+	    goto exit;
+	}
+	out->source = sheet->file;
+	out->filename = filename;
+	++nOutputs;
+	filename = NULL;
+	info = NULL;
+	id3 = NULL;
+    }
+    rval = 0;
+
+exit:
+    if (info != NULL) {
+	info->header.next = NULL;
+	FreeChunk(&info->header);
+    }
+    FreeChunk(id3);
+    free(filename);
+    free(prefix);
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Free what readSheet() and readRecord() allocated
+ */
+static void
+freeSheet(Sheet *sheet)
+{
+    int i;
+
+    for (i=0; i < sheet->ntracks; ++i) {
+	free(sheet->tracks[i].title);
+	free(sheet->tracks[i].performer);
+    }
+    free(sheet->tracks);
+    free(sheet->file);
+    free(sheet->title);
+    free(sheet->performer);
+    free(sheet->date);
+    free(sheet->genre);
+}
+
+/**
+ * Return the next field of a line, a word or a quoted string, and
+ * step past it. The line is modified.
+ * @return the field, or NULL at the end of the line
+ */
+static char *
+getField(char **line)
+{
+    char *p = *line, *field;
+
+    while (isspace((unsigned char)*p)) {
+	++p;
+    }
+    if (*p == '\0') {
+	return NULL;
+    }
+    if (*p == '"') {
+	field = ++p;
+	while (*p != '\0' && *p != '"') {
+	    ++p;
+	}
+    } else {
+	field = p;
+	while (*p != '\0' && !isspace((unsigned char)*p)) {
+	    ++p;
+	}
+    }
+    if (*p != '\0') {
+	*p++ = '\0';
+    }
+    *line = p;
+    return field;
+}
+
+/**
+ * The directory part of a path, with a trailing '/', or "" for
+ * the current directory.
+ * @return malloc'd string, or NULL if out of memory
+ */
+static char *
+dirName(const char *filename)
+{
+    const char *slash = strrchr(filename, '/');
+    size_t len = slash != NULL ? slash - filename + 1 : 0;
+    char *dir;
+
+    if ((dir = malloc(len + 1)) != NULL) {
+	memcpy(dir, filename, len);
+	dir[len] = '\0';
+    }
+    return dir;
+}
+
+/**
+ * Replace a file name extension, or append to the name if it
+ * does not have that extension.
+ * @return malloc'd string, or NULL if out of memory
+ */
+static char *
+replaceExt(const char *filename, const char *ext, const char *new)
+{
+    size_t len = strlen(filename), elen = strlen(ext);
+    char *rval;
+
+    if (len > elen && strcasecmp(filename + len - elen, ext) == 0) {
+	len -= elen;
+    }
+    if ((rval = malloc(len + strlen(new) + 1)) != NULL) {
+	memcpy(rval, filename, len);
+	strcpy(rval + len, new);
+    }
+    return rval;
+}
+
+/**
+ * Set a string, or append to it.
+ * @return 0 on success, -1 if out of memory
+ */
+static int
+setString(char **dst, const char *value, bool append)
+{
+    size_t len = append && *dst != NULL ? strlen(*dst) : 0;
+    char *s;
+
+    if ((s = malloc(len + strlen(value) + 1)) == NULL) {
+	return -1;
+    }
+    if (len > 0) {
+	memcpy(s, *dst, len);
+    }
+    strcpy(s + len, value);
+    free(*dst);
+    *dst = s;
+    return 0;
+}
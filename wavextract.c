@@ -0,0 +1,239 @@
+static const char usage[] = "usage:\n"
+"	wavextract [options] infile outfile\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-s	--start time	Start of the excerpt (0)\n"
+"	-e	--end time	End of the excerpt, not included (end of file)\n"
+"	-d	--duration time	Length of the excerpt, instead of --end\n"
+"\n"
+"Copies part of a .wav file to a new file. A time is a # of samples\n"
+"(sample frames), seconds with a decimal point or a trailing 's', or\n"
+"a timecode [hh:]mm:ss[.fff]:\n"
+"\n"
+"	wavextract -s 1:02:30 -d 10s in.wav excerpt.wav\n"
+"	wavextract -s 44100 -e 88200 in.wav second2.wav\n"
+"\n"
+"Only the excerpt is read: the samples are copied as they are with a\n"
+"file range copy, which some file systems can do by sharing blocks.\n"
+"Tags and other chunks are kept. Cue points in the excerpt, and\n"
+"regions that overlap it, are kept with their labels and moved to\n"
+"their place in the excerpt; regions are cut to fit.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "libwav.h"
+#include "libsplit.h"
+
+static int parseTime(const char *s, uint32_t rate, uint64_t *frames);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"start", required_argument, NULL, 's'},
+  {"end", required_argument, NULL, 'e'},
+  {"duration", required_argument, NULL, 'd'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static const char *startTime = NULL;
+static const char *endTime = NULL;
+static const char *duration = NULL;
+
+
+int
+main(int argc, char **argv)
+{
+    const char *ifilename, *ofilename;
+    FILE *ifile, *ofile = NULL;
+    WaveChunk *waveFile = NULL;
+    FmtChunk *fmt;
+    FactChunk *fact;
+    Chunk **dataPtr;
+    DataChunk *data;
+    struct stat ist, ost;
+    uint32_t frames;
+    uint64_t start = 0, end, length;
+    int c;
+    int rval = 4;
+
+    while ((c = getopt_long(argc, argv, "hvs:e:d:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 's': startTime = optarg; break;
+	case 'e': endTime = optarg; break;
+	case 'd': duration = optarg; break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (argc - optind != 2) {
+	fprintf(stderr, usage);
+	return 2;
+    }
+    if (endTime != NULL && duration != NULL) {
+	fprintf(stderr, "Give --end or --duration, not both\n");
+	return 2;
+    }
+    ifilename = argv[optind++];
+    ofilename = argv[optind++];
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if (stat(ofilename, &ost) == 0 && fstat(fileno(ifile), &ist) == 0 &&
+	ost.st_dev == ist.st_dev && ost.st_ino == ist.st_ino)
+    {
+	fprintf(stderr, "Input file and output file cannot be the same\n");
+	rval = 2;
+	goto exit;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	goto exit;
+    }
+    if (SplitFrames(waveFile, &frames) != 0) {
+	fprintf(stderr, "%s: %s\n", ifilename, SplitError);
+	goto exit;
+    }
+    fmt = (FmtChunk *)FindChunk(waveFile->children, "fmt ", NULL);
+
+    /* Work out the excerpt */
+    end = frames;
+    if ((startTime != NULL && parseTime(startTime, fmt->sample_rate, &start) != 0) ||
+	(endTime != NULL && parseTime(endTime, fmt->sample_rate, &end) != 0) ||
+	(duration != NULL && parseTime(duration, fmt->sample_rate, &length) != 0))
+    {
+	rval = 2;
+	goto exit;
+    }
+    if (duration != NULL) {
+	end = start + length;
+    }
+    if (end > frames) {
+	end = frames;
+    }
+    if (start >= end) {
+	fprintf(stderr, "%s: the excerpt is empty; the file has %" PRIu32
+	    " frames\n", ifilename, frames);
+	rval = 2;
+	goto exit;
+    }
+    if (verbose) {
+	printf("%s: frames %" PRIu64 "-%" PRIu64 " (%.3f-%.3fs)\n", ifilename,
+	    start, end - 1, (double)start / fmt->sample_rate,
+	    (double)end / fmt->sample_rate);
+    }
+
+    /* The new data refers to the excerpt in the input */
+    if ((dataPtr = FindChunkPtr(&waveFile->children, "data", NULL)) == NULL) {
+	fprintf(stderr, "%s: data chunk must be at the top level\n", ifilename);
+	goto exit;
+    }
+    data = newDataChunk("data", (end - start) * fmt->block_align,
+		(*dataPtr)->offset + start * fmt->block_align);
+    if (data == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	rval = 3;
+	goto exit;
+    }
+    FreeChunk(ReplaceChunk(&waveFile->children, &data->header));
+    if ((fact = (FactChunk *)FindChunk(waveFile->children, "fact", NULL)) != NULL) {
+	fact->n = end - start;
+    }
+    if (RebaseMarkers(waveFile, start, end) != 0) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	rval = 3;
+	goto exit;
+    }
+
+    rval = 3;
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+    if (WriteWaveFile(waveFile, ifile, ofile) != 0) {
+	fprintf(stderr, "%s: %s\n", ofilename, WaveError);
+	goto exit;
+    }
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    rval = 0;
+
+exit:
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Parse a time: frames, seconds, or [hh:]mm:ss[.fff]
+ * @return 0 on success, else -1 with a message printed
+ */
+static int
+parseTime(const char *s, uint32_t rate, uint64_t *frames)
+{
+    double parts[3], seconds = 0;
+    char *end;
+    int i, n = 0;
+
+    if (strchr(s, ':') == NULL && strchr(s, '.') == NULL) {
+	*frames = strtoull(s, &end, 10);
+	if (end != s && *end == '\0' && s[0] != '-') {
+	    return 0;
+	}
+	if (end != s && strcmp(end, "s") == 0) {
+	    *frames = *frames * rate;
+	    return 0;
+	}
+	fprintf(stderr, "Bad time \"%s\"\n", s);
+	return -1;
+    }
+
+    for (;;) {
+	parts[n++] = strtod(s, &end);
+	if (end == s || parts[n-1] < 0) {
+	    break;
+	}
+	if (*end == ':' && n < 3) {
+	    s = end + 1;
+	    continue;
+	}
+	if (*end == 's' && n == 1) {
+	    ++end;
+	}
+	if (*end == '\0') {
+	    for (i=0; i < n; ++i) {
+		seconds = seconds * 60 + parts[i];
+	    }
+	    *frames = (uint64_t)llround(seconds * rate);
+	    return 0;
+	}
+	break;
+    }
+    fprintf(stderr, "Bad time \"%s\"\n", s);
+    return -1;
+}
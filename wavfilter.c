@@ -0,0 +1,333 @@
+static const char usage[] = "usage:\n"
+"	wavfilter -f filter [options] infile outfile\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-f	--filter spec	Add a filter stage; may be repeated\n"
+"	-d	--dither type	Dither for integer output: none, rect, tpdf (tpdf)\n"
+"\n"
+"Filter specs, frequencies in Hz and gains in dB:\n"
+"\n"
+"	dc[:freq]		DC blocker (5 Hz)\n"
+"	hp:freq[:q]		High-pass, 12 dB/octave (q 0.7071)\n"
+"	lp:freq[:q]		Low-pass, 12 dB/octave (q 0.7071)\n"
+"	lowshelf:freq:gain[:q]	Low shelf (q 0.7071)\n"
+"	highshelf:freq:gain[:q]	High shelf (q 0.7071)\n"
+"	peak:freq:gain[:q]	Peaking EQ (q 1)\n"
+"	notch:freq[:q]		Notch (q 10)\n"
+"\n"
+"Runs every channel of a .wav file through a cascade of biquad filters,\n"
+"in the order given, in a single streaming pass. The sample format is\n"
+"unchanged. All chunks other than the audio data, including tags, are\n"
+"copied unchanged. Samples that clip are counted and reported.\n"
+"\n"
+"Example: remove DC and rumble from dialog:\n"
+"\n"
+"	wavfilter -f dc -f hp:80 in.wav out.wav\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libdither.h"
+#include "libbiquad.h"
+
+#define	BLOCK_FRAMES	8192
+#define	MAX_STAGES	32
+
+/**
+ * A filter as given on the command line; it can only be designed
+ * once the sample rate is known.
+ */
+typedef struct stage {
+  BiquadType type;
+  double freq, q, gain;
+} Stage;
+
+/**
+ * State for the data source that produces the filtered samples
+ */
+typedef struct filter {
+  PcmStream *stream;
+  FilterBank *bank;
+  Ditherer *dither;	/* NULL if float or 32 bits */
+  float *buffer;
+  bool clip;		/* Output is an integer format */
+  uint64_t clipped;	/* # of samples out of range */
+} Filter;
+
+static int parseStage(const char *spec, Stage *);
+static int filterFile(const char *ifilename, const char *ofilename);
+static long filterSource(void *ctx, void *buffer, size_t len);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"filter", required_argument, NULL, 'f'},
+  {"dither", required_argument, NULL, 'd'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static Stage stages[MAX_STAGES];
+static int nStages = 0;
+static DitherType ditherType = DITHER_TPDF;
+
+
+int
+main(int argc, char **argv)
+{
+    int c, v;
+
+    while ((c = getopt_long(argc, argv, "hvf:d:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'f':
+	  if (nStages >= MAX_STAGES) {
+	      fprintf(stderr, "At most %d filters may be given\n", MAX_STAGES);
+	      return 2;
+	  }
+	  if (parseStage(optarg, &stages[nStages++]) != 0) {
+	      return 2;
+	  }
+	  break;
+	case 'd':
+	  if ((v = DitherTypeFromName(optarg)) < 0) {
+	      fprintf(stderr, "Unknown dither type \"%s\"\n", optarg);
+	      return 2;
+	  }
+	  ditherType = v;
+	  break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (nStages == 0) {
+	fprintf(stderr, "Specify at least one filter with -f\n");
+	return 2;
+    }
+    if (argc - optind != 2) {
+	fprintf(stderr, "Specify an input file and an output file\n");
+	return 2;
+    }
+    if (strcmp(argv[optind], argv[optind+1]) == 0) {
+	fprintf(stderr,
+	    "Input file and output file cannot have the same name\n");
+	return 3;
+    }
+
+    return filterFile(argv[optind], argv[optind+1]);
+}
+
+/**
+ * Parse "type[:value...]". The values are freq, then gain for the
+ * shelves and peaks, then q.
+ * @return 0 on success, -1 on error, with a message printed
+ */
+static int
+parseStage(const char *spec, Stage *st)
+{
+    char name[16];
+    double v[3];
+    const char *p;
+    char *end;
+    int n = 0, t, need, max;
+    size_t len = strcspn(spec, ":");
+
+    if (len < sizeof(name)) {
+	memcpy(name, spec, len);
+	name[len] = '\0';
+    }
+    if (len >= sizeof(name) || (t = BiquadTypeFromName(name)) < 0) {
+	fprintf(stderr, "Unknown filter type in \"%s\"\n", spec);
+	return -1;
+    }
+    for (p = spec + len; *p == ':' && n < 3; p = end) {
+	v[n++] = strtod(p + 1, &end);
+	if (end == p + 1) break;
+    }
+    if (*p != '\0') {
+	fprintf(stderr, "Bad filter parameters in \"%s\"\n", spec);
+	return -1;
+    }
+
+    st->type = t;
+    st->q = 0.7071;
+    st->gain = 0;
+    switch (t) {
+      case BIQUAD_DC: need = 0; max = 1; break;
+      case BIQUAD_LOWSHELF: case BIQUAD_HIGHSHELF: need = 2; max = 3; break;
+      case BIQUAD_PEAK: need = 2; max = 3; st->q = 1; break;
+      case BIQUAD_NOTCH: need = 1; max = 2; st->q = 10; break;
+      default: need = 1; max = 2; break;
+    }
+    if (n < need || n > max) {
+	fprintf(stderr, "Wrong number of filter parameters in \"%s\"\n", spec);
+	return -1;
+    }
+    st->freq = n > 0 ? v[0] : 5;
+    if (need == 2) {
+	st->gain = v[1];
+	if (n > 2) st->q = v[2];
+    } else if (n > 1) {
+	st->q = v[1];
+    }
+    return 0;
+}
+
+static int
+filterFile(const char *ifilename, const char *ofilename)
+{
+    FILE *ifile, *ofile = NULL;
+    WaveChunk *waveFile;
+    const FmtChunk *fmt;
+    DataChunk *odata;
+    BiquadCoefs coefs[MAX_STAGES];
+    Filter filt;
+    int i, rval = 3;
+
+    memset(&filt, 0, sizeof(filt));
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	rval = 4;
+	goto exit;
+    }
+    if ((filt.stream = OpenPcmStream(ifile, waveFile)) == NULL ||
+	!PcmSupported(filt.stream->fmt))
+    {
+	fprintf(stderr, "%s: %s\n", ifilename,
+	    filt.stream == NULL ? PcmError : "Unsupported sample format");
+	rval = 4;
+	goto exit;
+    }
+    if (FindChunkPtr(&waveFile->children, "data", NULL) == NULL) {
+	fprintf(stderr, "%s: data chunk must be at the top level\n", ifilename);
+	rval = 4;
+	goto exit;
+    }
+    fmt = filt.stream->fmt;
+
+    for (i=0; i < nStages; ++i) {
+	if (BiquadDesign(&coefs[i], stages[i].type, fmt->sample_rate,
+		stages[i].freq, stages[i].q, stages[i].gain) != 0)
+	{
+	    fprintf(stderr, "Filter %d: %s\n", i + 1, BiquadError);
+	    rval = 2;
+	    goto exit;
+	}
+	if (verbose > 1) {
+	    printf("  stage %d: b = %.9g %.9g %.9g, a = 1 %.9g %.9g\n", i + 1,
+		coefs[i].b0, coefs[i].b1, coefs[i].b2, coefs[i].a1, coefs[i].a2);
+	}
+    }
+    if ((filt.bank = NewFilterBank(fmt->channels, coefs, nStages)) == NULL ||
+	(filt.buffer = malloc(BLOCK_FRAMES * fmt->channels * sizeof(float))) == NULL)
+    {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    filt.clip = FmtType(fmt) != RIFF_IEEE_FLOAT;
+    /* Filtered samples have more precision than the input's word */
+    if (FmtType(fmt) == RIFF_PCM && fmt->bits_samp <= 24) {
+	filt.dither = NewDitherer(fmt->channels, fmt->bits_samp,
+		ditherType, SHAPE_NONE, 0);
+	if (filt.dither == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+    }
+
+    odata = newDataChunk("data", filt.stream->frames * fmt->block_align, 0);
+    if (odata == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    odata->source = filterSource;
+    odata->source_ctx = &filt;
+    FreeChunk(ReplaceChunk(&waveFile->children, (Chunk *)odata));
+
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+    if (WriteWaveFile(waveFile, ifile, ofile) != 0) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	goto exit;
+    }
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    if (verbose) {
+	printf("%s: %" PRIu32 " frames through %d filters\n",
+	    ifilename, filt.stream->frames, nStages);
+    }
+    if (filt.clipped > 0) {
+	fprintf(stderr, "%s: %" PRIu64 " samples clipped\n",
+	    ofilename, filt.clipped);
+    }
+    rval = 0;
+
+exit:
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    free(filt.buffer);
+    FreeDitherer(filt.dither);
+    FreeFilterBank(filt.bank);
+    ClosePcmStream(filt.stream);
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Data source: read, filter and re-encode a block of frames.
+ */
+static long
+filterSource(void *ctx, void *buffer, size_t len)
+{
+    Filter *filt = ctx;
+    const FmtChunk *fmt = filt->stream->fmt;
+    size_t frames = len / fmt->block_align;
+    size_t i, n;
+
+    if (frames > BLOCK_FRAMES) {
+	frames = BLOCK_FRAMES;
+    }
+    if ((frames = ReadPcmFloat(filt->stream, filt->buffer, frames)) == 0) {
+	return -1;
+    }
+    FilterFrames(filt->bank, filt->buffer, frames);
+    if (filt->clip) {
+	n = frames * fmt->channels;
+	for (i=0; i < n; ++i) {
+	    if (fabsf(filt->buffer[i]) > 1.0f) ++filt->clipped;
+	}
+    }
+    if (filt->dither != NULL) {
+	DitherFrames(filt->dither, filt->buffer, buffer, frames);
+    } else {
+	PcmEncode(fmt, filt->buffer, buffer, frames);
+    }
+    return frames * fmt->block_align;
+}
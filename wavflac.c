@@ -0,0 +1,717 @@
+static const char usage[] = "usage:\n"
+"	wavflac [options] infile outfile\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-n	--no-riff	Don't keep the .wav file's chunks\n"
+"	-j	--threads N	Max threads for encoding (# of CPUs)\n"
+"\n"
+"A .wav file is encoded to FLAC, and a FLAC file is decoded to .wav.\n"
+"The samples must be integer PCM of up to 24 bits.\n"
+"\n"
+"The LIST/INFO tags become Vorbis comments. Unless -n is given, the RIFF\n"
+"header and every chunk other than the audio, including ID3 tags, are\n"
+"also stored unchanged in APPLICATION \"riff\" blocks, and decoding uses\n"
+"them to restore the original .wav file byte for byte. Without them, or\n"
+"with -n when decoding, the .wav file is built from the stream info and\n"
+"the Vorbis comments.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libflac.h"
+
+#define	BLOCK_FRAMES	8192	/* Frames read at a time */
+
+/**
+ * The INFO tags that libwav reads as text, and the Vorbis comments
+ * they become. Tags with no usual comment name keep their own.
+ */
+static const struct {
+  char tag[5];
+  const char *name;
+} infoNames[] = {
+  {"IARL", "IARL"},
+  {"IART", "ARTIST"},
+  {"ICMS", "ICMS"},
+  {"ICMT", "COMMENT"},
+  {"ICOP", "COPYRIGHT"},
+  {"ICRD", "DATE"},
+  {"ICRP", "ICRP"},
+  {"IDIM", "IDIM"},
+  {"IDPI", "IDPI"},
+  {"IENG", "ENGINEER"},
+  {"IGNR", "GENRE"},
+  {"IKEY", "KEYWORDS"},
+  {"ILGT", "ILGT"},
+  {"IMED", "IMED"},
+  {"INAM", "TITLE"},
+  {"IPLT", "IPLT"},
+  {"IPRD", "ALBUM"},
+  {"ISBJ", "SUBJECT"},
+  {"ISFT", "ENCODER"},
+  {"ISHP", "ISHP"},
+  {"ISRC", "SOURCE"},
+  {"ISRF", "ISRF"},
+  {"ITCH", "TECHNICIAN"},
+  {"ITRK", "TRACKNUMBER"},
+};
+
+#define	N_INFO	(sizeof(infoNames)/sizeof(infoNames[0]))
+
+/**
+ * State for the data source that produces decoded samples
+ */
+typedef struct decode {
+  FlacDecoder *dec;
+  int size;		/* Bytes per sample in the .wav file */
+  int shift;		/* Bits to shift samples up to fill size */
+  int32_t *buf;
+  bool failed;
+} Decode;
+
+static int encodeFile(const char *ifilename, const char *ofilename);
+static int addComments(FlacEncoder *, WaveChunk *);
+static int addRiffBlocks(FlacEncoder *, FILE *, WaveChunk *, PcmStream *);
+static int decodeFile(const char *ifilename, const char *ofilename);
+static int writeRiff(Decode *, FILE *ofile, const char *ifilename);
+static int writeWave(Decode *, FILE *ofile, const char *ifilename);
+static long decodeSource(void *ctx, void *buffer, size_t len);
+static void unpack(const uint8_t *in, int32_t *out, size_t n, int size);
+static void pack(const int32_t *in, uint8_t *out, size_t n, int size, int shift);
+static char *toUtf8(const char *s, size_t len);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"no-riff", no_argument, NULL, 'n'},
+  {"threads", required_argument, NULL, 'j'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static bool keepRiff = true;
+static int nThreads = 0;
+
+
+int
+main(int argc, char **argv)
+{
+    FILE *ifile;
+    char magic[4];
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hvnj:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'n': keepRiff = false; break;
+	case 'j': nThreads = atoi(optarg); break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (nThreads <= 0) {
+	nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (argc - optind != 2) {
+	fprintf(stderr, "Specify an input file and an output file\n");
+	return 2;
+    }
+    if (strcmp(argv[optind], argv[optind+1]) == 0) {
+	fprintf(stderr,
+	    "Input file and output file cannot have the same name\n");
+	return 3;
+    }
+
+    if ((ifile = fopen(argv[optind], "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", argv[optind], strerror(errno));
+	return 4;
+    }
+    c = fread(magic, 1, sizeof(magic), ifile);
+    fclose(ifile);
+    if (c == 4 && memcmp(magic, "RIFF", 4) == 0) {
+	return encodeFile(argv[optind], argv[optind+1]);
+    }
+    if (c == 4 && (memcmp(magic, "fLaC", 4) == 0 || memcmp(magic, "ID3", 3) == 0)) {
+	return decodeFile(argv[optind], argv[optind+1]);
+    }
+    fprintf(stderr, "%s: not a .wav or FLAC file\n", argv[optind]);
+    return 4;
+}
+
+static int
+encodeFile(const char *ifilename, const char *ofilename)
+{
+    FILE *ifile, *ofile = NULL;
+    WaveChunk *waveFile = NULL;
+    PcmStream *stream = NULL;
+    FlacEncoder *enc = NULL;
+    uint8_t *raw = NULL;
+    int32_t *samples = NULL;
+    uint32_t total = 0;
+    size_t n;
+    int nc, size;
+    int rval = 3;
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	rval = 4;
+	goto exit;
+    }
+    if ((stream = OpenPcmStream(ifile, waveFile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, PcmError);
+	rval = 4;
+	goto exit;
+    }
+    nc = stream->fmt->channels;
+    size = nc > 0 ? stream->fmt->block_align / nc : 0;
+    if (FmtType(stream->fmt) != RIFF_PCM || size < 1 || size > 3 ||
+	size * nc != stream->fmt->block_align)
+    {
+	fprintf(stderr, "%s: only 8, 16 and 24 bit PCM can be stored as FLAC\n",
+	    ifilename);
+	rval = 4;
+	goto exit;
+    }
+
+    raw = malloc(BLOCK_FRAMES * stream->fmt->block_align);
+    samples = malloc(BLOCK_FRAMES * nc * sizeof(int32_t));
+    if (raw == NULL || samples == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+    enc = NewFlacEncoder(ofile, nc, stream->fmt->sample_rate, size * 8,
+	stream->frames, nThreads);
+    if (enc == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, FlacError);
+	rval = 4;
+	goto exit;
+    }
+    if ((rval = addComments(enc, waveFile)) != 0) {
+	goto exit;
+    }
+    if (keepRiff && (rval = addRiffBlocks(enc, ifile, waveFile, stream)) != 0) {
+	goto exit;
+    }
+    rval = 3;
+
+    while ((n = ReadPcmFrames(stream, raw, BLOCK_FRAMES)) > 0) {
+	unpack(raw, samples, n * nc, size);
+	if (FlacEncode(enc, samples, n) != 0) {
+	    fprintf(stderr, "%s: %s\n", ofilename, FlacError);
+	    goto exit;
+	}
+	total += n;
+    }
+    if (total != stream->frames) {
+	fprintf(stderr, "%s: short file\n", ifilename);
+	rval = 4;
+	goto exit;
+    }
+    if (FlacFinish(enc) != 0) {
+	fprintf(stderr, "%s: %s\n", ofilename, FlacError);
+	goto exit;
+    }
+    if (verbose) {
+	long flen = ftell(ofile);
+	printf("%s: %" PRIu32 " frames, %" PRIu32 " bytes of audio, %ld bytes of FLAC\n",
+	    ifilename, total, total * stream->fmt->block_align, flen);
+    }
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    rval = 0;
+
+exit:
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    FreeFlacEncoder(enc);
+    free(raw);
+    free(samples);
+    ClosePcmStream(stream);
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Copy the INFO tags to Vorbis comments
+ * @return 0 on success, else exit code
+ */
+static int
+addComments(FlacEncoder *enc, WaveChunk *waveFile)
+{
+    ListChunk *info;
+    Chunk *child;
+    char *value;
+    size_t i, len;
+    int rval;
+
+    info = (ListChunk *)FindChunk(waveFile->children, "LIST", "INFO");
+    if (info == NULL) {
+	return 0;
+    }
+    for (child = info->children; child != NULL; child = child->next) {
+	for (i=0; i < N_INFO; ++i) {
+	    if (strncmp(child->identifier, infoNames[i].tag, 4) == 0) break;
+	}
+	if (i == N_INFO ||
+	    (len = strnlen(((TextChunk *)child)->string, child->length)) == 0)
+	{
+	    continue;
+	}
+	if ((value = toUtf8(((TextChunk *)child)->string, len)) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    return 3;
+	}
+	rval = FlacAddComment(enc, infoNames[i].name, value);
+	free(value);
+	if (rval != 0) {
+	    fprintf(stderr, "%s\n", FlacError);
+	    return 3;
+	}
+    }
+    return 0;
+}
+
+/**
+ * Store the RIFF header and each top-level chunk as it is in the
+ * file, except that the audio chunk is only its 8 byte header.
+ * @return 0 on success, else exit code
+ */
+static int
+addRiffBlocks(FlacEncoder *enc, FILE *ifile, WaveChunk *waveFile,
+	PcmStream *stream)
+{
+    Chunk *chunk;
+    uint8_t hdr[12], *buf = NULL;
+    uint32_t len, need;
+    bool audio = false;
+    int rval = 3;
+
+    if (fseek(ifile, 0, SEEK_SET) != 0 ||
+	fread(hdr, 1, sizeof(hdr), ifile) != sizeof(hdr))
+    {
+	fprintf(stderr, "Short file\n");
+	return 4;
+    }
+    if (FlacAddApplication(enc, "riff", hdr, sizeof(hdr)) != 0) {
+	fprintf(stderr, "%s\n", FlacError);
+	return 3;
+    }
+    for (chunk = waveFile->children; chunk != NULL; chunk = chunk->next) {
+	if (!audio && strncmp(chunk->identifier, "data", 4) == 0 &&
+	    (off_t)chunk->offset + 8 == stream->start)
+	{
+	    if (chunk->length != stream->length ||
+		stream->length != stream->frames * stream->fmt->block_align)
+	    {
+		fprintf(stderr,
+		    "data chunk is not a whole number of frames, use -n\n");
+		return 4;
+	    }
+	    audio = true;
+	    len = need = 8;
+	} else {
+	    /* Keep the pad byte after an odd length chunk */
+	    need = chunk->length + 8;
+	    len = need + (chunk->length & 1);
+	}
+	if ((buf = malloc(len)) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    return 3;
+	}
+	/* A pad byte missing at the end of the file is tolerated */
+	buf[len-1] = 0;
+	if (fseek(ifile, chunk->offset, SEEK_SET) != 0 ||
+	    fread(buf, 1, len, ifile) < need)
+	{
+	    fprintf(stderr, "Short file\n");
+	    rval = 4;
+	    goto exit;
+	}
+	if (FlacAddApplication(enc, "riff", buf, len) != 0) {
+	    fprintf(stderr, "%.4s chunk: %s, use -n\n", chunk->identifier,
+		FlacError);
+	    rval = 4;
+	    goto exit;
+	}
+	free(buf);
+	buf = NULL;
+    }
+    if (!audio) {
+	fprintf(stderr, "data chunk must be at the top level, use -n\n");
+	return 4;
+    }
+    rval = 0;
+
+exit:
+    free(buf);
+    return rval;
+}
+
+static int
+decodeFile(const char *ifilename, const char *ofilename)
+{
+    FILE *ifile, *ofile = NULL;
+    Decode dc;
+    FlacApp *app;
+    int rval = 3;
+
+    memset(&dc, 0, sizeof(dc));
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((dc.dec = OpenFlacDecoder(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, FlacError);
+	rval = 4;
+	goto exit;
+    }
+    dc.size = (dc.dec->bits + 7) / 8;
+    dc.shift = dc.size * 8 - dc.dec->bits;
+    if ((dc.buf = malloc(BLOCK_FRAMES * dc.dec->channels * sizeof(int32_t))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+
+    for (app = dc.dec->apps; app != NULL; app = app->next) {
+	if (memcmp(app->id, "riff", 4) == 0) break;
+    }
+    if (keepRiff && app != NULL) {
+	rval = writeRiff(&dc, ofile, ifilename);
+    } else {
+	rval = writeWave(&dc, ofile, ifilename);
+    }
+    if (rval != 0) {
+	goto exit;
+    }
+    rval = 3;
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    if (verbose) {
+	printf("%s: %" PRIu64 " frames, %d channels, %d bits\n", ifilename,
+	    dc.dec->frames, dc.dec->channels, dc.dec->bits);
+    }
+    rval = 0;
+
+exit:
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    free(dc.buf);
+    CloseFlacDecoder(dc.dec);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Write the stored RIFF header and chunks, with the decoded samples
+ * after the data chunk header.
+ * @return 0 on success, else exit code
+ */
+static int
+writeRiff(Decode *dc, FILE *ofile, const char *ifilename)
+{
+    const uint32_t align = dc->dec->channels * dc->size;
+    uint8_t buffer[BLOCK_FRAMES * 8 * 3];
+    FlacApp *app;
+    const uint8_t *p;
+    uint32_t length;
+    int nhdr = 0, ndata = 0;
+    long n;
+
+    /* Make sure the blocks describe this audio before writing anything */
+    for (app = dc->dec->apps; app != NULL; app = app->next) {
+	if (memcmp(app->id, "riff", 4) != 0) {
+	    continue;
+	}
+	p = app->data;
+	if (nhdr++ == 0) {
+	    if (app->length != 12 || memcmp(p, "RIFF", 4) != 0) break;
+	} else if (app->length == 8 && memcmp(p, "data", 4) == 0) {
+	    length = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+	    if (length != dc->dec->frames * align) break;
+	    ++ndata;
+	}
+    }
+    if (app != NULL || ndata != 1) {
+	fprintf(stderr, "%s: riff blocks do not match the audio, use -n\n",
+	    ifilename);
+	return 4;
+    }
+
+    for (app = dc->dec->apps; app != NULL; app = app->next) {
+	if (memcmp(app->id, "riff", 4) != 0) {
+	    continue;
+	}
+	fwrite(app->data, 1, app->length, ofile);
+	if (app->length != 8 || memcmp(app->data, "data", 4) != 0) {
+	    continue;
+	}
+	while ((n = FlacDecode(dc->dec, dc->buf, BLOCK_FRAMES)) > 0) {
+	    pack(dc->buf, buffer, n * dc->dec->channels, dc->size, dc->shift);
+	    fwrite(buffer, 1, n * align, ofile);
+	}
+	if (n < 0) {
+	    fprintf(stderr, "%s: %s\n", ifilename, FlacError);
+	    return 4;
+	}
+	if ((dc->dec->frames * align) & 1) {
+	    putc(0, ofile);
+	}
+    }
+    if (ferror(ofile)) {
+	fprintf(stderr, "Write failed: %s\n", strerror(errno));
+	return 3;
+    }
+    return 0;
+}
+
+/**
+ * Build a new .wav file with fmt, data and LIST/INFO chunks
+ * @return 0 on success, else exit code
+ */
+static int
+writeWave(Decode *dc, FILE *ofile, const char *ifilename)
+{
+    const FlacDecoder *dec = dc->dec;
+    const uint64_t length = dec->frames * dec->channels * dc->size;
+    WaveChunk *wave;
+    FmtChunk *fmt;
+    DataChunk *data;
+    ListChunk *info = NULL;
+    Chunk **tail;
+    TextChunk *text;
+    const char *value;
+    size_t i, l;
+    int c, rval = 3;
+
+    if (dec->frames == 0 || length > UINT32_MAX - 1024) {
+	fprintf(stderr, "%s: %s\n", ifilename, dec->frames == 0 ?
+	    "length is not known" : "too long for a .wav file");
+	return 4;
+    }
+
+    wave = (WaveChunk *)newChunk("RIFF", 4, 0, sizeof(*wave));
+    fmt = (FmtChunk *)newChunk("fmt ", 16, 0, sizeof(*fmt));
+    data = newDataChunk("data", length, 0);
+    if (wave == NULL || fmt == NULL || data == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	free(wave);
+	free(fmt);
+	free(data);
+	return 3;
+    }
+    memcpy(wave->type, "WAVE", 4);
+    fmt->type = RIFF_PCM;
+    fmt->channels = dec->channels;
+    fmt->sample_rate = dec->sample_rate;
+    fmt->block_align = dec->channels * dc->size;
+    fmt->bytes_sec = fmt->sample_rate * fmt->block_align;
+    fmt->bits_samp = dc->size * 8;
+    fmt->ext = NULL;
+    fmt->ext_len = 0;
+    data->source = decodeSource;
+    data->source_ctx = dc;
+    wave->children = &fmt->header;
+    fmt->header.next = &data->header;
+    tail = &data->header.next;
+
+    for (c=0; c < dec->ncomments; ++c) {
+	const char *comment = dec->comments[c];
+	if ((value = strchr(comment, '=')) == NULL || value[1] == '\0') {
+	    continue;
+	}
+	l = value - comment;
+	for (i=0; i < N_INFO; ++i) {
+	    if (strlen(infoNames[i].name) == l &&
+		strncasecmp(comment, infoNames[i].name, l) == 0)
+	    {
+		break;
+	    }
+	}
+	if (i == N_INFO) {
+	    continue;
+	}
+	if (info == NULL) {
+	    if ((info = (ListChunk *)newChunk("LIST", 4, 0, sizeof(*info))) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		goto exit;
+	    }
+	    memcpy(info->type, "INFO", 4);
+	    info->children = NULL;
+	    *tail = &info->header;
+	    tail = &info->children;
+	}
+	l = strlen(value + 1) + 1;
+	l += l%2;
+	if ((text = (TextChunk *)newChunk(infoNames[i].tag, l, 0, sizeof(Chunk) + l)) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+	strcpy(text->string, value + 1);
+	*tail = &text->header;
+	tail = &text->header.next;
+    }
+
+    if (WriteWaveFile(wave, NULL, ofile) != 0) {
+	fprintf(stderr, "%s: %s\n", ifilename,
+	    dc->failed ? FlacError : WaveError);
+	rval = dc->failed ? 4 : 3;
+	goto exit;
+    }
+    rval = 0;
+
+exit:
+    FreeWaveFile(wave);
+    return rval;
+}
+
+/**
+ * Data source: decode the next block of samples
+ */
+static long
+decodeSource(void *ctx, void *buffer, size_t len)
+{
+    Decode *dc = ctx;
+    const int nc = dc->dec->channels;
+    size_t frames = len / (nc * dc->size);
+    long n;
+
+    if (frames > BLOCK_FRAMES) {
+	frames = BLOCK_FRAMES;
+    }
+    if ((n = FlacDecode(dc->dec, dc->buf, frames)) <= 0) {
+	dc->failed = n < 0;
+	return -1;
+    }
+    pack(dc->buf, buffer, n * nc, dc->size, dc->shift);
+    return n * nc * dc->size;
+}
+
+/**
+ * Convert little-endian .wav samples to signed integers
+ */
+static void
+unpack(const uint8_t *in, int32_t *out, size_t n, int size)
+{
+    size_t i;
+
+    switch (size) {
+      case 1:
+	for (i=0; i < n; ++i) {
+	    out[i] = in[i] - 128;
+	}
+	break;
+      case 2:
+	for (i=0; i < n; ++i, in += 2) {
+	    out[i] = (int16_t)(in[0] | in[1] << 8);
+	}
+	break;
+      case 3:
+	for (i=0; i < n; ++i, in += 3) {
+	    out[i] = (int32_t)((uint32_t)in[0] << 8 | in[1] << 16 |
+		(uint32_t)in[2] << 24) >> 8;
+	}
+	break;
+    }
+}
+
+static void
+pack(const int32_t *in, uint8_t *out, size_t n, int size, int shift)
+{
+    size_t i;
+    uint32_t v;
+    int b;
+
+    for (i=0; i < n; ++i) {
+	v = (uint32_t)in[i] << shift;
+	if (size == 1) {
+	    *out++ = v + 128;
+	    continue;
+	}
+	for (b=0; b < size; ++b) {
+	    *out++ = v >> (8*b);
+	}
+    }
+}
+
+/**
+ * INFO text has no defined character set. Keep it if it is already
+ * valid UTF-8, otherwise treat it as Latin-1.
+ * @return malloc'd UTF-8 string
+ */
+static char *
+toUtf8(const char *s, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)s;
+    char *r, *q;
+    size_t i;
+    int n;
+    bool valid = true;
+
+    for (i=0; i < len && valid; ++i) {
+	n = p[i] < 0x80 ? 0 : (p[i] & 0xE0) == 0xC0 ? 1 :
+	    (p[i] & 0xF0) == 0xE0 ? 2 : (p[i] & 0xF8) == 0xF0 ? 3 : -1;
+	if (n < 0) {
+	    valid = false;
+	}
+	for (; valid && n > 0; --n) {
+	    if (++i >= len || (p[i] & 0xC0) != 0x80) valid = false;
+	}
+    }
+    if ((r = malloc(valid ? len + 1 : 2 * len + 1)) == NULL) {
+	return NULL;
+    }
+    if (valid) {
+	memcpy(r, s, len);
+	r[len] = '\0';
+	return r;
+    }
+    for (q=r, i=0; i < len; ++i) {
+	if (p[i] < 0x80) {
+	    *q++ = p[i];
+	} else {
+	    *q++ = 0xC0 | p[i] >> 6;
+	    *q++ = 0x80 | (p[i] & 0x3F);
+	}
+    }
+    *q = '\0';
+    return r;
+}
@@ -0,0 +1,352 @@
+static const char usage[] = "usage:\n"
+"	wavhash [options] file|directory ...\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-s	--sha256	Use SHA-256 instead of xxHash64\n"
+"	-d	--dedup		Report files with the same audio\n"
+"	-j	--threads N	Max threads (# of CPUs)\n"
+"\n"
+"Prints a hash of the audio in each file: only the bytes of the data\n"
+"chunk, so files that differ only in their tags or other chunks hash\n"
+"the same. Directories are searched recursively for .wav files.\n"
+"\n"
+"The data is hashed in 4 MB segments, in parallel, and the segment\n"
+"hashes are hashed together, so the result is not the same as that\n"
+"of xxhsum or sha256sum over the data, but it does not depend on the\n"
+"# of threads.\n"
+"\n"
+"With -d, lists the groups of files with the same audio, and how much\n"
+"of the audio is duplicated. Two files with the same bytes in their\n"
+"data chunks but different formats would also be listed; use wavcmp to\n"
+"check a group if that matters.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "libwav.h"
+#include "libhash.h"
+
+typedef struct item {
+  char *path;
+  uint64_t start;	/* File offset of the data */
+  uint64_t length;	/* Length of the data */
+  uint8_t digest[HASH_MAX_DIGEST];
+  bool error;
+} Item;
+
+/**
+ * Shared by the hashing threads, which take files in turn
+ */
+typedef struct work {
+  Item *items;
+  size_t nitems;
+  size_t next;		/* Next item to hash */
+  int threads;		/* Threads per file */
+  pthread_mutex_t lock;
+} Work;
+
+static int addPath(const char *path, bool top);
+static int addFile(const char *path);
+static void hashItems(void);
+static void dedupReport(void);
+static int compareItems(const void *, const void *);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"sha256", no_argument, NULL, 's'},
+  {"dedup", no_argument, NULL, 'd'},
+  {"threads", required_argument, NULL, 'j'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static HashType hashType = HASH_XXH64;
+static bool dedup = false;
+static int nThreads = 0;
+
+static Item *items = NULL;
+static size_t nItems = 0, maxItems = 0;
+
+
+int
+main(int argc, char **argv)
+{
+    char hex[2*HASH_MAX_DIGEST+1];
+    size_t i;
+    int c, rval = 0;
+
+    while ((c = getopt_long(argc, argv, "hvsdj:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 's': hashType = HASH_SHA256; break;
+	case 'd': dedup = true; break;
+	case 'j': nThreads = atoi(optarg); break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (optind >= argc) {
+	fprintf(stderr, "Specify at least one file or directory\n");
+	return 2;
+    }
+    if (nThreads <= 0) {
+	nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nThreads <= 0) nThreads = 1;
+    }
+
+    for (; optind < argc; ++optind) {
+	if ((c = addPath(argv[optind], true)) > rval) {
+	    rval = c;
+	}
+    }
+    if (nItems == 0) {
+	return rval;
+    }
+
+    hashItems();
+    for (i=0; i < nItems; ++i) {
+	if (items[i].error) {
+	    fprintf(stderr, "Error reading %s\n", items[i].path);
+	    rval = 4;
+	} else if (!dedup || verbose) {
+	    printf("%s  %s\n", HashHex(hashType, items[i].digest, hex),
+		items[i].path);
+	}
+    }
+    if (dedup) {
+	dedupReport();
+    }
+    return rval;
+}
+
+/**
+ * Add a file, or the .wav files under a directory.
+ * @param top  true for paths from the command line, which are taken
+ *             whatever their names
+ * @return 0 on success, else an exit code, with a message printed
+ */
+static int
+addPath(const char *path, bool top)
+{
+    struct stat st;
+    struct dirent *ent;
+    DIR *dir;
+    char *sub;
+    size_t len;
+    int rc, rval = 0;
+
+    if (stat(path, &st) != 0) {
+	fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+	return 4;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+	len = strlen(path);
+	if (top || (len > 4 && strcasecmp(path + len - 4, ".wav") == 0)) {
+	    return addFile(path);
+	}
+	return 0;
+    }
+    if ((dir = opendir(path)) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+	return 4;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+	if (ent->d_name[0] == '.') {
+	    continue;
+	}
+	len = strlen(path) + strlen(ent->d_name) + 2;
+	if ((sub = malloc(len)) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    rval = 3;
+	    break;
+	}
+	snprintf(sub, len, "%s/%s", path, ent->d_name);
+	if ((rc = addPath(sub, false)) > rval) {
+	    rval = rc;
+	}
+	free(sub);
+    }
+    closedir(dir);
+    return rval;
+}
+
+/**
+ * Read the chunks of a .wav file to find its data.
+ */
+static int
+addFile(const char *path)
+{
+    FILE *ifile;
+    WaveChunk *waveFile;
+    Chunk *data;
+    Item *item;
+    int rval = 4;
+
+    if ((ifile = fopen(path, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", path, WaveError);
+	goto exit;
+    }
+    if ((data = FindChunk(waveFile->children, "data", NULL)) == NULL) {
+	fprintf(stderr, "%s: no data chunk\n", path);
+	goto exit;
+    }
+    if (nItems >= maxItems) {
+	maxItems = maxItems == 0 ? 64 : maxItems * 2;
+	if ((item = realloc(items, maxItems * sizeof(Item))) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    rval = 3;
+	    goto exit;
+	}
+	items = item;
+    }
+    item = &items[nItems];
+    memset(item, 0, sizeof(*item));
+    if ((item->path = strdup(path)) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	rval = 3;
+	goto exit;
+    }
+    item->start = (uint64_t)data->offset + 8;
+    item->length = data->length;
+    ++nItems;
+    rval = 0;
+
+exit:
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+static void *
+hashJob(void *arg)
+{
+    Work *work = arg;
+    Item *item;
+    FILE *ifile;
+
+    for (;;) {
+	pthread_mutex_lock(&work->lock);
+	item = work->next < work->nitems ? &work->items[work->next++] : NULL;
+	pthread_mutex_unlock(&work->lock);
+	if (item == NULL) {
+	    break;
+	}
+	if ((ifile = fopen(item->path, "rb")) == NULL) {
+	    item->error = true;
+	    continue;
+	}
+	item->error = HashFileRange(fileno(ifile), item->start, item->length,
+			hashType, work->threads, item->digest) != 0;
+	fclose(ifile);
+    }
+    return NULL;
+}
+
+/**
+ * Hash every item. Files are shared among the threads; when there
+ * are fewer files than threads, each file is hashed on several.
+ */
+static void
+hashItems(void)
+{
+    Work work;
+    int nthreads = nThreads < (int)nItems ? nThreads : (int)nItems;
+    pthread_t tids[nthreads];
+    int t, started = 1;
+
+    work.items = items;
+    work.nitems = nItems;
+    work.next = 0;
+    work.threads = nThreads / nthreads;
+    pthread_mutex_init(&work.lock, NULL);
+
+    for (t=1; t < nthreads; ++t) {
+	if (pthread_create(&tids[t], NULL, hashJob, &work) != 0) {
+	    break;
+	}
+	++started;
+    }
+    hashJob(&work);
+    for (t=1; t < started; ++t) {
+	pthread_join(tids[t], NULL);
+    }
+    pthread_mutex_destroy(&work.lock);
+}
+
+/**
+ * List the groups of files with the same digest.
+ */
+static void
+dedupReport(void)
+{
+    char hex[2*HASH_MAX_DIGEST+1];
+    const size_t size = HashSize(hashType);
+    uint64_t total = 0, duplicated = 0;
+    size_t i, j, files = 0, groups = 0, copies = 0;
+
+    qsort(items, nItems, sizeof(Item), compareItems);
+    for (i=0; i < nItems; i = j) {
+	if (items[i].error) {
+	    j = i + 1;
+	    continue;
+	}
+	for (j = i + 1; j < nItems && !items[j].error &&
+	    memcmp(items[i].digest, items[j].digest, size) == 0; ++j)
+	  ;
+	files += j - i;
+	total += (j - i) * items[i].length;
+	if (j - i < 2) {
+	    continue;
+	}
+	++groups;
+	copies += j - i - 1;
+	duplicated += (j - i - 1) * items[i].length;
+	printf("%s  %zu files, %.1f MB of audio each\n",
+	    HashHex(hashType, items[i].digest, hex), j - i,
+	    items[i].length / 1e6);
+	for (; i < j; ++i) {
+	    printf("\t%s\n", items[i].path);
+	}
+    }
+    printf("%zu files, %zu duplicates in %zu groups; %.1f of %.1f MB "
+	"of audio duplicated (%.1f%%)\n", files, copies, groups,
+	duplicated / 1e6, total / 1e6,
+	total > 0 ? 100.0 * duplicated / total : 0.0);
+}
+
+/**
+ * By digest, then by path, with failed items last
+ */
+static int
+compareItems(const void *a, const void *b)
+{
+    const Item *i1 = a, *i2 = b;
+    int rc;
+
+    if (i1->error != i2->error) {
+	return i1->error ? 1 : -1;
+    }
+    if ((rc = memcmp(i1->digest, i2->digest, HashSize(hashType))) != 0) {
+	return rc;
+    }
+    return strcmp(i1->path, i2->path);
+}
@@ -0,0 +1,668 @@
+static const char usage[] = "usage:\n"
+"	wavmix [options] -o outfile input ...\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-o	--output file	Output file\n"
+"	-m	--metadata N	Take tags and other chunks from input N (1)\n"
+"	-c	--channels N	Output channels (most of any input, at least 2)\n"
+"	-b	--bits N	Output bits per sample: 16, 24 or 32 (as input N)\n"
+"	-f	--float		Write 32-bit IEEE float samples\n"
+"	-d	--dither type	Dither: none, rect, tpdf (tpdf)\n"
+"	-B	--block N	Frames mixed at a time (65536)\n"
+"	-j	--threads N	Max threads (# of CPUs)\n"
+"\n"
+"Each input is file[,gain[,pan[,offset]]]:\n"
+"\n"
+"	gain	in dB (0)\n"
+"	pan	-1 (left) to 1 (right) (0). Mono inputs are panned with\n"
+"		a constant power law; for stereo inputs it is a balance\n"
+"	offset	output frame where the input starts (0); a negative\n"
+"		offset skips the start of the input\n"
+"\n"
+"Mixes .wav stems into one file in a single streaming pass. Inputs must\n"
+"have the same sample rate, and one channel or as many as the output.\n"
+"The output is as long as the longest input, including its offset.\n"
+"Inputs are read and mixed in parallel, a block at a time, so memory\n"
+"use depends only on the block size and the # of threads. Samples that\n"
+"clip are counted and reported.\n"
+"\n"
+"Example: vocals 3 dB down and a little left, the guitar from 1s in:\n"
+"\n"
+"	wavmix -o mix.wav drums.wav vox.wav,-3,-0.2 gtr.wav,0,0,48000\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libdither.h"
+#include "libremix.h"
+
+#define	MAX_CHANNELS	64
+
+typedef struct input {
+  const char *filename;
+  FILE *file;
+  WaveChunk *wave;
+  PcmStream *stream;
+  double gain;		/* dB */
+  double pan;
+  int64_t offset;	/* Output frame of input frame 0 */
+  float gains[MAX_CHANNELS];	/* Per output channel */
+} Input;
+
+/**
+ * Mixing state: one accumulator and read buffer per thread
+ */
+typedef struct mix {
+  Input *inputs;
+  int ninputs;
+  FmtChunk *fmt;	/* Output format */
+  Ditherer *dither;	/* NULL if the sums are exact in the output */
+  int nthreads;
+  float **acc;		/* nthreads * block frames */
+  float **buf;
+  uint64_t frames;	/* Total output frames */
+  uint64_t position;	/* Output frames mixed so far */
+  size_t avail;		/* Frames in acc[0] */
+  size_t used;		/* Frames already returned */
+  uint64_t clipped;	/* # of samples out of range */
+  bool error;
+} Mix;
+
+typedef struct job {
+  Mix *mix;
+  int thread;		/* Inputs thread, thread+nthreads, ... */
+  size_t frames;	/* Frames in this block */
+  bool error;
+} Job;
+
+static int parseInput(char *spec, Input *);
+static int openInput(Input *);
+static bool exactMix(const Input *, int ninputs, int nout, int bits);
+static int shiftMarkers(Input *);
+static int mixFiles(const char *ofilename, Input *, int ninputs);
+static long mixSource(void *ctx, void *buffer, size_t len);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"output", required_argument, NULL, 'o'},
+  {"metadata", required_argument, NULL, 'm'},
+  {"channels", required_argument, NULL, 'c'},
+  {"bits", required_argument, NULL, 'b'},
+  {"float", no_argument, NULL, 'f'},
+  {"dither", required_argument, NULL, 'd'},
+  {"block", required_argument, NULL, 'B'},
+  {"threads", required_argument, NULL, 'j'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static const char *ofilename = NULL;
+static int metaInput = 1;
+static int outChannels = 0;
+static int bits = 0;
+static bool useFloat = false;
+static DitherType ditherType = DITHER_TPDF;
+static size_t blockFrames = 65536;
+static int nThreads = 0;
+
+
+int
+main(int argc, char **argv)
+{
+    Input *inputs;
+    struct stat so, si;
+    int c, v, i, n;
+
+    while ((c = getopt_long(argc, argv, "hvo:m:c:b:fd:B:j:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'o': ofilename = optarg; break;
+	case 'm': metaInput = atoi(optarg); break;
+	case 'c': outChannels = atoi(optarg); break;
+	case 'b': bits = atoi(optarg); break;
+	case 'f': useFloat = true; break;
+	case 'd':
+	  if ((v = DitherTypeFromName(optarg)) < 0) {
+	      fprintf(stderr, "Unknown dither type \"%s\"\n", optarg);
+	      return 2;
+	  }
+	  ditherType = v;
+	  break;
+	case 'B': blockFrames = strtoul(optarg, NULL, 0); break;
+	case 'j': nThreads = atoi(optarg); break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    n = argc - optind;
+    if (ofilename == NULL || n < 1) {
+	fprintf(stderr, "Specify an output file with -o and at least one input\n");
+	return 2;
+    }
+    if (metaInput < 1 || metaInput > n) {
+	fprintf(stderr, "-m must be from 1 to the # of inputs\n");
+	return 2;
+    }
+    if (outChannels < 0 || outChannels > MAX_CHANNELS) {
+	fprintf(stderr, "Output channels must be from 1 to %d\n", MAX_CHANNELS);
+	return 2;
+    }
+    if (bits != 0 && bits != 16 && bits != 24 && bits != 32) {
+	fprintf(stderr, "Bits must be 16, 24 or 32\n");
+	return 2;
+    }
+    if (blockFrames < 1024 || blockFrames > 1 << 24) {
+	fprintf(stderr, "Block size must be from 1024 to %d\n", 1 << 24);
+	return 2;
+    }
+    if (nThreads <= 0) {
+	nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nThreads <= 0) nThreads = 1;
+    }
+
+    if ((inputs = calloc(n, sizeof(Input))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	return 3;
+    }
+    for (i=0; i < n; ++i) {
+	if (parseInput(argv[optind + i], &inputs[i]) != 0) {
+	    return 2;
+	}
+	if (stat(ofilename, &so) == 0 && stat(inputs[i].filename, &si) == 0 &&
+	    so.st_dev == si.st_dev && so.st_ino == si.st_ino)
+	{
+	    fprintf(stderr, "Output file cannot be one of the inputs\n");
+	    return 3;
+	}
+    }
+    return mixFiles(ofilename, inputs, n);
+}
+
+/**
+ * Split "file[,gain[,pan[,offset]]]" in place.
+ * @return 0 on success, -1 on error, with a message printed
+ */
+static int
+parseInput(char *spec, Input *in)
+{
+    char *p, *end;
+
+    in->filename = spec;
+    if ((p = strchr(spec, ',')) == NULL) {
+	return 0;
+    }
+    *p++ = '\0';
+    in->gain = strtod(p, &end);
+    if (end == p || (*end != ',' && *end != '\0')) {
+	goto bad;
+    }
+    if (*end == ',') {
+	p = end + 1;
+	in->pan = strtod(p, &end);
+	if (end == p || (*end != ',' && *end != '\0') ||
+	    in->pan < -1 || in->pan > 1)
+	{
+	    goto bad;
+	}
+	if (*end == ',') {
+	    p = end + 1;
+	    in->offset = strtoll(p, &end, 10);
+	    if (end == p || *end != '\0') {
+		goto bad;
+	    }
+	}
+    }
+    return 0;
+
+bad:
+    fprintf(stderr, "%s: expected file,gain,pan,offset\n", in->filename);
+    return -1;
+}
+
+/**
+ * Open an input and position it at the first frame it contributes.
+ * @return 0 on success, else an exit code, with a message printed
+ */
+static int
+openInput(Input *in)
+{
+    if ((in->file = fopen(in->filename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", in->filename, strerror(errno));
+	return 4;
+    }
+    if ((in->wave = OpenWaveFile(in->file)) == NULL) {
+	fprintf(stderr, "%s: %s\n", in->filename, WaveError);
+	return 4;
+    }
+    if ((in->stream = OpenPcmStream(in->file, in->wave)) == NULL ||
+	!PcmDecodable(in->stream->fmt))
+    {
+	fprintf(stderr, "%s: %s\n", in->filename,
+	    in->stream == NULL ? PcmError : "Unsupported sample format");
+	return 4;
+    }
+    if (in->offset < 0) {
+	if (-in->offset >= in->stream->frames) {
+	    SeekPcmStream(in->stream, in->stream->frames);
+	} else if (SeekPcmStream(in->stream, (uint32_t)-in->offset) != 0) {
+	    fprintf(stderr, "%s: %s\n", in->filename, PcmError);
+	    return 4;
+	}
+    }
+    return 0;
+}
+
+/**
+ * Whether the mix can be written in this many bits with no rounding:
+ * every input is integer PCM no wider than that, and every channel is
+ * either at unity gain or left out.
+ */
+static bool
+exactMix(const Input *inputs, int ninputs, int nout, int bits)
+{
+    int i, c, prec;
+
+    for (i=0; i < ninputs; ++i) {
+	prec = PcmPrecision(inputs[i].stream->fmt);
+	if (prec == 0 || prec > bits) {
+	    return false;
+	}
+	for (c=0; c < nout; ++c) {
+	    if (inputs[i].gains[c] != 0 && inputs[i].gains[c] != 1) {
+		return false;
+	    }
+	}
+    }
+    return true;
+}
+
+/**
+ * Move the cue points of an input to where it starts in the mix. With
+ * a negative offset, those in the part that is skipped are dropped.
+ * @return 0 on success, -1 if out of memory
+ */
+static int
+shiftMarkers(Input *in)
+{
+    CueChunk *cue;
+    uint32_t i;
+
+    if (in->offset < 0) {
+	return RebaseMarkers(in->wave, -in->offset < UINT32_MAX ?
+		(uint32_t)-in->offset : UINT32_MAX, UINT32_MAX);
+    }
+    if ((cue = (CueChunk *)FindChunk(in->wave->children, "cue ", NULL)) != NULL) {
+	for (i=0; i < cue->n_cues; ++i) {
+	    cue->cues[i].position += (uint32_t)in->offset;
+	    cue->cues[i].sample_offset += (uint32_t)in->offset;
+	}
+    }
+    return 0;
+}
+
+/**
+ * Per output channel gains of an input
+ */
+static int
+setGains(Input *in, int nout)
+{
+    const int nin = in->stream->fmt->channels;
+    float g = (float)pow(10, in->gain / 20);
+    double theta;
+    int c;
+
+    if (nin != 1 && nin != nout) {
+	fprintf(stderr, "%s: cannot mix %d channels into %d\n",
+	    in->filename, nin, nout);
+	return -1;
+    }
+    for (c=0; c < nout; ++c) {
+	in->gains[c] = g;
+    }
+    if (nout >= 2 && nin == 1) {
+	/* Constant power: -3 dB each side in the center */
+	theta = (in->pan + 1) * M_PI / 4;
+	in->gains[0] = g * (float)cos(theta);
+	in->gains[1] = g * (float)sin(theta);
+	for (c=2; c < nout; ++c) {
+	    in->gains[c] = 0;
+	}
+    } else if (nout == 2) {
+	in->gains[0] = g * (float)(in->pan > 0 ? 1 - in->pan : 1);
+	in->gains[1] = g * (float)(in->pan < 0 ? 1 + in->pan : 1);
+    }
+    return 0;
+}
+
+static int
+mixFiles(const char *ofilename, Input *inputs, int ninputs)
+{
+    FILE *ofile = NULL;
+    Input *meta = &inputs[metaInput - 1];
+    Chunk *oldFmt = NULL;
+    FmtChunk *ofmt;
+    DataChunk *odata;
+    FactChunk *fact;
+    Mix mix;
+    const FmtChunk *mfmt;
+    int64_t end;
+    int i, t, maxIn = 0, rval = 3;
+
+    memset(&mix, 0, sizeof(mix));
+    mix.inputs = inputs;
+    mix.ninputs = ninputs;
+
+    for (i=0; i < ninputs; ++i) {
+	if ((rval = openInput(&inputs[i])) != 0) {
+	    goto exit;
+	}
+	rval = 3;
+	if (inputs[i].stream->fmt->sample_rate != inputs[0].stream->fmt->sample_rate) {
+	    fprintf(stderr, "%s: sample rate differs from %s\n",
+		inputs[i].filename, inputs[0].filename);
+	    rval = 4;
+	    goto exit;
+	}
+	if (inputs[i].stream->fmt->channels > maxIn) {
+	    maxIn = inputs[i].stream->fmt->channels;
+	}
+	end = inputs[i].offset + (int64_t)inputs[i].stream->frames;
+	if (end > (int64_t)mix.frames) {
+	    mix.frames = end;
+	}
+    }
+    if (outChannels == 0) {
+	outChannels = maxIn < 2 ? 2 : maxIn;
+    }
+    for (i=0; i < ninputs; ++i) {
+	if (setGains(&inputs[i], outChannels) != 0) {
+	    rval = 4;
+	    goto exit;
+	}
+    }
+    if (FindChunkPtr(&meta->wave->children, "fmt ", NULL) == NULL ||
+	FindChunkPtr(&meta->wave->children, "data", NULL) == NULL)
+    {
+	fprintf(stderr, "%s: fmt and data chunks must be at the top level\n",
+	    meta->filename);
+	rval = 4;
+	goto exit;
+    }
+
+    /* The output takes the chunks of the metadata source, with a new
+     * format and the mix as its data.
+     */
+    mfmt = meta->stream->fmt;
+    if ((ofmt = (FmtChunk *)newChunk("fmt ", 16, 0, sizeof(*ofmt))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    *ofmt = *mfmt;
+    ofmt->header.length = 16;
+    ofmt->ext = NULL;
+    ofmt->ext_len = 0;
+    ofmt->channels = outChannels;
+    if (bits == 0) {
+	useFloat = useFloat || FmtType(mfmt) == RIFF_IEEE_FLOAT;
+	bits = PcmSupported(mfmt) && mfmt->bits_samp >= 16 ? mfmt->bits_samp : 24;
+    }
+    ofmt->type = useFloat ? RIFF_IEEE_FLOAT : RIFF_PCM;
+    ofmt->bits_samp = useFloat ? 32 : bits;
+    ofmt->block_align = ofmt->channels * ofmt->bits_samp / 8;
+    ofmt->bytes_sec = ofmt->block_align * ofmt->sample_rate;
+    /* The metadata source's stream still reads with the old fmt chunk */
+    oldFmt = ReplaceChunk(&meta->wave->children, (Chunk *)ofmt);
+    mix.fmt = ofmt;
+
+    if (mix.frames * ofmt->block_align > UINT32_MAX - 1024) {
+	fprintf(stderr, "Output would be too large for a .wav file\n");
+	goto exit;
+    }
+
+    odata = newDataChunk("data", (uint32_t)(mix.frames * ofmt->block_align), 0);
+    if (odata == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    odata->source = mixSource;
+    odata->source_ctx = &mix;
+    FreeChunk(ReplaceChunk(&meta->wave->children, (Chunk *)odata));
+    if (shiftMarkers(meta) != 0) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+
+    /* Non-PCM formats need a fact chunk */
+    fact = (FactChunk *)FindChunk(meta->wave->children, "fact", NULL);
+    if (ofmt->type != RIFF_PCM && fact == NULL) {
+	fact = (FactChunk *)newChunk("fact", 4, 0, sizeof(*fact));
+	if (fact == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+	fact->header.next = ofmt->header.next;
+	ofmt->header.next = (Chunk *)fact;
+    }
+    if (fact != NULL) {
+	fact->n = (uint32_t)mix.frames;
+    }
+
+    if (ofmt->type == RIFF_PCM && ofmt->bits_samp <= 24 &&
+	!exactMix(inputs, ninputs, ofmt->channels, ofmt->bits_samp))
+    {
+	mix.dither = NewDitherer(ofmt->channels, ofmt->bits_samp,
+		ditherType, SHAPE_NONE, 0);
+	if (mix.dither == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+    }
+    mix.nthreads = nThreads < ninputs ? nThreads : ninputs;
+    mix.acc = calloc(mix.nthreads, sizeof(float *));
+    mix.buf = calloc(mix.nthreads, sizeof(float *));
+    if (mix.acc == NULL || mix.buf == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    for (t=0; t < mix.nthreads; ++t) {
+	mix.acc[t] = malloc(blockFrames * outChannels * sizeof(float));
+	mix.buf[t] = malloc(blockFrames * maxIn * sizeof(float));
+	if (mix.acc[t] == NULL || mix.buf[t] == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+    }
+
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+    if (WriteWaveFile(meta->wave, meta->file, ofile) != 0) {
+	fprintf(stderr, "%s: %s\n", ofilename, WaveError);
+	goto exit;
+    }
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    if (verbose) {
+	printf("%s: %d inputs, %" PRIu64 " frames, %d channels\n",
+	    ofilename, ninputs, mix.frames, outChannels);
+    }
+    if (mix.clipped > 0) {
+	fprintf(stderr, "%s: %" PRIu64 " samples clipped\n",
+	    ofilename, mix.clipped);
+    }
+    rval = 0;
+
+exit:
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    for (t=0; t < mix.nthreads; ++t) {
+	if (mix.acc != NULL) free(mix.acc[t]);
+	if (mix.buf != NULL) free(mix.buf[t]);
+    }
+    free(mix.acc);
+    free(mix.buf);
+    FreeDitherer(mix.dither);
+    for (i=0; i < ninputs; ++i) {
+	ClosePcmStream(inputs[i].stream);
+	FreeWaveFile(inputs[i].wave);
+	if (inputs[i].file != NULL) fclose(inputs[i].file);
+    }
+    FreeChunk(oldFmt);
+    free(inputs);
+    return rval;
+}
+
+/**
+ * Mix this thread's share of the inputs into its accumulator, for
+ * output frames position to position+frames.
+ */
+static void *
+mixJob(void *arg)
+{
+    Job *job = arg;
+    Mix *mix = job->mix;
+    const int nout = mix->fmt->channels;
+    const int64_t start = mix->position, end = start + job->frames;
+    float *acc = mix->acc[job->thread], *buf = mix->buf[job->thread];
+    int64_t from, to;
+    size_t want, got, n;
+    int i;
+
+    memset(acc, 0, job->frames * nout * sizeof(float));
+    for (i = job->thread; i < mix->ninputs; i += mix->nthreads) {
+	Input *in = &mix->inputs[i];
+	from = in->offset > start ? in->offset : start;
+	to = in->offset + (int64_t)in->stream->frames;
+	if (to > end) to = end;
+	if (from >= to) {
+	    continue;
+	}
+	want = to - from;
+	for (got = 0; got < want; got += n) {
+	    n = ReadPcmFloat(in->stream, buf + got * in->stream->fmt->channels,
+		    want - got);
+	    if (n == 0) {
+		job->error = true;
+		return NULL;
+	    }
+	}
+	MixFrames(acc + (from - start) * nout, nout, buf,
+	    in->stream->fmt->channels, in->gains, want);
+    }
+    return NULL;
+}
+
+/**
+ * Mix the next block: each thread reads and sums its share of the
+ * inputs, then the partial sums are added up.
+ */
+static int
+mixBlock(Mix *mix, size_t frames)
+{
+    const int nout = mix->fmt->channels;
+    Job jobs[mix->nthreads];
+    pthread_t tids[mix->nthreads];
+    float unity[MAX_CHANNELS];
+    int t, started = 1;
+    size_t i, n;
+
+    for (t=0; t < mix->nthreads; ++t) {
+	jobs[t].mix = mix;
+	jobs[t].thread = t;
+	jobs[t].frames = frames;
+	jobs[t].error = false;
+    }
+    for (t=1; t < mix->nthreads; ++t) {
+	if (pthread_create(&tids[t], NULL, mixJob, &jobs[t]) != 0) {
+	    break;
+	}
+	++started;
+    }
+    /* Do the share of any threads that could not be started */
+    for (t=started; t < mix->nthreads; ++t) {
+	mixJob(&jobs[t]);
+    }
+    mixJob(&jobs[0]);
+    for (t=1; t < started; ++t) {
+	pthread_join(tids[t], NULL);
+    }
+
+    for (t=0; t < mix->nthreads; ++t) {
+	if (jobs[t].error) {
+	    return -1;
+	}
+    }
+    for (t=0; t < nout; ++t) {
+	unity[t] = 1;
+    }
+    for (t=1; t < mix->nthreads; ++t) {
+	MixFrames(mix->acc[0], nout, mix->acc[t], nout, unity, frames);
+    }
+    if (mix->fmt->type != RIFF_IEEE_FLOAT) {
+	n = frames * nout;
+	for (i=0; i < n; ++i) {
+	    if (fabsf(mix->acc[0][i]) > 1.0f) ++mix->clipped;
+	}
+    }
+    mix->position += frames;
+    return 0;
+}
+
+/**
+ * Data source: return mixed frames, mixing another block whenever
+ * the last one has been used up.
+ */
+static long
+mixSource(void *ctx, void *buffer, size_t len)
+{
+    Mix *mix = ctx;
+    const int nout = mix->fmt->channels;
+    size_t frames = len / mix->fmt->block_align;
+
+    if (mix->used >= mix->avail) {
+	if (mix->position >= mix->frames) {
+	    return -1;
+	}
+	mix->avail = mix->frames - mix->position < blockFrames ?
+		mix->frames - mix->position : blockFrames;
+	mix->used = 0;
+	if (mixBlock(mix, mix->avail) != 0) {
+	    mix->avail = 0;
+	    return -1;
+	}
+    }
+
+    if (frames > mix->avail - mix->used) {
+	frames = mix->avail - mix->used;
+    }
+    if (mix->dither != NULL) {
+	DitherFrames(mix->dither, mix->acc[0] + mix->used * nout, buffer, frames);
+    } else {
+	PcmEncode(mix->fmt, mix->acc[0] + mix->used * nout, buffer, frames);
+    }
+    mix->used += frames;
+    return frames * mix->fmt->block_align;
+}
@@ -0,0 +1,312 @@
+static const char usage[] = "usage:\n"
+"	wavpeaks [options] file.wav ...\n"
+"	wavpeaks -e outfile [options] file.wav\n"
+"	wavpeaks -r start:end:pixels file\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-b	--base N	Sample frames per bin at the finest level (256)\n"
+"	-n	--levels N	Number of zoom levels (default: all)\n"
+"	-o	--output file	Name of the peak file (default file.wav.peaks)\n"
+"	-e	--embed outfile	Write a copy of the file with the peaks in a\n"
+"				private \"wpks\" chunk instead of a sidecar\n"
+"	-r	--read s:e:p	Read back the peaks for sample frames s-e\n"
+"				scaled to p pixels, and print them\n"
+"\n"
+"Generates a multi-resolution waveform overview of a .wav file in one\n"
+"pass over the audio data. Each zoom level holds a min/max pair per\n"
+"channel for twice as many sample frames as the level below it.\n"
+"\n"
+"With -r, the file may be a peak file or a .wav file with an embedded\n"
+"\"wpks\" chunk.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libpeaks.h"
+
+#define	BLOCK_FRAMES	8192	/* Frames read at a time */
+
+static int makePeaks(const char *ifilename, const char *ofilename);
+static int readWindow(const char *filename, const char *spec);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"base", required_argument, NULL, 'b'},
+  {"levels", required_argument, NULL, 'n'},
+  {"output", required_argument, NULL, 'o'},
+  {"embed", required_argument, NULL, 'e'},
+  {"read", required_argument, NULL, 'r'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static uint32_t base = 256;
+static int nLevels = 0;
+static const char *outputName = NULL;
+static const char *embedName = NULL;
+static const char *readSpec = NULL;
+
+
+int
+main(int argc, char **argv)
+{
+    int c;
+    int rval = 0;
+
+    while ((c = getopt_long(argc, argv, "hvb:n:o:e:r:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'b': base = strtoul(optarg, NULL, 0); break;
+	case 'n': nLevels = atoi(optarg); break;
+	case 'o': outputName = optarg; break;
+	case 'e': embedName = optarg; break;
+	case 'r': readSpec = optarg; break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (optind >= argc) {
+	fprintf(stderr, "Specify at least one file name\n");
+	return 2;
+    }
+    if ((outputName != NULL || embedName != NULL) && argc - optind > 1) {
+	fprintf(stderr, "-o and -e accept only one input file\n");
+	return 2;
+    }
+
+    for (; optind < argc; ++optind) {
+	if (readSpec != NULL) {
+	    rval |= readWindow(argv[optind], readSpec);
+	} else {
+	    rval |= makePeaks(argv[optind], outputName);
+	}
+    }
+    return rval;
+}
+
+/**
+ * Read the audio once, build the peak pyramid, and write it
+ * either to a sidecar file or to a copy of the input.
+ */
+static int
+makePeaks(const char *ifilename, const char *ofilename)
+{
+    FILE *ifile = NULL, *ofile = NULL;
+    WaveChunk *waveFile;
+    PcmStream *stream = NULL;
+    PeakBuilder *pb = NULL;
+    float *buffer = NULL;
+    void *peaks = NULL;
+    size_t len, n;
+    char *sidecar = NULL;
+    int rval = 3;
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	rval = 4;
+	goto exit;
+    }
+    if ((stream = OpenPcmStream(ifile, waveFile)) == NULL ||
+	!PcmDecodable(stream->fmt))
+    {
+	fprintf(stderr, "%s: %s\n", ifilename,
+	    stream == NULL ? PcmError : "Unsupported sample format");
+	rval = 4;
+	goto exit;
+    }
+
+    pb = NewPeakBuilder(stream->fmt->channels, stream->fmt->sample_rate,
+	    stream->frames, base, nLevels);
+    if (pb == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, PeakError);
+	rval = 2;
+	goto exit;
+    }
+    if ((buffer = malloc(BLOCK_FRAMES * stream->fmt->channels * sizeof(float))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    while ((n = ReadPcmFloat(stream, buffer, BLOCK_FRAMES)) > 0) {
+	AddPeakFrames(pb, buffer, n);
+    }
+    if (stream->position < stream->frames) {
+	fprintf(stderr, "%s: %s\n", ifilename, PcmError);
+	goto exit;
+    }
+    if ((peaks = FinishPeaks(pb, &len)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, PeakError);
+	goto exit;
+    }
+
+    if (embedName != NULL) {
+	/* Replace any existing peak chunk, and add the new one at
+	 * the end of the file.
+	 */
+	Chunk **ptr, *old;
+	DataChunk *dc;
+	if ((dc = newDataChunk(PEAK_TAG, len, 0)) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+	dc->data = peaks;
+	for (ptr = &waveFile->children; *ptr != NULL; ) {
+	    if (strncmp((*ptr)->identifier, PEAK_TAG, 4) == 0) {
+		old = *ptr;
+		*ptr = old->next;
+		FreeChunk(old);
+	    } else {
+		ptr = &(*ptr)->next;
+	    }
+	}
+	*ptr = (Chunk *)dc;
+	ofilename = embedName;
+    } else if (ofilename == NULL) {
+	if ((sidecar = malloc(strlen(ifilename) + 7)) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+	sprintf(sidecar, "%s.peaks", ifilename);
+	ofilename = sidecar;
+    }
+
+    if (strcmp(ifilename, ofilename) == 0) {
+	fprintf(stderr,
+	    "Input file and output file cannot have the same name\n");
+	rval = 2;
+	goto exit;
+    }
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+    if (embedName != NULL) {
+	if (WriteWaveFile(waveFile, ifile, ofile) != 0) {
+	    fprintf(stderr, "%s: %s\n", ofilename, WaveError);
+	    fclose(ofile);
+	    goto exit;
+	}
+    } else {
+	fwrite(peaks, 1, len, ofile);
+    }
+    if (fclose(ofile) != 0) {
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    if (verbose) {
+	printf("%s: %" PRIu32 " frames, %zu bytes of peaks in %s\n",
+	    ifilename, stream->frames, len, ofilename);
+    }
+    rval = 0;
+
+exit:
+    free(sidecar);
+    free(peaks);
+    free(buffer);
+    FreePeakBuilder(pb);
+    ClosePcmStream(stream);
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Print the min/max pairs for one window of the file, the
+ * way a renderer would fetch them.
+ */
+static int
+readWindow(const char *filename, const char *spec)
+{
+    FILE *ifile;
+    PeakFile *pf = NULL;
+    int16_t *peaks = NULL;
+    uint32_t start, end, first, count;
+    unsigned pixels;
+    off_t offset = 0;
+    char magic[4];
+    int level, i, c, rval = 3;
+    uint32_t spb;
+
+    if (sscanf(spec, "%" SCNu32 ":%" SCNu32 ":%u", &start, &end, &pixels) != 3 ||
+	end <= start || pixels == 0)
+    {
+	fprintf(stderr, "Window must be start:end:pixels\n");
+	return 2;
+    }
+    if ((ifile = fopen(filename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+	return 4;
+    }
+
+    /* Either a sidecar or a wave file with the peaks inside */
+    if (fread(magic, 1, 4, ifile) == 4 && memcmp(magic, "RIFF", 4) == 0) {
+	WaveChunk *waveFile;
+	Chunk *chunk;
+	rewind(ifile);
+	if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	    fprintf(stderr, "%s: %s\n", filename, WaveError);
+	    goto exit;
+	}
+	if ((chunk = FindChunk(waveFile->children, PEAK_TAG, NULL)) != NULL) {
+	    offset = chunk->offset + 8;
+	}
+	FreeWaveFile(waveFile);
+	if (chunk == NULL) {
+	    fprintf(stderr, "%s: no peak chunk found\n", filename);
+	    goto exit;
+	}
+    }
+    if ((pf = OpenPeakFile(fileno(ifile), offset)) == NULL) {
+	fprintf(stderr, "%s: %s\n", filename, PeakError);
+	goto exit;
+    }
+
+    level = PeakLevelFor(pf, (double)(end - start) / pixels);
+    spb = pf->levels[level].samples_per_bin;
+    first = start / spb;
+    count = (end + spb - 1) / spb - first;
+    if ((peaks = malloc(count * pf->channels * 2 * sizeof(int16_t))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    if ((i = ReadPeaks(pf, level, first, count, peaks)) < 0) {
+	fprintf(stderr, "%s: %s\n", filename, PeakError);
+	goto exit;
+    }
+    count = i;
+
+    printf("%s: level %d, %" PRIu32 " frames/bin, %" PRIu32 " bins\n",
+	filename, level, spb, count);
+    for (i=0; i < count; ++i) {
+	printf("  %10" PRIu32 ":", (first + i) * spb);
+	for (c=0; c < pf->channels; ++c) {
+	    printf(" %6d %6d", peaks[(i*pf->channels + c)*2],
+		peaks[(i*pf->channels + c)*2 + 1]);
+	}
+	putchar('\n');
+    }
+    rval = 0;
+
+exit:
+    free(peaks);
+    ClosePeakFile(pf);
+    fclose(ifile);
+    return rval;
+}
@@ -0,0 +1,372 @@
+static const char usage[] = "usage:\n"
+"	wavresample -r rate [options] infile outfile\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-r	--rate N	Output sample rate, e.g. 44100\n"
+"	-q	--quality q	Filter quality: fast, medium, best (medium)\n"
+"	-j	--threads N	Max threads, one per channel (# of CPUs)\n"
+"	-d	--dither type	Dither for integer output: none, rect, tpdf (tpdf)\n"
+"\n"
+"Converts a .wav file to a different sample rate in a single streaming\n"
+"pass with a polyphase filter. The sample format is unchanged. The\n"
+"\"fmt \" and \"fact\" chunks and the data length are rewritten, and\n"
+"cue points, regions, sampler loops and the bext time reference are\n"
+"moved to the same times at the new rate. All other chunks, including\n"
+"tags, are copied unchanged.\n"
+"\n"
+"Multichannel files are processed one channel per thread.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libdither.h"
+#include "libresample.h"
+
+/**
+ * State for the data source that produces the converted samples
+ */
+typedef struct convert {
+  PcmStream *stream;
+  FmtChunk *fmt;	/* Output format */
+  Resampler *resampler;
+  Ditherer *dither;	/* For PCM of up to 24 bits */
+  float *inBuf;
+  float *outBuf;
+  size_t outAvail;	/* Frames in outBuf */
+  size_t outUsed;	/* Frames already returned */
+  bool eof, flushed;
+} Convert;
+
+static int resampleFile(const char *ifilename, const char *ofilename);
+static long resampleSource(void *ctx, void *buffer, size_t len);
+static void scalePositions(WaveChunk *, uint32_t inRate, uint64_t outFrames);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"rate", required_argument, NULL, 'r'},
+  {"quality", required_argument, NULL, 'q'},
+  {"threads", required_argument, NULL, 'j'},
+  {"dither", required_argument, NULL, 'd'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static uint32_t outRate = 0;
+static ResampleQuality quality = RESAMPLE_MEDIUM;
+static int nThreads = 0;
+static DitherType ditherType = DITHER_TPDF;
+
+
+int
+main(int argc, char **argv)
+{
+    int c, v;
+
+    while ((c = getopt_long(argc, argv, "hvr:q:j:d:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'r': outRate = strtoul(optarg, NULL, 0); break;
+	case 'q':
+	  if ((v = ResampleQualityFromName(optarg)) < 0) {
+	      fprintf(stderr, "Unknown quality \"%s\"\n", optarg);
+	      return 2;
+	  }
+	  quality = v;
+	  break;
+	case 'j': nThreads = atoi(optarg); break;
+	case 'd':
+	  if ((v = DitherTypeFromName(optarg)) < 0) {
+	      fprintf(stderr, "Unknown dither type \"%s\"\n", optarg);
+	      return 2;
+	  }
+	  ditherType = v;
+	  break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (outRate == 0) {
+	fprintf(stderr, "Specify the output sample rate with -r\n");
+	return 2;
+    }
+    if (nThreads <= 0) {
+	nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (argc - optind != 2) {
+	fprintf(stderr, "Specify an input file and an output file\n");
+	return 2;
+    }
+    if (strcmp(argv[optind], argv[optind+1]) == 0) {
+	fprintf(stderr,
+	    "Input file and output file cannot have the same name\n");
+	return 3;
+    }
+
+    return resampleFile(argv[optind], argv[optind+1]);
+}
+
+static int
+resampleFile(const char *ifilename, const char *ofilename)
+{
+    FILE *ifile, *ofile = NULL;
+    WaveChunk *waveFile;
+    Chunk *oldFmt = NULL;
+    FmtChunk *ofmt;
+    DataChunk *odata;
+    FactChunk *fact;
+    Convert conv;
+    uint64_t outFrames;
+    int rval = 3;
+
+    memset(&conv, 0, sizeof(conv));
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	rval = 4;
+	goto exit;
+    }
+    if ((conv.stream = OpenPcmStream(ifile, waveFile)) == NULL ||
+	!PcmSupported(conv.stream->fmt))
+    {
+	fprintf(stderr, "%s: %s\n", ifilename,
+	    conv.stream == NULL ? PcmError : "Unsupported sample format");
+	rval = 4;
+	goto exit;
+    }
+    if (FindChunkPtr(&waveFile->children, "fmt ", NULL) == NULL ||
+	FindChunkPtr(&waveFile->children, "data", NULL) == NULL)
+    {
+	fprintf(stderr, "%s: fmt and data chunks must be at the top level\n",
+	    ifilename);
+	rval = 4;
+	goto exit;
+    }
+
+    conv.resampler = NewResampler(conv.stream->fmt->channels,
+	    conv.stream->fmt->sample_rate, outRate, quality, nThreads);
+    if (conv.resampler == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, ResampleError);
+	rval = 2;
+	goto exit;
+    }
+
+    /* The input stream keeps the original format chunk; the tree
+     * gets a new one describing the output.
+     */
+    if ((ofmt = (FmtChunk *)newChunk("fmt ", 16, 0, sizeof(*ofmt))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    *ofmt = *conv.stream->fmt;
+    ofmt->sample_rate = outRate;
+    ofmt->bytes_sec = ofmt->block_align * outRate;
+    /* The stream still reads with the old one, so it is kept */
+    oldFmt = ReplaceChunk(&waveFile->children, (Chunk *)ofmt);
+    conv.fmt = ofmt;
+    if (ofmt->ext != NULL) {
+	/* Its own copy of the extension */
+	if ((ofmt->ext = malloc(ofmt->ext_len)) == NULL) {
+	    ofmt->ext_len = 0;
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+	memcpy(ofmt->ext, conv.stream->fmt->ext, ofmt->ext_len);
+    }
+
+    outFrames = ResampleLength(conv.resampler, conv.stream->frames);
+    if (outFrames * ofmt->block_align > UINT32_MAX - 1024) {
+	fprintf(stderr, "%s: output would be too large for a .wav file\n",
+	    ifilename);
+	goto exit;
+    }
+    if ((fact = (FactChunk *)FindChunk(waveFile->children, "fact", NULL)) != NULL) {
+	fact->n = (uint32_t)outFrames;
+    }
+    scalePositions(waveFile, conv.stream->fmt->sample_rate, outFrames);
+
+    /* The output keeps the input's word length, but the new samples
+     * fall between its steps
+     */
+    if (FmtType(ofmt) == RIFF_PCM && ofmt->bits_samp <= 24) {
+	conv.dither = NewDitherer(ofmt->channels, ofmt->bits_samp,
+		ditherType, SHAPE_NONE, 0);
+	if (conv.dither == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+    }
+    conv.inBuf = malloc(RESAMPLE_MAX_BLOCK * ofmt->channels * sizeof(float));
+    conv.outBuf = malloc(ResampleOutputMax(conv.resampler, RESAMPLE_MAX_BLOCK)
+	    * ofmt->channels * sizeof(float));
+    if (conv.inBuf == NULL || conv.outBuf == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+
+    odata = newDataChunk("data", (uint32_t)(outFrames * ofmt->block_align), 0);
+    if (odata == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+    odata->source = resampleSource;
+    odata->source_ctx = &conv;
+    FreeChunk(ReplaceChunk(&waveFile->children, (Chunk *)odata));
+
+    if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    ofilename, strerror(errno));
+	goto exit;
+    }
+    if (WriteWaveFile(waveFile, ifile, ofile) != 0) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	goto exit;
+    }
+    if (fclose(ofile) != 0) {
+	ofile = NULL;
+	fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	goto exit;
+    }
+    ofile = NULL;
+    if (verbose) {
+	printf("%s: %" PRIu32 " frames at %" PRIu32 " Hz to %" PRIu64
+	    " frames at %" PRIu32 " Hz\n", ifilename, conv.stream->frames,
+	    conv.stream->fmt->sample_rate, outFrames, outRate);
+    }
+    rval = 0;
+
+exit:
+    if (ofile != NULL) {
+	fclose(ofile);
+    }
+    free(conv.inBuf);
+    free(conv.outBuf);
+    FreeDitherer(conv.dither);
+    FreeResampler(conv.resampler);
+    ClosePcmStream(conv.stream);
+    FreeChunk(oldFmt);
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Move a frame # to the same time at the output rate
+ */
+static uint32_t
+scaleFrame(uint64_t frame, uint32_t inRate, uint64_t outFrames)
+{
+    frame = (frame * outRate + inRate / 2) / inRate;
+    return (uint32_t)(frame < outFrames ? frame : outFrames);
+}
+
+/**
+ * Everything in the tree that counts sample frames still counts them
+ * at the input rate. Scale it by outRate/inRate, in place.
+ */
+static void
+scalePositions(WaveChunk *waveFile, uint32_t inRate, uint64_t outFrames)
+{
+    CueChunk *cue;
+    SmplChunk *smpl;
+    BextChunk *bext;
+    Chunk *chunk, *child;
+    LtxtChunk *ltxt;
+    uint32_t i, end;
+
+    if ((cue = (CueChunk *)FindChunk(waveFile->children, "cue ", NULL)) != NULL) {
+	for (i=0; i < cue->n_cues; ++i) {
+	    cue->cues[i].position =
+		scaleFrame(cue->cues[i].position, inRate, outFrames);
+	    cue->cues[i].sample_offset =
+		scaleFrame(cue->cues[i].sample_offset, inRate, outFrames);
+	}
+    }
+    for (chunk = waveFile->children; chunk != NULL; chunk = chunk->next) {
+	if (strncasecmp(chunk->identifier, "list", 4) != 0 ||
+	    strncasecmp(((ListChunk *)chunk)->type, "adtl", 4) != 0)
+	{
+	    continue;
+	}
+	for (child = ((ListChunk *)chunk)->children; child != NULL;
+	     child = child->next)
+	{
+	    if (strncasecmp(child->identifier, "ltxt", 4) == 0) {
+		ltxt = (LtxtChunk *)child;
+		ltxt->sample_length =
+		    scaleFrame(ltxt->sample_length, inRate, outFrames);
+	    }
+	}
+    }
+    if ((smpl = (SmplChunk *)FindChunk(waveFile->children, "smpl", NULL)) != NULL) {
+	smpl->sample_period = (uint32_t)(1000000000.0 / outRate + 0.5);
+	for (i=0; i < smpl->n_loops; ++i) {
+	    /* The end is the last frame played */
+	    smpl->loops[i].start =
+		scaleFrame(smpl->loops[i].start, inRate, outFrames);
+	    end = scaleFrame(smpl->loops[i].end + 1ULL, inRate, outFrames);
+	    smpl->loops[i].end = end > 0 ? end - 1 : 0;
+	}
+    }
+    if ((bext = (BextChunk *)FindChunk(waveFile->children, "bext", NULL)) != NULL) {
+	bext->time_reference = (bext->time_reference * outRate + inRate / 2) / inRate;
+    }
+}
+
+/**
+ * Data source: return converted frames, running the resampler
+ * whenever the output buffer has been used up.
+ */
+static long
+resampleSource(void *ctx, void *buffer, size_t len)
+{
+    Convert *conv = ctx;
+    const int nc = conv->fmt->channels;
+    size_t frames = len / conv->fmt->block_align;
+    size_t n;
+
+    while (conv->outUsed >= conv->outAvail) {
+	conv->outUsed = conv->outAvail = 0;
+	if (!conv->eof) {
+	    n = ReadPcmFloat(conv->stream, conv->inBuf, RESAMPLE_MAX_BLOCK);
+	    if (n == 0) {
+		conv->eof = true;
+		continue;
+	    }
+	    conv->outAvail = Resample(conv->resampler, conv->inBuf, n, conv->outBuf);
+	} else if (!conv->flushed) {
+	    conv->outAvail = Resample(conv->resampler, NULL, 0, conv->outBuf);
+	    conv->flushed = true;
+	} else {
+	    return -1;
+	}
+    }
+
+    if (frames > conv->outAvail - conv->outUsed) {
+	frames = conv->outAvail - conv->outUsed;
+    }
+    if (conv->dither != NULL) {
+	DitherFrames(conv->dither, conv->outBuf + conv->outUsed * nc, buffer, frames);
+    } else {
+	PcmEncode(conv->fmt, conv->outBuf + conv->outUsed * nc, buffer, frames);
+    }
+    conv->outUsed += frames;
+    return frames * conv->fmt->block_align;
+}
@@ -0,0 +1,306 @@
+static const char usage[] = "usage:\n"
+"	wavsilence [options] file ...\n"
+"	wavsilence -t [options] infile outfile\n"
+"	wavsilence -s [options] infile outfile\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-d	--threshold dB	Silence threshold in dBFS (-60)\n"
+"	-m	--min-length ms	Shortest interior silence to report (500)\n"
+"	-t	--trim		Remove leading and trailing silence\n"
+"	-p	--pad ms	Silence to keep at each edge when trimming (0)\n"
+"	-s	--slnt		Replace interior silences with \"slnt\" chunks\n"
+"\n"
+"Reports the leading, trailing and interior silence in a .wav file.\n"
+"\n"
+"With -t or -s, writes a copy of the file with the silence removed.\n"
+"The audio that is kept is copied from the input byte for byte; it is\n"
+"never decoded and re-encoded. Tags are carried over, and cue points\n"
+"are moved with the audio; those in trimmed silence are dropped.\n"
+"\n"
+"With -s, the audio is stored in a \"wavl\" list of alternating \"data\"\n"
+"and \"slnt\" chunks, as described in the RIFF specification. Not all\n"
+"software understands this.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libsilence.h"
+
+static int scanFile(const char *ifilename, const char *ofilename);
+static int writeTrimmed(WaveChunk *, PcmStream *, SilenceInfo *, FILE *ifile, FILE *ofile);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"threshold", required_argument, NULL, 'd'},
+  {"min-length", required_argument, NULL, 'm'},
+  {"trim", no_argument, NULL, 't'},
+  {"pad", required_argument, NULL, 'p'},
+  {"slnt", no_argument, NULL, 's'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static double thresholdDb = -60;
+static double minLength = 500;		/* ms */
+static double padLength = 0;		/* ms */
+static bool trim = false;
+static bool useSlnt = false;
+
+
+int
+main(int argc, char **argv)
+{
+    int c;
+    int rval = 0;
+
+    while ((c = getopt_long(argc, argv, "hvd:m:tp:s", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'd': thresholdDb = atof(optarg); break;
+	case 'm': minLength = atof(optarg); break;
+	case 't': trim = true; break;
+	case 'p': padLength = atof(optarg); break;
+	case 's': useSlnt = true; break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (optind >= argc) {
+	fprintf(stderr, "Specify at least one file name\n");
+	return 2;
+    }
+
+    if (trim || useSlnt) {
+	if (argc - optind != 2) {
+	    fprintf(stderr, "Specify an input file and an output file\n");
+	    return 2;
+	}
+	if (strcmp(argv[optind], argv[optind+1]) == 0) {
+	    fprintf(stderr,
+		"Input file and output file cannot have the same name\n");
+	    return 3;
+	}
+	return scanFile(argv[optind], argv[optind+1]);
+    }
+
+    for (; optind < argc; ++optind) {
+	rval |= scanFile(argv[optind], NULL);
+    }
+    return rval;
+}
+
+static int
+scanFile(const char *ifilename, const char *ofilename)
+{
+    FILE *ifile, *ofile;
+    WaveChunk *waveFile;
+    PcmStream *stream = NULL;
+    SilenceInfo *si = NULL;
+    double rate, total;
+    int i, rval = 3;
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	rval = 4;
+	goto exit;
+    }
+    if ((stream = OpenPcmStream(ifile, waveFile)) == NULL ||
+	!PcmDecodable(stream->fmt))
+    {
+	fprintf(stderr, "%s: %s\n", ifilename,
+	    stream == NULL ? PcmError : "Unsupported sample format");
+	rval = 4;
+	goto exit;
+    }
+    /* The kept audio is copied, so it must be cut between frames */
+    if (ofilename != NULL && stream->block_frames != 1) {
+	fprintf(stderr, "%s: cannot trim ADPCM audio\n", ifilename);
+	rval = 4;
+	goto exit;
+    }
+
+    rate = stream->fmt->sample_rate;
+    si = FindSilence(stream, (float)pow(10, thresholdDb/20),
+	    (uint32_t)(minLength * rate / 1000));
+    if (si == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, SilenceError);
+	goto exit;
+    }
+
+    if (ofilename == NULL || verbose) {
+	total = si->lead + si->trail;
+	printf("%s: %" PRIu32 " frames, %.3fs\n",
+	    ifilename, si->frames, si->frames / rate);
+	printf("  lead: %.3fs (%" PRIu32 " frames)\n",
+	    si->lead / rate, si->lead);
+	printf("  trail: %.3fs (%" PRIu32 " frames)\n",
+	    si->trail / rate, si->trail);
+	for (i=0; i < si->n_runs; ++i) {
+	    printf("  silence at %.3fs for %.3fs\n",
+		si->runs[i].start / rate, si->runs[i].length / rate);
+	    total += si->runs[i].length;
+	}
+	if (si->frames > 0) {
+	    printf("  total silence: %.1f%%\n", 100 * total / si->frames);
+	}
+    }
+
+    if (ofilename != NULL) {
+	if ((ofile = fopen(ofilename, "wb")) == NULL) {
+	    fprintf(stderr, "Unable to open %s for write: %s\n",
+		ofilename, strerror(errno));
+	    goto exit;
+	}
+	if (writeTrimmed(waveFile, stream, si, ifile, ofile) != 0) {
+	    fclose(ofile);
+	    goto exit;
+	}
+	if (fclose(ofile) != 0) {
+	    fprintf(stderr, "Error writing %s: %s\n", ofilename, strerror(errno));
+	    goto exit;
+	}
+    }
+    rval = 0;
+
+exit:
+    FreeSilenceInfo(si);
+    ClosePcmStream(stream);
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Create a data chunk that refers to frames [start,end) of the
+ * original data chunk. writeData() copies the bytes from the
+ * source file starting at offset+8, so no samples are decoded.
+ */
+static Chunk *
+rangeChunk(Chunk *data, uint32_t align, uint32_t start, uint32_t end)
+{
+    return (Chunk *)newDataChunk("data", (end - start) * align,
+	    data->offset + start * align);
+}
+
+static Chunk *
+slntChunk(uint32_t frames)
+{
+    SilenceChunk *sc;
+
+    if ((sc = (SilenceChunk *)newChunk("slnt", 4, 0, sizeof(*sc))) != NULL) {
+	sc->n = frames;
+    }
+    return (Chunk *)sc;
+}
+
+/**
+ * Replace the data chunk with the parts of it that we want
+ * to keep, and write the result.
+ */
+static int
+writeTrimmed(WaveChunk *waveFile, PcmStream *stream, SilenceInfo *si,
+	FILE *ifile, FILE *ofile)
+{
+    Chunk **ptr, *data, *segments = NULL, **tail = &segments, *chunk, *next;
+    uint32_t align = stream->fmt->block_align;
+    uint32_t pad = (uint32_t)(padLength * stream->fmt->sample_rate / 1000);
+    uint32_t start = 0, end = si->frames, pos;
+    int i, n = 0;
+    FactChunk *fact;
+
+    if (trim && si->lead < si->frames) {
+	start = si->lead > pad ? si->lead - pad : 0;
+	end = si->frames - (si->trail > pad ? si->trail - pad : 0);
+	/* Before the data is replaced; the new cue chunk goes after it */
+	if (RebaseMarkers(waveFile, start, end) != 0) {
+	    fprintf(stderr, "%s\n", WaveError);
+	    return -1;
+	}
+    }
+    /* After RebaseMarkers(), which frees the chunks it replaces */
+    if ((ptr = FindChunkPtr(&waveFile->children, "data", NULL)) == NULL) {
+	fprintf(stderr, "Data chunk not found\n");
+	return -1;
+    }
+    data = *ptr;
+
+    /* Build the list of kept ranges and silences */
+    pos = start;
+    for (i=0; useSlnt && i < si->n_runs; ++i) {
+	uint32_t rs = si->runs[i].start + pad;
+	uint32_t re = si->runs[i].start + si->runs[i].length - pad;
+	if (si->runs[i].length <= 2*pad || rs < pos || re > end) {
+	    continue;
+	}
+	if ((*tail = rangeChunk(data, align, pos, rs)) == NULL ||
+	    ((*tail)->next = slntChunk(re - rs)) == NULL)
+	{
+	    fprintf(stderr, "Out of memory\n");
+	    goto fail;
+	}
+	tail = &(*tail)->next->next;
+	pos = re;
+	++n;
+    }
+    if ((*tail = rangeChunk(data, align, pos, end)) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto fail;
+    }
+
+    if (n == 0) {
+	chunk = segments;
+    } else {
+	ListChunk *lc;
+	if ((lc = (ListChunk *)newChunk("LIST", 4, 0, sizeof(*lc))) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto fail;
+	}
+	memcpy(lc->type, "wavl", 4);
+	lc->children = segments;
+	chunk = (Chunk *)lc;
+    }
+    chunk->next = data->next;
+    *ptr = chunk;
+    FreeChunk(data);
+
+    if ((fact = (FactChunk *)FindChunk(waveFile->children, "fact", NULL)) != NULL) {
+	/* slnt chunks still count as played samples */
+	fact->n = end - start;
+    }
+
+    if (verbose) {
+	printf("  kept frames %" PRIu32 "-%" PRIu32 ", %d silences replaced\n",
+	    start, end, n);
+    }
+
+    if (WriteWaveFile(waveFile, ifile, ofile) != 0) {
+	fprintf(stderr, "%s\n", WaveError);
+	return -1;
+    }
+    return 0;
+
+fail:
+    for (chunk = segments; chunk != NULL; chunk = next) {
+	next = chunk->next;
+	FreeChunk(chunk);
+    }
+    return -1;
+}
@@ -0,0 +1,287 @@
+static const char usage[] = "usage:\n"
+"	wavspectrum [options] file ...\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-n	--fft N		FFT size, a power of 2 (2048)\n"
+"	-o	--hop N		Samples between FFT frames (FFT size / 4)\n"
+"	-j	--threads N	Max threads (# of CPUs)\n"
+"	-p	--pgm file	Write the spectrogram as a PGM image\n"
+"	-w	--width N	Max image width; frames are merged to fit\n"
+"	-r	--range dB	Dynamic range of the image (120)\n"
+"	-f	--float file	Write the spectrogram as raw float dB values\n"
+"\n"
+"Analyzes the spectrum of each .wav file and reports its effective\n"
+"bandwidth: the highest frequency clearly above the noise floor. A\n"
+"steep cutoff well below Nyquist is reported as upsampling when it is\n"
+"at the Nyquist frequency of a common lower rate, or as a lossy source\n"
+"when it is where MP3 and AAC encoders put their low-pass filters.\n"
+"\n"
+"Channels are mixed to mono. With -p or -f, only one file may be\n"
+"given. The image has the highest frequency at the top, one row per\n"
+"bin, and one column per FFT frame, or the loudest of several frames\n"
+"with -w. The raw file holds one row of FFT size/2+1 native-endian\n"
+"floats per FFT frame.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include "libwav.h"
+#include "libpcm.h"
+#include "libspectrum.h"
+
+#define	READ_FRAMES	8192
+
+/**
+ * Where the spectrogram rows go
+ */
+typedef struct output {
+  FILE *raw;		/* Raw float file, or NULL */
+  uint8_t *image;	/* bins rows * width columns, or NULL */
+  int width;
+  uint64_t frames;	/* Total # of spectrum frames */
+} Output;
+
+static int scanFile(const char *ifilename);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"fft", required_argument, NULL, 'n'},
+  {"hop", required_argument, NULL, 'o'},
+  {"threads", required_argument, NULL, 'j'},
+  {"pgm", required_argument, NULL, 'p'},
+  {"width", required_argument, NULL, 'w'},
+  {"range", required_argument, NULL, 'r'},
+  {"float", required_argument, NULL, 'f'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static int fftSize = 2048;
+static int hop = 0;
+static int nThreads = 0;
+static const char *pgmFile = NULL;
+static int maxWidth = 0;
+static double range = 120;
+static const char *rawFile = NULL;
+
+
+int
+main(int argc, char **argv)
+{
+    int c;
+    int rval = 0;
+
+    while ((c = getopt_long(argc, argv, "hvn:o:j:p:w:r:f:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'n': fftSize = atoi(optarg); break;
+	case 'o': hop = atoi(optarg); break;
+	case 'j': nThreads = atoi(optarg); break;
+	case 'p': pgmFile = optarg; break;
+	case 'w': maxWidth = atoi(optarg); break;
+	case 'r': range = atof(optarg); break;
+	case 'f': rawFile = optarg; break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (optind >= argc) {
+	fprintf(stderr, "Specify at least one file name\n");
+	return 2;
+    }
+    if ((pgmFile != NULL || rawFile != NULL) && argc - optind != 1) {
+	fprintf(stderr, "Only one file may be given with -p or -f\n");
+	return 2;
+    }
+    if (range <= 0 || maxWidth < 0) {
+	fprintf(stderr, "Range and width must be positive\n");
+	return 2;
+    }
+    if (hop == 0) {
+	hop = fftSize / 4;
+    }
+    if (nThreads < 1) {
+	nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nThreads < 1) nThreads = 1;
+    }
+
+    for (; optind < argc; ++optind) {
+	rval |= scanFile(argv[optind]);
+    }
+    return rval;
+}
+
+static void
+putRow(void *ctx, uint64_t frame, const float *db, int bins)
+{
+    Output *out = ctx;
+    int k, col, v;
+    uint8_t *p;
+
+    if (out->raw != NULL) {
+	fwrite(db, sizeof(float), bins, out->raw);
+    }
+    if (out->image != NULL && frame < out->frames) {
+	col = (int)(frame * out->width / out->frames);
+	p = out->image + (size_t)(bins - 1) * out->width + col;
+	for (k=0; k < bins; ++k, p -= out->width) {
+	    v = (int)((db[k] + range) * 255 / range + 0.5);
+	    if (v > 255) v = 255;
+	    if (v > *p) *p = v;
+	}
+    }
+}
+
+static const char *
+verdictText(const SpectralSummary *sum)
+{
+    static char text[64];
+
+    switch (sum->verdict) {
+      case SPECTRUM_SILENT: return "silent";
+      case SPECTRUM_FULL: return "full bandwidth";
+      case SPECTRUM_ROLLOFF: return "rolls off before Nyquist, no cutoff";
+      case SPECTRUM_UPSAMPLED:
+	snprintf(text, sizeof(text), "upsampled, probably from %" PRIu32 " Hz",
+	    sum->source_rate);
+	return text;
+      case SPECTRUM_LOSSY: return "low-passed like a lossy source";
+      case SPECTRUM_LIMITED: return "band-limited";
+    }
+    return "";
+}
+
+static int
+scanFile(const char *ifilename)
+{
+    FILE *ifile, *pgm = NULL;
+    WaveChunk *waveFile;
+    PcmStream *stream = NULL;
+    Spectrum *spectrum = NULL;
+    SpectralSummary sum;
+    Output out;
+    float *buffer = NULL;
+    size_t n;
+    int bins = fftSize / 2 + 1;
+    uint32_t rate;
+    int rval = 3;
+
+    memset(&out, 0, sizeof(out));
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	rval = 4;
+	goto exit;
+    }
+    if ((stream = OpenPcmStream(ifile, waveFile)) == NULL ||
+	!PcmDecodable(stream->fmt))
+    {
+	fprintf(stderr, "%s: %s\n", ifilename,
+	    stream == NULL ? PcmError : "Unsupported sample format");
+	rval = 4;
+	goto exit;
+    }
+    stream->threads = nThreads;
+    rate = stream->fmt->sample_rate;
+
+    if ((spectrum = NewSpectrum(fftSize, hop, stream->fmt->channels, nThreads,
+		putRow, &out)) == NULL)
+    {
+	fprintf(stderr, "%s\n", SpectrumError);
+	rval = 2;
+	goto exit;
+    }
+    if ((buffer = malloc(READ_FRAMES * stream->fmt->channels * sizeof(float))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	goto exit;
+    }
+
+    out.frames = ((uint64_t)stream->frames + hop - 1) / hop;
+    if (pgmFile != NULL) {
+	out.width = maxWidth > 0 && maxWidth < out.frames ? maxWidth :
+		out.frames > 0 ? (int)out.frames : 1;
+	if ((out.image = calloc((size_t)bins * out.width, 1)) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    goto exit;
+	}
+	if ((pgm = fopen(pgmFile, "wb")) == NULL) {
+	    fprintf(stderr, "Unable to open %s for write: %s\n",
+		pgmFile, strerror(errno));
+	    goto exit;
+	}
+    }
+    if (rawFile != NULL && (out.raw = fopen(rawFile, "wb")) == NULL) {
+	fprintf(stderr, "Unable to open %s for write: %s\n",
+	    rawFile, strerror(errno));
+	goto exit;
+    }
+
+    while ((n = ReadPcmFloat(stream, buffer, READ_FRAMES)) > 0) {
+	SpectrumWrite(spectrum, buffer, n);
+    }
+    if (stream->position < stream->frames) {
+	fprintf(stderr, "%s: %s\n", ifilename, PcmError);
+	goto exit;
+    }
+    SpectrumFinish(spectrum);
+    if (SpectrumSummary(spectrum, rate, &sum) != 0) {
+	fprintf(stderr, "%s: %s\n", ifilename, SpectrumError);
+	goto exit;
+    }
+
+    if (pgm != NULL) {
+	fprintf(pgm, "P5\n%d %d\n255\n", out.width, bins);
+	fwrite(out.image, out.width, bins, pgm);
+	if (fclose(pgm) != 0) {
+	    pgm = NULL;
+	    fprintf(stderr, "Error writing %s: %s\n", pgmFile, strerror(errno));
+	    goto exit;
+	}
+	pgm = NULL;
+    }
+    if (out.raw != NULL) {
+	if (fclose(out.raw) != 0) {
+	    out.raw = NULL;
+	    fprintf(stderr, "Error writing %s: %s\n", rawFile, strerror(errno));
+	    goto exit;
+	}
+	out.raw = NULL;
+    }
+
+    printf("%s: %" PRIu32 " Hz, %d channels, %.3fs\n", ifilename,
+	rate, stream->fmt->channels, (double)stream->frames / rate);
+    if (verbose) {
+	printf("  %" PRIu64 " frames of %d, hop %d\n", sum.frames, fftSize, hop);
+    }
+    if (sum.verdict != SPECTRUM_SILENT) {
+	printf("  bandwidth: %.1f kHz (floor %.1f dB, %.1f dB drop at cutoff)\n",
+	    sum.bandwidth / 1000, sum.floor_db, sum.drop_db);
+    }
+    printf("  %s\n", verdictText(&sum));
+    rval = 0;
+
+exit:
+    if (pgm != NULL) fclose(pgm);
+    if (out.raw != NULL) fclose(out.raw);
+    free(out.image);
+    free(buffer);
+    FreeSpectrum(spectrum);
+    ClosePcmStream(stream);
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
@@ -0,0 +1,289 @@
+static const char usage[] = "usage:\n"
+"	wavsplit [options] infile [prefix]\n"
+"\n"
+"	-h	--help		This list\n"
+"	-v	--verbose	Verbose\n"
+"	-l	--list		List the segments and exit\n"
+"	-p	--points	Split at every cue point, ignoring regions\n"
+"	-j	--threads N	Max files written at once (# of CPUs)\n"
+"\n"
+"Splits a .wav file into one file per segment, as marked by its cue\n"
+"points. If the file has regions (\"ltxt\" chunks giving a cue point a\n"
+"length), each region becomes a file. Otherwise, or with -p, the file\n"
+"is cut at every cue point, and audio before the first one becomes a\n"
+"file of its own.\n"
+"\n"
+"Output files are named prefixNN.wav, where prefix defaults to the\n"
+"input file name without \".wav\" plus \"-\", and NN counts from 01.\n"
+"\n"
+"The samples are copied as they are, without decoding, by file range\n"
+"copies, and the files are written in parallel. Each file gets the INFO\n"
+"tags of the input, with ITRK set to its number and INAM set to the\n"
+"label of its cue point if it has one. Block checksums are recomputed\n"
+"if the input has them.\n"
+;
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "libwav.h"
+#include "libsplit.h"
+
+typedef struct segment {
+  uint32_t start, end;	/* Frames */
+  const char *label;	/* or NULL */
+} Segment;
+
+static int findSegments(MarkerIndex *mi, uint32_t frames, Segment **segments);
+static WaveChunk *buildSegment(WaveChunk *waveFile, const Segment *seg, int n);
+
+struct option longopts[] = {
+  {"help", no_argument, NULL, 'h'},
+  {"verbose", no_argument, NULL, 'v'},
+  {"list", no_argument, NULL, 'l'},
+  {"points", no_argument, NULL, 'p'},
+  {"threads", required_argument, NULL, 'j'},
+  {0,0,0,0}
+};
+
+static int verbose = 0;
+static bool listOnly = false;
+static bool pointsOnly = false;
+static int nThreads = 0;
+
+
+int
+main(int argc, char **argv)
+{
+    const char *ifilename;
+    char *prefix = NULL, number[16];
+    FILE *ifile;
+    WaveChunk *waveFile = NULL;
+    FmtChunk *fmt;
+    MarkerIndex *mi = NULL;
+    Segment *segments = NULL, *seg;
+    SplitOutput *outputs = NULL, *out;
+    struct stat ist, ost;
+    uint32_t frames;
+    size_t len;
+    double rate;
+    int c, i, n = 0, width;
+    int rval = 4;
+
+    while ((c = getopt_long(argc, argv, "hvlpj:", longopts, NULL)) != -1)
+    {
+      switch (c) {
+	case 'h': printf(usage); return 0;
+	case 'v': verbose++; break;
+	case 'l': listOnly = true; break;
+	case 'p': pointsOnly = true; break;
+	case 'j': nThreads = atoi(optarg); break;
+	case '?': fprintf(stderr, usage); return 2;
+      }
+    }
+
+    if (optind >= argc || argc - optind > 2) {
+	fprintf(stderr, usage);
+	return 2;
+    }
+    if (nThreads <= 0) {
+	nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nThreads <= 0) nThreads = 1;
+    }
+    ifilename = argv[optind++];
+
+    if ((ifile = fopen(ifilename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", ifilename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", ifilename, WaveError);
+	goto exit;
+    }
+    if (SplitFrames(waveFile, &frames) != 0) {
+	fprintf(stderr, "%s: %s\n", ifilename, SplitError);
+	goto exit;
+    }
+    fmt = (FmtChunk *)FindChunk(waveFile->children, "fmt ", NULL);
+    rate = fmt->sample_rate > 0 ? fmt->sample_rate : 1;
+
+    if ((mi = NewMarkerIndex(waveFile)) == NULL ||
+	(n = findSegments(mi, frames, &segments)) < 0)
+    {
+	fprintf(stderr, "Out of memory\n");
+	rval = 3;
+	goto exit;
+    }
+    if (n == 0) {
+	fprintf(stderr, "%s: no cue points\n", ifilename);
+	goto exit;
+    }
+    if ((outputs = calloc(n, sizeof(SplitOutput))) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	rval = 3;
+	goto exit;
+    }
+
+    /* Name the files */
+    if (optind < argc) {
+	prefix = strdup(argv[optind]);
+    } else if ((prefix = malloc(strlen(ifilename) + 2)) != NULL) {
+	strcpy(prefix, ifilename);
+	len = strlen(prefix);
+	if (len > 4 && strcasecmp(prefix + len - 4, ".wav") == 0) {
+	    prefix[len - 4] = '\0';
+	}
+	strcat(prefix, "-");
+    }
+    if (prefix == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	rval = 3;
+	goto exit;
+    }
+    for (width = 2, c = 100; n >= c; ++width, c *= 10)
+      ;
+    fstat(fileno(ifile), &ist);
+    for (i=0; i < n; ++i) {
+	seg = &segments[i];
+	out = &outputs[i];
+	out->source = ifilename;
+	snprintf(number, sizeof(number), "%d", i + 1);
+	len = strlen(prefix) + width + 5;
+	if ((out->filename = malloc(len)) == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    rval = 3;
+	    goto exit;
+	}
+	snprintf(out->filename, len, "%s%.*s%s.wav", prefix,
+	    width - (int)strlen(number), "0000000000", number);
+	if (listOnly || verbose) {
+	    printf("%s: %u-%u (%.3f-%.3fs)%s%s\n", out->filename,
+		seg->start, seg->end - 1, seg->start / rate, seg->end / rate,
+		seg->label != NULL ? " " : "",
+		seg->label != NULL ? seg->label : "");
+	}
+	if (stat(out->filename, &ost) == 0 &&
+	    ost.st_dev == ist.st_dev && ost.st_ino == ist.st_ino)
+	{
+	    fprintf(stderr, "%s would overwrite the input file\n", out->filename);
+	    rval = 2;
+	    goto exit;
+	}
+	if (!listOnly &&
+	    (out->wave = buildSegment(waveFile, seg, i + 1)) == NULL)
+	{
+	    fprintf(stderr, "Out of memory\n");
+	    rval = 3;
+	    goto exit;
+	}
+    }
+    if (listOnly) {
+	rval = 0;
+	goto exit;
+    }
+
+    rval = SplitWrite(outputs, n, nThreads);
+
+exit:
+    SplitFree(outputs, n);
+    free(segments);
+    FreeMarkerIndex(mi);
+    FreeWaveFile(waveFile);
+    free(prefix);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * Work out the segments from the markers: the regions, or the spans
+ * between distinct cue point positions.
+ * @return # of segments, or -1 if out of memory
+ */
+static int
+findSegments(MarkerIndex *mi, uint32_t frames, Segment **segments)
+{
+    Segment *segs;
+    const Marker *m;
+    size_t i;
+    int n = 0;
+    bool regions = false;
+
+    if (!pointsOnly) {
+	for (i=0; i < mi->count && !regions; ++i) {
+	    regions = mi->markers[i].length > 0 &&
+			mi->markers[i].position < frames;
+	}
+    }
+    /* At most one more segment than markers */
+    if ((segs = calloc(mi->count + 1, sizeof(Segment))) == NULL) {
+	return -1;
+    }
+    if (regions) {
+	for (i=0; i < mi->count; ++i) {
+	    m = &mi->markers[i];
+	    if (m->length == 0 || m->position >= frames) {
+		continue;
+	    }
+	    segs[n].start = m->position;
+	    segs[n].end = m->length < frames - m->position ?
+				m->position + m->length : frames;
+	    segs[n++].label = m->label;
+	}
+    } else if (mi->count > 0) {
+	segs[n].start = 0;
+	for (i=0; i < mi->count; ++i) {
+	    m = &mi->markers[i];
+	    if (m->position >= frames) {
+		break;
+	    }
+	    if (m->position == segs[n].start) {
+		/* The first marker at a position names the segment */
+		if (segs[n].label == NULL) {
+		    segs[n].label = m->label;
+		}
+		continue;
+	    }
+	    segs[n++].end = m->position;
+	    segs[n].start = m->position;
+	    segs[n].label = m->label;
+	}
+	if (segs[n].start < frames) {
+	    segs[n++].end = frames;
+	}
+    }
+    *segments = segs;
+    return n;
+}
+
+/**
+ * Build one output file: the segment's part of the data, and the
+ * INFO tags with ITRK and INAM set.
+ * @return the new file, or NULL if out of memory
+ */
+static WaveChunk *
+buildSegment(WaveChunk *waveFile, const Segment *seg, int n)
+{
+    ListChunk *info;
+    WaveChunk *wave = NULL;
+    char track[16];
+
+    snprintf(track, sizeof(track), "%d", n);
+    if ((info = SplitCopyInfo(waveFile)) == NULL) {
+	return NULL;
+    }
+    if (SplitSetInfo(info, "ITRK", track) != 0 ||
+	(seg->label != NULL && SplitSetInfo(info, "INAM", seg->label) != 0) ||
+	(wave = SplitWave(waveFile, seg->start, seg->end, &info->header)) == NULL)
+    {
+	FreeChunk(&info->header);
+    }
+    return wave;
+}
@@ -1,7 +1,12 @@
 static const char usage[] = "usage:\n"
 "	wavtags -l file ...\n"
 "	wavtags -i file ...\n"
+"	wavtags -V file ...\n"
+"	wavtags -M file ...\n"
 "	wavtags [options] tag=value ... infile outfile\n"
+"	wavtags -u tag=value ... file ...\n"
+"	wavtags -S file ...\n"
+"	wavtags -R [-n] file ...\n"
 "	wavtags -l\n"
 "\n"
 "	-h	--help		This list\n"
@@ -12,8 +17,21 @@ static const char usage[] = "usage:\n"
 "	-i	--info		Display format info and exit\n"
 "	-L	--list-tags	List supported tags and exit\n"
 "	-I	--list-id3	List supported id3 tags and exit\n"
+"	-k	--checksum	Store checksums of the audio in the output file\n"
+"	-V	--verify	Check files against their stored checksums\n"
+"	-j	--threads N	Max threads for --verify (# of CPUs)\n"
+"	-M	--markers	List cue points, labels and regions and exit\n"
+"	-u	--update	Change bext, smpl or inst fields in the files\n"
+"				themselves\n"
+"	-S	--loops		Print the root note and loops of each file, one\n"
+"				line each, and exit; \"-\" reads file names\n"
+"				from stdin\n"
+"	-R	--repair	Fix the RIFF, data, fact and ds64 lengths of\n"
+"				unfinished recordings in place\n"
+"	-n	--dry-run	With -R, report what would be fixed\n"
 "\n"
-"Prints or edits the tags from a Microsoft multimedia file, such as .wav\n"
+"Prints or edits the tags from a Microsoft multimedia file, such as .wav,\n"
+"or an AIFF or AIFC file.\n"
 "\n"
 "With no tags specified on the command line and no output file, dumps tags\n"
 "and exits. If tags are specified, an output file must be specified.\n"
@@ -21,6 +39,36 @@ static const char usage[] = "usage:\n"
 "A leading '<' for a tag value takes the value from a named file.\n"
 "\n"
 "Set a tag to an empty string, e.g. \"isbj=''\" to delete it.\n"
+"\n"
+"With -k, a \"bsum\" chunk holding a CRC-32 of each 256 KB block of the\n"
+"audio is added; no tags need be given. Every tool in this package\n"
+"that writes a file recomputes the chunk if it is present, so it stays\n"
+"valid. --verify reports the sample ranges of any blocks that no\n"
+"longer match, and exits with status 1 if there are any.\n"
+"\n"
+"Broadcast Wave \"bext\" fields are set by name, e.g. Originator=Studio1\n"
+"or LoudnessValue=-23.0 (see -L), and \"iXML=<file.xml\" sets the iXML\n"
+"chunk. A bext chunk is added if there is none. Sampler \"smpl\" and\n"
+"instrument \"inst\" fields are set the same way, e.g. UnityNote=57 or\n"
+"Loop=1000-44099,forward; each Loop adds a loop, and \"Loop=\" removes\n"
+"them all. With -u, the chunks of each file are rewritten where they\n"
+"are, without copying the file, as long as they keep their sizes:\n"
+"\n"
+"	wavtags -u LoudnessValue=-23.0 MaxTruePeakLevel=-1.0 *.wav\n"
+"\n"
+"AIFF files have NAME, AUTH, ANNO and \"(c) \" text chunks and ID3 tags.\n"
+"INAM, IART, ICMT and ICOP may be used for them, and the AIFF names may\n"
+"be used for .wav files.\n"
+"\n"
+"-R is for files that a recorder never finished, whose lengths are 0 or\n"
+"out of date. The data is taken to run to the end of the file, in whole\n"
+"blocks, unless its length fits in the file. Bytes after the last chunk\n"
+"are reported and left alone. Only the wrong fields are written. With -n,\n"
+"the exit status is 1 if any file needs repair.\n"
+"\n"
+"-S prints, tab-separated, the file name, unity note, cents above it,\n"
+"and each loop as start-end,type,count. Only the chunk headers of each\n"
+"file are read.\n"
 ;
 
 #include <stdio.h>
@@ -34,6 +82,8 @@ static const char usage[] = "usage:\n"
 #include <unistd.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <stddef.h>
+#include <math.h>
 #include <err.h>
 
 #include "libwav.h"
@@ -51,6 +101,22 @@ typedef struct frame_type {
     void (*dumper)(Frame *, struct frame_type *);
 } FrameType;
 
+typedef enum {BEXT_TEXT, BEXT_TIME, BEXT_UMID, BEXT_LOUDNESS, BEXT_HISTORY} BextKind;
+
+typedef struct bext_field {
+    const char *name, *description;
+    BextKind kind;
+    size_t offset, size;	/* Of the field in a BextChunk */
+} BextField;
+
+typedef struct sampler_field {
+    const char *name, *description;
+    const char *tag;	/* Chunk it is in */
+    size_t offset, size;	/* Of the field; size 0 for a loop */
+    double min, max;
+    double scale;	/* Stored value per unit */
+} SamplerField;
+
 
 #define	NA(a)	(sizeof(a)/sizeof(a[0]))
 
@@ -59,9 +125,17 @@ static void dumpTagsFile(const char *filename);
 static void dumpChunks(Chunk *list);
 static void dumpText(Chunk *chunk, ChunkType *);
 static void dumpId3(Chunk *chunk, ChunkType *);
+static void dumpChecksums(Chunk *chunk, ChunkType *);
+static void dumpBext(Chunk *chunk, ChunkType *);
+static void dumpSmpl(Chunk *chunk, ChunkType *);
+static void dumpInst(Chunk *chunk, ChunkType *);
+static int dumpLoopsFile(const char *filename);
+static int dumpMarkersFile(const char *filename);
+static int verifyFile(const char *filename);
 static void listTags(void);
 static void listId3Tags(void);
 static void dumpFormat(WaveChunk *);
+static bool isAiff(WaveChunk *);
 static int modifyTags(WaveChunk *, char **tag_replacements, int n_replacements);
 static Chunk *searchFor(Chunk *top, const char *tag, const char *type);
 static TextChunk *TextChunkFromString(const char *tag, const char *string);
@@ -71,6 +145,10 @@ static void dumpId3Frame(Frame *frame, FrameType *frameType);
 static void dumpId3Text(Frame *frame, FrameType *frameType);
 static ChunkType *findChunkType(const char *tag);
 static FrameType *findFrameType(const char *tag);
+static const BextField *findBextField(const char *name, size_t len);
+static const SamplerField *findSamplerField(const char *name, size_t len);
+static int updateFile(const char *filename, char **tag_replacements, int n_replacements);
+static int repairFile(const char *filename);
 
 
 struct option longopts[] = {
@@ -82,6 +160,14 @@ struct option longopts[] = {
   {"info", no_argument, NULL, 'i'},
   {"list-tags", no_argument, NULL, 'L'},
   {"list-id3", no_argument, NULL, 'I'},
+  {"checksum", no_argument, NULL, 'k'},
+  {"verify", no_argument, NULL, 'V'},
+  {"threads", required_argument, NULL, 'j'},
+  {"markers", no_argument, NULL, 'M'},
+  {"update", no_argument, NULL, 'u'},
+  {"loops", no_argument, NULL, 'S'},
+  {"repair", no_argument, NULL, 'R'},
+  {"dry-run", no_argument, NULL, 'n'},
   {0,0,0,0}
 };
 
@@ -90,6 +176,14 @@ static bool clearTags = false;
 static bool appendTags = false;
 static bool showTags = false;
 static bool showInfo = false;
+static bool addChecksums = false;
+static bool verify = false;
+static bool showMarkers = false;
+static bool updateInPlace = false;
+static bool showLoops = false;
+static bool repair = false;
+static bool dryRun = false;
+static int nThreads = 0;
 
 
 int
@@ -101,8 +195,10 @@ main(int argc, char **argv)
     int c;
     char **tag_replacements;
     int n_replacements = 0;
+    int rval = 0;
+    size_t l;
 
-    while ((c = getopt_long(argc, argv, "hvcLaIil", longopts, NULL)) != -1)
+    while ((c = getopt_long(argc, argv, "hvcLaIilkVj:MuSRn", longopts, NULL)) != -1)
     {
       switch (c) {
 	case 'h': printf(usage); return 0;
@@ -113,6 +209,14 @@ main(int argc, char **argv)
 	case 'a': appendTags = true; break;
 	case 'i': showInfo = true; break;
 	case 'l': showTags = true; break;
+	case 'k': addChecksums = true; break;
+	case 'V': verify = true; break;
+	case 'j': nThreads = atoi(optarg); break;
+	case 'M': showMarkers = true; break;
+	case 'u': updateInPlace = true; break;
+	case 'S': showLoops = true; break;
+	case 'R': repair = true; break;
+	case 'n': dryRun = true; break;
 	case '?': fprintf(stderr, usage); return 2;
       }
     }
@@ -148,6 +252,79 @@ main(int argc, char **argv)
 	return 0;
     }
 
+    if (showMarkers) {
+	for (; optind < argc; ++optind) {
+	    if ((c = dumpMarkersFile(argv[optind])) > rval) {
+		rval = c;
+	    }
+	}
+	return rval;
+    }
+
+    if (showLoops) {
+	char name[4096];
+	size_t len;
+	for (; optind < argc; ++optind) {
+	    if (strcmp(argv[optind], "-") != 0) {
+		c = dumpLoopsFile(argv[optind]);
+	    } else {
+		while (fgets(name, sizeof(name), stdin) != NULL) {
+		    len = strcspn(name, "\r\n");
+		    name[len] = '\0';
+		    if (len > 0 && (c = dumpLoopsFile(name)) > rval) {
+			rval = c;
+		    }
+		}
+		c = 0;
+	    }
+	    if (c > rval) {
+		rval = c;
+	    }
+	}
+	return rval;
+    }
+
+    if (repair) {
+	for (; optind < argc; ++optind) {
+	    if ((c = repairFile(argv[optind])) > rval) {
+		rval = c;
+	    }
+	}
+	return rval;
+    }
+
+    if (updateInPlace) {
+	for (c=0; c < n_replacements; ++c) {
+	    l = strchr(tag_replacements[c], '=') - tag_replacements[c];
+	    if (findBextField(tag_replacements[c], l) == NULL &&
+		findSamplerField(tag_replacements[c], l) == NULL)
+	    {
+		fprintf(stderr, "Only bext, smpl and inst fields can be changed "
+		    "in place, not \"%s\"\n", tag_replacements[c]);
+		return 2;
+	    }
+	}
+	for (; optind < argc; ++optind) {
+	    if ((c = updateFile(argv[optind], tag_replacements, n_replacements)) > rval) {
+		rval = c;
+	    }
+	}
+	return rval;
+    }
+
+    if (verify) {
+	if (nThreads <= 0) {
+	    nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	    if (nThreads <= 0) nThreads = 1;
+	}
+	for (; optind < argc; ++optind) {
+	    if ((c = verifyFile(argv[optind])) > rval) {
+		rval = c;
+	    }
+	}
+	return rval;
+    }
+
     ifilename = argv[optind++];
 
     ifile = fopen(ifilename, "rb");
@@ -166,7 +343,7 @@ main(int argc, char **argv)
      * and an output file was specified, change the
      * tags. Else, just dump them.
      */
-    if (n_replacements == 0 || optind >= argc) {
+    if ((n_replacements == 0 && !addChecksums) || optind >= argc) {
 	dumpChunks(waveFile->children);
     } else {
 	ofilename = argv[optind++];
@@ -181,6 +358,10 @@ main(int argc, char **argv)
 		ofilename, strerror(errno));
 	    return 3;
 	}
+	if (addChecksums && AddChecksums(waveFile, 0) != 0) {
+	    fprintf(stderr, "%s: %s\n", ofilename, WaveError);
+	    return 3;
+	}
 	if (modifyTags(waveFile, tag_replacements, n_replacements) == 0) {
 	    if (verbose) {
 		dumpChunks(waveFile->children);
@@ -218,7 +399,78 @@ static ChunkType chunkTypes[] = {
     {"ILGT", "Lightness", dumpText},
     {"IPLT", "Palette Setting", dumpText},
     {"ISHP", "Sharpness", dumpText},
+    {"NAME", "Name (AIFF)", dumpText},
+    {"AUTH", "Author (AIFF)", dumpText},
+    {"ANNO", "Annotation (AIFF)", dumpText},
+    {"(c) ", "Copyright (AIFF)", dumpText},
     {"ID3 ", "ID3 Tags", dumpId3},
+    {"bsum", "Block checksums", dumpChecksums},
+    {"bext", "Broadcast extension", dumpBext},
+    {"iXML", "iXML metadata", dumpText},
+    {"smpl", "Sampler", dumpSmpl},
+    {"inst", "Instrument", dumpInst},
+};
+
+/* The INFO tags that AIFF files have, and their AIFF names */
+static const struct {
+  const char *info, *aiff;
+} aiffTags[] = {
+  {"INAM", "NAME"},
+  {"IART", "AUTH"},
+  {"ICMT", "ANNO"},
+  {"ICOP", "(c) "},
+};
+
+static const SamplerField samplerFields[] = {
+    {"UnityNote", "MIDI note played at the recorded pitch", "smpl",
+	offsetof(SmplChunk, midi_unity_note), 4, 0, 127, 1},
+    {"PitchFraction", "Cents above the unity note", "smpl",
+	offsetof(SmplChunk, midi_pitch_fraction), 4, 0, 99.999, 4294967296.0/100},
+    {"Loop", "Loop, start-end[,type[,count]], last frame included", "smpl",
+	0, 0, 0, 0, 0},
+    {"UnshiftedNote", "MIDI note of the sample", "inst",
+	offsetof(InstChunk, unshifted_note), 1, 0, 127, 1},
+    {"FineTune", "Cents", "inst", offsetof(InstChunk, fine_tune), 1, -50, 50, 1},
+    {"Gain", "dB", "inst", offsetof(InstChunk, gain), 1, -64, 64, 1},
+    {"LowNote", "Lowest MIDI note to play it for", "inst",
+	offsetof(InstChunk, low_note), 1, 0, 127, 1},
+    {"HighNote", "Highest MIDI note", "inst",
+	offsetof(InstChunk, high_note), 1, 0, 127, 1},
+    {"LowVelocity", "Lowest velocity", "inst",
+	offsetof(InstChunk, low_velocity), 1, 1, 127, 1},
+    {"HighVelocity", "Highest velocity", "inst",
+	offsetof(InstChunk, high_velocity), 1, 1, 127, 1},
+};
+
+static const char *loopTypes[] = {"forward", "pingpong", "backward"};
+
+static const BextField bextFields[] = {
+    {"Description", "Description", BEXT_TEXT,
+	offsetof(BextChunk, description), 256},
+    {"Originator", "Originator", BEXT_TEXT,
+	offsetof(BextChunk, originator), 32},
+    {"OriginatorReference", "Originator reference", BEXT_TEXT,
+	offsetof(BextChunk, originator_reference), 32},
+    {"OriginationDate", "Origination date, yyyy-mm-dd", BEXT_TEXT,
+	offsetof(BextChunk, origination_date), 10},
+    {"OriginationTime", "Origination time, hh:mm:ss", BEXT_TEXT,
+	offsetof(BextChunk, origination_time), 8},
+    {"TimeReference", "Samples since midnight", BEXT_TIME,
+	offsetof(BextChunk, time_reference), 8},
+    {"UMID", "SMPTE UMID, in hex", BEXT_UMID,
+	offsetof(BextChunk, umid), 64},
+    {"LoudnessValue", "Integrated loudness, LUFS", BEXT_LOUDNESS,
+	offsetof(BextChunk, loudness_value), 2},
+    {"LoudnessRange", "Loudness range, LU", BEXT_LOUDNESS,
+	offsetof(BextChunk, loudness_range), 2},
+    {"MaxTruePeakLevel", "Maximum true peak level, dBTP", BEXT_LOUDNESS,
+	offsetof(BextChunk, max_true_peak_level), 2},
+    {"MaxMomentaryLoudness", "Maximum momentary loudness, LUFS", BEXT_LOUDNESS,
+	offsetof(BextChunk, max_momentary_loudness), 2},
+    {"MaxShortTermLoudness", "Maximum short-term loudness, LUFS", BEXT_LOUDNESS,
+	offsetof(BextChunk, max_short_term_loudness), 2},
+    {"CodingHistory", "Coding history", BEXT_HISTORY,
+	offsetof(BextChunk, coding_history), 0},
 };
 
 static FrameType id3Types[] = {
@@ -311,6 +563,14 @@ listTags(void)
 	printf(" %s %s\n", chunkTypes[i].tag, chunkTypes[i].description);
     }
     printf("(INAM and IART are displayed by Mac quicklook)\n");
+    printf("Broadcast Wave (bext) fields:\n");
+    for (i=0; i<NA(bextFields); ++i) {
+	printf(" %s: %s\n", bextFields[i].name, bextFields[i].description);
+    }
+    printf("Sampler (smpl and inst) fields:\n");
+    for (i=0; i<NA(samplerFields); ++i) {
+	printf(" %s: %s\n", samplerFields[i].name, samplerFields[i].description);
+    }
 }
 
 static void
@@ -387,8 +647,21 @@ static void
 dumpFormat(WaveChunk *waveFile)
 {
     Chunk *chunk = searchFor(waveFile->children, "fmt ", NULL);
+    CommChunk *cc;
 
-    if (chunk == NULL) {
+    if (isAiff(waveFile) &&
+	(cc = (CommChunk *)searchFor(waveFile->children, "COMM", NULL)) != NULL)
+    {
+	printf("  type=%.4s\n", cc->compression[0] != '\0' ?
+	    cc->compression : "NONE");
+	if (cc->compression_name[0] != '\0') {
+	    printf("  compression=%s\n", cc->compression_name);
+	}
+	printf("  channels=%u\n", cc->channels);
+	printf("  rate=%g\n", cc->sample_rate);
+	printf("  frames=%" PRIu32 "\n", cc->frames);
+	printf("  bits/sample=%u\n", cc->bits_samp);
+    } else if (chunk == NULL) {
 	fprintf(stderr, "Format info not found in file\n");
     } else {
 	FmtChunk *fc = (FmtChunk *)chunk;
@@ -401,6 +674,12 @@ dumpFormat(WaveChunk *waveFile)
     }
 }
 
+static bool
+isAiff(WaveChunk *waveFile)
+{
+    return strncasecmp(waveFile->header.identifier, "FORM", 4) == 0;
+}
+
 
 /**
  * Recurse through the file structure looking for text tags
@@ -442,6 +721,34 @@ findChunkType(const char *tag)
     return NULL;
 }
 
+static const BextField *
+findBextField(const char *name, size_t len)
+{
+    int i;
+    for (i=0; i < NA(bextFields); ++i) {
+	if (strlen(bextFields[i].name) == len &&
+	    strncasecmp(name, bextFields[i].name, len) == 0)
+	{
+	    return &bextFields[i];
+	}
+    }
+    return NULL;
+}
+
+static const SamplerField *
+findSamplerField(const char *name, size_t len)
+{
+    int i;
+    for (i=0; i < NA(samplerFields); ++i) {
+	if (strlen(samplerFields[i].name) == len &&
+	    strncasecmp(name, samplerFields[i].name, len) == 0)
+	{
+	    return &samplerFields[i];
+	}
+    }
+    return NULL;
+}
+
 static FrameType *
 findFrameType(const char *tag)
 {
@@ -464,6 +771,11 @@ static void clearId3Tags(Id3v2Chunk *ic);
 static void recomputeId3Size(Id3v2Chunk *ic);
 static int addInfoTag(ListChunk *lc, const ChunkType *, const char *value);
 static int addId3Tag(Id3v2Chunk *ic, const FrameType *, const char *value);
+static int setBextField(WaveChunk *waveFile, const BextField *, const char *value);
+static int setXml(WaveChunk *waveFile, const char *value);
+static int setSamplerField(WaveChunk *waveFile, const SamplerField *, const char *value);
+static ChunkType *textTypeFor(const ChunkType *, bool aiff);
+static void clearAiffTags(WaveChunk *waveFile);
 
 /**
  * Search for a list of type "info" and modify the tags it contains.
@@ -475,6 +787,10 @@ modifyTags(WaveChunk *waveFile, char **tag_replacements, int n_replacements)
     Id3v2Chunk *ic = NULL;
     ChunkType *ct = NULL;
     FrameType *ft = NULL;
+    const BextField *bf;
+    const SamplerField *sf;
+    const bool aiff = isAiff(waveFile);
+    bool aiffCleared = false;
     char **repl = tag_replacements;
     int nrep = n_replacements;
     char *eq;
@@ -486,6 +802,30 @@ modifyTags(WaveChunk *waveFile, char **tag_replacements, int n_replacements)
     {
 	eq = strchr(*repl, '=');
 	l = eq - *repl;
+	bf = findBextField(*repl, l);
+	sf = findSamplerField(*repl, l);
+	if (aiff && (bf != NULL || sf != NULL ||
+		     (l == 4 && strncasecmp(*repl, "iXML", 4) == 0)))
+	{
+	    fprintf(stderr, "%.*s cannot be stored in an AIFF file\n", l, *repl);
+	    return -1;
+	}
+	if (bf != NULL) {
+	    value = eq + 1;
+	    if (*value == '<' && (value = readValueFromFile(value + 1)) == NULL) {
+		return -1;
+	    }
+	    if (setBextField(waveFile, bf, value) != 0) {
+		return -1;
+	    }
+	    continue;
+	}
+	if (sf != NULL) {
+	    if (setSamplerField(waveFile, sf, eq + 1) != 0) {
+		return -1;
+	    }
+	    continue;
+	}
 	if (l > 4) {
 	    fprintf(stderr, "Unrecognized tag: \"%s\", ignored\n",
 		*repl);
@@ -494,7 +834,7 @@ modifyTags(WaveChunk *waveFile, char **tag_replacements, int n_replacements)
 
 	memcpy(tag, *repl, l);
 	if (l < 4) {
-	    memset(tag, ' ', 4-l);
+	    memset(tag+l, ' ', 4-l);
 	}
 	tag[4] = '\0';
 	value = eq + 1;
@@ -503,7 +843,27 @@ modifyTags(WaveChunk *waveFile, char **tag_replacements, int n_replacements)
 	    value = readValueFromFile(value + 1);
 	}
 
-	if ((ct = findChunkType(tag)) != NULL) {
+	if (strcasecmp(tag, "iXML") == 0) {
+	    if (value == NULL || setXml(waveFile, value) != 0) {
+		return -1;
+	    }
+	} else if ((ct = findChunkType(tag)) != NULL && ct->dumper == dumpText) {
+	    if ((ct = textTypeFor(ct, aiff)) == NULL) {
+		fprintf(stderr, "%s cannot be stored in %s file\n", tag,
+		    aiff ? "an AIFF" : "a .wav");
+		return -1;
+	    }
+	    if (aiff) {
+		/* AIFF text chunks are not in a list */
+		if (clearTags && !aiffCleared) {
+		    clearAiffTags(waveFile);
+		    aiffCleared = true;
+		}
+		if (addInfoTag(waveFile, ct, value) != 0) {
+		    return -1;
+		}
+		continue;
+	    }
 	    if (lc == NULL) {
 		lc = findInfoChunk(waveFile);
 		if (clearTags) {
@@ -533,6 +893,50 @@ modifyTags(WaveChunk *waveFile, char **tag_replacements, int n_replacements)
     return 0;
 }
 
+/**
+ * The text tag that stands for ct in the kind of file being edited:
+ * INFO tags for .wav files and their AIFF names for AIFF files.
+ * @return the tag, or NULL if the file cannot hold it
+ */
+static ChunkType *
+textTypeFor(const ChunkType *ct, bool aiff)
+{
+    size_t i;
+
+    for (i=0; i < NA(aiffTags); ++i) {
+	if (strncasecmp(ct->tag, aiffTags[i].info, 4) == 0 ||
+	    strncasecmp(ct->tag, aiffTags[i].aiff, 4) == 0)
+	{
+	    return findChunkType(aiff ? aiffTags[i].aiff : aiffTags[i].info);
+	}
+    }
+    return aiff ? NULL : (ChunkType *)ct;
+}
+
+/**
+ * Remove the text chunks of an AIFF file, which are at the top level.
+ */
+static void
+clearAiffTags(WaveChunk *waveFile)
+{
+    Chunk **ptr, *chunk;
+    size_t i;
+
+    for (ptr = &waveFile->children; (chunk = *ptr) != NULL; ) {
+	for (i=0; i < NA(aiffTags); ++i) {
+	    if (strncasecmp(chunk->identifier, aiffTags[i].aiff, 4) == 0) {
+		break;
+	    }
+	}
+	if (i < NA(aiffTags)) {
+	    *ptr = chunk->next;
+	    free(chunk);
+	} else {
+	    ptr = &chunk->next;
+	}
+    }
+}
+
 /**
  * Find and return the first LIST.INFO chunk in the file. Create
  * if necessary.
@@ -760,6 +1164,403 @@ addId3Tag(Id3v2Chunk *ic, const FrameType *ft, const char *value)
     return 0;
 }
 
+/**
+ * Set a field of the bext chunk, adding the chunk if there is none.
+ * A new coding history keeps the chunk's size if it fits, so that
+ * the chunk can still be updated in place.
+ */
+static int
+setBextField(WaveChunk *waveFile, const BextField *bf, const char *value)
+{
+    Chunk **ptr;
+    BextChunk *bc, *nbc;
+    uint8_t *field;
+    char *end;
+    double db;
+    size_t i;
+    int digit;
+
+    for (ptr = &waveFile->children;
+	 *ptr != NULL && strncasecmp((*ptr)->identifier, "bext", 4) != 0;
+	 ptr = &(*ptr)->next)
+      ;
+    bc = (BextChunk *)*ptr;
+
+    if (bc == NULL || bf->kind == BEXT_HISTORY) {
+	nbc = NewBextChunk(bf->kind == BEXT_HISTORY ? value :
+			    bc != NULL ? bc->coding_history : "");
+	if (nbc == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    return -1;
+	}
+	if (bc != NULL) {
+	    /* Same fields, new history */
+	    memcpy(nbc->description, bc->description,
+		offsetof(BextChunk, coding_history) -
+		offsetof(BextChunk, description));
+	    if (nbc->header.length < bc->header.length) {
+		nbc->header.length = bc->header.length;
+	    }
+	    nbc->header.offset = bc->header.offset;
+	    nbc->header.next = bc->header.next;
+	    free(bc);
+	    *ptr = &nbc->header;
+	} else {
+	    /* By custom, bext comes first */
+	    nbc->header.next = waveFile->children;
+	    waveFile->children = &nbc->header;
+	}
+	bc = nbc;
+    }
+
+    field = (uint8_t *)bc + bf->offset;
+    switch (bf->kind) {
+      case BEXT_TEXT:
+	if (strlen(value) > bf->size) {
+	    fprintf(stderr, "%s is limited to %zu characters\n",
+		bf->name, bf->size);
+	    return -1;
+	}
+	strcpy((char *)field, value);
+	break;
+      case BEXT_TIME:
+	bc->time_reference = strtoull(value, &end, 10);
+	if (end == value || *end != '\0' || value[0] == '-') {
+	    fprintf(stderr, "%s must be a # of samples, not \"%s\"\n",
+		bf->name, value);
+	    return -1;
+	}
+	break;
+      case BEXT_UMID:
+	memset(field, 0, bf->size);
+	for (i=0; value[i] != '\0'; ++i) {
+	    if (i >= 2 * bf->size || !isxdigit((unsigned char)value[i])) {
+		fprintf(stderr, "%s must be up to %zu hex digits\n",
+		    bf->name, 2 * bf->size);
+		return -1;
+	    }
+	    digit = isdigit((unsigned char)value[i]) ? value[i] - '0' :
+			tolower((unsigned char)value[i]) - 'a' + 10;
+	    field[i/2] |= i%2 == 0 ? digit << 4 : digit;
+	}
+	break;
+      case BEXT_LOUDNESS:
+	/* Empty means not set */
+	if (value[0] == '\0') {
+	    *(int16_t *)field = BEXT_NO_LOUDNESS;
+	    break;
+	}
+	db = strtod(value, &end);
+	if (end == value || *end != '\0' || !(db > -327.68 && db < 327.67)) {
+	    fprintf(stderr, "Bad %s \"%s\"\n", bf->name, value);
+	    return -1;
+	}
+	*(int16_t *)field = (int16_t)lround(db * 100);
+	if (bc->version < 2) {
+	    bc->version = 2;
+	}
+	break;
+      case BEXT_HISTORY:
+	break;
+    }
+    return 0;
+}
+
+/**
+ * Set a field of the smpl or inst chunk, adding the chunk at the end
+ * of the file if there is none. A loop is added to the smpl chunk,
+ * or all are removed if value is empty.
+ */
+static int
+setSamplerField(WaveChunk *waveFile, const SamplerField *sf, const char *value)
+{
+    Chunk **ptr;
+    SmplChunk *sc, *nsc;
+    FmtChunk *fmt;
+    SampleLoop *loop;
+    const char *text = value;
+    uint8_t *field;
+    char *end;
+    double v;
+    int i;
+
+    for (ptr = &waveFile->children;
+	 *ptr != NULL && strncasecmp((*ptr)->identifier, sf->tag, 4) != 0;
+	 ptr = &(*ptr)->next)
+      ;
+    if (*ptr == NULL) {
+	if (strcmp(sf->tag, "smpl") == 0) {
+	    if ((sc = NewSmplChunk(0, 0)) != NULL &&
+		(fmt = (FmtChunk *)FindChunk(waveFile->children, "fmt ", NULL)) != NULL &&
+		fmt->sample_rate > 0)
+	    {
+		sc->sample_period = 1000000000 / fmt->sample_rate;
+	    }
+	    *ptr = (Chunk *)sc;
+	} else {
+	    *ptr = (Chunk *)NewInstChunk();
+	}
+	if (*ptr == NULL) {
+	    fprintf(stderr, "Out of memory\n");
+	    return -1;
+	}
+    }
+
+    if (sf->size == 0) {
+	/* A loop */
+	sc = (SmplChunk *)*ptr;
+	if (value[0] == '\0') {
+	    sc->n_loops = 0;
+	} else {
+	    if ((nsc = NewSmplChunk(sc->n_loops + 1, sc->sampler_data_len)) == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	    }
+	    memcpy(&nsc->manufacturer, &sc->manufacturer,
+		offsetof(SmplChunk, n_loops) - offsetof(SmplChunk, manufacturer));
+	    memcpy(nsc->loops, sc->loops, sc->n_loops * sizeof(SampleLoop));
+	    memcpy(nsc->sampler_data, sc->sampler_data, sc->sampler_data_len);
+	    nsc->header.offset = sc->header.offset;
+	    nsc->header.next = sc->header.next;
+	    free(sc);
+	    *ptr = &nsc->header;
+	    sc = nsc;
+
+	    loop = &sc->loops[sc->n_loops - 1];
+	    loop->name = sc->n_loops - 1;
+	    loop->start = strtoul(value, &end, 10);
+	    if (end == value || *end != '-') {
+		goto bad;
+	    }
+	    value = end + 1;
+	    loop->end = strtoul(value, &end, 10);
+	    if (end == value || loop->end < loop->start) {
+		goto bad;
+	    }
+	    if (*end == ',') {
+		value = end + 1;
+		end = (char *)value + strcspn(value, ",");
+		for (i=0; i < NA(loopTypes); ++i) {
+		    if (strncasecmp(value, loopTypes[i], end - value) == 0 &&
+			end - value == strlen(loopTypes[i]))
+		    {
+			break;
+		    }
+		}
+		loop->type = i < NA(loopTypes) ? i : strtoul(value, &end, 10);
+		if (end == value) {
+		    goto bad;
+		}
+	    }
+	    if (*end == ',') {
+		value = end + 1;
+		loop->play_count = strtoul(value, &end, 10);
+		if (end == value) {
+		    goto bad;
+		}
+	    }
+	    if (*end != '\0') {
+		goto bad;
+	    }
+	}
+	sc->header.length = 36 + 24 * sc->n_loops + sc->sampler_data_len;
+	return 0;
+    }
+
+    v = strtod(value, &end);
+    if (end == value || *end != '\0' || v < sf->min || v > sf->max) {
+	fprintf(stderr, "%s must be from %g to %g\n", sf->name, sf->min, sf->max);
+	return -1;
+    }
+    field = (uint8_t *)*ptr + sf->offset;
+    if (sf->size == 4) {
+	*(uint32_t *)field = (uint32_t)llround(v * sf->scale);
+    } else {
+	*(int8_t *)field = (int8_t)lround(v * sf->scale);
+    }
+    return 0;
+
+bad:
+    fprintf(stderr, "Bad loop \"%s\", use start-end[,type[,count]]\n", text);
+    return -1;
+}
+
+/**
+ * Set the iXML chunk, or delete it if value is empty. A new value
+ * that fits in the old chunk is padded to its size.
+ */
+static int
+setXml(WaveChunk *waveFile, const char *value)
+{
+    Chunk **ptr, *old;
+    TextChunk *tc;
+    uint32_t len = strlen(value) + 1;
+
+    for (ptr = &waveFile->children;
+	 *ptr != NULL && strncasecmp((*ptr)->identifier, "iXML", 4) != 0;
+	 ptr = &(*ptr)->next)
+      ;
+    old = *ptr;
+    if (value[0] == '\0') {
+	if (old != NULL) {
+	    *ptr = old->next;
+	    free(old);
+	}
+	return 0;
+    }
+
+    len += len%2;
+    if (old != NULL && old->length > len) {
+	len = old->length;
+    }
+    if ((tc = (TextChunk *)newChunk("iXML", len, 0, sizeof(Chunk) + len + 1)) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	return -1;
+    }
+    memset(tc->string, 0, len + 1);
+    strcpy(tc->string, value);
+    if (old != NULL) {
+	tc->header.offset = old->offset;
+	tc->header.next = old->next;
+	free(old);
+    }
+    *ptr = &tc->header;
+    return 0;
+}
+
+/**
+ * Change bext, smpl or inst fields of a file in place.
+ * @return 0 on success, else the exit code, with a message printed
+ */
+static int
+updateFile(const char *filename, char **tag_replacements, int n_replacements)
+{
+    static const char *tags[] = {"bext", "smpl", "inst"};
+    FILE *file;
+    WaveChunk *waveFile;
+    Chunk *chunk;
+    const SamplerField *sf;
+    uint32_t lengths[NA(tags)];
+    bool changed[NA(tags)];
+    size_t l;
+    int i, j, rval = 4;
+
+    if ((file = fopen(filename, "r+b")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(file)) == NULL) {
+	fprintf(stderr, "%s: %s\n", filename, WaveError);
+	goto exit;
+    }
+
+    /* The chunks to be changed must be there already */
+    for (i=0; i < NA(tags); ++i) {
+	changed[i] = false;
+	for (j=0; j < n_replacements; ++j) {
+	    l = strchr(tag_replacements[j], '=') - tag_replacements[j];
+	    sf = findSamplerField(tag_replacements[j], l);
+	    changed[i] |= sf != NULL ? strcmp(sf->tag, tags[i]) == 0 :
+				strcmp(tags[i], "bext") == 0;
+	}
+	chunk = FindChunk(waveFile->children, tags[i], NULL);
+	if (changed[i] && chunk == NULL) {
+	    fprintf(stderr, "%s: no %s chunk; give an output file to add one\n",
+		filename, tags[i]);
+	    rval = 2;
+	    goto exit;
+	}
+	lengths[i] = chunk != NULL ? chunk->length : 0;
+    }
+    if (modifyTags(waveFile, tag_replacements, n_replacements) != 0) {
+	rval = 2;
+	goto exit;
+    }
+    /* Chunks may have been replaced by larger ones; check them all
+     * before writing any
+     */
+    for (i=0; i < NA(tags); ++i) {
+	chunk = FindChunk(waveFile->children, tags[i], NULL);
+	if (changed[i] && chunk->length != lengths[i]) {
+	    fprintf(stderr, "%s: the %s chunk has changed size, the file must "
+		"be rewritten\n", filename, tags[i]);
+	    rval = 2;
+	    goto exit;
+	}
+    }
+    for (i=0; i < NA(tags); ++i) {
+	if (!changed[i]) {
+	    continue;
+	}
+	chunk = FindChunk(waveFile->children, tags[i], NULL);
+	if (UpdateChunk(file, chunk, lengths[i]) != 0) {
+	    fprintf(stderr, "%s: %4.4s: %s\n", filename, tags[i], WaveError);
+	    rval = 3;
+	    goto exit;
+	}
+	if (verbose) {
+	    printf("%s: %4.4s, %" PRIu32 " bytes updated in place\n", filename,
+		tags[i], 8 + chunk->length);
+	}
+    }
+    rval = 0;
+
+exit:
+    FreeWaveFile(waveFile);
+    if (fclose(file) != 0 && rval == 0) {
+	fprintf(stderr, "Error writing %s: %s\n", filename, strerror(errno));
+	rval = 3;
+    }
+    return rval;
+}
+
+/**
+ * Fix the lengths of a file that was not finished, in place.
+ * @return 0 if nothing needed fixing or it was fixed, 1 if it needs
+ *         fixing and this is a dry run, else an exit code
+ */
+static int
+repairFile(const char *filename)
+{
+    FILE *file;
+    WaveRepair repairs[MAX_WAVE_REPAIRS];
+    uint64_t trailing;
+    int i, n, rval = 4;
+
+    if ((file = fopen(filename, dryRun ? "rb" : "r+b")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+	return 4;
+    }
+    if ((n = FindWaveRepairs(file, repairs, &trailing)) < 0) {
+	fprintf(stderr, "%s: %s\n", filename, WaveError);
+	goto exit;
+    }
+    if (!dryRun && ApplyWaveRepairs(file, repairs, n) != 0) {
+	fprintf(stderr, "%s: %s\n", filename, WaveError);
+	rval = 3;
+	goto exit;
+    }
+    if (n == 0 && verbose) {
+	printf("%s: OK\n", filename);
+    }
+    if (trailing > 0) {
+	printf("%s: %" PRIu64 " bytes after the last chunk, left alone\n",
+	    filename, trailing);
+    }
+    for (i=0; i < n; ++i) {
+	printf("%s: %s %" PRIu64 " -> %" PRIu64 " (at byte %" PRIu64 ")%s\n",
+	    filename, repairs[i].field, repairs[i].old_value,
+	    repairs[i].new_value, repairs[i].offset, dryRun ? "" : ", fixed");
+    }
+    rval = n > 0 && dryRun ? 1 : 0;
+
+exit:
+    if (fclose(file) != 0 && rval == 0) {
+	fprintf(stderr, "Error writing %s: %s\n", filename, strerror(errno));
+	rval = 3;
+    }
+    return rval;
+}
 
 /**
 * Recursively search for a chunk with this tag.
@@ -794,7 +1595,7 @@ static TextChunk *
 TextChunkFromString(const char *tag, const char *string)
 {
     TextChunk *textChunk;
-    int l;
+    int i, l;
     l = strlen(string) + 1;
     l += l%2;
     textChunk = (TextChunk *)newChunk(tag, l, 0, sizeof(Chunk) + l);
@@ -802,7 +1603,14 @@ TextChunkFromString(const char *tag, const char *string)
 	fprintf(stderr, "Out of memory\n");
 	return NULL;
     }
+    memset(textChunk->string, 0, l);
     strcpy(textChunk->string, string);
+    /* AIFF text is not nul-terminated; the writer pads it */
+    for (i=0; i < NA(aiffTags); ++i) {
+	if (strncmp(tag, aiffTags[i].aiff, 4) == 0) {
+	    textChunk->header.length = strlen(string);
+	}
+    }
     return textChunk;
 }
 
@@ -941,3 +1749,304 @@ exit:
     }
     return rval;
 }
+
+/**
+ * Print the fields of a bext chunk that are set
+ */
+static void
+dumpBext(Chunk *chunk, ChunkType *chunkType)
+{
+    BextChunk *bc = (BextChunk *)chunk;
+    const BextField *bf;
+    const uint8_t *field;
+    int16_t loudness;
+    size_t i;
+    int j;
+
+    printf("  %4.4s %s, version %u:\n", chunk->identifier,
+	chunkType->description, bc->version);
+    for (i=0; i < NA(bextFields); ++i) {
+	bf = &bextFields[i];
+	field = (const uint8_t *)bc + bf->offset;
+	switch (bf->kind) {
+	  case BEXT_TEXT:
+	  case BEXT_HISTORY:
+	    if (field[0] != '\0') {
+		printf("    %s: %s\n", bf->name, (const char *)field);
+	    }
+	    break;
+	  case BEXT_TIME:
+	    printf("    %s: %" PRIu64 "\n", bf->name, bc->time_reference);
+	    break;
+	  case BEXT_UMID:
+	    for (j=0; j < bf->size && field[j] == 0; ++j)
+	      ;
+	    if (j < bf->size) {
+		printf("    %s: ", bf->name);
+		for (j=0; j < bf->size; ++j) {
+		    printf("%02x", field[j]);
+		}
+		putchar('\n');
+	    }
+	    break;
+	  case BEXT_LOUDNESS:
+	    loudness = *(const int16_t *)field;
+	    if (bc->version >= 2 && loudness != BEXT_NO_LOUDNESS) {
+		printf("    %s: %.2f\n", bf->name, loudness / 100.0);
+	    }
+	    break;
+	}
+    }
+}
+
+static void
+dumpSmpl(Chunk *chunk, ChunkType *chunkType)
+{
+    SmplChunk *sc = (SmplChunk *)chunk;
+    SampleLoop *loop;
+    uint32_t i;
+
+    printf("  %4.4s %s: unity note %u +%.2f cents, %u loop%s\n",
+	chunk->identifier, chunkType->description, sc->midi_unity_note,
+	sc->midi_pitch_fraction * 100.0 / 4294967296.0, sc->n_loops,
+	sc->n_loops == 1 ? "" : "s");
+    for (i=0; i < sc->n_loops; ++i) {
+	loop = &sc->loops[i];
+	printf("    %u: %s %u-%u, ", loop->name,
+	    loop->type < NA(loopTypes) ? loopTypes[loop->type] : "type",
+	    loop->start, loop->end);
+	if (loop->play_count == 0) {
+	    printf("forever\n");
+	} else {
+	    printf("%u times\n", loop->play_count);
+	}
+    }
+}
+
+static void
+dumpInst(Chunk *chunk, ChunkType *chunkType)
+{
+    InstChunk *ic = (InstChunk *)chunk;
+
+    printf("  %4.4s %s: note %u %+d cents %+d dB, notes %u-%u, "
+	"velocities %u-%u\n", chunk->identifier, chunkType->description,
+	ic->unshifted_note, ic->fine_tune, ic->gain, ic->low_note,
+	ic->high_note, ic->low_velocity, ic->high_velocity);
+}
+
+/**
+ * Print a file's root note and loops on one line, for scripts that
+ * build instruments from many samples.
+ * @return 0, or 4 if the file can't be read
+ */
+static int
+dumpLoopsFile(const char *filename)
+{
+    FILE *ifile;
+    WaveChunk *waveFile;
+    SmplChunk *sc;
+    InstChunk *ic;
+    uint32_t i;
+    int rval = 4;
+
+    if ((ifile = fopen(filename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", filename, WaveError);
+	goto exit;
+    }
+    sc = (SmplChunk *)FindChunk(waveFile->children, "smpl", NULL);
+    ic = (InstChunk *)FindChunk(waveFile->children, "inst", NULL);
+    printf("%s", filename);
+    if (sc != NULL) {
+	printf("\t%u\t%.2f", sc->midi_unity_note,
+	    sc->midi_pitch_fraction * 100.0 / 4294967296.0);
+	for (i=0; i < sc->n_loops; ++i) {
+	    printf("\t%u-%u,", sc->loops[i].start, sc->loops[i].end);
+	    if (sc->loops[i].type < NA(loopTypes)) {
+		printf("%s", loopTypes[sc->loops[i].type]);
+	    } else {
+		printf("%u", sc->loops[i].type);
+	    }
+	    printf(",%u", sc->loops[i].play_count);
+	}
+    } else if (ic != NULL) {
+	printf("\t%u\t%d", ic->unshifted_note, ic->fine_tune);
+    } else {
+	printf("\t-\t-");
+    }
+    putchar('\n');
+    rval = 0;
+
+exit:
+    FreeWaveFile(waveFile);
+    fclose(ifile);
+    return rval;
+}
+
+static void
+dumpChecksums(Chunk *chunk, ChunkType *chunkType)
+{
+    ChecksumChunk *cs = (ChecksumChunk *)chunk;
+    printf("  %4.4s %s: %u blocks of %u bytes\n",
+	chunk->identifier, chunkType->description, cs->count, cs->block);
+}
+
+/**
+ * Print a range of bad data, as samples if the format allows
+ */
+static void
+printBadRange(const FmtChunk *fc, uint64_t start, uint64_t end)
+{
+    uint16_t type = fc != NULL ? FmtType(fc) : 0;
+    uint64_t f0, f1;
+
+    if ((type == RIFF_PCM || type == RIFF_IEEE_FLOAT || type == RIFF_ALAW ||
+	 type == RIFF_MULAW) && fc->block_align > 0 && fc->sample_rate > 0)
+    {
+	f0 = start / fc->block_align;
+	f1 = (end + fc->block_align - 1) / fc->block_align;
+	printf("  samples %" PRIu64 "-%" PRIu64 " (%.3f-%.3f s) are corrupt\n",
+	    f0, f1 - 1, (double)f0 / fc->sample_rate,
+	    (double)f1 / fc->sample_rate);
+    } else {
+	printf("  data bytes %" PRIu64 "-%" PRIu64 " are corrupt\n",
+	    start, end - 1);
+    }
+}
+
+/**
+ * Check a file against its checksum chunk.
+ * @return 0 if it matches, 1 if not, else an exit code
+ */
+static int
+verifyFile(const char *filename)
+{
+    FILE *ifile;
+    WaveChunk *waveFile;
+    ChecksumChunk *cs;
+    Chunk *data;
+    uint8_t *bad = NULL;
+    uint32_t b, e;
+    long nbad;
+    int rval = 4;
+
+    if ((ifile = fopen(filename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", filename, WaveError);
+	goto exit;
+    }
+    cs = (ChecksumChunk *)searchFor(waveFile->children, "bsum", NULL);
+    data = searchFor(waveFile->children, "data", NULL);
+    if (cs == NULL) {
+	fprintf(stderr, "%s: no checksums, add them with -k\n", filename);
+	goto exit;
+    }
+    if ((bad = malloc(cs->count + 1)) == NULL) {
+	fprintf(stderr, "Out of memory\n");
+	rval = 3;
+	goto exit;
+    }
+    if ((nbad = VerifyChecksums(waveFile, ifile, nThreads, bad)) < 0) {
+	fprintf(stderr, "%s: %s\n", filename, WaveError);
+	goto exit;
+    }
+
+    rval = nbad > 0 || data->length != cs->data_length;
+    printf("%s: %s, %u blocks checked\n", filename,
+	rval ? "CORRUPT" : "OK", cs->count);
+    if (data->length != cs->data_length) {
+	printf("  data is %u bytes, was %u when summed\n",
+	    data->length, cs->data_length);
+    }
+    for (b = 0; b < cs->count; b = e) {
+	if (!bad[b]) {
+	    e = b + 1;
+	    continue;
+	}
+	for (e = b + 1; e < cs->count && bad[e]; ++e)
+	  ;
+	printBadRange((FmtChunk *)searchFor(waveFile->children, "fmt ", NULL),
+	    (uint64_t)b * cs->block,
+	    e == cs->count ? cs->data_length : (uint64_t)e * cs->block);
+    }
+
+exit:
+    FreeWaveFile(waveFile);
+    free(bad);
+    fclose(ifile);
+    return rval;
+}
+
+/**
+ * List the cue points of a file in order, with their labels,
+ * notes and region lengths.
+ * @return 0 on success, else an exit code
+ */
+static int
+dumpMarkersFile(const char *filename)
+{
+    FILE *ifile;
+    WaveChunk *waveFile;
+    FmtChunk *fc;
+    MarkerIndex *mi = NULL;
+    const Marker *m;
+    double rate;
+    size_t i;
+    int rval = 4;
+
+    if ((ifile = fopen(filename, "rb")) == NULL) {
+	fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+	return 4;
+    }
+    if ((waveFile = OpenWaveFile(ifile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", filename, WaveError);
+	goto exit;
+    }
+    if ((mi = NewMarkerIndex(waveFile)) == NULL) {
+	fprintf(stderr, "%s: %s\n", filename, WaveError);
+	rval = 3;
+	goto exit;
+    }
+    fc = (FmtChunk *)searchFor(waveFile->children, "fmt ", NULL);
+    rate = fc != NULL && fc->sample_rate > 0 ? fc->sample_rate : 0;
+
+    printf("%s: %zu markers\n", filename, mi->count);
+    for (i=0; i < mi->count; ++i) {
+	m = &mi->markers[i];
+	printf("  %5u %10u", m->name, m->position);
+	if (rate > 0) {
+	    printf(" %10.3fs", m->position / rate);
+	}
+	if (m->length > 0) {
+	    printf("  length %u", m->length);
+	    if (rate > 0) {
+		printf(" (%.3fs)", m->length / rate);
+	    }
+	}
+	if (m->label != NULL) {
+	    printf("  \"%s\"", m->label);
+	}
+	putchar('\n');
+	if (m->note != NULL) {
+	    printf("\tnote: %s\n", m->note);
+	}
+	if (m->ltxt != NULL && m->ltxt->data[0] != '\0') {
+	    printf("\t%.4s: %s\n", m->ltxt->purpose, (const char *)m->ltxt->data);
+	}
+    }
+    rval = 0;
+
+exit:
+    FreeMarkerIndex(mi);
+    FreeWaveFile(waveFile);
+    if (ifile != NULL) {
+	fclose(ifile);
+    }
+    return rval;
+}